@@ -50,8 +50,8 @@ impl Iterator for Repl {
 struct BaseInfo {
     software: String,
     uptime: u64,
-    port_allocated: u16,
-    port_capacity: u16,
+    port_allocated: usize,
+    port_capacity: usize,
 }
 
 #[derive(Tabled)]
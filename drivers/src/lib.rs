@@ -1,14 +1,16 @@
-use std::{future::Future, net::SocketAddr, sync::Arc};
+use std::{future::Future, io::Read, net::SocketAddr, sync::Arc};
 
 use async_trait::async_trait;
 use axum::{
-    extract::{Json as Body, Query, State},
-    http::HeaderMap,
+    body::Bytes,
+    extract::{Query, State},
+    http::{header::CONTENT_ENCODING, HeaderMap},
     response::IntoResponse,
     routing::{get, post},
     Json, Router,
 };
 
+use flate2::read::GzDecoder;
 use reqwest::{Client, Response, StatusCode};
 use serde::{Deserialize, Serialize};
 use serde_json::Value;
@@ -20,6 +22,7 @@ use tokio::net::TcpListener;
 pub enum Transport {
     TCP = 0,
     UDP = 1,
+    TLS = 2,
 }
 
 #[derive(Deserialize, Serialize, Debug, Clone)]
@@ -38,9 +41,9 @@ pub struct Info {
     /// Turn the server's running time in seconds
     pub uptime: u64,
     /// The number of allocated ports
-    pub port_allocated: u16,
+    pub port_allocated: usize,
     /// The total number of ports available for allocation
-    pub port_capacity: u16,
+    pub port_capacity: usize,
     /// Turn all interfaces bound to the server
     pub interfaces: Vec<Interface>,
 }
@@ -57,6 +60,10 @@ pub struct Session {
     pub allocated_channels: Vec<u16>,
     /// List of port numbers that have been assigned to the session
     pub allocated_ports: Vec<u16>,
+    /// List of relayed transport addresses that have been assigned to the
+    /// session
+    #[serde(default)]
+    pub relayed_addresses: Vec<SocketAddr>,
     /// The validity period of the current session application, in seconds
     pub expiration: u32,
     /// The lifetime of the session currently in use, in seconds
@@ -446,9 +453,15 @@ where
         .route(
             "/events",
             post(
-                |headers: HeaderMap, State(state): State<Arc<T>>, Body(event): Body<Events>| async move {
+                |headers: HeaderMap, State(state): State<Arc<T>>, body: Bytes| async move {
+                    let Some(events) = decode_events(&headers, &body) else {
+                        return StatusCode::BAD_REQUEST;
+                    };
+
                     if let Some((realm, rid)) = get_realm_and_rid(&headers) {
-                        state.on(event, realm, rid).await;
+                        for event in events {
+                            state.on(event, realm.clone(), rid.clone()).await;
+                        }
                     }
 
                     StatusCode::OK
@@ -462,6 +475,24 @@ where
     Ok(())
 }
 
+/// decode a batch of events, the turn server posts the events as a json
+/// array, compressed with gzip when `api.events.gzip` is set.
+fn decode_events(headers: &HeaderMap, body: &[u8]) -> Option<Vec<Events>> {
+    let gzip = headers
+        .get(CONTENT_ENCODING)
+        .and_then(|it| it.to_str().ok())
+        .map(|it| it.eq_ignore_ascii_case("gzip"))
+        .unwrap_or(false);
+
+    if !gzip {
+        return serde_json::from_slice(body).ok();
+    }
+
+    let mut buf = Vec::with_capacity(body.len() * 4);
+    GzDecoder::new(body).read_to_end(&mut buf).ok()?;
+    serde_json::from_slice(&buf).ok()
+}
+
 fn get_realm_and_rid(headers: &HeaderMap) -> Option<(String, String)> {
     if let (Some(Ok(realm)), Some(Ok(rid))) = (
         headers.get("realm").map(|it| it.to_str()),
@@ -1,5 +1,27 @@
+use std::convert::TryFrom;
+
+use bytes::BytesMut;
 use criterion::*;
-use stun::Decoder;
+use stun::attribute::*;
+use stun::*;
+
+const TOKEN: [u8; 12] = [
+    0x6c, 0x46, 0x62, 0x54, 0x6d, 0x4b, 0x36, 0x67, 0x59, 0x4e, 0x61, 0x6b,
+];
+
+/// create a signed request like the ones that clients send after the
+/// first 401 response.
+fn signed_request(method: Method, attrs: impl FnOnce(&mut MessageWriter)) -> BytesMut {
+    let key = util::long_key("user", "password", "localhost");
+    let mut buf = BytesMut::with_capacity(1280);
+    let mut msg = MessageWriter::new(method, &TOKEN, &mut buf);
+    attrs(&mut msg);
+    msg.append::<UserName>("user");
+    msg.append::<Realm>("localhost");
+    msg.append::<Nonce>("0003a1c2a94b3fd30c0e5a71");
+    msg.flush(Some(&key)).unwrap();
+    buf
+}
 
 const CHANNEL_BIND: [u8; 108] = [
     0x00, 0x09, 0x00, 0x58, 0x21, 0x12, 0xa4, 0x42, 0x35, 0x6a, 0x52, 0x42, 0x33, 0x4c, 0x65, 0x68,
@@ -40,7 +62,116 @@ fn criterion_benchmark(c: &mut Criterion) {
         })
     });
 
+    let allocate = signed_request(Method::Allocate(Kind::Request), |msg| {
+        msg.append::<ReqeestedTransport>(Transport::UDP);
+    });
+
+    stun_decoder.throughput(Throughput::Bytes(allocate.len() as u64));
+    stun_decoder.bench_function("decoder_allocate", |b| {
+        b.iter(|| {
+            codec.decode(&allocate).unwrap();
+        })
+    });
+
+    let refresh = signed_request(Method::Refresh(Kind::Request), |msg| {
+        msg.append::<Lifetime>(600);
+    });
+
+    stun_decoder.throughput(Throughput::Bytes(refresh.len() as u64));
+    stun_decoder.bench_function("decoder_refresh", |b| {
+        b.iter(|| {
+            codec.decode(&refresh).unwrap();
+        })
+    });
+
+    // Decode and look up the attributes that the allocate processor reads.
+    stun_decoder.throughput(Throughput::Bytes(allocate.len() as u64));
+    stun_decoder.bench_function("decoder_allocate_get", |b| {
+        b.iter(|| {
+            if let Payload::Message(reader) = codec.decode(&allocate).unwrap() {
+                black_box(reader.get::<ReqeestedTransport>());
+                black_box(reader.get::<Nonce>());
+                black_box(reader.get::<UserName>());
+                black_box(reader.get::<MessageIntegrity>());
+            }
+        })
+    });
+
     stun_decoder.finish();
+
+    // ChannelData through the general decoder and through the fast path
+    // that the processor takes.
+    let mut channel_data = c.benchmark_group("stun_channel_data");
+    let mut packet = vec![0u8; 1204];
+    packet[..4].copy_from_slice(&[0x40, 0x00, 0x04, 0xb0]);
+
+    channel_data.throughput(Throughput::Bytes(packet.len() as u64));
+    channel_data.bench_function("decoder_channel_data", |b| {
+        b.iter(|| {
+            if let Payload::ChannelData(data) = codec.decode(black_box(&packet)).unwrap() {
+                black_box(data.number);
+            }
+        })
+    });
+
+    channel_data.bench_function("fast_path_channel_data", |b| {
+        b.iter(|| {
+            let buf = black_box(&packet[..]);
+            if Decoder::is_channel_data(buf) {
+                black_box(ChannelData::try_from(buf).unwrap().number);
+            }
+        })
+    });
+
+    channel_data.finish();
+
+    // Sign and check a refresh with the raw key, which runs the hmac key
+    // schedule on every message, and with the keyed state of the session.
+    let mut stun_integrity = c.benchmark_group("stun_integrity");
+    let key = util::long_key("user", "password", "localhost");
+    let hmac = util::HmacSha1::new(&key).unwrap();
+    let mut attributes = Attributes::default();
+    let reader = MessageReader::decode(&refresh, &mut attributes).unwrap();
+    let mut buf = BytesMut::with_capacity(1280);
+
+    stun_integrity.bench_function("flush_key", |b| {
+        b.iter(|| {
+            let mut msg = MessageWriter::extend(Method::Refresh(Kind::Response), &reader, &mut buf);
+            msg.append::<Lifetime>(600);
+            msg.flush(Some(black_box(&key))).unwrap();
+        })
+    });
+
+    stun_integrity.bench_function("flush_with_state", |b| {
+        b.iter(|| {
+            let mut msg = MessageWriter::extend(Method::Refresh(Kind::Response), &reader, &mut buf);
+            msg.append::<Lifetime>(600);
+            msg.flush_with(black_box(&hmac));
+        })
+    });
+
+    stun_integrity.bench_function("integrity_key", |b| {
+        b.iter(|| reader.integrity(black_box(&key)).unwrap())
+    });
+
+    stun_integrity.bench_function("integrity_with_state", |b| {
+        b.iter(|| reader.integrity_with(black_box(&hmac)).unwrap())
+    });
+
+    stun_integrity.finish();
+
+    // FINGERPRINT over the sizes of the messages that a server signs, from
+    // a bare header up to a full mtu.
+    let mut stun_fingerprint = c.benchmark_group("stun_fingerprint");
+    for size in [20, 64, 128, 256, 512, 1024, 1500] {
+        let buf = vec![0x5au8; size];
+        stun_fingerprint.throughput(Throughput::Bytes(size as u64));
+        stun_fingerprint.bench_with_input(BenchmarkId::from_parameter(size), &buf, |b, buf| {
+            b.iter(|| util::fingerprint(black_box(buf)))
+        });
+    }
+
+    stun_fingerprint.finish();
 }
 
 criterion_group!(benches, criterion_benchmark);
@@ -99,6 +99,7 @@ pub enum AttrKind {
     MappedAddress = 0x0001,
     ResponseOrigin = 0x802B,
     Software = 0x8022,
+    AlternateServer = 0x8023,
     MessageIntegrity = 0x0008,
     ErrorCode = 0x0009,
     Lifetime = 0x000D,
@@ -113,6 +114,48 @@ pub enum AttrKind {
     IceControlling = 0x802A,
 }
 
+impl AttrKind {
+    /// The number of attribute kinds, the size of the attribute table of a
+    /// decoded message.
+    pub const COUNT: usize = 21;
+
+    /// the slot of the attribute kind in the attribute table.
+    ///
+    /// # Unit Test
+    ///
+    /// ```
+    /// use stun::attribute::*;
+    ///
+    /// assert_eq!(AttrKind::UserName.index(), 0);
+    /// assert_eq!(AttrKind::AlternateServer.index(), AttrKind::COUNT - 1);
+    /// ```
+    pub const fn index(&self) -> usize {
+        match self {
+            Self::UserName => 0,
+            Self::Data => 1,
+            Self::Realm => 2,
+            Self::Nonce => 3,
+            Self::XorPeerAddress => 4,
+            Self::XorRelayedAddress => 5,
+            Self::XorMappedAddress => 6,
+            Self::MappedAddress => 7,
+            Self::ResponseOrigin => 8,
+            Self::Software => 9,
+            Self::MessageIntegrity => 10,
+            Self::ErrorCode => 11,
+            Self::Lifetime => 12,
+            Self::ReqeestedTransport => 13,
+            Self::Fingerprint => 14,
+            Self::ChannelNumber => 15,
+            Self::IceControlled => 16,
+            Self::Priority => 17,
+            Self::UseCandidate => 18,
+            Self::IceControlling => 19,
+            Self::AlternateServer => 20,
+        }
+    }
+}
+
 /// dyn stun/turn message attribute.
 #[rustfmt::skip]
 pub trait Property<'a> {
@@ -511,6 +554,29 @@ impl<'a> Property<'a> for ResponseOrigin {
     }
 }
 
+/// The alternate server represents an alternate transport address
+/// identifying a different STUN server that the STUN client should try.
+///
+/// It is encoded in the same way as MAPPED-ADDRESS, and thus refers to a
+/// single server by IP address.
+pub struct AlternateServer;
+impl<'a> Property<'a> for AlternateServer {
+    type Error = StunError;
+    type Inner = SocketAddr;
+
+    fn kind() -> AttrKind {
+        AttrKind::AlternateServer
+    }
+
+    fn into(value: Self::Inner, buf: &mut BytesMut, token: &[u8]) {
+        Addr::into(&value, token, buf, false)
+    }
+
+    fn try_from(buf: &'a [u8], token: &'a [u8]) -> Result<Self::Inner, Self::Error> {
+        Addr::try_from(buf, token, false)
+    }
+}
+
 /// [RFC7231]: https://datatracker.ietf.org/doc/html/rfc7231
 /// [RFC3261]: https://datatracker.ietf.org/doc/html/rfc3261
 /// [RFC3629]: https://datatracker.ietf.org/doc/html/rfc3629
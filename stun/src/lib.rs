@@ -289,13 +289,13 @@ pub enum Payload<'a, 'b> {
 }
 
 pub struct Decoder {
-    attrs: Vec<(attribute::AttrKind, &'static [u8])>,
+    attrs: Attributes<'static>,
 }
 
 impl Decoder {
     pub fn new() -> Self {
         Self {
-            attrs: Vec::with_capacity(10),
+            attrs: Attributes::default(),
         }
     }
 
@@ -324,9 +324,6 @@ impl Decoder {
     /// ```
     pub fn decode<'a>(&mut self, buf: &'a [u8]) -> Result<Payload<'a, '_>, StunError> {
         assert!(buf.len() >= 4);
-        if !self.attrs.is_empty() {
-            self.attrs.clear();
-        }
 
         let flag = buf[0] >> 6;
         if flag > 3 {
@@ -346,6 +343,25 @@ impl Decoder {
         })
     }
 
+    /// whether the buffer is a ChannelData message.
+    ///
+    /// only looks at the first two bits, which are zero for every stun
+    /// message, so the data path can skip the general decoder.
+    ///
+    /// # Unit Test
+    ///
+    /// ```
+    /// use stun::*;
+    ///
+    /// assert!(Decoder::is_channel_data(&[0x40, 0x00, 0x00, 0x00]));
+    /// assert!(!Decoder::is_channel_data(&[0x00, 0x01, 0x00, 0x00]));
+    /// assert!(!Decoder::is_channel_data(&[]));
+    /// ```
+    #[inline(always)]
+    pub fn is_channel_data(buf: &[u8]) -> bool {
+        !buf.is_empty() && buf[0] >> 6 != 0
+    }
+
     /// # Unit Test
     ///
     /// ```
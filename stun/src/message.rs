@@ -13,6 +13,52 @@ const COOKIE: [u8; 4] = 0x2112A442u32.to_be_bytes();
 /// (username, password, realm)
 type Auth = [u8; 16];
 
+/// The maximum number of attributes that are walked in one message, a
+/// message of empty attributes can not make the decoder walk the whole
+/// datagram four bytes at a time. a message with more attributes is
+/// rejected.
+const MAX_ATTRIBUTES: usize = 64;
+
+/// attribute table of a decoded message.
+///
+/// one slot per attribute kind, indexed by `AttrKind::index`, so decoding
+/// never allocates and getting an attribute is a single index. when an
+/// attribute appears more than once, the first one is kept.
+#[derive(Debug, Default)]
+pub struct Attributes<'a>([Option<&'a [u8]>; AttrKind::COUNT]);
+
+impl<'a> Attributes<'a> {
+    /// get the body of the attribute.
+    ///
+    /// # Unit Test
+    ///
+    /// ```
+    /// use stun::attribute::*;
+    /// use stun::*;
+    ///
+    /// let attributes = Attributes::default();
+    /// assert!(attributes.get(AttrKind::UserName).is_none());
+    /// ```
+    #[inline(always)]
+    pub fn get(&self, kind: AttrKind) -> Option<&'a [u8]> {
+        self.0[kind.index()]
+    }
+
+    /// remove all attributes.
+    #[inline(always)]
+    pub fn clear(&mut self) {
+        self.0 = [None; AttrKind::COUNT];
+    }
+
+    #[inline(always)]
+    fn insert(&mut self, kind: AttrKind, value: &'a [u8]) {
+        let slot = &mut self.0[kind.index()];
+        if slot.is_none() {
+            *slot = Some(value);
+        }
+    }
+}
+
 pub struct MessageWriter<'a> {
     token: &'a [u8],
     raw: &'a mut BytesMut,
@@ -42,7 +88,7 @@ impl<'a, 'b> MessageWriter<'a> {
     ///     0x42, 0x72, 0x52, 0x64, 0x48, 0x57, 0x62, 0x4b, 0x2b,
     /// ];
     ///
-    /// let mut attributes = Vec::new();
+    /// let mut attributes = Attributes::default();
     /// let mut buf = BytesMut::new();
     /// let old = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
     /// MessageWriter::extend(Method::Binding(Kind::Request), &old, &mut buf);
@@ -84,7 +130,7 @@ impl<'a, 'b> MessageWriter<'a> {
     /// ];
     ///
     /// let mut buf = BytesMut::new();
-    /// let mut attributes = Vec::new();
+    /// let mut attributes = Attributes::default();
     /// let old = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
     /// let mut message =
     ///     MessageWriter::extend(Method::Binding(Kind::Request), &old, &mut buf);
@@ -138,7 +184,7 @@ impl<'a, 'b> MessageWriter<'a> {
     ///     0x04, 0xed, 0x41, 0xb6, 0xbe,
     /// ];
     ///
-    /// let mut attributes = Vec::new();
+    /// let mut attributes = Attributes::default();
     /// let mut buf = BytesMut::with_capacity(1280);
     /// let old = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
     /// let mut message =
@@ -157,12 +203,48 @@ impl<'a, 'b> MessageWriter<'a> {
 
         // if need message integrity?
         if let Some(a) = auth {
-            self.integrity(a)?;
+            self.integrity(&util::HmacSha1::new(a)?);
         }
 
         Ok(())
     }
 
+    /// try decoder bytes as message, signed with a keyed hmac state.
+    ///
+    /// the same as `flush(Some(key))`, without running the key schedule
+    /// for every message.
+    ///
+    /// # Unit Test
+    ///
+    /// ```
+    /// use bytes::BytesMut;
+    /// use stun::*;
+    ///
+    /// let buffer = [
+    ///     0x00u8, 0x01, 0x00, 0x00, 0x21, 0x12, 0xa4, 0x42, 0x72, 0x6d, 0x49,
+    ///     0x42, 0x72, 0x52, 0x64, 0x48, 0x57, 0x62, 0x4b, 0x2b,
+    /// ];
+    ///
+    /// let key = util::long_key("panda", "panda", "raspberry");
+    /// let hmac = util::HmacSha1::new(&key).unwrap();
+    ///
+    /// let mut attributes = Attributes::default();
+    /// let old = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
+    ///
+    /// let mut signed = BytesMut::with_capacity(1280);
+    /// MessageWriter::extend(Method::Binding(Kind::Request), &old, &mut signed)
+    ///     .flush(Some(&key))
+    ///     .unwrap();
+    ///
+    /// let mut buf = BytesMut::with_capacity(1280);
+    /// MessageWriter::extend(Method::Binding(Kind::Request), &old, &mut buf)
+    ///     .flush_with(&hmac);
+    /// assert_eq!(&buf[..], &signed[..]);
+    /// ```
+    pub fn flush_with(&mut self, hmac: &util::HmacSha1) {
+        self.integrity(hmac);
+    }
+
     /// append MessageIntegrity attribute.
     ///
     /// add the `MessageIntegrity` attribute to the stun message
@@ -188,7 +270,7 @@ impl<'a, 'b> MessageWriter<'a> {
     ///     0x04, 0xed, 0x41, 0xb6, 0xbe,
     /// ];
     ///
-    /// let mut attributes = Vec::new();
+    /// let mut attributes = Attributes::default();
     /// let mut buf = BytesMut::from(&buffer[..]);
     /// let old = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
     /// let mut message =
@@ -198,7 +280,7 @@ impl<'a, 'b> MessageWriter<'a> {
     ///     .unwrap();
     /// assert_eq!(&buf[..], &result);
     /// ```
-    fn integrity(&mut self, auth: &Auth) -> Result<(), StunError> {
+    fn integrity(&mut self, hmac: &util::HmacSha1) {
         assert!(self.raw.len() >= 20);
 
         // compute new size,
@@ -213,13 +295,12 @@ impl<'a, 'b> MessageWriter<'a> {
         // long key,
         // digest the message buffer,
         // create the new MessageIntegrity attribute.
-        let hmac_output = util::hmac_sha1(auth, vec![self.raw])?.into_bytes();
-        let property_buf = hmac_output.as_slice();
+        let property_buf = hmac.digest(&[&self.raw[..]]);
 
         // write MessageIntegrity attribute.
         self.raw.put_u16(AttrKind::MessageIntegrity as u16);
         self.raw.put_u16(20);
-        self.raw.put(property_buf);
+        self.raw.put(&property_buf[..]);
 
         // compute new size,
         // new size include the Fingerprint attribute size.
@@ -234,8 +315,6 @@ impl<'a, 'b> MessageWriter<'a> {
         self.raw.put_u16(AttrKind::Fingerprint as u16);
         self.raw.put_u16(4);
         self.raw.put_u32(util::fingerprint(self.raw));
-
-        Ok(())
     }
 }
 
@@ -249,8 +328,8 @@ pub struct MessageReader<'a, 'b> {
     buf: &'a [u8],
     /// message valid block bytes size.
     valid_offset: u16,
-    // message attribute list.
-    attributes: &'b Vec<(AttrKind, &'a [u8])>,
+    // message attribute table.
+    attributes: &'b Attributes<'a>,
 }
 
 impl<'a, 'b> MessageReader<'a, 'b> {
@@ -270,16 +349,14 @@ impl<'a, 'b> MessageReader<'a, 'b> {
     ///     0x42, 0x72, 0x52, 0x64, 0x48, 0x57, 0x62, 0x4b, 0x2b,
     /// ];
     ///
-    /// let mut attributes = Vec::new();
+    /// let mut attributes = Attributes::default();
     /// let message = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
     /// assert!(message.get::<UserName>().is_none());
     /// ```
     pub fn get<T: Property<'a>>(&self) -> Option<T::Inner> {
-        let kind = T::kind();
         self.attributes
-            .iter()
-            .find(|(k, _)| k == &kind)
-            .and_then(|(_, v)| T::try_from(v, self.token).ok())
+            .get(T::kind())
+            .and_then(|v| T::try_from(v, self.token).ok())
     }
 
     /// check MessageReaderIntegrity attribute.
@@ -305,7 +382,7 @@ impl<'a, 'b> MessageReader<'a, 'b> {
     ///     0xc5, 0xb1, 0x03, 0xb2, 0x6d,
     /// ];
     ///
-    /// let mut attributes = Vec::new();
+    /// let mut attributes = Attributes::default();
     /// let message = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
     /// let result = message
     ///     .integrity(&util::long_key("panda", "panda", "raspberry"))
@@ -313,6 +390,39 @@ impl<'a, 'b> MessageReader<'a, 'b> {
     /// assert!(result);
     /// ```
     pub fn integrity(&self, auth: &Auth) -> Result<(), StunError> {
+        self.integrity_with(&util::HmacSha1::new(auth)?)
+    }
+
+    /// check MessageReaderIntegrity attribute with a keyed hmac state.
+    ///
+    /// the same as `integrity(key)`, without running the key schedule for
+    /// every message.
+    ///
+    /// # Unit Test
+    ///
+    /// ```
+    /// use stun::*;
+    ///
+    /// let buffer = [
+    ///     0x00u8, 0x03, 0x00, 0x50, 0x21, 0x12, 0xa4, 0x42, 0x64, 0x4f, 0x5a,
+    ///     0x78, 0x6a, 0x56, 0x33, 0x62, 0x4b, 0x52, 0x33, 0x31, 0x00, 0x19, 0x00,
+    ///     0x04, 0x11, 0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x05, 0x70, 0x61, 0x6e,
+    ///     0x64, 0x61, 0x00, 0x00, 0x00, 0x00, 0x14, 0x00, 0x09, 0x72, 0x61, 0x73,
+    ///     0x70, 0x62, 0x65, 0x72, 0x72, 0x79, 0x00, 0x00, 0x00, 0x00, 0x15, 0x00,
+    ///     0x10, 0x31, 0x63, 0x31, 0x33, 0x64, 0x32, 0x62, 0x32, 0x34, 0x35, 0x62,
+    ///     0x33, 0x61, 0x37, 0x33, 0x34, 0x00, 0x08, 0x00, 0x14, 0xd6, 0x78, 0x26,
+    ///     0x99, 0x0e, 0x15, 0x56, 0x15, 0xe5, 0xf4, 0x24, 0x74, 0xe2, 0x3c, 0x26,
+    ///     0xc5, 0xb1, 0x03, 0xb2, 0x6d,
+    /// ];
+    ///
+    /// let key = util::long_key("panda", "panda", "raspberry");
+    /// let hmac = util::HmacSha1::new(&key).unwrap();
+    ///
+    /// let mut attributes = Attributes::default();
+    /// let message = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
+    /// assert!(message.integrity_with(&hmac).is_ok());
+    /// ```
+    pub fn integrity_with(&self, hmac: &util::HmacSha1) -> Result<(), StunError> {
         if self.buf.is_empty() || self.valid_offset < 20 {
             return Err(StunError::InvalidInput);
         }
@@ -325,18 +435,17 @@ impl<'a, 'b> MessageReader<'a, 'b> {
 
         // create multiple submit.
         let size_buf = (self.valid_offset + 4).to_be_bytes();
-        let body = vec![
+        let body: [&[u8]; 3] = [
             &self.buf[0..2],
             &size_buf,
             &self.buf[4..self.valid_offset as usize],
         ];
 
         // digest the message buffer.
-        let hmac_output = util::hmac_sha1(auth, body)?.into_bytes();
-        let property_buf = hmac_output.as_slice();
+        let property_buf = hmac.digest(&body);
 
         // Compare local and original attribute.
-        if integrity != property_buf {
+        if integrity != &property_buf[..] {
             return Err(StunError::IntegrityFailed);
         }
 
@@ -355,20 +464,41 @@ impl<'a, 'b> MessageReader<'a, 'b> {
     ///     0x72, 0x52, 0x64, 0x48, 0x57, 0x62, 0x4b, 0x2b,
     /// ];
     ///
-    /// let mut attributes = Vec::new();
+    /// let mut attributes = Attributes::default();
     /// let message = MessageReader::decode(&buffer[..], &mut attributes).unwrap();
     /// assert_eq!(message.method, Method::Binding(Kind::Request));
     /// assert!(message.get::<UserName>().is_none());
+    ///
+    /// // a message with more attributes than are walked is rejected.
+    /// let with_attributes = |count: u16| {
+    ///     let mut message = buffer.to_vec();
+    ///     message[2..4].copy_from_slice(&(count * 4).to_be_bytes());
+    ///     for _ in 0..count {
+    ///         message.extend_from_slice(&[0x80, 0x22, 0x00, 0x00]);
+    ///     }
+    ///
+    ///     message
+    /// };
+    ///
+    /// let message = with_attributes(64);
+    /// let mut attributes = Attributes::default();
+    /// assert!(MessageReader::decode(&message, &mut attributes).is_ok());
+    ///
+    /// let message = with_attributes(65);
+    /// let mut attributes = Attributes::default();
+    /// assert!(MessageReader::decode(&message, &mut attributes).is_err());
     /// ```
     #[rustfmt::skip]
     pub fn decode(
         buf: &'a [u8],
-        attributes: &'b mut Vec<(AttrKind, &'a [u8])>,
+        attributes: &'b mut Attributes<'a>,
     ) -> Result<MessageReader<'a, 'b>, StunError> {
         if buf.len() < 20 {
             return Err(StunError::InvalidInput)
         }
 
+        attributes.clear();
+
         let mut find_integrity = false;
         let mut valid_offset = 0;
         let count_size = buf.len();
@@ -391,14 +521,21 @@ impl<'a, 'b> MessageReader<'a, 'b> {
         let token = &buf[8..20];
         let mut offset = 20;
 
-    // warn: loop
-    loop {
+    // the walk is bounded by the number of attributes.
+    for index in 0..=MAX_ATTRIBUTES {
         // if the buf length is not long enough to continue,
         // jump out of the loop.
         if count_size - offset < 4 {
             break;
         }
 
+        // the attributes after the last one walked could be the
+        // MessageIntegrity or Fingerprint, the message is rejected rather
+        // than handled without them.
+        if index == MAX_ATTRIBUTES {
+            return Err(StunError::InvalidInput);
+        }
+
         // get attribute type
         let key = u16::from_be_bytes([buf[offset], buf[offset + 1]]);
 
@@ -441,8 +578,8 @@ impl<'a, 'b> MessageReader<'a, 'b> {
         };
 
         // get attribute body
-        // insert attribute to attributes list.
-        attributes.push((attrkind, &buf[range]));
+        // insert attribute to attributes table.
+        attributes.insert(attrkind, &buf[range]);
     }
 
         Ok(Self {
@@ -1,4 +1,3 @@
-use crc::{Crc, CRC_32_ISO_HDLC};
 use hmac::{digest::CtOutput, Hmac, Mac};
 use md5::{Digest, Md5};
 
@@ -88,15 +87,60 @@ pub fn hmac_sha1(key: &[u8], source: Vec<&[u8]>) -> Result<CtOutput<Hmac<sha1::S
     }
 }
 
+/// keyed HMAC SHA1 state.
+///
+/// the key schedule (the inner and outer padded key blocks) is run once
+/// when the state is created, every digest starts from a copy of the keyed
+/// state, so signing or checking a message hashes only the message.
+///
+/// # Unit Test
+///
+/// ```
+/// use stun::util::*;
+///
+/// let key = long_key("panda", "panda", "raspberry");
+/// let hmac = HmacSha1::new(&key).unwrap();
+///
+/// let digest = hmac.digest(&[b"hello ", b"world"]);
+/// let expected = hmac_sha1(&key, vec![b"hello world"]).unwrap().into_bytes();
+/// assert_eq!(&digest[..], expected.as_slice());
+/// ```
+#[derive(Clone)]
+pub struct HmacSha1(Hmac<sha1::Sha1>);
+
+impl HmacSha1 {
+    pub fn new(key: &[u8]) -> Result<Self, StunError> {
+        Hmac::<sha1::Sha1>::new_from_slice(key)
+            .map(Self)
+            .map_err(|_| StunError::ShaFailed)
+    }
+
+    /// digest the buffers as one message.
+    pub fn digest(&self, source: &[&[u8]]) -> [u8; 20] {
+        let mut mac = self.0.clone();
+        for buf in source {
+            mac.update(buf);
+        }
+
+        mac.finalize().into_bytes().into()
+    }
+}
+
 /// CRC32 Fingerprint.
 ///
+/// the crc is computed with the carry-less multiply instructions
+/// (PCLMULQDQ on x86, CRC32/PMULL on aarch64) when the cpu supports them,
+/// the support is detected at runtime and cached, the portable fallback
+/// uses precomputed slice-by-16 tables.
+///
 /// # Unit Test
 ///
 /// ```
 /// assert_eq!(stun::util::fingerprint(b"1"), 3498621689);
 /// ```
+#[inline]
 pub fn fingerprint(buffer: &[u8]) -> u32 {
-    Crc::<u32>::new(&CRC_32_ISO_HDLC).checksum(buffer) ^ 0x5354_554e
+    crc32fast::hash(buffer) ^ 0x5354_554e
 }
 
 /// slice as u16.
@@ -1,6 +1,84 @@
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    cell::Cell,
+    net::SocketAddr,
+    thread,
+    time::{Duration, Instant},
+};
+
+use bytes::BytesMut;
 use criterion::*;
-use tests::{allocate_request, create_client, create_permission_request, create_turn, indication};
-use tokio::{net::UdpSocket, runtime::Runtime};
+use tests::{
+    allocate_request, channel_bind_request, channel_data, create_client, create_permission_request,
+    create_turn, indication, load,
+};
+use tokio::{net::UdpSocket, runtime::Runtime, time::timeout};
+use turn::StunClass;
+use turn_server::{
+    metrics::{Method, Metrics},
+    router::Router,
+    statistics::{Statistics, Stats},
+};
+
+thread_local! {
+    static ALLOCATIONS: Cell<usize> = const { Cell::new(0) };
+}
+
+/// the system allocator, counting the allocations of the current thread so
+/// the runtime and timer threads do not pollute the numbers of a benchmark.
+struct CountingAllocator;
+
+impl CountingAllocator {
+    fn count() {
+        // The thread local is gone while the thread is being torn down.
+        let _ = ALLOCATIONS.try_with(|it| it.set(it.get() + 1));
+    }
+
+    fn allocations() -> usize {
+        ALLOCATIONS.with(|it| it.get())
+    }
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        Self::count();
+        System.alloc(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        Self::count();
+        System.alloc_zeroed(layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, size: usize) -> *mut u8 {
+        Self::count();
+        System.realloc(ptr, layout, size)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// run the forwarding of one packet many times on the current thread and
+/// return the number of allocations per packet, the first rounds warm up
+/// the pool so its chunks are not counted.
+fn allocations_per_packet(packets: usize, mut forward: impl FnMut() -> usize) -> f64 {
+    for _ in 0..packets {
+        forward();
+    }
+
+    let mut forwarded = 0;
+    let start = CountingAllocator::allocations();
+    for _ in 0..packets {
+        forwarded += forward();
+    }
+
+    (CountingAllocator::allocations() - start) as f64 / forwarded as f64
+}
 
 fn create_turn_block(rt: &Runtime) {
     rt.block_on(async { create_turn().await })
@@ -18,6 +96,31 @@ fn create_permission_request_block(rt: &Runtime, socket: &UdpSocket, port: u16)
     rt.block_on(async { create_permission_request(&socket, port).await })
 }
 
+fn channel_bind_request_block(rt: &Runtime, socket: &UdpSocket, port: u16) {
+    rt.block_on(async { channel_bind_request(&socket, port).await })
+}
+
+/// relay a packet from the local client of every pair to its peer, the
+/// packets of all the pairs are in flight at the same time.
+async fn relay_round(pairs: &[load::Pair], indication: bool) {
+    let mut buf = BytesMut::with_capacity(256);
+    let payload = [0u8; 160];
+    for pair in pairs {
+        if indication {
+            pair.local.indication(&mut buf, pair.peer.relay(), &payload);
+        } else {
+            pair.local.channel_data(&mut buf, load::CHANNEL, &payload);
+        }
+
+        pair.local.send(&buf).await.unwrap();
+    }
+
+    // A lost datagram does not stall the benchmark.
+    for pair in pairs {
+        let _ = timeout(Duration::from_secs(1), pair.peer.recv(&mut buf)).await;
+    }
+}
+
 fn criterion_benchmark(c: &mut Criterion) {
     let rt = Runtime::new().unwrap();
 
@@ -28,6 +131,8 @@ fn criterion_benchmark(c: &mut Criterion) {
     let peer_port = allocate_request_block(&rt, &peer);
     create_permission_request_block(&rt, &local, peer_port);
     create_permission_request_block(&rt, &peer, local_port);
+    channel_bind_request_block(&rt, &local, peer_port);
+    channel_bind_request_block(&rt, &peer, local_port);
 
     let mut turn_relay = c.benchmark_group("turn_relay");
     turn_relay.bench_function("send_indication_local_to_peer", |b| {
@@ -40,7 +145,229 @@ fn criterion_benchmark(c: &mut Criterion) {
             .iter(|| indication(&peer, &local, local_port))
     });
 
+    // ChannelData takes the fast path that skips the stun decoder, the
+    // indications above go through the whole decoder.
+    turn_relay.bench_function("channel_data_local_to_peer", |b| {
+        b.to_async(&rt).iter(|| channel_data(&local, &peer))
+    });
+
+    turn_relay.bench_function("channel_data_peer_to_local", |b| {
+        b.to_async(&rt).iter(|| channel_data(&peer, &local))
+    });
+
     turn_relay.finish();
+
+    // The relay of many allocations at once, rather than one round trip of
+    // a single allocation at a time.
+    let mut turn_load = c.benchmark_group("turn_load");
+    for count in [64, 512] {
+        let options = load::Options {
+            pairs: count,
+            ..load::Options::default()
+        };
+
+        let pairs = rt.block_on(load::create_pairs(&options)).unwrap();
+        turn_load.throughput(Throughput::Elements(count as u64));
+        turn_load.bench_with_input(
+            BenchmarkId::new("channel_data", count * 2),
+            &pairs,
+            |b, pairs| b.to_async(&rt).iter(|| relay_round(pairs, false)),
+        );
+
+        turn_load.bench_with_input(
+            BenchmarkId::new("send_indication", count * 2),
+            &pairs,
+            |b, pairs| b.to_async(&rt).iter(|| relay_round(pairs, true)),
+        );
+    }
+
+    turn_load.finish();
+
+    // Forwarding a packet between interfaces used to allocate a new vector
+    // per packet, the router now copies it into a shared pool chunk.
+    let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    let router = Router::default();
+    let mut receiver = router.get_receiver(addr);
+    let packet = [0u8; 1200];
+
+    // Criterion only reports time, the allocations per forwarded packet are
+    // counted around the same loops and printed next to it.
+    let to_vec = allocations_per_packet(10_000, || {
+        black_box(black_box(&packet[..]).to_vec());
+        1
+    });
+
+    let send_recv = allocations_per_packet(10_000, || {
+        router.send(&addr, StunClass::Channel, &addr, black_box(&packet));
+        black_box(receiver.try_recv().unwrap());
+        1
+    });
+
+    let send_recv_batch = allocations_per_packet(1_000, || {
+        for _ in 0..64 {
+            router.send(&addr, StunClass::Channel, &addr, black_box(&packet));
+        }
+
+        for _ in 0..64 {
+            black_box(receiver.try_recv().unwrap());
+        }
+
+        64
+    });
+
+    println!(
+        "router_forward/to_vec_1200: {:.3} allocations per packet",
+        to_vec
+    );
+    println!(
+        "router_forward/send_recv_1200: {:.3} allocations per packet",
+        send_recv
+    );
+    println!(
+        "router_forward/send_recv_batch_64x1200: {:.3} allocations per packet",
+        send_recv_batch
+    );
+
+    let mut router_forward = c.benchmark_group("router_forward");
+    router_forward.throughput(Throughput::Elements(1));
+    router_forward.bench_function("to_vec_1200", |b| {
+        b.iter(|| black_box(black_box(&packet[..]).to_vec()))
+    });
+
+    router_forward.bench_function("send_recv_1200", |b| {
+        b.iter(|| {
+            router.send(&addr, StunClass::Channel, &addr, black_box(&packet));
+            black_box(receiver.try_recv().unwrap())
+        })
+    });
+
+    router_forward.bench_function("send_recv_batch_64x1200", |b| {
+        b.iter(|| {
+            for _ in 0..64 {
+                router.send(&addr, StunClass::Channel, &addr, black_box(&packet));
+            }
+
+            for _ in 0..64 {
+                black_box(receiver.try_recv().unwrap());
+            }
+        })
+    });
+
+    router_forward.finish();
+
+    // Counting the packets of a busy session from several workers, with a
+    // slab per worker and through the shared counters of the node.
+    let _guard = rt.enter();
+    let statistics = Statistics::default();
+    statistics.set(addr, "test");
+
+    let mut statistics_send = c.benchmark_group("statistics_send");
+    let payload = [Stats::ReceivedBytes(1200), Stats::ReceivedPkts(1)];
+    for threads in [1, 4] {
+        statistics_send.throughput(Throughput::Elements(threads as u64));
+        statistics_send.bench_with_input(
+            BenchmarkId::new("worker_slab", threads),
+            &threads,
+            |b, threads| {
+                b.iter_custom(|iters| {
+                    let start = Instant::now();
+                    thread::scope(|scope| {
+                        for _ in 0..*threads {
+                            let mut actor = statistics.get_actor();
+                            let payload = &payload;
+                            scope.spawn(move || {
+                                for _ in 0..iters {
+                                    actor.send(&addr, payload);
+                                }
+                            });
+                        }
+                    });
+
+                    start.elapsed()
+                })
+            },
+        );
+
+        statistics_send.bench_with_input(
+            BenchmarkId::new("shared", threads),
+            &threads,
+            |b, threads| {
+                b.iter_custom(|iters| {
+                    let start = Instant::now();
+                    thread::scope(|scope| {
+                        for _ in 0..*threads {
+                            let actor = statistics.get_actor();
+                            let payload = &payload;
+                            scope.spawn(move || {
+                                for _ in 0..iters {
+                                    actor.send_shared(&addr, payload);
+                                }
+                            });
+                        }
+                    });
+
+                    start.elapsed()
+                })
+            },
+        );
+    }
+
+    statistics_send.finish();
+
+    // Recording the processor latency from several workers, into a slab per
+    // worker and into the shared histograms.
+    let metrics = Metrics::default();
+    let elapsed = Duration::from_nanos(850);
+
+    let mut metrics_record = c.benchmark_group("metrics_record");
+    for threads in [1, 4] {
+        metrics_record.throughput(Throughput::Elements(threads as u64));
+        metrics_record.bench_with_input(
+            BenchmarkId::new("worker_slab", threads),
+            &threads,
+            |b, threads| {
+                b.iter_custom(|iters| {
+                    let start = Instant::now();
+                    thread::scope(|scope| {
+                        for _ in 0..*threads {
+                            let mut recorder = metrics.get_recorder();
+                            scope.spawn(move || {
+                                for _ in 0..iters {
+                                    recorder.record(Method::ChannelData, black_box(elapsed));
+                                }
+                            });
+                        }
+                    });
+
+                    start.elapsed()
+                })
+            },
+        );
+
+        metrics_record.bench_with_input(
+            BenchmarkId::new("shared", threads),
+            &threads,
+            |b, threads| {
+                b.iter_custom(|iters| {
+                    let start = Instant::now();
+                    thread::scope(|scope| {
+                        for _ in 0..*threads {
+                            let metrics = &metrics;
+                            scope.spawn(move || {
+                                for _ in 0..iters {
+                                    metrics.record(Method::ChannelData, black_box(elapsed));
+                                }
+                            });
+                        }
+                    });
+
+                    start.elapsed()
+                })
+            },
+        );
+    }
+
+    metrics_record.finish();
 }
 
 criterion_group!(benches, criterion_benchmark);
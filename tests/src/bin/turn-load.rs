@@ -0,0 +1,103 @@
+use std::{net::SocketAddr, process::ExitCode, time::Duration};
+
+use clap::Parser;
+use tests::load::{run, Options};
+
+/// relay load generator, allocates pairs of clients on a running turn
+/// server and relays mixed traffic between them.
+#[derive(Parser)]
+#[command(about, version)]
+struct Cli {
+    /// the address of the server.
+    #[arg(long, default_value = "127.0.0.1:3478")]
+    server: SocketAddr,
+    #[arg(long, default_value = "user1")]
+    username: String,
+    #[arg(long, default_value = "test")]
+    password: String,
+    #[arg(long, default_value = "localhost")]
+    realm: String,
+    /// the number of pairs of allocations.
+    #[arg(long, default_value_t = 1000)]
+    pairs: usize,
+    /// the share of the clients that connect over tcp.
+    #[arg(long, default_value_t = 0.0)]
+    tcp: f64,
+    /// the share of the packets that are sent as send indications.
+    #[arg(long, default_value_t = 0.1)]
+    indication: f64,
+    /// the packets per second of all the clients together.
+    #[arg(long, default_value_t = 100_000)]
+    pps: u64,
+    /// the size of the application data of a packet.
+    #[arg(long, default_value_t = 160)]
+    size: usize,
+    /// how long the traffic runs, in seconds.
+    #[arg(long, default_value_t = 60)]
+    duration: u64,
+    /// how often a report is printed, in seconds.
+    #[arg(long, default_value_t = 5)]
+    interval: u64,
+    /// the pid of the server process, its cpu time and memory are sampled.
+    #[arg(long)]
+    pid: Option<u32>,
+    /// fail the run when more than this share of the packets is lost.
+    #[arg(long)]
+    max_loss: Option<f64>,
+    /// fail the run when the p99 latency of the channel data is above this
+    /// number of microseconds.
+    #[arg(long)]
+    max_p99: Option<u64>,
+}
+
+#[tokio::main]
+async fn main() -> ExitCode {
+    let cli = Cli::parse();
+    let ret = run(Options {
+        server: cli.server,
+        username: cli.username,
+        password: cli.password,
+        realm: cli.realm,
+        pairs: cli.pairs,
+        tcp: cli.tcp,
+        indication: cli.indication,
+        pps: cli.pps,
+        size: cli.size,
+        duration: Duration::from_secs(cli.duration),
+        interval: Duration::from_secs(cli.interval.max(1)),
+        pid: cli.pid,
+    })
+    .await;
+
+    let report = match ret {
+        Ok(report) => report,
+        Err(e) => {
+            eprintln!("load failed: err={}", e);
+            return ExitCode::FAILURE;
+        }
+    };
+
+    println!("summary: {}", report);
+
+    let mut passed = true;
+    if let Some(max) = cli.max_loss {
+        if report.loss() > max {
+            eprintln!("loss above the limit: loss={}, max={}", report.loss(), max);
+            passed = false;
+        }
+    }
+
+    if let Some(max) = cli.max_p99.map(Duration::from_micros) {
+        let p99 = report.channel_data.quantile(0.99);
+        if p99 > max {
+            eprintln!("p99 above the limit: p99={:?}, max={:?}", p99, max);
+            passed = false;
+        }
+    }
+
+    if passed {
+        ExitCode::SUCCESS
+    } else {
+        ExitCode::FAILURE
+    }
+}
@@ -1,5 +1,7 @@
 #![allow(static_mut_refs)]
 
+pub mod load;
+
 use bytes::BytesMut;
 use stun::attribute::{
     ChannelNumber, Data, ErrKind, ErrorCode, Lifetime, MappedAddress, Realm, ReqeestedTransport,
@@ -23,6 +25,8 @@ use std::sync::Arc;
 
 pub const BIND_IP: IpAddr = IpAddr::V4(Ipv4Addr::new(127, 0, 0, 1));
 pub const BIND_ADDR: SocketAddr = SocketAddr::new(BIND_IP, 3478);
+/// the interface that receives and sends its datagrams in batches.
+pub const BATCH_ADDR: SocketAddr = SocketAddr::new(BIND_IP, 3479);
 pub const USERNAME: &str = "user1";
 pub const PASSWORD: &str = "test";
 pub const REALM: &str = "localhost";
@@ -64,11 +68,36 @@ pub async fn create_turn() {
             log: Log::default(),
             turn: Turn {
                 realm: REALM.to_string(),
-                interfaces: vec![Interface {
-                    transport: config::Transport::UDP,
-                    bind: BIND_ADDR,
-                    external: BIND_ADDR,
-                }],
+                interfaces: vec![
+                    Interface {
+                        transport: config::Transport::UDP,
+                        bind: BIND_ADDR,
+                        external: BIND_ADDR,
+                        batch: 1,
+                        reuse_port: false,
+                        cert: None,
+                        key: None,
+                    },
+                    Interface {
+                        transport: config::Transport::UDP,
+                        bind: BATCH_ADDR,
+                        external: BATCH_ADDR,
+                        batch: 8,
+                        reuse_port: false,
+                        cert: None,
+                        key: None,
+                    },
+                ],
+                queue: Queue::default(),
+                auth: config::Auth::default(),
+                nonce_secret: None,
+                port_range: config::PortRange::default(),
+                relay: config::Relay::default(),
+                xdp: config::Xdp::default(),
+                cluster: config::Cluster::default(),
+                handoff: config::Handoff::default(),
+                limits: config::Limits::default(),
+                trace: config::Trace::default(),
             },
         }))
         .await
@@ -81,8 +110,12 @@ pub async fn create_turn() {
 // that the order of request responses is relatively strict, and should not
 // be changed under normal circumstances.
 pub async fn create_client() -> UdpSocket {
+    connect_client(BIND_ADDR).await
+}
+
+pub async fn connect_client(server: SocketAddr) -> UdpSocket {
     let socket = UdpSocket::bind(SocketAddr::new(BIND_IP, 0)).await.unwrap();
-    socket.connect(BIND_ADDR).await.unwrap();
+    socket.connect(server).await.unwrap();
     socket
 }
 
@@ -266,6 +299,44 @@ pub async fn indication(local: &UdpSocket, peer: &UdpSocket, port: u16) {
     assert_eq!(value, TOKEN_BUF.as_slice());
 }
 
+pub async fn channel_data(local: &UdpSocket, peer: &UdpSocket) {
+    let mut buf = [0u8; 16];
+    buf[..2].copy_from_slice(&0x4000u16.to_be_bytes());
+    buf[2..4].copy_from_slice(&(TOKEN_BUF.len() as u16).to_be_bytes());
+    buf[4..].copy_from_slice(TOKEN_BUF.as_slice());
+    local.send(&buf).await.unwrap();
+
+    let size = peer.recv(unsafe { &mut RECV_BUF }).await.unwrap();
+    assert_eq!(unsafe { &RECV_BUF[..size] }, &buf[..]);
+}
+
+// Send a burst of channel data before reading any of it, so the server
+// receives and forwards the packets of the burst together. The workers of
+// an interface may reorder them, so only the set of packets is checked.
+pub async fn channel_data_burst(local: &UdpSocket, peer: &UdpSocket, count: u8) {
+    let mut buf = [0u8; 16];
+    buf[..2].copy_from_slice(&0x4000u16.to_be_bytes());
+    buf[2..4].copy_from_slice(&(TOKEN_BUF.len() as u16).to_be_bytes());
+    buf[4..].copy_from_slice(TOKEN_BUF.as_slice());
+    for i in 0..count {
+        buf[4] = i;
+        local.send(&buf).await.unwrap();
+    }
+
+    let mut received = Vec::with_capacity(count as usize);
+    for _ in 0..count {
+        let size = peer.recv(unsafe { &mut RECV_BUF }).await.unwrap();
+        let packet = unsafe { &RECV_BUF[..size] };
+        assert_eq!(size, buf.len());
+        assert_eq!(&packet[..4], &buf[..4]);
+        assert_eq!(&packet[5..], &buf[5..]);
+        received.push(packet[4]);
+    }
+
+    received.sort();
+    assert_eq!(received, (0..count).collect::<Vec<_>>());
+}
+
 #[cfg(test)]
 mod tests {
     #[tokio::test]
@@ -278,5 +349,20 @@ mod tests {
         crate::create_permission_request(&socket, port).await;
         crate::channel_bind_request(&socket, port).await;
         crate::refresh_request(&socket).await;
+
+        // The relay through the batched interface, so the sendmmsg/recvmmsg
+        // and GRO/GSO paths of the server run too.
+        let local = crate::connect_client(crate::BATCH_ADDR).await;
+        let peer = crate::create_client().await;
+        let local_port = crate::allocate_request(&local).await;
+        let peer_port = crate::allocate_request(&peer).await;
+        crate::create_permission_request(&local, peer_port).await;
+        crate::create_permission_request(&peer, local_port).await;
+        crate::channel_bind_request(&local, peer_port).await;
+        crate::channel_bind_request(&peer, local_port).await;
+        crate::indication(&local, &peer, peer_port).await;
+        crate::indication(&peer, &local, local_port).await;
+        crate::channel_data_burst(&local, &peer, 16).await;
+        crate::channel_data_burst(&peer, &local, 16).await;
     }
 }
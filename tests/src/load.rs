@@ -0,0 +1,834 @@
+use crate::{BIND_ADDR, PASSWORD, REALM, USERNAME};
+
+use std::{
+    fmt, fs,
+    io::{self, ErrorKind},
+    net::SocketAddr,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc,
+    },
+    time::Duration,
+};
+
+use bytes::{BufMut, BytesMut};
+use stun::{
+    attribute::{
+        self, ChannelNumber, Data, ErrorCode, Lifetime, Realm, ReqeestedTransport, UserName,
+        XorPeerAddress, XorRelayedAddress,
+    },
+    Decoder, Kind, MessageReader, MessageWriter, Method, Payload,
+};
+use tokio::{
+    io::{AsyncReadExt, AsyncWriteExt},
+    net::{
+        tcp::{OwnedReadHalf, OwnedWriteHalf},
+        TcpStream, UdpSocket,
+    },
+    sync::{Mutex, Semaphore},
+    task::JoinSet,
+    time::{interval, sleep_until, timeout_at, Instant, MissedTickBehavior},
+};
+use turn_server::metrics::{self, HistogramCounts, Metrics};
+
+/// The channel that the allocations of a pair bind towards each other.
+pub const CHANNEL: u16 = 0x4000;
+
+/// The lifetime that the allocations ask for and refresh, in seconds.
+const LIFETIME: u32 = 600;
+
+/// How long a request waits for its response.
+const TIMEOUT: Duration = Duration::from_secs(5);
+
+/// The number of pairs that are set up at the same time.
+const SETUP_CONCURRENCY: usize = 64;
+
+/// The pacing period of the senders, every tick sends the packets that are
+/// due since the last one.
+const TICK: Duration = Duration::from_millis(1);
+
+/// How long the packets that are still in flight are waited for once the
+/// senders have stopped.
+const DRAIN: Duration = Duration::from_secs(1);
+
+/// The number of clock ticks of a second in `/proc/<pid>/stat`, which is
+/// fixed by the kernel abi.
+const USER_HZ: u64 = 100;
+
+/// the transport that a client connects to the server over.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Protocol {
+    Udp,
+    Tcp,
+}
+
+/// load generator options.
+#[derive(Debug, Clone)]
+pub struct Options {
+    pub server: SocketAddr,
+    pub username: String,
+    pub password: String,
+    pub realm: String,
+    /// the number of pairs of allocations, the allocations of a pair relay
+    /// to each other.
+    pub pairs: usize,
+    /// the share of the clients that connect over tcp, between 0 and 1, the
+    /// server needs a tcp interface on the same address.
+    pub tcp: f64,
+    /// the share of the packets that are sent as send indications, between
+    /// 0 and 1, the rest is sent as channel data.
+    pub indication: f64,
+    /// the packets per second of all the clients together.
+    pub pps: u64,
+    /// the size of the application data of a packet, the send time takes
+    /// the first 8 bytes.
+    pub size: usize,
+    /// how long the traffic runs.
+    pub duration: Duration,
+    /// how often a report is printed.
+    pub interval: Duration,
+    /// the server process whose cpu time and memory are sampled, only on
+    /// linux.
+    pub pid: Option<u32>,
+}
+
+impl Default for Options {
+    fn default() -> Self {
+        Self {
+            server: BIND_ADDR,
+            username: USERNAME.to_string(),
+            password: PASSWORD.to_string(),
+            realm: REALM.to_string(),
+            pairs: 1000,
+            tcp: 0.0,
+            indication: 0.1,
+            pps: 100_000,
+            size: 160,
+            duration: Duration::from_secs(60),
+            interval: Duration::from_secs(5),
+            pid: None,
+        }
+    }
+}
+
+/// whether the nth item is one of the `share` of the items, the items are
+/// spread evenly instead of at random so that every run has the same mix.
+///
+/// # Example
+///
+/// ```
+/// use tests::load::spread;
+///
+/// let count = (0..1000).filter(|n| spread(*n, 0.25)).count();
+/// assert_eq!(count, 250);
+///
+/// assert!(!(0..1000).any(|n| spread(n, 0.0)));
+/// assert!((0..1000).all(|n| spread(n, 1.0)));
+/// ```
+pub fn spread(n: u64, share: f64) -> bool {
+    let share = share.clamp(0.0, 1.0);
+    ((n + 1) as f64 * share).floor() > (n as f64 * share).floor()
+}
+
+/// the connection of a client, the tcp stream is split so that a client
+/// sends and receives at the same time.
+enum Socket {
+    Udp(UdpSocket),
+    Tcp {
+        reader: Mutex<(OwnedReadHalf, BytesMut)>,
+        writer: Mutex<OwnedWriteHalf>,
+    },
+}
+
+impl Socket {
+    async fn connect(protocol: Protocol, server: SocketAddr) -> io::Result<Self> {
+        Ok(match protocol {
+            Protocol::Udp => {
+                let bind = if server.is_ipv4() {
+                    "0.0.0.0:0"
+                } else {
+                    "[::]:0"
+                };
+                let socket = UdpSocket::bind(bind).await?;
+                socket.connect(server).await?;
+                Self::Udp(socket)
+            }
+            Protocol::Tcp => {
+                let stream = TcpStream::connect(server).await?;
+                stream.set_nodelay(true)?;
+
+                let (reader, writer) = stream.into_split();
+                Self::Tcp {
+                    reader: Mutex::new((reader, BytesMut::with_capacity(4096))),
+                    writer: Mutex::new(writer),
+                }
+            }
+        })
+    }
+
+    async fn send(&self, buf: &[u8]) -> io::Result<()> {
+        match self {
+            Self::Udp(socket) => socket.send(buf).await.map(|_| ()),
+            Self::Tcp { writer, .. } => writer.lock().await.write_all(buf).await,
+        }
+    }
+
+    /// receive one message into the buffer.
+    async fn recv(&self, buf: &mut BytesMut) -> io::Result<()> {
+        buf.clear();
+        match self {
+            Self::Udp(socket) => {
+                buf.reserve(2048);
+                socket.recv_buf(buf).await?;
+            }
+            Self::Tcp { reader, .. } => {
+                let mut reader = reader.lock().await;
+                let (stream, stash) = &mut *reader;
+                loop {
+                    let header = if Decoder::is_channel_data(stash) {
+                        4
+                    } else {
+                        20
+                    };
+                    if stash.len() >= header {
+                        let size = Decoder::message_size(stash, true).map_err(invalid_data)?;
+                        if size <= stash.len() {
+                            buf.extend_from_slice(&stash.split_to(size));
+                            return Ok(());
+                        }
+                    }
+
+                    stash.reserve(4096);
+                    if stream.read_buf(stash).await? == 0 {
+                        return Err(ErrorKind::UnexpectedEof.into());
+                    }
+                }
+            }
+        }
+
+        Ok(())
+    }
+}
+
+/// a client with an allocation on the server.
+pub struct Client {
+    socket: Socket,
+    protocol: Protocol,
+    token: [u8; 12],
+    key: [u8; 16],
+    username: String,
+    realm: String,
+    relay: SocketAddr,
+}
+
+impl Client {
+    /// connect to the server and allocate a relay address.
+    pub async fn connect(options: &Options, protocol: Protocol) -> io::Result<Self> {
+        let mut client = Self {
+            socket: Socket::connect(protocol, options.server).await?,
+            token: rand::random(),
+            key: stun::util::long_key(&options.username, &options.password, &options.realm),
+            username: options.username.clone(),
+            realm: options.realm.clone(),
+            relay: options.server,
+            protocol,
+        };
+
+        let mut buf = BytesMut::with_capacity(2048);
+        let mut msg = MessageWriter::new(Method::Allocate(Kind::Request), &client.token, &mut buf);
+        msg.append::<ReqeestedTransport>(attribute::Transport::UDP);
+        msg.append::<UserName>(&client.username);
+        msg.append::<Realm>(&client.realm);
+        msg.flush(Some(&client.key)).map_err(invalid_data)?;
+
+        client.relay = client
+            .transaction(&mut buf, Method::Allocate(Kind::Response), |m| {
+                m.get::<XorRelayedAddress>()
+            })
+            .await?;
+
+        Ok(client)
+    }
+
+    /// the relay address of the allocation.
+    pub fn relay(&self) -> SocketAddr {
+        self.relay
+    }
+
+    pub fn protocol(&self) -> Protocol {
+        self.protocol
+    }
+
+    pub async fn create_permission(&self, peer: SocketAddr) -> io::Result<()> {
+        let mut buf = BytesMut::with_capacity(2048);
+        let method = Method::CreatePermission(Kind::Request);
+        let mut msg = MessageWriter::new(method, &self.token, &mut buf);
+        msg.append::<XorPeerAddress>(peer);
+        msg.append::<UserName>(&self.username);
+        msg.append::<Realm>(&self.realm);
+        msg.flush(Some(&self.key)).map_err(invalid_data)?;
+
+        self.transaction(&mut buf, Method::CreatePermission(Kind::Response), |_| {
+            Some(())
+        })
+        .await
+    }
+
+    pub async fn channel_bind(&self, number: u16, peer: SocketAddr) -> io::Result<()> {
+        let mut buf = BytesMut::with_capacity(2048);
+        let mut msg = MessageWriter::new(Method::ChannelBind(Kind::Request), &self.token, &mut buf);
+        msg.append::<ChannelNumber>(number);
+        msg.append::<XorPeerAddress>(peer);
+        msg.append::<UserName>(&self.username);
+        msg.append::<Realm>(&self.realm);
+        msg.flush(Some(&self.key)).map_err(invalid_data)?;
+
+        self.transaction(&mut buf, Method::ChannelBind(Kind::Response), |_| Some(()))
+            .await
+    }
+
+    /// send the request in the buffer and wait for its response, the
+    /// messages of other transactions and the relayed data in between are
+    /// skipped.
+    async fn transaction<T>(
+        &self,
+        buf: &mut BytesMut,
+        response: Method,
+        f: impl Fn(&MessageReader) -> Option<T>,
+    ) -> io::Result<T> {
+        self.socket.send(buf).await?;
+
+        let mut decoder = Decoder::new();
+        let deadline = Instant::now() + TIMEOUT;
+        loop {
+            timeout_at(deadline, self.socket.recv(buf))
+                .await
+                .map_err(|_| io::Error::from(ErrorKind::TimedOut))??;
+
+            if buf.len() < 4 || Decoder::is_channel_data(buf) {
+                continue;
+            }
+
+            let message = match decoder.decode(buf) {
+                Ok(Payload::Message(message)) => message,
+                _ => continue,
+            };
+
+            if message.token != self.token.as_slice() {
+                continue;
+            }
+
+            if let Some(error) = message.get::<ErrorCode>() {
+                return Err(io::Error::new(
+                    ErrorKind::Other,
+                    format!(
+                        "{:?} failed: code={}, message={}",
+                        message.method, error.code, error.message
+                    ),
+                ));
+            }
+
+            if message.method != response {
+                continue;
+            }
+
+            message.integrity(&self.key).map_err(invalid_data)?;
+            return f(&message).ok_or_else(|| invalid_data("missing attribute"));
+        }
+    }
+
+    /// write a ChannelData message of the payload into the buffer.
+    pub fn channel_data(&self, buf: &mut BytesMut, number: u16, payload: &[u8]) {
+        buf.clear();
+        buf.put_u16(number);
+        buf.put_u16(payload.len() as u16);
+        buf.put_slice(payload);
+
+        // The channel data needs to be aligned in multiples of 4 in tcp.
+        let pad = buf.len() % 4;
+        if self.protocol == Protocol::Tcp && pad > 0 {
+            buf.put_bytes(0, 4 - pad);
+        }
+    }
+
+    /// write a send indication of the payload towards the peer into the
+    /// buffer.
+    pub fn indication(&self, buf: &mut BytesMut, peer: SocketAddr, payload: &[u8]) {
+        let mut msg = MessageWriter::new(Method::SendIndication, &self.token, buf);
+        msg.append::<XorPeerAddress>(peer);
+        msg.append::<Data>(payload);
+        let _ = msg.flush(None);
+    }
+
+    /// write a refresh request of the allocation into the buffer, the
+    /// response is skipped by the receiver.
+    pub fn refresh(&self, buf: &mut BytesMut) {
+        let mut msg = MessageWriter::new(Method::Refresh(Kind::Request), &self.token, buf);
+        msg.append::<Lifetime>(LIFETIME);
+        msg.append::<UserName>(&self.username);
+        msg.append::<Realm>(&self.realm);
+        let _ = msg.flush(Some(&self.key));
+    }
+
+    pub async fn send(&self, buf: &[u8]) -> io::Result<()> {
+        self.socket.send(buf).await
+    }
+
+    /// receive the next message from the server into the buffer.
+    pub async fn recv(&self, buf: &mut BytesMut) -> io::Result<()> {
+        self.socket.recv(buf).await
+    }
+}
+
+/// get the application data of a relayed message, and whether it was
+/// relayed as channel data or as a data indication.
+///
+/// # Example
+///
+/// ```
+/// use tests::load::relayed;
+/// use stun::Decoder;
+/// use turn_server::metrics::Method;
+///
+/// let mut decoder = Decoder::new();
+/// let buf = [0x40, 0x00, 0x00, 0x02, 0x01, 0x02, 0x00, 0x00];
+/// assert_eq!(
+///     relayed(&mut decoder, &buf),
+///     Some((Method::ChannelData, &[0x01, 0x02][..]))
+/// );
+/// ```
+pub fn relayed<'a>(decoder: &mut Decoder, buf: &'a [u8]) -> Option<(metrics::Method, &'a [u8])> {
+    if buf.len() < 4 {
+        return None;
+    }
+
+    if Decoder::is_channel_data(buf) {
+        let size = u16::from_be_bytes([buf[2], buf[3]]) as usize;
+        return buf
+            .get(4..4 + size)
+            .map(|data| (metrics::Method::ChannelData, data));
+    }
+
+    match decoder.decode(buf) {
+        Ok(Payload::Message(message)) if message.method == Method::DataIndication => message
+            .get::<Data>()
+            .map(|data| (metrics::Method::SendIndication, data)),
+        _ => None,
+    }
+}
+
+/// the packet counters of a client, every counter has a single writer.
+#[derive(Default)]
+pub struct Counters {
+    pub sent: AtomicU64,
+    pub received: AtomicU64,
+    pub errors: AtomicU64,
+}
+
+/// a pair of allocations that relay to each other.
+pub struct Pair {
+    pub local: Arc<Client>,
+    pub peer: Arc<Client>,
+}
+
+impl Pair {
+    /// allocate both clients and give each of them a permission and a
+    /// channel towards the relay address of the other.
+    pub async fn connect(options: &Options, local: Protocol, peer: Protocol) -> io::Result<Self> {
+        let local = Client::connect(options, local).await?;
+        let peer = Client::connect(options, peer).await?;
+
+        local.create_permission(peer.relay).await?;
+        peer.create_permission(local.relay).await?;
+        local.channel_bind(CHANNEL, peer.relay).await?;
+        peer.channel_bind(CHANNEL, local.relay).await?;
+
+        Ok(Self {
+            local: Arc::new(local),
+            peer: Arc::new(peer),
+        })
+    }
+}
+
+/// set up the pairs of the options, a limited number at the same time.
+///
+/// the first `options.tcp` of the clients connect over tcp, spread evenly
+/// over the pairs.
+pub async fn create_pairs(options: &Options) -> io::Result<Vec<Pair>> {
+    let semaphore = Arc::new(Semaphore::new(SETUP_CONCURRENCY));
+    let mut tasks = JoinSet::new();
+    for index in 0..options.pairs {
+        let protocol = |n: usize| {
+            if spread(n as u64, options.tcp) {
+                Protocol::Tcp
+            } else {
+                Protocol::Udp
+            }
+        };
+
+        let (local, peer) = (protocol(index * 2), protocol(index * 2 + 1));
+        let semaphore = semaphore.clone();
+        let options = options.clone();
+        tasks.spawn(async move {
+            let _permit = semaphore.acquire_owned().await;
+            Pair::connect(&options, local, peer).await
+        });
+    }
+
+    let mut pairs = Vec::with_capacity(options.pairs);
+    while let Some(ret) = tasks.join_next().await {
+        pairs.push(ret.map_err(io::Error::other)??);
+    }
+
+    Ok(pairs)
+}
+
+/// the cpu time and memory of a process.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct Usage {
+    pub cpu: Duration,
+    /// the resident set size in bytes.
+    pub rss: u64,
+}
+
+impl Usage {
+    /// sample the usage of the process from `/proc`, none where there is no
+    /// `/proc` or the process is gone.
+    pub fn sample(pid: u32) -> Option<Self> {
+        let stat = fs::read_to_string(format!("/proc/{}/stat", pid)).ok()?;
+
+        // The name of the command is in parentheses and may hold spaces, the
+        // fields after it start with the state, the third field.
+        let fields = stat
+            .get(stat.rfind(')')? + 1..)?
+            .split_whitespace()
+            .collect::<Vec<_>>();
+
+        let utime = fields.get(11)?.parse::<u64>().ok()?;
+        let stime = fields.get(12)?.parse::<u64>().ok()?;
+
+        let status = fs::read_to_string(format!("/proc/{}/status", pid)).ok()?;
+        let rss = status
+            .lines()
+            .find_map(|line| line.strip_prefix("VmRSS:"))?
+            .trim()
+            .trim_end_matches("kB")
+            .trim()
+            .parse::<u64>()
+            .ok()?;
+
+        Some(Self {
+            cpu: Duration::from_millis((utime + stime) * 1000 / USER_HZ),
+            rss: rss * 1024,
+        })
+    }
+}
+
+/// the traffic of a reporting interval.
+#[derive(Debug, Clone)]
+pub struct Report {
+    /// the time since the traffic started.
+    pub elapsed: Duration,
+    /// the length of the interval.
+    pub interval: Duration,
+    pub allocations: usize,
+    pub sent: u64,
+    pub received: u64,
+    pub errors: u64,
+    pub size: usize,
+    /// the relay latency of the channel data and of the indications.
+    pub channel_data: HistogramCounts,
+    pub indication: HistogramCounts,
+    /// the cpu time the server spent in the interval and its memory at the
+    /// end of it.
+    pub usage: Option<Usage>,
+}
+
+impl Report {
+    /// the relayed packets per second.
+    pub fn pps(&self) -> f64 {
+        self.received as f64 / self.interval.as_secs_f64().max(f64::EPSILON)
+    }
+
+    /// the share of the sent packets that were not relayed, the packets in
+    /// flight at the end of an interval are counted in the next one.
+    pub fn loss(&self) -> f64 {
+        if self.sent == 0 {
+            return 0.0;
+        }
+
+        self.sent.saturating_sub(self.received) as f64 / self.sent as f64
+    }
+
+    /// the cpu cores the server takes for every million relayed packets per
+    /// second.
+    pub fn cores_per_mpps(&self) -> Option<f64> {
+        let usage = self.usage?;
+        let mpps = self.pps() / 1_000_000.0;
+        if mpps <= 0.0 {
+            return None;
+        }
+
+        Some(usage.cpu.as_secs_f64() / self.interval.as_secs_f64() / mpps)
+    }
+}
+
+impl fmt::Display for Report {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let latency = |counts: &HistogramCounts| {
+            format!(
+                "{:?}/{:?}/{:?}",
+                counts.quantile(0.5),
+                counts.quantile(0.99),
+                counts.quantile(0.999)
+            )
+        };
+
+        write!(
+            f,
+            "elapsed={:?}, allocations={}, pps={:.0}, mbps={:.2}, loss={:.4}%, errors={}, \
+             channel_data(p50/p99/p999)={}, indication(p50/p99/p999)={}",
+            self.elapsed,
+            self.allocations,
+            self.pps(),
+            self.pps() * self.size as f64 * 8.0 / 1_000_000.0,
+            self.loss() * 100.0,
+            self.errors,
+            latency(&self.channel_data),
+            latency(&self.indication),
+        )?;
+
+        if let Some(usage) = self.usage {
+            write!(
+                f,
+                ", cpu={:.2}cores, rss={}MiB",
+                usage.cpu.as_secs_f64() / self.interval.as_secs_f64(),
+                usage.rss / 1024 / 1024
+            )?;
+        }
+
+        if let Some(cores) = self.cores_per_mpps() {
+            write!(f, ", cores_per_mpps={:.2}", cores)?;
+        }
+
+        Ok(())
+    }
+}
+
+/// send the packets of a client towards its peer at `pps` until the
+/// deadline, the payload starts with the send time since the epoch.
+async fn send_loop(
+    client: Arc<Client>,
+    peer: SocketAddr,
+    pps: f64,
+    options: Arc<Options>,
+    counters: Arc<Counters>,
+    epoch: Instant,
+    deadline: Instant,
+) {
+    let mut buf = BytesMut::with_capacity(options.size + 64);
+    let mut payload = vec![0u8; options.size.max(8)];
+    let mut ticker = interval(TICK);
+    ticker.set_missed_tick_behavior(MissedTickBehavior::Skip);
+
+    let start = Instant::now();
+    let mut refreshed = start;
+    let mut sent = 0;
+    while Instant::now() < deadline {
+        ticker.tick().await;
+
+        let due = (start.elapsed().as_secs_f64() * pps) as u64;
+        while sent < due {
+            let now = epoch.elapsed().as_nanos() as u64;
+            payload[..8].copy_from_slice(&now.to_be_bytes());
+            if spread(sent, options.indication) {
+                client.indication(&mut buf, peer, &payload);
+            } else {
+                client.channel_data(&mut buf, CHANNEL, &payload);
+            }
+
+            let counter = match client.send(&buf).await {
+                Ok(_) => &counters.sent,
+                Err(_) => &counters.errors,
+            };
+
+            counter.fetch_add(1, Ordering::Relaxed);
+            sent += 1;
+        }
+
+        if refreshed.elapsed() >= Duration::from_secs(LIFETIME as u64 / 2) {
+            refreshed = Instant::now();
+            client.refresh(&mut buf);
+            if client.send(&buf).await.is_err() {
+                counters.errors.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+/// receive the packets relayed to a client until the deadline and record
+/// their latency.
+async fn recv_loop(
+    client: Arc<Client>,
+    latency: Metrics,
+    counters: Arc<Counters>,
+    epoch: Instant,
+    deadline: Instant,
+) {
+    let mut decoder = Decoder::new();
+    let mut buf = BytesMut::with_capacity(2048);
+    while let Ok(ret) = timeout_at(deadline, client.recv(&mut buf)).await {
+        if ret.is_err() {
+            counters.errors.fetch_add(1, Ordering::Relaxed);
+            break;
+        }
+
+        if let Some((method, data)) = relayed(&mut decoder, &buf) {
+            if let Some(sent) = data.get(..8) {
+                let sent = u64::from_be_bytes(sent.try_into().unwrap());
+                let elapsed = (epoch.elapsed().as_nanos() as u64).saturating_sub(sent);
+                latency.record(method, Duration::from_nanos(elapsed));
+                counters.received.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+/// run the load of the options against the server, prints a report every
+/// interval and returns the report of the whole run.
+///
+/// the packets are relayed between the allocations of every pair both
+/// ways, so every packet crosses the server once and its latency is the
+/// time from the send of one client to the receive of the other.
+pub async fn run(options: Options) -> io::Result<Report> {
+    let started = Instant::now();
+    let pairs = create_pairs(&options).await?;
+    let tcp = pairs
+        .iter()
+        .flat_map(|pair| [&pair.local, &pair.peer])
+        .filter(|client| client.protocol() == Protocol::Tcp)
+        .count();
+
+    println!(
+        "allocated: allocations={}, tcp={}, elapsed={:?}",
+        pairs.len() * 2,
+        tcp,
+        started.elapsed()
+    );
+
+    let options = Arc::new(options);
+    let latency = Metrics::default();
+    let epoch = Instant::now();
+    let deadline = epoch + options.duration;
+    let pps = options.pps as f64 / (pairs.len() * 2).max(1) as f64;
+
+    let mut counters = Vec::with_capacity(pairs.len() * 2);
+    let mut tasks = JoinSet::new();
+    for pair in &pairs {
+        for (client, peer) in [(&pair.local, &pair.peer), (&pair.peer, &pair.local)] {
+            let counter = Arc::new(Counters::default());
+            counters.push(counter.clone());
+
+            tasks.spawn(send_loop(
+                client.clone(),
+                peer.relay(),
+                pps,
+                options.clone(),
+                counter.clone(),
+                epoch,
+                deadline,
+            ));
+
+            tasks.spawn(recv_loop(
+                client.clone(),
+                latency.clone(),
+                counter,
+                epoch,
+                deadline + DRAIN,
+            ));
+        }
+    }
+
+    let totals = || {
+        let mut totals = (0, 0, 0);
+        for counter in &counters {
+            totals.0 += counter.sent.load(Ordering::Relaxed);
+            totals.1 += counter.received.load(Ordering::Relaxed);
+            totals.2 += counter.errors.load(Ordering::Relaxed);
+        }
+
+        totals
+    };
+
+    let sample = || options.pid.and_then(Usage::sample);
+    let histograms = || {
+        (
+            latency.get_processor(metrics::Method::ChannelData),
+            latency.get_processor(metrics::Method::SendIndication),
+        )
+    };
+
+    let first_usage = sample();
+    let mut last_usage = first_usage;
+    let mut last_at = epoch;
+    let mut last_totals = totals();
+    let mut last_histograms = histograms();
+
+    let mut next = epoch;
+    while next < deadline + DRAIN {
+        next = (next + options.interval).min(deadline + DRAIN);
+        sleep_until(next).await;
+
+        let (at, usage) = (Instant::now(), sample());
+        let (sent, received, errors) = totals();
+        let (channel_data, indication) = histograms();
+        println!(
+            "{}",
+            Report {
+                elapsed: at - epoch,
+                interval: at - last_at,
+                allocations: pairs.len() * 2,
+                sent: sent - last_totals.0,
+                received: received - last_totals.1,
+                errors: errors - last_totals.2,
+                size: options.size,
+                channel_data: channel_data.since(&last_histograms.0),
+                indication: indication.since(&last_histograms.1),
+                usage: usage.zip(last_usage).map(|(usage, last)| Usage {
+                    cpu: usage.cpu.saturating_sub(last.cpu),
+                    rss: usage.rss,
+                }),
+            }
+        );
+
+        last_at = at;
+        last_usage = usage;
+        last_totals = (sent, received, errors);
+        last_histograms = (channel_data, indication);
+    }
+
+    tasks.abort_all();
+
+    let (sent, received, errors) = totals();
+    let (channel_data, indication) = histograms();
+    let elapsed = epoch.elapsed();
+    Ok(Report {
+        allocations: pairs.len() * 2,
+        interval: elapsed,
+        size: options.size,
+        usage: last_usage.zip(first_usage).map(|(usage, first)| Usage {
+            cpu: usage.cpu.saturating_sub(first.cpu),
+            rss: usage.rss,
+        }),
+        channel_data,
+        indication,
+        received,
+        elapsed,
+        errors,
+        sent,
+    })
+}
+
+fn invalid_data<E: Into<Box<dyn std::error::Error + Send + Sync>>>(e: E) -> io::Error {
+    io::Error::new(ErrorKind::InvalidData, e)
+}
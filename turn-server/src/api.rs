@@ -4,11 +4,18 @@ use std::{
     time::{Duration, Instant},
 };
 
-use crate::{config::Config, statistics::Statistics};
+use crate::{
+    config::{Config, Transport},
+    credentials::{Credentials, Fetch},
+    events::{Event, Events},
+    metrics::{Encoder, Method, Metrics},
+    statistics::{InterfaceCounts, Session, Statistics, TOP_SESSIONS},
+    trace::Stage,
+};
 
 use axum::{
     extract::{Query, State},
-    http::StatusCode,
+    http::{header::CONTENT_TYPE, StatusCode},
     middleware,
     response::{IntoResponse, Response},
     routing::{delete, get},
@@ -24,12 +31,15 @@ use reqwest::{
 
 use serde::Deserialize;
 use serde_json::{json, Value};
-use tokio::{
-    net::TcpListener,
-    sync::mpsc::{unbounded_channel, UnboundedSender},
-};
+use tokio::net::TcpListener;
 
-use turn::Service;
+use turn::{
+    router::{
+        limits::{Limit, Limits},
+        shards::ShardedMap,
+    },
+    Service,
+};
 
 static RID: Lazy<String> = Lazy::new(|| {
     let mut rng = thread_rng();
@@ -43,7 +53,10 @@ static RID: Lazy<String> = Lazy::new(|| {
 struct AppState {
     config: Arc<Config>,
     service: Service,
+    forwarder: Arc<crate::router::Router>,
     statistics: Statistics,
+    credentials: Credentials,
+    metrics: Metrics,
     uptime: Instant,
 }
 
@@ -53,6 +66,29 @@ struct QueryFilter {
     username: Option<String>,
 }
 
+/// the page size of the session listing when the query does not give one.
+const PAGE_LIMIT: usize = 100;
+
+#[derive(Deserialize)]
+struct QueryPage {
+    /// the address of the last session of the previous page.
+    cursor: Option<SocketAddr>,
+    limit: Option<usize>,
+}
+
+fn session_json(session: &Session) -> Value {
+    json!({
+        "address": session.addr,
+        "username": &*session.username,
+        "received_bytes": session.counts.received_bytes,
+        "send_bytes": session.counts.send_bytes,
+        "received_pkts": session.counts.received_pkts,
+        "send_pkts": session.counts.send_pkts,
+        "dropped_pkts": session.counts.dropped_pkts,
+        "limited_pkts": session.counts.limited_pkts,
+    })
+}
+
 /// start http server
 ///
 /// Create an http server and start it, and you can access the controller
@@ -65,13 +101,19 @@ struct QueryFilter {
 pub async fn start_server(
     config: Arc<Config>,
     service: Service,
+    forwarder: Arc<crate::router::Router>,
     statistics: Statistics,
+    credentials: Credentials,
+    metrics: Metrics,
 ) -> anyhow::Result<()> {
     let state = Arc::new(AppState {
         config: config.clone(),
         uptime: Instant::now(),
+        credentials,
+        forwarder,
         service,
         statistics,
+        metrics,
     });
 
     let app = Router::new()
@@ -105,12 +147,18 @@ pub async fn start_server(
                     let mut res = Vec::with_capacity(addrs.len());
                     for addr in addrs {
                         if let Some(node) = state.service.get_router().get_node(&Arc::new(addr)) {
+                            let ports = node
+                                .ports
+                                .iter()
+                                .map(|relay| relay.port())
+                                .collect::<Vec<_>>();
                             res.push(json!({
                                 "address": addr,
                                 "username": node.username,
                                 "password": node.password,
                                 "allocated_channels": node.channels,
-                                "allocated_ports": node.ports,
+                                "allocated_ports": ports,
+                                "relayed_addresses": node.ports,
                                 "expiration": node.expiration,
                                 "lifetime": node.lifetime.elapsed().as_secs(),
                             }));
@@ -132,6 +180,10 @@ pub async fn start_server(
                                 "send_bytes": counts.send_bytes,
                                 "received_pkts": counts.received_pkts,
                                 "send_pkts": counts.send_pkts,
+                                "dropped_bytes": counts.dropped_bytes,
+                                "dropped_pkts": counts.dropped_pkts,
+                                "limited_bytes": counts.limited_bytes,
+                                "limited_pkts": counts.limited_pkts,
                             }))
                             .into_response();
                         }
@@ -141,6 +193,117 @@ pub async fn start_server(
                 },
             ),
         )
+        .route(
+            "/sessions",
+            get(
+                |Query(query): Query<QueryPage>, State(state): State<Arc<AppState>>| async move {
+                    let snapshot = state.statistics.get_snapshot();
+                    let limit = query.limit.unwrap_or(PAGE_LIMIT).min(TOP_SESSIONS);
+                    let page = snapshot.get_page(query.cursor, limit);
+                    let next = if page.len() < limit {
+                        None
+                    } else {
+                        page.last().map(|it| it.addr)
+                    };
+
+                    Json(json!({
+                        "time": snapshot.time,
+                        "total": snapshot.len(),
+                        "sessions": page.iter().map(session_json).collect::<Vec<_>>(),
+                        "next": next,
+                    }))
+                },
+            ),
+        )
+        .route(
+            "/sessions/top",
+            get(
+                |Query(query): Query<QueryPage>, State(state): State<Arc<AppState>>| async move {
+                    let snapshot = state.statistics.get_snapshot();
+                    let limit = query.limit.unwrap_or(PAGE_LIMIT);
+                    Json(json!({
+                        "time": snapshot.time,
+                        "sessions": snapshot.get_top(limit).map(session_json).collect::<Vec<_>>(),
+                    }))
+                },
+            ),
+        )
+        .route(
+            "/credentials/statistics",
+            get(|State(state): State<Arc<AppState>>| async move {
+                let counts = state.credentials.get_counts();
+                Json(json!({
+                    "hits": counts.hits,
+                    "stale_hits": counts.stale_hits,
+                    "negative_hits": counts.negative_hits,
+                    "coalesced": counts.coalesced,
+                    "misses": counts.misses,
+                }))
+            }),
+        )
+        .route(
+            "/interfaces/statistics",
+            get(|State(state): State<Arc<AppState>>| async move {
+                let mut res = Vec::with_capacity(state.config.turn.interfaces.len());
+                for interface in &state.config.turn.interfaces {
+                    if interface.transport != Transport::UDP {
+                        continue;
+                    }
+
+                    if let Some(counts) = state.statistics.get_interface(&interface.bind) {
+                        res.push(json!({
+                            "bind": interface.bind,
+                            "recv_syscalls": counts.recv_syscalls,
+                            "recv_pkts": counts.recv_pkts,
+                            "recv_bytes": counts.recv_bytes,
+                            "recv_pkts_per_syscall": counts.recv_pkts_per_syscall(),
+                            "send_syscalls": counts.send_syscalls,
+                            "send_pkts": counts.send_pkts,
+                            "send_bytes": counts.send_bytes,
+                            "send_pkts_per_syscall": counts.send_pkts_per_syscall(),
+                        }));
+                    }
+                }
+
+                Json(Value::Array(res))
+            }),
+        )
+        .route(
+            "/traces",
+            get(|State(state): State<Arc<AppState>>| async move {
+                let traces = state.forwarder.get_tracer().get_slowest();
+                let mut res = Vec::with_capacity(traces.len());
+                for trace in traces {
+                    let mut stages = serde_json::Map::with_capacity(Stage::ALL.len());
+                    for stage in Stage::ALL {
+                        stages.insert(
+                            stage.name().to_string(),
+                            json!(trace.get(stage).as_micros() as u64),
+                        );
+                    }
+
+                    res.push(json!({
+                        "address": trace.addr,
+                        "method": trace.method.name(),
+                        "size": trace.size,
+                        "time": trace.time,
+                        "total": trace.total.as_micros() as u64,
+                        "stages": stages,
+                    }));
+                }
+
+                Json(Value::Array(res))
+            }),
+        )
+        .route(
+            "/metrics",
+            get(|State(state): State<Arc<AppState>>| async move {
+                (
+                    [(CONTENT_TYPE, "text/plain; version=0.0.4")],
+                    encode_metrics(&state),
+                )
+            }),
+        )
         .route(
             "/session",
             delete(
@@ -186,14 +349,186 @@ pub async fn start_server(
     Ok(())
 }
 
+/// encode the metrics in the prometheus text format.
+///
+/// the counters are cumulative, the rates (packets and bytes per second)
+/// are left to the queries.
+fn encode_metrics(state: &AppState) -> String {
+    let router = state.service.get_router();
+    let mut encoder = Encoder::default();
+
+    encoder.family("turn_allocations", "gauge", "Allocated relay ports.");
+    encoder.sample("turn_allocations", &[], router.len());
+    encoder.family(
+        "turn_allocation_capacity",
+        "gauge",
+        "Relay ports that can be allocated.",
+    );
+    encoder.sample("turn_allocation_capacity", &[], router.capacity());
+    encoder.family("turn_channels", "gauge", "Channel bindings.");
+    encoder.sample("turn_channels", &[], router.channels_len());
+    encoder.family("turn_permissions", "gauge", "Permissions installed on allocations.");
+    encoder.sample("turn_permissions", &[], router.permissions_len());
+
+    let name = "turn_processor_seconds";
+    encoder.family(name, "histogram", "Processor latency per STUN method.");
+    for method in Method::ALL {
+        let counts = state.metrics.get_processor(method);
+        encoder.histogram(name, &[("method", method.name())], &counts);
+    }
+
+    let name = "turn_auth_fetch_seconds";
+    encoder.family(name, "histogram", "Latency of the password fetches from the hooks server.");
+    encoder.histogram(name, &[], &state.metrics.get_auth_fetch());
+
+    let name = "turn_auth_dropped_total";
+    encoder.family(name, "counter", "Requests dropped because the auth queue is full.");
+    encoder.sample(name, &[], state.metrics.get_auth_dropped());
+
+    if state.forwarder.get_tracer().is_enabled() {
+        let name = "turn_trace_stage_seconds";
+        encoder.family(
+            name,
+            "histogram",
+            "Time the sampled packets spent in a stage.",
+        );
+        for stage in Stage::ALL {
+            let counts = state.metrics.get_stage(stage);
+            encoder.histogram(name, &[("stage", stage.name())], &counts);
+        }
+
+        let name = "turn_trace_total_seconds";
+        encoder.family(
+            name,
+            "histogram",
+            "Time from receiving to sending the sampled packets.",
+        );
+        encoder.histogram(name, &[], &state.metrics.get_trace_total());
+    }
+
+    let (dropped, failed) = state.metrics.get_events();
+    let name = "turn_hooks_events_dropped_total";
+    encoder.family(
+        name,
+        "counter",
+        "Webhook events dropped because the queue is full.",
+    );
+    encoder.sample(name, &[], dropped);
+    let name = "turn_hooks_events_failed_total";
+    encoder.family(name, "counter", "Webhook events that could not be posted.");
+    encoder.sample(name, &[], failed);
+
+    let queue = state.forwarder.get_queue_counts();
+    let name = "turn_forward_queue_packets";
+    encoder.family(name, "gauge", "Packets waiting in the forwarding queues.");
+    encoder.sample(name, &[], queue.packets);
+    let name = "turn_forward_queue_bytes";
+    encoder.family(name, "gauge", "Bytes waiting in the forwarding queues.");
+    encoder.sample(name, &[], queue.bytes);
+    let name = "turn_forward_dropped_packets_total";
+    encoder.family(name, "counter", "Packets dropped by the forwarding queues.");
+    encoder.sample(name, &[], queue.dropped_pkts);
+    let name = "turn_forward_dropped_bytes_total";
+    encoder.family(name, "counter", "Bytes dropped by the forwarding queues.");
+    encoder.sample(name, &[], queue.dropped_bytes);
+
+    if let Some(relays) = state.forwarder.get_relays() {
+        let relay = relays.get_counts();
+        let name = "turn_relay_sockets";
+        encoder.family(name, "gauge", "Open relay sockets.");
+        encoder.sample(name, &[], relay.sockets);
+
+        let name = "turn_relay_received_packets_total";
+        encoder.family(name, "counter", "Packets received from the peers.");
+        encoder.sample(name, &[], relay.recv_pkts);
+        let name = "turn_relay_received_bytes_total";
+        encoder.family(name, "counter", "Bytes received from the peers.");
+        encoder.sample(name, &[], relay.recv_bytes);
+        let name = "turn_relay_sent_packets_total";
+        encoder.family(name, "counter", "Packets sent to the peers.");
+        encoder.sample(name, &[], relay.send_pkts);
+        let name = "turn_relay_sent_bytes_total";
+        encoder.family(name, "counter", "Bytes sent to the peers.");
+        encoder.sample(name, &[], relay.send_bytes);
+        let name = "turn_relay_dropped_packets_total";
+        encoder.family(name, "counter", "Packets dropped by the relay sockets.");
+        encoder.sample(name, &[], relay.dropped_pkts);
+    }
+
+    if let Some(cluster) = state.forwarder.get_cluster().filter(|it| it.is_enabled()) {
+        let counts = cluster.get_counts();
+        let name = "turn_cluster_nodes";
+        encoder.family(name, "gauge", "Live nodes of the cluster besides this one.");
+        encoder.sample(name, &[], counts.nodes);
+
+        let name = "turn_cluster_received_packets_total";
+        encoder.family(name, "counter", "Packets received from the other nodes.");
+        encoder.sample(name, &[], counts.recv_pkts);
+        let name = "turn_cluster_received_bytes_total";
+        encoder.family(name, "counter", "Bytes received from the other nodes.");
+        encoder.sample(name, &[], counts.recv_bytes);
+        let name = "turn_cluster_sent_packets_total";
+        encoder.family(name, "counter", "Packets sent to the other nodes.");
+        encoder.sample(name, &[], counts.send_pkts);
+        let name = "turn_cluster_sent_bytes_total";
+        encoder.family(name, "counter", "Bytes sent to the other nodes.");
+        encoder.sample(name, &[], counts.send_bytes);
+        let name = "turn_cluster_sent_datagrams_total";
+        encoder.family(name, "counter", "Datagrams sent to the other nodes.");
+        encoder.sample(name, &[], counts.send_datagrams);
+        let name = "turn_cluster_dropped_packets_total";
+        encoder.family(name, "counter", "Packets dropped towards the other nodes.");
+        encoder.sample(name, &[], counts.dropped_pkts);
+    }
+
+    let mut interfaces = Vec::with_capacity(state.config.turn.interfaces.len());
+    for interface in &state.config.turn.interfaces {
+        if interface.transport == Transport::UDP {
+            if let Some(counts) = state.statistics.get_interface(&interface.bind) {
+                interfaces.push((interface.bind.to_string(), counts));
+            }
+        }
+    }
+
+    let families: [(&str, &str, fn(&InterfaceCounts) -> usize); 6] = [
+        ("turn_interface_received_packets_total", "Packets received.", |it| it.recv_pkts),
+        ("turn_interface_received_bytes_total", "Bytes received.", |it| it.recv_bytes),
+        ("turn_interface_recv_syscalls_total", "Receive system calls.", |it| it.recv_syscalls),
+        ("turn_interface_sent_packets_total", "Packets sent.", |it| it.send_pkts),
+        ("turn_interface_sent_bytes_total", "Bytes sent.", |it| it.send_bytes),
+        ("turn_interface_send_syscalls_total", "Send system calls.", |it| it.send_syscalls),
+    ];
+
+    for (name, help, value) in families {
+        encoder.family(name, "counter", help);
+        for (bind, counts) in &interfaces {
+            encoder.sample(name, &[("interface", bind.as_str())], value(counts));
+        }
+    }
+
+    encoder.finish()
+}
+
+/// The headers of a `/password` response that carry the limits of the user.
+const LIMIT_HEADERS: [&str; 4] = ["Limit-Pps", "Limit-Bps", "Limit-User-Pps", "Limit-User-Bps"];
+
 pub struct HooksService {
     client: Arc<Client>,
-    tx: UnboundedSender<Value>,
+    events: Option<Events>,
+    /// the limits that the hooks server gave the users with their
+    /// passwords.
+    limits: Arc<ShardedMap<String, Limits>>,
     cfg: Arc<Config>,
+    credentials: Credentials,
+    metrics: Metrics,
 }
 
 impl HooksService {
-    pub fn new(cfg: Arc<Config>) -> anyhow::Result<Self> {
+    pub fn new(
+        cfg: Arc<Config>,
+        credentials: Credentials,
+        metrics: Metrics,
+    ) -> anyhow::Result<Self> {
         let mut headers = HeaderMap::new();
         headers.insert("Realm", HeaderValue::from_str(&cfg.turn.realm)?);
         headers.insert("Rid", HeaderValue::from_str(&RID)?);
@@ -205,22 +540,23 @@ impl HooksService {
                 .build()?,
         );
 
-        let cfg_ = cfg.clone();
-        let client_ = client.clone();
-        let (tx, mut rx) = unbounded_channel::<Value>();
-        tokio::spawn(async move {
-            if let Some(server) = &cfg_.api.hooks {
-                let uri = format!("{}/events", server);
-
-                while let Some(signal) = rx.recv().await {
-                    if let Err(e) = client_.post(&uri).json(&signal).send().await {
-                        log::error!("failed to request hooks server, err={}", e);
-                    }
-                }
-            }
+        let events = cfg.api.hooks.as_ref().map(|server| {
+            Events::new(
+                &cfg.api.events,
+                client.clone(),
+                format!("{}/events", server),
+                metrics.clone(),
+            )
         });
 
-        Ok(Self { client, cfg, tx })
+        Ok(Self {
+            limits: Arc::new(ShardedMap::with_capacity(1024)),
+            client,
+            cfg,
+            events,
+            credentials,
+            metrics,
+        })
     }
 
     pub async fn get_password(&self, addr: &SocketAddr, name: &str) -> Option<String> {
@@ -228,27 +564,164 @@ impl HooksService {
             return Some(pwd.clone());
         }
 
-        if let Some(server) = &self.cfg.api.hooks {
-            if let Ok(res) = self
-                .client
-                .get(format!("{}/password?addr={}&name={}", server, addr, name))
-                .send()
-                .await
-            {
-                if let Ok(password) = res.text().await {
-                    return Some(password);
+        let server = self.cfg.api.hooks.as_ref()?;
+        let client = self.client.clone();
+        let metrics = self.metrics.clone();
+        let limits = self.limits.clone();
+        let username = name.to_string();
+        let uri = format!("{}/password?addr={}&name={}", server, addr, name);
+
+        // The password is cached by username, concurrent lookups of the same
+        // user share one request to the hooks server.
+        self.credentials
+            .get(name, async move {
+                let start = Instant::now();
+                let ret: Fetch = async {
+                    let res = client.get(uri).send().await.map_err(|e| {
+                        log::error!("failed to request hooks server, err={}", e);
+                    })?;
+
+                    if let Some(ret) = get_password_status(res.status()) {
+                        if ret.is_ok() {
+                            limits.remove(&username);
+                        } else {
+                            log::error!(
+                                "hooks server failed to get password, status={}",
+                                res.status()
+                            );
+                        }
+
+                        return ret;
+                    }
+
+                    match get_limits(res.headers()) {
+                        Some(it) => limits.insert(username, it),
+                        None => limits.remove(&username),
+                    };
+
+                    res.text().await.map(Some).map_err(|e| {
+                        log::error!("failed to read hooks server response, err={}", e);
+                    })
                 }
-            }
+                .await;
+
+                metrics.record_auth_fetch(start.elapsed());
+                ret
+            })
+            .await
+    }
+
+    /// get the limits that the hooks server gave the user with its
+    /// password, none when it gave none.
+    pub fn get_limits(&self, name: &str) -> Option<Limits> {
+        self.limits.get(&name.to_string())
+    }
+
+    pub fn send_event(&self, event: Event) {
+        if let Some(events) = &self.events {
+            events.send(event);
         }
+    }
+}
+
+/// get the result of a `/password` response from its status, none when the
+/// response carries the password.
+///
+/// the hooks server answers an unknown user with a client error, which is
+/// cached as a negative entry. the other errors, including 408 and 429, are
+/// transient, they are not cached and a stale password is kept.
+///
+/// # Example
+///
+/// ```
+/// use std::time::Duration;
+/// use reqwest::StatusCode;
+/// use turn_server::{api::get_password_status, credentials::*};
+///
+/// #[tokio::main]
+/// async fn main() {
+///     assert_eq!(get_password_status(StatusCode::OK), None);
+///     assert_eq!(get_password_status(StatusCode::NOT_FOUND), Some(Ok(None)));
+///     assert_eq!(get_password_status(StatusCode::TOO_MANY_REQUESTS), Some(Err(())));
+///     assert_eq!(get_password_status(StatusCode::SERVICE_UNAVAILABLE), Some(Err(())));
+///
+///     // every entry is stale at once, and served while it is refreshed.
+///     let credentials = Credentials::new(
+///         Duration::ZERO,
+///         Duration::from_secs(30),
+///         Duration::from_secs(300),
+///     );
+///
+///     let fetch = async { Ok(Some("test".to_string())) };
+///     assert_eq!(credentials.get("test", fetch).await.as_deref(), Some("test"));
+///
+///     // a hooks server that fails does not replace the cached password.
+///     let fetch = async { get_password_status(StatusCode::BAD_GATEWAY).unwrap() };
+///     assert_eq!(credentials.get("test", fetch).await.as_deref(), Some("test"));
+///
+///     tokio::time::sleep(Duration::from_millis(100)).await;
+///     let fetch = async { Ok(None) };
+///     assert_eq!(credentials.get("test", fetch).await.as_deref(), Some("test"));
+///     assert_eq!(credentials.get_counts().stale_hits, 2);
+/// }
+/// ```
+pub fn get_password_status(status: reqwest::StatusCode) -> Option<Fetch> {
+    use reqwest::StatusCode;
 
+    if status.is_success() {
         None
+    } else if status.is_client_error()
+        && status != StatusCode::REQUEST_TIMEOUT
+        && status != StatusCode::TOO_MANY_REQUESTS
+    {
+        Some(Ok(None))
+    } else {
+        Some(Err(()))
     }
+}
 
-    pub fn send_event(&self, event: Value) {
-        if self.cfg.api.hooks.is_some() {
-            if let Err(e) = self.tx.send(event) {
-                log::error!("failed to send event, err={}", e)
-            }
-        }
+/// get the limits of a `/password` response, none when the response has
+/// none of the limit headers. a header that is missing or not a number is
+/// unlimited.
+///
+/// # Example
+///
+/// ```
+/// use reqwest::header::{HeaderMap, HeaderValue};
+/// use turn::router::limits::*;
+/// use turn_server::api::get_limits;
+///
+/// let mut headers = HeaderMap::new();
+/// assert_eq!(get_limits(&headers), None);
+///
+/// headers.insert("Limit-Pps", HeaderValue::from_static("100"));
+/// headers.insert("Limit-User-Bps", HeaderValue::from_static("2000000"));
+/// assert_eq!(
+///     get_limits(&headers),
+///     Some(Limits {
+///         allocation: Limit { pps: 100, bps: 0 },
+///         user: Limit { pps: 0, bps: 2000000 },
+///     })
+/// );
+/// ```
+pub fn get_limits(headers: &HeaderMap) -> Option<Limits> {
+    if !LIMIT_HEADERS.iter().any(|name| headers.contains_key(*name)) {
+        return None;
     }
+
+    let [pps, bps, user_pps, user_bps] = LIMIT_HEADERS.map(|name| {
+        headers
+            .get(name)
+            .and_then(|value| value.to_str().ok())
+            .and_then(|value| value.trim().parse::<u64>().ok())
+            .unwrap_or(0)
+    });
+
+    Some(Limits {
+        allocation: Limit { pps, bps },
+        user: Limit {
+            pps: user_pps,
+            bps: user_bps,
+        },
+    })
 }
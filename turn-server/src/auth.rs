@@ -0,0 +1,96 @@
+use crate::{
+    config::Auth,
+    metrics::{Method, Metrics},
+    router::Router,
+};
+
+use std::{net::SocketAddr, sync::Arc, time::Instant};
+
+use bytes::Bytes;
+use tokio::sync::{mpsc, Semaphore};
+use turn::Service;
+
+struct Request {
+    data: Bytes,
+    addr: SocketAddr,
+    interface: SocketAddr,
+    external: SocketAddr,
+}
+
+/// authentication stage.
+///
+/// the first authenticated request of a node waits for its key to be
+/// fetched from the hooks server. the interface workers hand these requests
+/// over to this stage and go on receiving, the stage processes them on its
+/// own tasks, a limited number at a time, and sends the responses through
+/// the router to the interface that the request was received on.
+#[derive(Clone)]
+pub struct Authenticator {
+    sender: mpsc::Sender<Request>,
+    metrics: Metrics,
+}
+
+impl Authenticator {
+    /// create the authentication stage and spawn its tasks, requires a
+    /// tokio runtime.
+    pub fn new(options: &Auth, service: Service, router: Arc<Router>, metrics: Metrics) -> Self {
+        let (sender, mut receiver) = mpsc::channel::<Request>(options.queue.max(1));
+        let semaphore = Arc::new(Semaphore::new(options.concurrency.max(1)));
+
+        let metrics_ = metrics.clone();
+        tokio::spawn(async move {
+            while let Some(request) = receiver.recv().await {
+                let permit = match semaphore.clone().acquire_owned().await {
+                    Ok(permit) => permit,
+                    Err(_) => break,
+                };
+
+                let mut processor = service.get_processor(request.interface, request.external);
+                let router = router.clone();
+                let metrics = metrics_.clone();
+                tokio::spawn(async move {
+                    let start = Instant::now();
+                    let ret = processor.process(&request.data, request.addr).await;
+                    metrics.record(Method::of(&request.data), start.elapsed());
+                    if let Ok(Some(res)) = ret {
+                        let target = res.relay.unwrap_or(request.addr);
+                        let to = res.interface.unwrap_or(request.interface);
+                        router.send(&to, res.kind, &target, res.data);
+                    }
+
+                    drop(permit);
+                });
+            }
+        });
+
+        Self { sender, metrics }
+    }
+
+    /// hand the request over to the stage.
+    ///
+    /// `interface` is the router endpoint that the response is sent to, the
+    /// same address that the processor of the worker was created with.
+    /// returns false when the queue is full and the request is dropped.
+    pub fn submit(
+        &self,
+        data: &[u8],
+        addr: SocketAddr,
+        interface: SocketAddr,
+        external: SocketAddr,
+    ) -> bool {
+        let request = Request {
+            data: Bytes::copy_from_slice(data),
+            interface,
+            external,
+            addr,
+        };
+
+        if self.sender.try_send(request).is_err() {
+            log::warn!("auth queue is full, request dropped: addr={:?}", addr);
+            self.metrics.auth_dropped();
+            return false;
+        }
+
+        true
+    }
+}
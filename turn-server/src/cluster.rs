@@ -0,0 +1,836 @@
+use crate::{
+    config::{self, Interface, Transport},
+    router::Router,
+};
+
+use std::{
+    io::{self, ErrorKind},
+    net::{IpAddr, Ipv4Addr, Ipv6Addr, SocketAddr, UdpSocket},
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        mpsc::{self, Receiver, SyncSender},
+        Arc, Mutex, RwLock,
+    },
+    thread,
+    time::{Duration, Instant},
+};
+
+use ahash::AHashMap;
+use bytes::{BufMut, Bytes, BytesMut};
+
+/// The first two bytes of an inter-node datagram.
+const MAGIC: u16 = 0x5443;
+
+/// The version of the inter-node protocol.
+const VERSION: u8 = 1;
+
+/// The size of the datagram header, the magic, the version and a reserved
+/// byte.
+const HEADER_SIZE: usize = 4;
+
+/// The size of the record header, the kind and the length of the body.
+const RECORD_HEADER_SIZE: usize = 3;
+
+const KIND_HELLO: u8 = 1;
+const KIND_DATA: u8 = 2;
+
+/// The interval of the hello records that the nodes announce themselves
+/// with.
+const HELLO_INTERVAL: Duration = Duration::from_secs(1);
+
+/// A node that has not sent a hello for this long is left out of the
+/// cluster.
+const NODE_TIMEOUT: Duration = Duration::from_secs(5);
+
+/// The number of points of a node on the hash ring.
+const VNODES: usize = 64;
+
+/// The maximum number of records that the writer takes from the queue
+/// before the datagrams are sent.
+const WRITE_BATCH: usize = 256;
+
+/// The largest udp payload.
+const RECV_BUF_SIZE: usize = 65536;
+
+/// the address of an interface or an allocation in a record.
+fn addr_size(addr: &SocketAddr) -> usize {
+    if addr.is_ipv4() {
+        7
+    } else {
+        19
+    }
+}
+
+fn put_addr(buf: &mut BytesMut, addr: &SocketAddr) {
+    match addr.ip() {
+        IpAddr::V4(ip) => {
+            buf.put_u8(4);
+            buf.put_slice(&ip.octets());
+        }
+        IpAddr::V6(ip) => {
+            buf.put_u8(6);
+            buf.put_slice(&ip.octets());
+        }
+    }
+
+    buf.put_u16(addr.port());
+}
+
+fn read_addr(buf: &mut &[u8]) -> Option<SocketAddr> {
+    let data: &[u8] = buf;
+    let (family, rest) = data.split_first()?;
+    let size = match family {
+        4 => 4,
+        6 => 16,
+        _ => return None,
+    };
+
+    if rest.len() < size + 2 {
+        return None;
+    }
+
+    let ip = if size == 4 {
+        IpAddr::V4(Ipv4Addr::from(<[u8; 4]>::try_from(&rest[..4]).ok()?))
+    } else {
+        IpAddr::V6(Ipv6Addr::from(<[u8; 16]>::try_from(&rest[..16]).ok()?))
+    };
+
+    let port = u16::from_be_bytes([rest[size], rest[size + 1]]);
+    *buf = &rest[size + 2..];
+    Some(SocketAddr::new(ip, port))
+}
+
+fn transport_from(value: u8) -> Option<Transport> {
+    match value {
+        0 => Some(Transport::TCP),
+        1 => Some(Transport::UDP),
+        2 => Some(Transport::TLS),
+        _ => None,
+    }
+}
+
+/// a record of the inter-node protocol.
+///
+/// a datagram is a header followed by as many records as fit, the records
+/// towards the same node are packed together:
+///
+/// ```text
+/// datagram: magic (u16) | version (u8) | reserved (u8) | record ...
+/// record:   kind (u8) | length (u16) | body
+/// address:  family (u8, 4 or 6) | ip (4 or 16 bytes) | port (u16)
+/// ```
+///
+/// a record of an unknown kind is skipped.
+#[derive(Debug, PartialEq, Eq)]
+pub enum Record<'a> {
+    /// the external addresses of the interfaces of the sending node, the
+    /// relayed transport addresses of its allocations are on these ips.
+    ///
+    /// body: count (u8) | (transport (u8) | address) ...
+    Hello(Vec<(Transport, SocketAddr)>),
+    /// the data that the allocation of `source` relays to the allocation
+    /// of `target`, both are relayed transport addresses.
+    ///
+    /// body: source | target | data
+    Data {
+        source: SocketAddr,
+        target: SocketAddr,
+        data: &'a [u8],
+    },
+}
+
+impl Record<'_> {
+    /// write the header of a datagram.
+    pub fn encode_header(buf: &mut BytesMut) {
+        buf.put_u16(MAGIC);
+        buf.put_u8(VERSION);
+        buf.put_u8(0);
+    }
+
+    /// the size of the encoded record.
+    pub fn size(&self) -> usize {
+        RECORD_HEADER_SIZE
+            + match self {
+                Self::Hello(externals) => {
+                    1 + externals
+                        .iter()
+                        .map(|(_, addr)| 1 + addr_size(addr))
+                        .sum::<usize>()
+                }
+                Self::Data {
+                    source,
+                    target,
+                    data,
+                } => addr_size(source) + addr_size(target) + data.len(),
+            }
+    }
+
+    /// append the record to a datagram.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use bytes::BytesMut;
+    /// use turn_server::{cluster::*, config::Transport};
+    ///
+    /// let source = "1.1.1.1:49152".parse().unwrap();
+    /// let target = "2.2.2.2:49153".parse().unwrap();
+    /// let hello = Record::Hello(vec![(Transport::UDP, "2.2.2.2:3478".parse().unwrap())]);
+    /// let data = Record::Data {
+    ///     data: &[1, 2, 3],
+    ///     source,
+    ///     target,
+    /// };
+    ///
+    /// let mut buf = BytesMut::new();
+    /// Record::encode_header(&mut buf);
+    /// hello.encode(&mut buf);
+    /// data.encode(&mut buf);
+    /// assert_eq!(buf.len(), 4 + hello.size() + data.size());
+    ///
+    /// let records = Records::new(&buf).unwrap().collect::<Vec<_>>();
+    /// assert_eq!(records, vec![hello, data]);
+    /// assert!(Records::new(&buf[1..]).is_none());
+    /// ```
+    pub fn encode(&self, buf: &mut BytesMut) {
+        match self {
+            Self::Hello(externals) => {
+                buf.put_u8(KIND_HELLO);
+                buf.put_u16((self.size() - RECORD_HEADER_SIZE) as u16);
+                buf.put_u8(externals.len() as u8);
+                for (transport, addr) in externals {
+                    buf.put_u8(*transport as u8);
+                    put_addr(buf, addr);
+                }
+            }
+            Self::Data {
+                source,
+                target,
+                data,
+            } => {
+                buf.put_u8(KIND_DATA);
+                buf.put_u16((self.size() - RECORD_HEADER_SIZE) as u16);
+                put_addr(buf, source);
+                put_addr(buf, target);
+                buf.put_slice(data);
+            }
+        }
+    }
+}
+
+/// the records of a datagram.
+pub struct Records<'a>(&'a [u8]);
+
+impl<'a> Records<'a> {
+    /// none when the datagram is not of the inter-node protocol.
+    pub fn new(datagram: &'a [u8]) -> Option<Self> {
+        if datagram.len() < HEADER_SIZE
+            || u16::from_be_bytes([datagram[0], datagram[1]]) != MAGIC
+            || datagram[2] != VERSION
+        {
+            return None;
+        }
+
+        Some(Self(&datagram[HEADER_SIZE..]))
+    }
+
+    fn decode(kind: u8, mut body: &'a [u8]) -> Option<Record<'a>> {
+        match kind {
+            KIND_HELLO => {
+                let (count, rest) = body.split_first()?;
+                body = rest;
+
+                let mut externals = Vec::with_capacity(*count as usize);
+                for _ in 0..*count {
+                    let (transport, rest) = body.split_first()?;
+                    body = rest;
+
+                    let addr = read_addr(&mut body)?;
+                    externals.push((transport_from(*transport)?, addr));
+                }
+
+                Some(Record::Hello(externals))
+            }
+            KIND_DATA => Some(Record::Data {
+                source: read_addr(&mut body)?,
+                target: read_addr(&mut body)?,
+                data: body,
+            }),
+            _ => None,
+        }
+    }
+}
+
+impl<'a> Iterator for Records<'a> {
+    type Item = Record<'a>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        while self.0.len() >= RECORD_HEADER_SIZE {
+            let kind = self.0[0];
+            let size = u16::from_be_bytes([self.0[1], self.0[2]]) as usize;
+            if self.0.len() < RECORD_HEADER_SIZE + size {
+                break;
+            }
+
+            let data: &'a [u8] = self.0;
+            let (body, rest) = data[RECORD_HEADER_SIZE..].split_at(size);
+            self.0 = rest;
+
+            if let Some(record) = Self::decode(kind, body) {
+                return Some(record);
+            }
+        }
+
+        self.0 = &[];
+        None
+    }
+}
+
+/// FNV-1a, the same hash on every node regardless of the process.
+fn hash(data: &[u8]) -> u64 {
+    data.iter().fold(0xcbf29ce484222325, |hash, byte| {
+        (hash ^ *byte as u64).wrapping_mul(0x100000001b3)
+    })
+}
+
+/// consistent hash ring of the nodes.
+///
+/// every node has a number of points on the ring, a key belongs to the
+/// node of the first point after the hash of the key. when a node joins or
+/// leaves, only the keys between its points and the points before them
+/// move to another node.
+#[derive(Default)]
+pub struct Ring(Vec<(u64, SocketAddr)>);
+
+impl Ring {
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn_server::cluster::*;
+    ///
+    /// let a = "10.0.0.1:3479".parse::<SocketAddr>().unwrap();
+    /// let b = "10.0.0.2:3479".parse::<SocketAddr>().unwrap();
+    /// let c = "10.0.0.3:3479".parse::<SocketAddr>().unwrap();
+    ///
+    /// assert_eq!(Ring::new(&[]).get("user"), None);
+    /// assert_eq!(Ring::new(&[a]).get("user"), Some(a));
+    ///
+    /// // the order of the nodes does not matter.
+    /// let ring = Ring::new(&[a, b, c]);
+    /// assert_eq!(ring.get("user"), Ring::new(&[c, a, b]).get("user"));
+    ///
+    /// // the keys of a node that leaves move, the others stay.
+    /// let owner = ring.get("user").unwrap();
+    /// let rest = [a, b, c]
+    ///     .into_iter()
+    ///     .filter(|node| *node != owner)
+    ///     .collect::<Vec<_>>();
+    ///
+    /// let smaller = Ring::new(&rest);
+    /// assert_ne!(smaller.get("user"), Some(owner));
+    /// for key in ["a", "b", "c", "d", "e", "f"] {
+    ///     if ring.get(key) != Some(owner) {
+    ///         assert_eq!(smaller.get(key), ring.get(key));
+    ///     }
+    /// }
+    /// ```
+    pub fn new(nodes: &[SocketAddr]) -> Self {
+        let mut points = Vec::with_capacity(nodes.len() * VNODES);
+        for node in nodes {
+            for index in 0..VNODES {
+                points.push((hash(format!("{}#{}", node, index).as_bytes()), *node));
+            }
+        }
+
+        points.sort_unstable();
+        Self(points)
+    }
+
+    /// get the node that the key belongs to.
+    pub fn get(&self, key: &str) -> Option<SocketAddr> {
+        let hash = hash(key.as_bytes());
+        let index = self.0.partition_point(|(point, _)| *point < hash);
+        self.0
+            .get(index)
+            .or_else(|| self.0.first())
+            .map(|(_, node)| *node)
+    }
+}
+
+struct Node {
+    externals: Vec<(Transport, SocketAddr)>,
+    seen: Instant,
+}
+
+/// the live nodes of the cluster and the directory of their relay ips.
+#[derive(Default)]
+struct State {
+    nodes: AHashMap<SocketAddr, Node>,
+    directory: AHashMap<IpAddr, SocketAddr>,
+    ring: Ring,
+}
+
+/// a record waiting for the writer.
+struct Outgoing {
+    node: SocketAddr,
+    source: SocketAddr,
+    target: SocketAddr,
+    data: Bytes,
+}
+
+/// the records towards a node that are packed into one datagram.
+struct Batch {
+    buf: BytesMut,
+    records: usize,
+    bytes: usize,
+}
+
+/// The traffic of the inter-node protocol.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct ClusterCounts {
+    pub nodes: usize,
+    pub send_pkts: usize,
+    pub send_bytes: usize,
+    pub send_datagrams: usize,
+    pub recv_pkts: usize,
+    pub recv_bytes: usize,
+    pub dropped_pkts: usize,
+}
+
+#[derive(Default)]
+struct Counts {
+    send_pkts: AtomicUsize,
+    send_bytes: AtomicUsize,
+    send_datagrams: AtomicUsize,
+    recv_pkts: AtomicUsize,
+    recv_bytes: AtomicUsize,
+    dropped_pkts: AtomicUsize,
+}
+
+struct Inner {
+    addr: SocketAddr,
+    members: Vec<SocketAddr>,
+    externals: Vec<(Transport, SocketAddr)>,
+    mtu: usize,
+    socket: Option<UdpSocket>,
+    sender: SyncSender<Outgoing>,
+    receiver: Mutex<Option<Receiver<Outgoing>>>,
+    state: RwLock<State>,
+    counts: Counts,
+}
+
+impl Inner {
+    /// handle the hello of a node, the directory and the ring are rebuilt
+    /// when the node joins or its addresses change.
+    fn hello(&self, from: SocketAddr, externals: Vec<(Transport, SocketAddr)>) {
+        let mut state = self.state.write().unwrap();
+        let changed = state
+            .nodes
+            .get(&from)
+            .map(|node| node.externals != externals)
+            .unwrap_or(true);
+
+        if changed {
+            log::info!(
+                "cluster node joined: node={}, externals={:?}",
+                from,
+                externals
+            );
+        }
+
+        state.nodes.insert(
+            from,
+            Node {
+                seen: Instant::now(),
+                externals,
+            },
+        );
+
+        if changed {
+            self.rebuild(&mut state);
+        }
+    }
+
+    /// leave out the nodes that have not sent a hello for a while.
+    fn expire(&self) {
+        let mut state = self.state.write().unwrap();
+        let size = state.nodes.len();
+        state.nodes.retain(|node, item| {
+            let alive = item.seen.elapsed() < NODE_TIMEOUT;
+            if !alive {
+                log::warn!("cluster node left: node={}", node);
+            }
+
+            alive
+        });
+
+        if state.nodes.len() != size {
+            self.rebuild(&mut state);
+        }
+    }
+
+    fn rebuild(&self, state: &mut State) {
+        let mut directory = AHashMap::with_capacity(state.nodes.len() * 2);
+        for (node, item) in state.nodes.iter() {
+            for (_, external) in item.externals.iter() {
+                // The relay ips of this server are never routed to another
+                // node, the nodes have to use ips of their own.
+                if self
+                    .externals
+                    .iter()
+                    .all(|(_, addr)| addr.ip() != external.ip())
+                {
+                    directory.insert(external.ip(), *node);
+                }
+            }
+        }
+
+        let mut nodes = state.nodes.keys().copied().collect::<Vec<_>>();
+        nodes.push(self.addr);
+
+        state.ring = Ring::new(&nodes);
+        state.directory = directory;
+    }
+}
+
+/// cluster of turn servers.
+///
+/// the servers of a cluster announce the external ips of their interfaces
+/// to each other, which are also the ips of the relayed transport
+/// addresses of their allocations. an allocation relays to an allocation
+/// of another node like to an external peer, the permission and the
+/// channel are installed towards the relayed address of the peer, but the
+/// data is tunneled to the node that owns the address instead of being
+/// sent from a relay socket. the receiving node delivers it to its client
+/// as ChannelData or a Data indication, the same as the data of an
+/// external peer.
+///
+/// the records towards a node are queued to a single writer, which packs
+/// all the records that are waiting into as few datagrams as possible, so
+/// the number of datagrams between the nodes goes down as the load goes up
+/// without delaying a lone packet.
+///
+/// the new allocations are placed on the nodes by the consistent hash of
+/// the username, a client that asks the wrong node is sent to the right one
+/// with a 300 (Try Alternate) error.
+#[derive(Clone)]
+pub struct Cluster(Arc<Inner>);
+
+impl Cluster {
+    /// bind the inter-node socket, nothing is bound when the cluster is
+    /// disabled.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::{cluster::*, config};
+    ///
+    /// let cluster = Cluster::new(&config::Cluster::default(), &[]).unwrap();
+    /// assert!(!cluster.is_enabled());
+    /// assert!(!cluster.is_member(&"1.1.1.1".parse().unwrap()));
+    /// ```
+    pub fn new(options: &config::Cluster, interfaces: &[Interface]) -> io::Result<Self> {
+        let socket = if options.enabled {
+            if !options.nodes.contains(&options.addr) {
+                return Err(io::Error::new(
+                    ErrorKind::InvalidInput,
+                    "the cluster addr is not one of the cluster nodes",
+                ));
+            }
+
+            Some(UdpSocket::bind(options.addr)?)
+        } else {
+            None
+        };
+
+        let (sender, receiver) = mpsc::sync_channel(options.queue.max(1));
+        Ok(Self(Arc::new(Inner {
+            addr: options.addr,
+            members: options
+                .nodes
+                .iter()
+                .filter(|node| **node != options.addr)
+                .copied()
+                .collect(),
+            externals: interfaces
+                .iter()
+                .map(|item| (item.transport, item.external))
+                .collect(),
+            mtu: options.mtu.max(HEADER_SIZE + RECORD_HEADER_SIZE),
+            receiver: Mutex::new(Some(receiver)),
+            state: RwLock::new(State::default()),
+            counts: Counts::default(),
+            socket,
+            sender,
+        })))
+    }
+
+    /// whether the server is a node of a cluster.
+    pub fn is_enabled(&self) -> bool {
+        self.0.socket.is_some()
+    }
+
+    /// start the threads of the inter-node protocol.
+    ///
+    /// the data of the other nodes is checked against the permissions of
+    /// the turn router and forwarded through the router of the interfaces.
+    pub fn start(&self, service: Arc<turn::Router>, router: Arc<Router>) -> io::Result<()> {
+        let socket = match &self.0.socket {
+            Some(socket) => socket,
+            None => return Ok(()),
+        };
+
+        let receiver = match self.0.receiver.lock().unwrap().take() {
+            Some(receiver) => receiver,
+            None => return Ok(()),
+        };
+
+        let inner = self.0.clone();
+        let reader = socket.try_clone()?;
+        thread::Builder::new()
+            .name("turn-cluster-reader".to_string())
+            .spawn(move || read_loop(reader, inner, service, router))?;
+
+        let inner = self.0.clone();
+        let writer = socket.try_clone()?;
+        thread::Builder::new()
+            .name("turn-cluster-writer".to_string())
+            .spawn(move || write_loop(writer, inner, receiver))?;
+
+        let inner = self.0.clone();
+        let socket = socket.try_clone()?;
+        thread::Builder::new()
+            .name("turn-cluster-hello".to_string())
+            .spawn(move || hello_loop(socket, inner))?;
+
+        Ok(())
+    }
+
+    /// whether the ip is a relay ip of another node of the cluster.
+    pub fn is_member(&self, ip: &IpAddr) -> bool {
+        self.0.state.read().unwrap().directory.contains_key(ip)
+    }
+
+    /// get the address that the client is sent to when its allocation is
+    /// placed on another node.
+    ///
+    /// the address is the external address of an interface of that node
+    /// with the same transport and address family as the interface that
+    /// the client asked on. none when the allocation belongs to this node,
+    /// or the node has no such interface.
+    pub fn get_alternate(
+        &self,
+        name: &str,
+        transport: Transport,
+        external: &SocketAddr,
+    ) -> Option<SocketAddr> {
+        let state = self.0.state.read().unwrap();
+        let owner = state.ring.get(name)?;
+        if owner == self.0.addr {
+            return None;
+        }
+
+        state
+            .nodes
+            .get(&owner)?
+            .externals
+            .iter()
+            .find(|(kind, addr)| *kind == transport && addr.is_ipv4() == external.is_ipv4())
+            .map(|(_, addr)| *addr)
+    }
+
+    /// send the data of the relayed transport address to the allocation of
+    /// another node.
+    ///
+    /// the data is queued to the writer, it is dropped when the queue is
+    /// full or the peer is not a relayed address of a node.
+    pub fn send(&self, relay: &SocketAddr, peer: &SocketAddr, data: &[u8]) {
+        let node = self
+            .0
+            .state
+            .read()
+            .unwrap()
+            .directory
+            .get(&peer.ip())
+            .copied();
+        let outgoing = match node {
+            Some(node) if data.len() <= u16::MAX as usize - 64 => Outgoing {
+                data: Bytes::copy_from_slice(data),
+                source: *relay,
+                target: *peer,
+                node,
+            },
+            _ => {
+                self.0.counts.dropped_pkts.fetch_add(1, Ordering::Relaxed);
+                return;
+            }
+        };
+
+        if self.0.sender.try_send(outgoing).is_err() {
+            self.0.counts.dropped_pkts.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// get the number of live nodes and the traffic between the nodes.
+    pub fn get_counts(&self) -> ClusterCounts {
+        let counts = &self.0.counts;
+        ClusterCounts {
+            nodes: self.0.state.read().unwrap().nodes.len(),
+            send_pkts: counts.send_pkts.load(Ordering::Relaxed),
+            send_bytes: counts.send_bytes.load(Ordering::Relaxed),
+            send_datagrams: counts.send_datagrams.load(Ordering::Relaxed),
+            recv_pkts: counts.recv_pkts.load(Ordering::Relaxed),
+            recv_bytes: counts.recv_bytes.load(Ordering::Relaxed),
+            dropped_pkts: counts.dropped_pkts.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// the loop of the reader thread, the datagrams that do not come from a
+/// node of the cluster are ignored.
+fn read_loop(
+    socket: UdpSocket,
+    inner: Arc<Inner>,
+    service: Arc<turn::Router>,
+    router: Arc<Router>,
+) {
+    let mut buf = vec![0u8; RECV_BUF_SIZE];
+    let mut bytes = BytesMut::with_capacity(4096);
+
+    loop {
+        let (size, from) = match socket.recv_from(&mut buf) {
+            Ok(ret) => ret,
+            Err(e) => {
+                if e.kind() != ErrorKind::Interrupted {
+                    log::warn!("cluster socket recv failed: err={}", e);
+                }
+
+                continue;
+            }
+        };
+
+        if !inner.members.contains(&from) {
+            continue;
+        }
+
+        let records = match Records::new(&buf[..size]) {
+            Some(records) => records,
+            None => continue,
+        };
+
+        for record in records {
+            match record {
+                Record::Hello(externals) => inner.hello(from, externals),
+                Record::Data {
+                    source,
+                    target,
+                    data,
+                } => {
+                    inner.counts.recv_pkts.fetch_add(1, Ordering::Relaxed);
+                    inner
+                        .counts
+                        .recv_bytes
+                        .fetch_add(data.len(), Ordering::Relaxed);
+                    if let Ok(Some(res)) =
+                        turn::processor::peer::process(&service, &target, &source, data, &mut bytes)
+                    {
+                        if let (Some(to), Some(addr)) = (res.interface, res.relay) {
+                            router.send(&to, res.kind, &addr, res.data);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// the loop of the writer thread.
+///
+/// the writer waits for a record, then takes the records that are queued
+/// behind it and sends one datagram per node, or more when they do not fit.
+fn write_loop(socket: UdpSocket, inner: Arc<Inner>, receiver: Receiver<Outgoing>) {
+    let mut batches = AHashMap::<SocketAddr, Batch>::with_capacity(inner.members.len());
+
+    while let Ok(outgoing) = receiver.recv() {
+        push(&socket, &inner, &mut batches, outgoing);
+        for outgoing in receiver.try_iter().take(WRITE_BATCH) {
+            push(&socket, &inner, &mut batches, outgoing);
+        }
+
+        for (node, batch) in batches.iter_mut() {
+            flush(&socket, &inner, node, batch);
+        }
+    }
+}
+
+fn push(
+    socket: &UdpSocket,
+    inner: &Inner,
+    batches: &mut AHashMap<SocketAddr, Batch>,
+    outgoing: Outgoing,
+) {
+    let batch = batches.entry(outgoing.node).or_insert_with(|| Batch {
+        buf: BytesMut::with_capacity(inner.mtu),
+        records: 0,
+        bytes: 0,
+    });
+
+    let record = Record::Data {
+        source: outgoing.source,
+        target: outgoing.target,
+        data: &outgoing.data,
+    };
+
+    if batch.records > 0 && batch.buf.len() + record.size() > inner.mtu {
+        flush(socket, inner, &outgoing.node, batch);
+    }
+
+    if batch.records == 0 {
+        batch.buf.clear();
+        Record::encode_header(&mut batch.buf);
+    }
+
+    record.encode(&mut batch.buf);
+    batch.records += 1;
+    batch.bytes += outgoing.data.len();
+}
+
+fn flush(socket: &UdpSocket, inner: &Inner, node: &SocketAddr, batch: &mut Batch) {
+    if batch.records == 0 {
+        return;
+    }
+
+    let counts = &inner.counts;
+    if socket.send_to(&batch.buf, node).is_ok() {
+        counts.send_pkts.fetch_add(batch.records, Ordering::Relaxed);
+        counts.send_bytes.fetch_add(batch.bytes, Ordering::Relaxed);
+        counts.send_datagrams.fetch_add(1, Ordering::Relaxed);
+    } else {
+        counts
+            .dropped_pkts
+            .fetch_add(batch.records, Ordering::Relaxed);
+    }
+
+    batch.records = 0;
+    batch.bytes = 0;
+}
+
+/// the loop of the hello thread, the hello of this node is sent to every
+/// other node once per interval.
+fn hello_loop(socket: UdpSocket, inner: Arc<Inner>) {
+    let mut buf = BytesMut::with_capacity(1024);
+    Record::encode_header(&mut buf);
+    Record::Hello(inner.externals.clone()).encode(&mut buf);
+
+    loop {
+        for node in inner.members.iter() {
+            if let Err(e) = socket.send_to(&buf, node) {
+                log::warn!("cluster hello failed: node={}, err={}", node, e);
+            }
+        }
+
+        inner.expire();
+        thread::sleep(HELLO_INTERVAL);
+    }
+}
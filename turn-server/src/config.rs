@@ -1,7 +1,8 @@
-use std::{collections::HashMap, fs::read_to_string, net::SocketAddr};
+use std::{collections::HashMap, fs::read_to_string, net::SocketAddr, path::PathBuf};
 
 use clap::Parser;
 use serde::{Deserialize, Serialize};
+use turn::router::limits::{self, Limit};
 
 #[repr(C)]
 #[derive(Deserialize, Serialize, Debug, Clone, Copy, PartialEq, Eq)]
@@ -9,6 +10,7 @@ use serde::{Deserialize, Serialize};
 pub enum Transport {
     TCP = 0,
     UDP = 1,
+    TLS = 2,
 }
 
 #[derive(Deserialize, Serialize, Debug, Clone)]
@@ -23,6 +25,481 @@ pub struct Interface {
     /// you need to manually specify the server external IP
     /// address and service listening port.
     pub external: SocketAddr,
+    /// udp batch size
+    ///
+    /// the maximum number of datagrams read by one `recvmmsg` and written
+    /// by one `sendmmsg` system call. GSO/GRO is also enabled on the socket
+    /// when the kernel supports it. the default value of 1 keeps the plain
+    /// `recv_from`/`send_to` path. this option only applies to udp
+    /// interfaces on linux and is ignored elsewhere.
+    #[serde(default = "Interface::batch")]
+    pub batch: usize,
+    /// udp socket sharding
+    ///
+    /// bind one udp socket per core to the same address with
+    /// `SO_REUSEPORT`, the kernel spreads the flows across the sockets by
+    /// the hash of the 5-tuple. each socket is owned by its own thread,
+    /// which is pinned to a core. this option only applies to udp
+    /// interfaces on linux and is ignored elsewhere.
+    #[serde(default = "Interface::reuse_port")]
+    pub reuse_port: bool,
+    /// tls certificate chain
+    ///
+    /// the path of the pem encoded certificate chain of a tls interface,
+    /// the server certificate first.
+    #[serde(default)]
+    pub cert: Option<PathBuf>,
+    /// tls private key
+    ///
+    /// the path of the pem encoded private key of a tls interface.
+    #[serde(default)]
+    pub key: Option<PathBuf>,
+}
+
+impl Interface {
+    fn batch() -> usize {
+        1
+    }
+
+    fn reuse_port() -> bool {
+        false
+    }
+}
+
+#[derive(Deserialize, Serialize, Debug, Clone, Copy, PartialEq, Eq)]
+#[serde(rename_all = "snake_case")]
+pub enum DropPolicy {
+    /// drop the oldest packet in the queue to make room for the new one.
+    DropOldest,
+    /// drop the new packet.
+    DropNewest,
+    /// drop new media (channel data) packets, but keep the stun messages,
+    /// a stun message evicts the oldest media packet in the queue.
+    KeepStun,
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Queue {
+    /// max packets
+    ///
+    /// the maximum number of packets waiting in the forwarding queue of an
+    /// endpoint.
+    #[serde(default = "Queue::max_packets")]
+    pub max_packets: usize,
+    /// max bytes
+    ///
+    /// the maximum number of payload bytes waiting in the forwarding queue
+    /// of an endpoint.
+    #[serde(default = "Queue::max_bytes")]
+    pub max_bytes: usize,
+    /// drop policy
+    ///
+    /// which packet is dropped when the queue is full.
+    #[serde(default = "Queue::policy")]
+    pub policy: DropPolicy,
+}
+
+impl Queue {
+    fn max_packets() -> usize {
+        4096
+    }
+
+    fn max_bytes() -> usize {
+        4 * 1024 * 1024
+    }
+
+    fn policy() -> DropPolicy {
+        DropPolicy::DropNewest
+    }
+}
+
+impl Default for Queue {
+    fn default() -> Self {
+        Self {
+            max_packets: Self::max_packets(),
+            max_bytes: Self::max_bytes(),
+            policy: Self::policy(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Auth {
+    /// auth queue
+    ///
+    /// the maximum number of requests waiting for the key of their node to
+    /// be fetched from the hooks server. the requests that arrive when the
+    /// queue is full are dropped and retransmitted by the client.
+    #[serde(default = "Auth::queue")]
+    pub queue: usize,
+    /// auth concurrency
+    ///
+    /// the maximum number of requests that wait for the hooks server at the
+    /// same time.
+    #[serde(default = "Auth::concurrency")]
+    pub concurrency: usize,
+}
+
+impl Auth {
+    fn queue() -> usize {
+        1024
+    }
+
+    fn concurrency() -> usize {
+        64
+    }
+}
+
+impl Default for Auth {
+    fn default() -> Self {
+        Self {
+            queue: Self::queue(),
+            concurrency: Self::concurrency(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Relay {
+    /// external relay
+    ///
+    /// open a udp socket for the relayed transport address of every
+    /// allocation, so that the allocations can relay to the peers outside
+    /// of the server. when it is disabled, only the allocations of this
+    /// server can be peers of each other.
+    #[serde(default = "Relay::enabled")]
+    pub enabled: bool,
+    /// relay threads
+    ///
+    /// the number of threads that poll the relay sockets, every socket is
+    /// polled by one of them.
+    #[serde(default = "Relay::threads")]
+    pub threads: usize,
+}
+
+impl Relay {
+    fn enabled() -> bool {
+        false
+    }
+
+    fn threads() -> usize {
+        1
+    }
+}
+
+impl Default for Relay {
+    fn default() -> Self {
+        Self {
+            enabled: Self::enabled(),
+            threads: Self::threads(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Xdp {
+    /// xdp fast path
+    ///
+    /// relay the channel data between the udp clients of the server with
+    /// the xdp program in `turn-server/xdp`, which has to be loaded and
+    /// attached before the server starts. the server only keeps the maps
+    /// of the program in sync. this option only applies on linux.
+    #[serde(default = "Xdp::enabled")]
+    pub enabled: bool,
+    /// bpf map pin path
+    ///
+    /// the directory that the maps of the program are pinned in.
+    #[serde(default = "Xdp::pin_path")]
+    pub pin_path: PathBuf,
+    /// counter interval
+    ///
+    /// the number of seconds between two reads of the counters of the
+    /// program into the session statistics.
+    #[serde(default = "Xdp::interval")]
+    pub interval: u64,
+}
+
+impl Xdp {
+    fn enabled() -> bool {
+        false
+    }
+
+    fn pin_path() -> PathBuf {
+        PathBuf::from("/sys/fs/bpf/turn")
+    }
+
+    fn interval() -> u64 {
+        1
+    }
+}
+
+impl Default for Xdp {
+    fn default() -> Self {
+        Self {
+            enabled: Self::enabled(),
+            pin_path: Self::pin_path(),
+            interval: Self::interval(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Cluster {
+    /// cluster mode
+    ///
+    /// the servers in `nodes` relay between each other's allocations over
+    /// the inter-node protocol, and place the allocations on the nodes by
+    /// the consistent hash of the username.
+    #[serde(default = "Cluster::enabled")]
+    pub enabled: bool,
+    /// inter-node address
+    ///
+    /// the udp address of this server in the cluster, it has to be one of
+    /// `nodes`.
+    #[serde(default = "Cluster::addr")]
+    pub addr: SocketAddr,
+    /// cluster nodes
+    ///
+    /// the inter-node addresses of all the servers of the cluster, the
+    /// same list on every server. the datagrams from any other address are
+    /// ignored.
+    #[serde(default = "Cluster::nodes")]
+    pub nodes: Vec<SocketAddr>,
+    /// inter-node datagram size
+    ///
+    /// the records towards a node are packed into datagrams up to this
+    /// size, a larger record is sent on its own.
+    #[serde(default = "Cluster::mtu")]
+    pub mtu: usize,
+    /// inter-node queue
+    ///
+    /// the number of records waiting to be sent, the data is dropped when
+    /// the queue is full.
+    #[serde(default = "Cluster::queue")]
+    pub queue: usize,
+}
+
+impl Cluster {
+    fn enabled() -> bool {
+        false
+    }
+
+    fn addr() -> SocketAddr {
+        "127.0.0.1:3479".parse().unwrap()
+    }
+
+    fn nodes() -> Vec<SocketAddr> {
+        vec![]
+    }
+
+    fn mtu() -> usize {
+        1400
+    }
+
+    fn queue() -> usize {
+        4096
+    }
+}
+
+impl Default for Cluster {
+    fn default() -> Self {
+        Self {
+            enabled: Self::enabled(),
+            addr: Self::addr(),
+            nodes: Self::nodes(),
+            mtu: Self::mtu(),
+            queue: Self::queue(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Handoff {
+    /// warm restart
+    ///
+    /// a new process takes the sessions over from the running one through
+    /// the unix socket at `path`, the running process exits once the new
+    /// one has the snapshot of its state.
+    #[serde(default = "Handoff::enabled")]
+    pub enabled: bool,
+    /// handoff socket
+    ///
+    /// the path of the unix socket that the running process listens on.
+    #[serde(default = "Handoff::path")]
+    pub path: String,
+    /// handoff timeout
+    ///
+    /// the number of seconds that one side of the handoff waits for the
+    /// other, the running process keeps serving when it runs out.
+    #[serde(default = "Handoff::timeout")]
+    pub timeout: u64,
+}
+
+impl Handoff {
+    fn enabled() -> bool {
+        false
+    }
+
+    fn path() -> String {
+        "/tmp/turn-server.sock".to_string()
+    }
+
+    fn timeout() -> u64 {
+        5
+    }
+}
+
+impl Default for Handoff {
+    fn default() -> Self {
+        Self {
+            enabled: Self::enabled(),
+            path: Self::path(),
+            timeout: Self::timeout(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Limits {
+    /// allocation packet rate
+    ///
+    /// the maximum number of packets per second that an allocation sends,
+    /// zero is unlimited.
+    #[serde(default = "Limits::pps")]
+    pub pps: u64,
+    /// allocation bandwidth
+    ///
+    /// the maximum number of bits per second that an allocation sends, zero
+    /// is unlimited.
+    #[serde(default = "Limits::bps")]
+    pub bps: u64,
+    /// user packet rate
+    ///
+    /// the maximum number of packets per second that all the allocations of
+    /// a username send together, zero is unlimited.
+    #[serde(default = "Limits::user_pps")]
+    pub user_pps: u64,
+    /// user bandwidth
+    ///
+    /// the maximum number of bits per second that all the allocations of a
+    /// username send together, zero is unlimited.
+    #[serde(default = "Limits::user_bps")]
+    pub user_bps: u64,
+}
+
+impl Limits {
+    fn pps() -> u64 {
+        0
+    }
+
+    fn bps() -> u64 {
+        0
+    }
+
+    fn user_pps() -> u64 {
+        0
+    }
+
+    fn user_bps() -> u64 {
+        0
+    }
+
+    /// get the limits of the turn router.
+    pub fn as_limits(&self) -> limits::Limits {
+        limits::Limits {
+            allocation: Limit {
+                pps: self.pps,
+                bps: self.bps,
+            },
+            user: Limit {
+                pps: self.user_pps,
+                bps: self.user_bps,
+            },
+        }
+    }
+}
+
+impl Default for Limits {
+    fn default() -> Self {
+        Self {
+            pps: Self::pps(),
+            bps: Self::bps(),
+            user_pps: Self::user_pps(),
+            user_bps: Self::user_bps(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Trace {
+    /// sample rate
+    ///
+    /// one in every `sample` packets that a worker receives is traced
+    /// through the stages of the server, zero disables the tracing.
+    #[serde(default = "Trace::sample")]
+    pub sample: u64,
+    /// slow threshold
+    ///
+    /// the traced packets that take at least this many microseconds from
+    /// the receive to the send are kept for the REST API.
+    #[serde(default = "Trace::slow")]
+    pub slow: u64,
+    /// the number of the slowest traces that are kept.
+    #[serde(default = "Trace::capacity")]
+    pub capacity: usize,
+}
+
+impl Trace {
+    fn sample() -> u64 {
+        0
+    }
+
+    fn slow() -> u64 {
+        1000
+    }
+
+    fn capacity() -> usize {
+        256
+    }
+}
+
+impl Default for Trace {
+    fn default() -> Self {
+        Self {
+            sample: Self::sample(),
+            slow: Self::slow(),
+            capacity: Self::capacity(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct PortRange {
+    /// the first relay port.
+    #[serde(default = "PortRange::start")]
+    pub start: u16,
+    /// the end of the relay ports, this port itself is not allocated.
+    #[serde(default = "PortRange::end")]
+    pub end: u16,
+}
+
+impl PortRange {
+    fn start() -> u16 {
+        49152
+    }
+
+    fn end() -> u16 {
+        65535
+    }
+}
+
+impl Default for PortRange {
+    fn default() -> Self {
+        Self {
+            start: Self::start(),
+            end: Self::end(),
+        }
+    }
 }
 
 #[derive(Deserialize, Debug)]
@@ -43,6 +520,79 @@ pub struct Turn {
     /// ipv4 and ipv6.
     #[serde(default = "Turn::interfaces")]
     pub interfaces: Vec<Interface>,
+
+    /// forwarding queue
+    ///
+    /// the packets forwarded between interfaces are queued per endpoint,
+    /// this option limits the queue size and specifies which packets are
+    /// dropped when the queue is full.
+    #[serde(default)]
+    pub queue: Queue,
+
+    /// authentication stage
+    ///
+    /// the first authenticated request of a node fetches its key from the
+    /// hooks server, these requests are processed by a separate stage so
+    /// that the interface workers keep relaying while the fetch is in
+    /// flight.
+    #[serde(default)]
+    pub auth: Auth,
+
+    /// nonce secret
+    ///
+    /// the nonces are derived from the client address and the time with
+    /// this secret instead of being stored per client. the servers that
+    /// share the secret accept each other's nonces, also after a restart.
+    /// when it is not set, a random secret is generated at startup.
+    #[serde(default)]
+    pub nonce_secret: Option<String>,
+
+    /// relay port range
+    ///
+    /// the range that the relay ports of the allocations are taken from,
+    /// which also limits the number of allocations of the server. the
+    /// default is the dynamic port range 49152-65535.
+    #[serde(default)]
+    pub port_range: PortRange,
+
+    /// relay sockets
+    ///
+    /// the sockets of the relayed transport addresses, which the peers
+    /// outside of the server send to and receive from.
+    #[serde(default)]
+    pub relay: Relay,
+
+    /// xdp fast path
+    ///
+    /// the channel data between the udp clients of the server relayed in
+    /// the kernel.
+    #[serde(default)]
+    pub xdp: Xdp,
+
+    /// cluster mode
+    ///
+    /// the servers that relay between each other's allocations.
+    #[serde(default)]
+    pub cluster: Cluster,
+
+    /// warm restart
+    ///
+    /// the new process of a restart takes the sessions over from the old
+    /// one.
+    #[serde(default)]
+    pub handoff: Handoff,
+
+    /// rate limits
+    ///
+    /// the packet rates and bandwidths that the allocations may send at.
+    #[serde(default)]
+    pub limits: Limits,
+
+    /// packet tracing
+    ///
+    /// the per-stage timing of sampled packets.
+    #[serde(default)]
+    pub trace: Trace,
 }
 
 impl Turn {
@@ -66,6 +616,16 @@ impl Default for Turn {
         Self {
             realm: Self::realm(),
             interfaces: Self::interfaces(),
+            queue: Queue::default(),
+            auth: Auth::default(),
+            nonce_secret: None,
+            port_range: PortRange::default(),
+            relay: Relay::default(),
+            xdp: Xdp::default(),
+            cluster: Cluster::default(),
+            handoff: Handoff::default(),
+            limits: Limits::default(),
+            trace: Trace::default(),
         }
     }
 }
@@ -92,6 +652,26 @@ pub struct Api {
     /// through this service, please do not expose it directly to an unsafe
     /// environment.
     pub hooks: Option<String>,
+    /// password cache ttl
+    ///
+    /// the number of seconds that a password fetched from the hooks service
+    /// is cached.
+    #[serde(default = "Api::password_ttl")]
+    pub password_ttl: u64,
+    /// password cache negative ttl
+    ///
+    /// the number of seconds that an unknown user is cached, during which
+    /// the hooks service is not asked again for this user.
+    #[serde(default = "Api::password_negative_ttl")]
+    pub password_negative_ttl: u64,
+    /// password cache stale ttl
+    ///
+    /// the number of seconds after the ttl during which the cached password
+    /// is still used, while it is fetched again in the background.
+    #[serde(default = "Api::password_stale_ttl")]
+    pub password_stale_ttl: u64,
+    #[serde(default)]
+    pub events: Events,
 }
 
 impl Api {
@@ -102,6 +682,18 @@ impl Api {
     fn hooks() -> Option<String> {
         None
     }
+
+    fn password_ttl() -> u64 {
+        600
+    }
+
+    fn password_negative_ttl() -> u64 {
+        30
+    }
+
+    fn password_stale_ttl() -> u64 {
+        300
+    }
 }
 
 impl Default for Api {
@@ -109,6 +701,76 @@ impl Default for Api {
         Self {
             bind: Self::bind(),
             hooks: Self::hooks(),
+            password_ttl: Self::password_ttl(),
+            password_negative_ttl: Self::password_negative_ttl(),
+            password_stale_ttl: Self::password_stale_ttl(),
+            events: Events::default(),
+        }
+    }
+}
+
+#[derive(Deserialize, Debug, Clone)]
+pub struct Events {
+    /// events batch size
+    ///
+    /// the maximum number of events that are posted to the hooks server in
+    /// one request.
+    #[serde(default = "Events::batch_size")]
+    pub batch_size: usize,
+    /// events batch interval
+    ///
+    /// the number of milliseconds that the first event of a batch waits for
+    /// more events before the batch is posted.
+    #[serde(default = "Events::interval")]
+    pub interval: u64,
+    /// events concurrency
+    ///
+    /// the maximum number of batches that are posted at the same time.
+    #[serde(default = "Events::concurrency")]
+    pub concurrency: usize,
+    /// events queue
+    ///
+    /// the maximum number of events waiting to be batched, the events that
+    /// are raised when the queue is full are dropped and counted.
+    #[serde(default = "Events::queue")]
+    pub queue: usize,
+    /// events compression
+    ///
+    /// compress the batches with gzip.
+    #[serde(default = "Events::gzip")]
+    pub gzip: bool,
+}
+
+impl Events {
+    fn batch_size() -> usize {
+        256
+    }
+
+    fn interval() -> u64 {
+        100
+    }
+
+    fn concurrency() -> usize {
+        4
+    }
+
+    fn queue() -> usize {
+        65536
+    }
+
+    fn gzip() -> bool {
+        false
+    }
+}
+
+impl Default for Events {
+    fn default() -> Self {
+        Self {
+            batch_size: Self::batch_size(),
+            interval: Self::interval(),
+            concurrency: Self::concurrency(),
+            queue: Self::queue(),
+            gzip: Self::gzip(),
         }
     }
 }
@@ -0,0 +1,278 @@
+use std::{
+    future::Future,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+    time::{Duration, Instant},
+};
+
+use ahash::AHashMap;
+use tokio::sync::OnceCell;
+
+/// The result of a password fetch.
+///
+/// `Ok(None)` means that the user does not exist and is cached as a
+/// negative entry, `Err(())` is a transient failure (for example the hooks
+/// server is unreachable) and is never cached.
+pub type Fetch = Result<Option<String>, ()>;
+
+struct Fetched {
+    value: Fetch,
+    time: Instant,
+}
+
+#[derive(PartialEq)]
+enum Freshness {
+    Fresh,
+    Stale,
+    Expired,
+}
+
+struct Entry {
+    cell: Arc<OnceCell<Fetched>>,
+    refreshing: bool,
+}
+
+impl Default for Entry {
+    fn default() -> Self {
+        Self {
+            cell: Arc::new(OnceCell::new()),
+            refreshing: false,
+        }
+    }
+}
+
+/// The hit and miss counters of the credential cache.
+#[derive(Debug, Clone, Copy)]
+pub struct CredentialCounts {
+    /// lookups answered from a fresh entry.
+    pub hits: usize,
+    /// lookups answered from a stale entry while it is refreshed.
+    pub stale_hits: usize,
+    /// lookups answered from a negative entry.
+    pub negative_hits: usize,
+    /// lookups that joined a fetch already in flight.
+    pub coalesced: usize,
+    /// lookups that started a fetch.
+    pub misses: usize,
+}
+
+#[derive(Default)]
+struct Counters {
+    hits: AtomicUsize,
+    stale_hits: AtomicUsize,
+    negative_hits: AtomicUsize,
+    coalesced: AtomicUsize,
+    misses: AtomicUsize,
+}
+
+struct Inner {
+    entries: Mutex<(AHashMap<String, Entry>, usize)>,
+    counters: Counters,
+    ttl: Duration,
+    negative_ttl: Duration,
+    stale_ttl: Duration,
+}
+
+impl Inner {
+    fn freshness(&self, fetched: &Fetched) -> Freshness {
+        let age = fetched.time.elapsed();
+        match fetched.value {
+            Ok(Some(_)) if age < self.ttl => Freshness::Fresh,
+            Ok(Some(_)) if age < self.ttl + self.stale_ttl => Freshness::Stale,
+            Ok(None) if age < self.negative_ttl => Freshness::Fresh,
+            _ => Freshness::Expired,
+        }
+    }
+}
+
+/// credential cache.
+///
+/// caches the passwords fetched from the hooks server by username. the
+/// realm of a server is fixed, so the username is the whole key. concurrent
+/// lookups of a missing user share one fetch, unknown users are cached for
+/// a shorter time, and an expired password is still served for a while
+/// after its ttl while a single background fetch refreshes it.
+#[derive(Clone)]
+pub struct Credentials(Arc<Inner>);
+
+impl Credentials {
+    /// create a credential cache.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::time::Duration;
+    /// use turn_server::credentials::*;
+    ///
+    /// let credentials = Credentials::new(
+    ///     Duration::from_secs(600),
+    ///     Duration::from_secs(30),
+    ///     Duration::from_secs(300),
+    /// );
+    ///
+    /// assert_eq!(credentials.get_counts().misses, 0);
+    /// ```
+    pub fn new(ttl: Duration, negative_ttl: Duration, stale_ttl: Duration) -> Self {
+        Self(Arc::new(Inner {
+            entries: Mutex::new((AHashMap::with_capacity(1024), 1024)),
+            counters: Counters::default(),
+            negative_ttl,
+            stale_ttl,
+            ttl,
+        }))
+    }
+
+    /// get the password of the user.
+    ///
+    /// `fetch` is only polled when the password has to be fetched, either
+    /// by this lookup or in the background to refresh a stale entry.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::time::Duration;
+    /// use turn_server::credentials::*;
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let credentials = Credentials::new(
+    ///         Duration::from_secs(600),
+    ///         Duration::from_secs(30),
+    ///         Duration::from_secs(300),
+    ///     );
+    ///
+    ///     let fetch = async { Ok(Some("test".to_string())) };
+    ///     let password = credentials.get("test", fetch).await;
+    ///     assert_eq!(password.as_deref(), Some("test"));
+    ///
+    ///     // served from the cache, the second fetch is never polled.
+    ///     let fetch = async { Ok(None) };
+    ///     let password = credentials.get("test", fetch).await;
+    ///     assert_eq!(password.as_deref(), Some("test"));
+    ///
+    ///     // unknown users are cached too.
+    ///     credentials.get("none", async { Ok(None) }).await;
+    ///     let fetch = async { Ok(Some("none".to_string())) };
+    ///     assert_eq!(credentials.get("none", fetch).await, None);
+    ///
+    ///     let counts = credentials.get_counts();
+    ///     assert_eq!(counts.hits, 1);
+    ///     assert_eq!(counts.negative_hits, 1);
+    ///     assert_eq!(counts.misses, 2);
+    /// }
+    /// ```
+    pub async fn get<F>(&self, username: &str, fetch: F) -> Option<String>
+    where
+        F: Future<Output = Fetch> + Send + 'static,
+    {
+        let counters = &self.0.counters;
+        let cell = {
+            let mut guard = self.0.entries.lock().unwrap();
+            let (entries, sweep_at) = &mut *guard;
+
+            // Drop the expired entries once the table has doubled since the
+            // last sweep, so that it does not grow with every unknown user.
+            if entries.len() >= *sweep_at {
+                entries.retain(|_, entry| match entry.cell.get() {
+                    Some(fetched) => self.0.freshness(fetched) != Freshness::Expired,
+                    None => true,
+                });
+
+                *sweep_at = (entries.len() * 2).max(1024);
+            }
+
+            let entry = entries.entry(username.to_string()).or_default();
+            let value = entry
+                .cell
+                .get()
+                .map(|fetched| (self.0.freshness(fetched), fetched.value.clone().ok().flatten()));
+
+            match value {
+                Some((Freshness::Fresh, value)) => {
+                    if value.is_some() {
+                        counters.hits.fetch_add(1, Ordering::Relaxed);
+                    } else {
+                        counters.negative_hits.fetch_add(1, Ordering::Relaxed);
+                    }
+
+                    return value;
+                }
+                Some((Freshness::Stale, value)) => {
+                    counters.stale_hits.fetch_add(1, Ordering::Relaxed);
+                    if !entry.refreshing {
+                        entry.refreshing = true;
+                        self.refresh(username.to_string(), fetch);
+                    }
+
+                    return value;
+                }
+                Some((Freshness::Expired, _)) => {
+                    counters.misses.fetch_add(1, Ordering::Relaxed);
+                    *entry = Entry::default();
+                }
+                None => {
+                    // Nobody has completed the fetch yet, either this lookup
+                    // is the first one or it joins the one in flight.
+                    if Arc::strong_count(&entry.cell) > 1 {
+                        counters.coalesced.fetch_add(1, Ordering::Relaxed);
+                    } else {
+                        counters.misses.fetch_add(1, Ordering::Relaxed);
+                    }
+                }
+            }
+
+            entry.cell.clone()
+        };
+
+        cell.get_or_init(|| async move {
+            Fetched {
+                value: fetch.await,
+                time: Instant::now(),
+            }
+        })
+        .await
+        .value
+        .clone()
+        .ok()
+        .flatten()
+    }
+
+    /// fetch the password in the background and replace the stale entry.
+    fn refresh<F>(&self, username: String, fetch: F)
+    where
+        F: Future<Output = Fetch> + Send + 'static,
+    {
+        let this = self.clone();
+        tokio::spawn(async move {
+            let value = fetch.await;
+            let mut guard = this.0.entries.lock().unwrap();
+            let (entries, _) = &mut *guard;
+            if let Some(entry) = entries.get_mut(&username) {
+                entry.refreshing = false;
+
+                // A transient failure keeps serving the stale password until
+                // it expires.
+                if value.is_ok() {
+                    entry.cell = Arc::new(OnceCell::new_with(Some(Fetched {
+                        time: Instant::now(),
+                        value,
+                    })));
+                }
+            }
+        });
+    }
+
+    /// get the hit and miss counters.
+    pub fn get_counts(&self) -> CredentialCounts {
+        let counters = &self.0.counters;
+        CredentialCounts {
+            hits: counters.hits.load(Ordering::Relaxed),
+            stale_hits: counters.stale_hits.load(Ordering::Relaxed),
+            negative_hits: counters.negative_hits.load(Ordering::Relaxed),
+            coalesced: counters.coalesced.load(Ordering::Relaxed),
+            misses: counters.misses.load(Ordering::Relaxed),
+        }
+    }
+}
@@ -0,0 +1,217 @@
+use crate::{config, metrics::Metrics};
+
+use std::{
+    io::{self, Write},
+    net::SocketAddr,
+    sync::Arc,
+    time::Duration,
+};
+
+use flate2::{write::GzEncoder, Compression};
+use reqwest::{
+    header::{CONTENT_ENCODING, CONTENT_TYPE},
+    Client,
+};
+use serde::Serialize;
+use tokio::{
+    sync::{mpsc, Semaphore},
+    time::{timeout_at, Instant},
+};
+
+/// an event of a session that is pushed to the hooks server.
+///
+/// the processor only moves the fields into the event, it is serialized
+/// into its batch by the event pipeline.
+#[derive(Debug, Clone, Serialize)]
+#[serde(tag = "kind", rename_all = "snake_case")]
+pub enum Event {
+    Binding {
+        addr: SocketAddr,
+    },
+    Allocated {
+        name: String,
+        addr: SocketAddr,
+        port: u16,
+    },
+    ChannelBind {
+        name: String,
+        addr: SocketAddr,
+        channel: u16,
+    },
+    CreatePermission {
+        name: String,
+        addr: SocketAddr,
+        relay: SocketAddr,
+    },
+    Refresh {
+        name: String,
+        addr: SocketAddr,
+        expiration: u32,
+    },
+    Abort {
+        name: String,
+        addr: SocketAddr,
+    },
+}
+
+/// a batch of events, encoded as a json array.
+///
+/// # Example
+///
+/// ```
+/// use turn_server::events::*;
+///
+/// let addr = "127.0.0.1:8080".parse().unwrap();
+/// let mut batch = Batch::default();
+/// assert!(batch.is_empty());
+///
+/// batch.push(&Event::Binding { addr });
+/// batch.push(&Event::Abort {
+///     name: "test".to_string(),
+///     addr,
+/// });
+///
+/// assert_eq!(batch.len(), 2);
+/// assert_eq!(
+///     batch.finish(false).unwrap(),
+///     br#"[{"kind":"binding","addr":"127.0.0.1:8080"},{"kind":"abort","name":"test","addr":"127.0.0.1:8080"}]"#
+/// );
+/// ```
+#[derive(Default)]
+pub struct Batch {
+    buf: Vec<u8>,
+    len: usize,
+}
+
+impl Batch {
+    /// serialize the event into the batch, an event that fails to
+    /// serialize leaves the batch as it was.
+    pub fn push(&mut self, event: &Event) {
+        let start = self.buf.len();
+        self.buf.push(if self.len == 0 { b'[' } else { b',' });
+        if serde_json::to_writer(&mut self.buf, event).is_ok() {
+            self.len += 1;
+        } else {
+            self.buf.truncate(start);
+        }
+    }
+
+    /// the number of events of the batch.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// close the array and get the body of the request, compressed with
+    /// gzip when `gzip` is set.
+    pub fn finish(mut self, gzip: bool) -> io::Result<Vec<u8>> {
+        if self.len == 0 {
+            self.buf.push(b'[');
+        }
+
+        self.buf.push(b']');
+        if !gzip {
+            return Ok(self.buf);
+        }
+
+        let mut encoder =
+            GzEncoder::new(Vec::with_capacity(self.buf.len() / 4), Compression::fast());
+
+        encoder.write_all(&self.buf)?;
+        encoder.finish()
+    }
+}
+
+/// webhook event pipeline.
+///
+/// the events are put into a bounded queue without waiting, a task takes
+/// them out and collects them into batches, which are posted when they are
+/// full or when the first event of the batch has waited for the batch
+/// interval. a limited number of batches are posted at the same time, when
+/// the hooks server falls behind the queue fills up and the new events are
+/// dropped and counted instead of piling up in memory.
+pub struct Events {
+    sender: mpsc::Sender<Event>,
+    metrics: Metrics,
+}
+
+impl Events {
+    /// create the pipeline and spawn its task, requires a tokio runtime.
+    pub fn new(
+        options: &config::Events,
+        client: Arc<Client>,
+        uri: String,
+        metrics: Metrics,
+    ) -> Self {
+        let (sender, mut receiver) = mpsc::channel::<Event>(options.queue.max(1));
+        let semaphore = Arc::new(Semaphore::new(options.concurrency.max(1)));
+        let interval = Duration::from_millis(options.interval);
+        let batch_size = options.batch_size.max(1);
+        let gzip = options.gzip;
+
+        let metrics_ = metrics.clone();
+        tokio::spawn(async move {
+            while let Some(event) = receiver.recv().await {
+                let mut batch = Batch::default();
+                batch.push(&event);
+
+                let deadline = Instant::now() + interval;
+                while batch.len() < batch_size {
+                    match timeout_at(deadline, receiver.recv()).await {
+                        Ok(Some(event)) => batch.push(&event),
+                        Ok(None) | Err(_) => break,
+                    }
+                }
+
+                let count = batch.len() as u64;
+                let body = match batch.finish(gzip) {
+                    Ok(body) => body,
+                    Err(e) => {
+                        log::error!("failed to encode events, err={}", e);
+                        metrics_.events_failed(count);
+                        continue;
+                    }
+                };
+
+                let permit = match semaphore.clone().acquire_owned().await {
+                    Ok(permit) => permit,
+                    Err(_) => break,
+                };
+
+                let client = client.clone();
+                let metrics = metrics_.clone();
+                let uri = uri.clone();
+                tokio::spawn(async move {
+                    let mut req = client
+                        .post(&uri)
+                        .header(CONTENT_TYPE, "application/json")
+                        .body(body);
+                    if gzip {
+                        req = req.header(CONTENT_ENCODING, "gzip");
+                    }
+
+                    let ret = req.send().await.and_then(|res| res.error_for_status());
+                    if let Err(e) = ret {
+                        log::error!("failed to request hooks server, err={}", e);
+                        metrics.events_failed(count);
+                    }
+
+                    drop(permit);
+                });
+            }
+        });
+
+        Self { sender, metrics }
+    }
+
+    /// put the event into the queue, the event is dropped when the queue is
+    /// full.
+    pub fn send(&self, event: Event) {
+        if self.sender.try_send(event).is_err() {
+            self.metrics.events_dropped();
+        }
+    }
+}
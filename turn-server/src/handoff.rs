@@ -0,0 +1,235 @@
+use crate::config;
+
+use std::{
+    io::{self, ErrorKind},
+    sync::Arc,
+    time::Duration,
+};
+
+#[cfg(unix)]
+use std::{
+    fs,
+    io::{Read, Write},
+    os::unix::{
+        fs::PermissionsExt,
+        net::{UnixListener, UnixStream},
+    },
+    thread,
+    time::Instant,
+};
+
+#[cfg(unix)]
+use bytes::{BufMut, BytesMut};
+#[cfg(unix)]
+use turn::router::snapshot::Snapshot;
+
+/// The byte that the new process confirms the snapshot with.
+#[cfg(unix)]
+const ACK: u8 = 1;
+
+/// The largest snapshot that is accepted from the running process.
+#[cfg(unix)]
+const MAX_SNAPSHOT_SIZE: usize = 1 << 30;
+
+struct Inner {
+    path: String,
+    timeout: Duration,
+}
+
+/// warm restart.
+///
+/// the running process listens on a unix socket. a new process connects to
+/// it before it binds its interfaces, and the running process answers with
+/// a snapshot of the sessions of its turn router:
+///
+/// ```text
+/// old                                 new
+///  |  <---------------------------- connect
+///  |  size (u32) | snapshot ------->  |
+///  |  <------------------------------ ack (u8)
+/// exit, the sockets are closed        |
+///  |  ---------------------------->  eof
+///                                    restore, bind the interfaces
+/// ```
+///
+/// the new process restores the sessions with their keys, relay addresses,
+/// permissions and channels once the old one is gone, so the relay sockets
+/// and the udp ports are free again, and then binds the interfaces. the
+/// clients keep their allocations and are not asked for credentials again,
+/// the media stops only for the time it takes the old process to exit and
+/// the new one to bind. the changes that the old process makes after it
+/// took the snapshot are lost, and so are the tcp connections, which can
+/// not outlive the process.
+pub struct Handoff(Option<Inner>);
+
+impl Handoff {
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::{config, handoff::*};
+    ///
+    /// let handoff = Handoff::new(&config::Handoff::default()).unwrap();
+    /// assert!(!handoff.is_enabled());
+    /// ```
+    pub fn new(options: &config::Handoff) -> io::Result<Self> {
+        if !options.enabled {
+            return Ok(Self(None));
+        }
+
+        if cfg!(not(unix)) {
+            return Err(io::Error::new(
+                ErrorKind::Unsupported,
+                "the handoff is only supported on unix",
+            ));
+        }
+
+        Ok(Self(Some(Inner {
+            timeout: Duration::from_secs(options.timeout.max(1)),
+            path: options.path.clone(),
+        })))
+    }
+
+    /// whether the sessions are handed over between the processes.
+    pub fn is_enabled(&self) -> bool {
+        self.0.is_some()
+    }
+
+    /// take the sessions over from the running process, returns the number
+    /// of the sessions that were restored.
+    ///
+    /// nothing is restored when no process listens on the handoff socket,
+    /// this is the first start then. blocks until the running process has
+    /// exited.
+    pub fn take_over(&self, router: &turn::Router) -> io::Result<usize> {
+        #[cfg(unix)]
+        if let Some(inner) = &self.0 {
+            let mut stream = match UnixStream::connect(&inner.path) {
+                Ok(stream) => stream,
+                Err(e)
+                    if matches!(e.kind(), ErrorKind::NotFound | ErrorKind::ConnectionRefused) =>
+                {
+                    return Ok(0)
+                }
+                Err(e) => return Err(e),
+            };
+
+            stream.set_read_timeout(Some(inner.timeout))?;
+            stream.set_write_timeout(Some(inner.timeout))?;
+
+            let mut size = [0u8; 4];
+            stream.read_exact(&mut size)?;
+
+            let size = u32::from_be_bytes(size) as usize;
+            if size > MAX_SNAPSHOT_SIZE {
+                return Err(io::Error::new(ErrorKind::InvalidData, "snapshot too large"));
+            }
+
+            let mut buf = vec![0u8; size];
+            stream.read_exact(&mut buf)?;
+
+            let snapshot = Snapshot::decode(&buf)
+                .ok_or_else(|| io::Error::new(ErrorKind::InvalidData, "invalid snapshot"))?;
+
+            // The old process exits on the ack, the connection is closed
+            // with the rest of its sockets.
+            stream.write_all(&[ACK])?;
+
+            // It has committed to exit once the ack is written, so it is
+            // waited for however long it takes to close, and a failed wait
+            // does not fail the start of this process.
+            if let Err(e) = wait_closed(&mut stream) {
+                log::warn!("failed to wait for the handoff process to exit: err={}", e);
+            }
+
+            return Ok(router.restore(&snapshot));
+        }
+
+        #[cfg(not(unix))]
+        let _ = router;
+
+        Ok(0)
+    }
+
+    /// listen on the handoff socket, the process exits when it has handed
+    /// its sessions over to a new process.
+    pub fn listen(&self, router: Arc<turn::Router>) -> io::Result<()> {
+        #[cfg(unix)]
+        if let Some(inner) = &self.0 {
+            // The socket file of the process that was taken over is left
+            // behind.
+            let _ = fs::remove_file(&inner.path);
+
+            let listener = UnixListener::bind(&inner.path)?;
+            fs::set_permissions(&inner.path, fs::Permissions::from_mode(0o600))?;
+
+            let timeout = inner.timeout;
+            thread::Builder::new()
+                .name("turn-handoff".to_string())
+                .spawn(move || {
+                    for stream in listener.incoming() {
+                        let ret = stream.and_then(|stream| hand_over(stream, &router, timeout));
+                        if let Err(e) = ret {
+                            log::warn!("session handoff failed: err={}", e);
+                        }
+                    }
+                })?;
+        }
+
+        #[cfg(not(unix))]
+        let _ = router;
+
+        Ok(())
+    }
+}
+
+/// wait for the other end of the handoff socket to close it.
+#[cfg(unix)]
+fn wait_closed(stream: &mut UnixStream) -> io::Result<()> {
+    stream.set_read_timeout(None)?;
+
+    let mut rest = [0u8; 1];
+    loop {
+        match stream.read(&mut rest) {
+            Ok(0) => return Ok(()),
+            Ok(_) => (),
+            Err(e) if e.kind() == ErrorKind::Interrupted => (),
+            Err(e) => return Err(e),
+        }
+    }
+}
+
+/// send the snapshot to the new process and exit once it has confirmed it.
+#[cfg(unix)]
+fn hand_over(mut stream: UnixStream, router: &turn::Router, timeout: Duration) -> io::Result<()> {
+    stream.set_read_timeout(Some(timeout))?;
+    stream.set_write_timeout(Some(timeout))?;
+
+    let started = Instant::now();
+    let snapshot = router.snapshot();
+
+    let mut buf = BytesMut::with_capacity(4096);
+    buf.put_u32(0);
+    snapshot.encode(&mut buf);
+
+    let size = (buf.len() - 4) as u32;
+    buf[..4].copy_from_slice(&size.to_be_bytes());
+    stream.write_all(&buf)?;
+
+    let mut ack = [0u8; 1];
+    stream.read_exact(&mut ack)?;
+    if ack[0] != ACK {
+        return Err(io::Error::new(
+            ErrorKind::InvalidData,
+            "invalid handoff ack",
+        ));
+    }
+
+    log::info!(
+        "sessions handed over, exiting: sessions={}, bytes={}, elapsed={:?}",
+        snapshot.sessions.len(),
+        size,
+        started.elapsed()
+    );
+
+    std::process::exit(0)
+}
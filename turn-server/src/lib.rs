@@ -1,25 +1,105 @@
 pub mod api;
+pub mod auth;
+pub mod cluster;
 pub mod config;
+pub mod credentials;
+pub mod events;
+pub mod handoff;
+pub mod metrics;
+#[cfg(target_os = "linux")]
+pub mod mmsg;
 pub mod observer;
+pub mod relay;
 pub mod router;
 pub mod server;
+#[cfg(target_os = "linux")]
+pub mod shard;
 pub mod statistics;
+pub mod tls;
+pub mod trace;
+pub mod xdp;
 
-use std::sync::Arc;
+use std::{sync::Arc, time::Duration};
 
-use turn::Service;
+use turn::{router::Options, Nonces, Service};
 
-use self::{config::Config, observer::Observer, statistics::Statistics};
+use self::{
+    cluster::Cluster, config::Config, credentials::Credentials, handoff::Handoff, metrics::Metrics,
+    observer::Observer, relay::Relays, statistics::Statistics, xdp::Fastpath,
+};
 
 /// In order to let the integration test directly use the turn-server crate and
 /// start the server, a function is opened to replace the main function to
 /// directly start the server.
 pub async fn server_main(config: Arc<Config>) -> anyhow::Result<()> {
     let statistics = Statistics::default();
-    let observer = Observer::new(config.clone(), statistics.clone()).await?;
+    let metrics = Metrics::default();
+    let credentials = Credentials::new(
+        Duration::from_secs(config.api.password_ttl),
+        Duration::from_secs(config.api.password_negative_ttl),
+        Duration::from_secs(config.api.password_stale_ttl),
+    );
+
+    let relays = Relays::new(&config.turn.relay, &config.turn.interfaces)?;
+    let cluster = Cluster::new(&config.turn.cluster, &config.turn.interfaces)?;
+    let fastpath = Fastpath::new(
+        &config.turn.xdp,
+        &config.turn.interfaces,
+        statistics.clone(),
+    )?;
+    let observer = Observer::new(
+        config.clone(),
+        statistics.clone(),
+        credentials.clone(),
+        metrics.clone(),
+        relays.clone(),
+        cluster.clone(),
+        fastpath,
+    )
+    .await?;
     let externals = config.turn.get_externals();
-    let service = Service::new(config.turn.realm.clone(), externals, observer);
-    server::run(config.clone(), statistics.clone(), &service).await?;
-    api::start_server(config, service, statistics).await?;
+    let nonces = match &config.turn.nonce_secret {
+        Some(secret) => Nonces::with_secret(secret.as_bytes()),
+        None => Nonces::new(),
+    };
+
+    let port_range = &config.turn.port_range;
+    if port_range.start >= port_range.end {
+        return Err(anyhow::anyhow!(
+            "invalid port range: {}..{}",
+            port_range.start,
+            port_range.end
+        ));
+    }
+
+    let service = Service::with_options(
+        config.turn.realm.clone(),
+        externals,
+        observer,
+        Options {
+            port_range: port_range.start..port_range.end,
+            nonces,
+        },
+    );
+
+    // The sessions of the running process are taken over before the
+    // interfaces are bound, that process exits once it has handed them over.
+    let handoff = Handoff::new(&config.turn.handoff)?;
+    if handoff.is_enabled() {
+        let restored = handoff.take_over(service.get_router())?;
+        log::info!("sessions taken over: sessions={}", restored);
+    }
+
+    let router = server::run(
+        config.clone(),
+        statistics.clone(),
+        metrics.clone(),
+        relays,
+        cluster,
+        &service,
+    )
+    .await?;
+    handoff.listen(service.get_router().clone())?;
+    api::start_server(config, service, router, statistics, credentials, metrics).await?;
     Ok(())
 }
@@ -0,0 +1,558 @@
+use crate::trace::{Stage, Trace};
+
+use std::{
+    fmt::{Display, Write},
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex,
+    },
+    time::Duration,
+};
+
+use stun::Decoder;
+
+/// The number of sub buckets of every power of two, as a power of two, the
+/// relative error of a recorded value is at most 1 / 8.
+const SUB_BITS: usize = 3;
+const SUB: usize = 1 << SUB_BITS;
+
+/// The number of buckets of a histogram, values of 2^34 nanoseconds (about
+/// 17 seconds) and above are counted in the last bucket.
+const BUCKETS: usize = 256;
+
+/// The exported bucket bounds are the powers of two from 2^7 nanoseconds
+/// (128ns) up to 2^34 nanoseconds, so the series are the same on every
+/// scrape.
+const EXPORTED: std::ops::RangeInclusive<usize> = 7..=34;
+
+/// get the bucket of a value in nanoseconds.
+///
+/// the values below `SUB` have a bucket each, above that every power of two
+/// is split into `SUB` buckets of the same width.
+fn index(value: u64) -> usize {
+    if value < SUB as u64 {
+        return value as usize;
+    }
+
+    let exp = 63 - value.leading_zeros() as usize;
+    let sub = (value >> (exp - SUB_BITS)) as usize & (SUB - 1);
+    (((exp - SUB_BITS + 1) << SUB_BITS) | sub).min(BUCKETS - 1)
+}
+
+/// get the exclusive upper bound of a bucket in nanoseconds.
+fn upper(index: usize) -> u64 {
+    if index < SUB {
+        return index as u64 + 1;
+    }
+
+    let exp = (index >> SUB_BITS) + SUB_BITS - 1;
+    ((SUB + (index & (SUB - 1)) + 1) as u64) << (exp - SUB_BITS)
+}
+
+/// The method of a processed message, the processor latency is recorded
+/// per method.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Method {
+    Binding,
+    Allocate,
+    CreatePermission,
+    ChannelBind,
+    Refresh,
+    SendIndication,
+    ChannelData,
+    Other,
+}
+
+impl Method {
+    pub const ALL: [Method; 8] = [
+        Method::Binding,
+        Method::Allocate,
+        Method::CreatePermission,
+        Method::ChannelBind,
+        Method::Refresh,
+        Method::SendIndication,
+        Method::ChannelData,
+        Method::Other,
+    ];
+
+    /// get the method of a message from its header.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::metrics::*;
+    ///
+    /// assert_eq!(Method::of(&[0x00, 0x01, 0x00, 0x00]), Method::Binding);
+    /// assert_eq!(Method::of(&[0x00, 0x03, 0x00, 0x00]), Method::Allocate);
+    /// assert_eq!(Method::of(&[0x40, 0x00, 0x00, 0x04]), Method::ChannelData);
+    /// assert_eq!(Method::of(&[0x0f]), Method::Other);
+    /// ```
+    pub fn of(buf: &[u8]) -> Self {
+        if buf.len() < 2 {
+            return Self::Other;
+        }
+
+        if Decoder::is_channel_data(buf) {
+            return Self::ChannelData;
+        }
+
+        match stun::Method::try_from(u16::from_be_bytes([buf[0], buf[1]])) {
+            Ok(stun::Method::Binding(_)) => Self::Binding,
+            Ok(stun::Method::Allocate(_)) => Self::Allocate,
+            Ok(stun::Method::CreatePermission(_)) => Self::CreatePermission,
+            Ok(stun::Method::ChannelBind(_)) => Self::ChannelBind,
+            Ok(stun::Method::Refresh(_)) => Self::Refresh,
+            Ok(stun::Method::SendIndication) => Self::SendIndication,
+            _ => Self::Other,
+        }
+    }
+
+    /// the label value of the method.
+    pub fn name(&self) -> &'static str {
+        match self {
+            Self::Binding => "binding",
+            Self::Allocate => "allocate",
+            Self::CreatePermission => "create_permission",
+            Self::ChannelBind => "channel_bind",
+            Self::Refresh => "refresh",
+            Self::SendIndication => "send_indication",
+            Self::ChannelData => "channel_data",
+            Self::Other => "other",
+        }
+    }
+}
+
+/// log-linear latency histogram.
+struct Histogram {
+    buckets: [AtomicU64; BUCKETS],
+    /// the sum of the recorded values in nanoseconds.
+    sum: AtomicU64,
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Self {
+            buckets: std::array::from_fn(|_| AtomicU64::new(0)),
+            sum: AtomicU64::new(0),
+        }
+    }
+}
+
+impl Histogram {
+    fn record(&self, value: u64) {
+        self.buckets[index(value)].fetch_add(1, Ordering::Relaxed);
+        self.sum.fetch_add(value, Ordering::Relaxed);
+    }
+
+    /// record into a histogram that has a single writer, a plain load and
+    /// store instead of a locked read-modify-write.
+    fn record_owned(&self, value: u64) {
+        let bucket = &self.buckets[index(value)];
+        bucket.store(bucket.load(Ordering::Relaxed) + 1, Ordering::Relaxed);
+        let sum = self.sum.load(Ordering::Relaxed);
+        self.sum.store(sum.wrapping_add(value), Ordering::Relaxed);
+    }
+
+    fn merge_into(&self, counts: &mut HistogramCounts) {
+        for (count, bucket) in counts.buckets.iter_mut().zip(self.buckets.iter()) {
+            *count += bucket.load(Ordering::Relaxed);
+        }
+
+        counts.sum = counts.sum.wrapping_add(self.sum.load(Ordering::Relaxed));
+    }
+}
+
+/// The merged counts of a histogram.
+///
+/// the counts are cumulative since the start of the server.
+#[derive(Debug, Clone)]
+pub struct HistogramCounts {
+    buckets: Vec<u64>,
+    sum: u64,
+}
+
+impl Default for HistogramCounts {
+    fn default() -> Self {
+        Self {
+            buckets: vec![0; BUCKETS],
+            sum: 0,
+        }
+    }
+}
+
+impl HistogramCounts {
+    /// the number of recorded values.
+    pub fn count(&self) -> u64 {
+        self.buckets.iter().sum()
+    }
+
+    /// the sum of the recorded values.
+    pub fn sum(&self) -> Duration {
+        Duration::from_nanos(self.sum)
+    }
+
+    /// get the upper bound of the bucket that the quantile falls in, the
+    /// quantile is between 0 and 1.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::time::Duration;
+    /// use turn_server::metrics::*;
+    ///
+    /// let metrics = Metrics::default();
+    /// for micros in 1..=100 {
+    ///     metrics.record_auth_fetch(Duration::from_micros(micros));
+    /// }
+    ///
+    /// let counts = metrics.get_auth_fetch();
+    /// assert_eq!(counts.count(), 100);
+    ///
+    /// // the bound is at most 1 / 8 above the value.
+    /// let p99 = counts.quantile(0.99);
+    /// assert!(p99 >= Duration::from_micros(99));
+    /// assert!(p99 <= Duration::from_micros(99) * 9 / 8);
+    /// ```
+    pub fn quantile(&self, q: f64) -> Duration {
+        let rank = (self.count() as f64 * q.clamp(0.0, 1.0)).ceil().max(1.0) as u64;
+        let mut seen = 0;
+        for (index, count) in self.buckets.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Duration::from_nanos(upper(index));
+            }
+        }
+
+        Duration::ZERO
+    }
+
+    /// get the values that were recorded after the `earlier` counts of the
+    /// same histogram were taken.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::time::Duration;
+    /// use turn_server::metrics::*;
+    ///
+    /// let metrics = Metrics::default();
+    /// metrics.record_auth_fetch(Duration::from_micros(1));
+    ///
+    /// let earlier = metrics.get_auth_fetch();
+    /// metrics.record_auth_fetch(Duration::from_millis(1));
+    ///
+    /// let counts = metrics.get_auth_fetch().since(&earlier);
+    /// assert_eq!(counts.count(), 1);
+    /// assert_eq!(counts.sum(), Duration::from_millis(1));
+    /// assert!(counts.quantile(0.5) >= Duration::from_millis(1));
+    /// ```
+    pub fn since(&self, earlier: &Self) -> Self {
+        Self {
+            buckets: self
+                .buckets
+                .iter()
+                .zip(earlier.buckets.iter())
+                .map(|(count, earlier)| count.saturating_sub(*earlier))
+                .collect(),
+            sum: self.sum.wrapping_sub(earlier.sum),
+        }
+    }
+
+    /// the number of recorded values below 2^exp nanoseconds.
+    fn below(&self, exp: usize) -> u64 {
+        let end = if exp < SUB_BITS {
+            1 << exp
+        } else {
+            (exp - SUB_BITS + 1) << SUB_BITS
+        };
+
+        self.buckets[..end.min(BUCKETS)].iter().sum()
+    }
+}
+
+/// One histogram per method, a slab is aligned to a cache line so that the
+/// slabs of different workers never share one.
+#[repr(align(64))]
+struct Slab {
+    methods: [Histogram; Method::ALL.len()],
+}
+
+impl Default for Slab {
+    fn default() -> Self {
+        Self {
+            methods: std::array::from_fn(|_| Histogram::default()),
+        }
+    }
+}
+
+#[derive(Default)]
+struct Inner {
+    slabs: Mutex<Vec<Arc<Slab>>>,
+    /// histograms for the callers that do not own a slab.
+    shared: Slab,
+    auth_fetch: Histogram,
+    auth_dropped: AtomicU64,
+    events_dropped: AtomicU64,
+    events_failed: AtomicU64,
+    /// the stages of the traced packets, they are sampled, so the shared
+    /// histograms are not contended.
+    stages: [Histogram; Stage::ALL.len()],
+    trace_total: Histogram,
+}
+
+/// data plane metrics.
+///
+/// every worker records the processor latency into a slab of histograms
+/// that it owns, recording takes no lock and no shared atomic. the slabs
+/// are merged when the metrics are scraped.
+#[derive(Clone, Default)]
+pub struct Metrics(Arc<Inner>);
+
+impl Metrics {
+    /// get a recorder with a slab of its own.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::time::Duration;
+    /// use turn_server::metrics::*;
+    ///
+    /// let metrics = Metrics::default();
+    /// let mut recorder = metrics.get_recorder();
+    ///
+    /// recorder.record(Method::Binding, Duration::from_micros(3));
+    /// metrics.record(Method::Binding, Duration::from_micros(5));
+    ///
+    /// let counts = metrics.get_processor(Method::Binding);
+    /// assert_eq!(counts.count(), 2);
+    /// assert_eq!(counts.sum(), Duration::from_micros(8));
+    /// assert_eq!(metrics.get_processor(Method::Allocate).count(), 0);
+    /// ```
+    pub fn get_recorder(&self) -> Recorder {
+        let slab = Arc::new(Slab::default());
+        self.0.slabs.lock().unwrap().push(slab.clone());
+        Recorder {
+            metrics: self.clone(),
+            slab,
+        }
+    }
+
+    /// record the processor latency through the shared histograms, for the
+    /// callers that can not hold a recorder of their own.
+    pub fn record(&self, method: Method, elapsed: Duration) {
+        self.0.shared.methods[method as usize].record(elapsed.as_nanos() as u64);
+    }
+
+    /// record the latency of a password fetch from the hooks server.
+    pub fn record_auth_fetch(&self, elapsed: Duration) {
+        self.0.auth_fetch.record(elapsed.as_nanos() as u64);
+    }
+
+    /// count a request dropped because the auth queue is full.
+    pub fn auth_dropped(&self) {
+        self.0.auth_dropped.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// count a webhook event dropped because the event queue is full.
+    pub fn events_dropped(&self) {
+        self.0.events_dropped.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// count the webhook events of a batch that could not be posted.
+    pub fn events_failed(&self, count: u64) {
+        self.0.events_failed.fetch_add(count, Ordering::Relaxed);
+    }
+
+    /// record the stages and the total time of a traced packet.
+    pub fn record_trace(&self, trace: &Trace) {
+        for stage in Stage::ALL {
+            self.0.stages[stage as usize].record(trace.get(stage).as_nanos() as u64);
+        }
+
+        self.0.trace_total.record(trace.total.as_nanos() as u64);
+    }
+
+    /// get the processor latency of a method, merged over all the workers.
+    pub fn get_processor(&self, method: Method) -> HistogramCounts {
+        let mut counts = HistogramCounts::default();
+        self.0.shared.methods[method as usize].merge_into(&mut counts);
+        for slab in self.0.slabs.lock().unwrap().iter() {
+            slab.methods[method as usize].merge_into(&mut counts);
+        }
+
+        counts
+    }
+
+    /// get the latency of the password fetches.
+    pub fn get_auth_fetch(&self) -> HistogramCounts {
+        let mut counts = HistogramCounts::default();
+        self.0.auth_fetch.merge_into(&mut counts);
+        counts
+    }
+
+    /// get the time the traced packets spent in a stage.
+    pub fn get_stage(&self, stage: Stage) -> HistogramCounts {
+        let mut counts = HistogramCounts::default();
+        self.0.stages[stage as usize].merge_into(&mut counts);
+        counts
+    }
+
+    /// get the total time of the traced packets.
+    pub fn get_trace_total(&self) -> HistogramCounts {
+        let mut counts = HistogramCounts::default();
+        self.0.trace_total.merge_into(&mut counts);
+        counts
+    }
+
+    /// get the number of requests dropped by the auth queue.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::metrics::*;
+    ///
+    /// let metrics = Metrics::default();
+    /// metrics.auth_dropped();
+    /// assert_eq!(metrics.get_auth_dropped(), 1);
+    /// ```
+    pub fn get_auth_dropped(&self) -> u64 {
+        self.0.auth_dropped.load(Ordering::Relaxed)
+    }
+
+    /// get the number of webhook events dropped by the event queue and the
+    /// number of events that could not be posted.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::metrics::*;
+    ///
+    /// let metrics = Metrics::default();
+    /// metrics.events_dropped();
+    /// metrics.events_failed(3);
+    /// assert_eq!(metrics.get_events(), (1, 3));
+    /// ```
+    pub fn get_events(&self) -> (u64, u64) {
+        (
+            self.0.events_dropped.load(Ordering::Relaxed),
+            self.0.events_failed.load(Ordering::Relaxed),
+        )
+    }
+}
+
+/// processor latency recorder.
+///
+/// It is held by each worker, a clone is a new recorder with a slab of its
+/// own.
+pub struct Recorder {
+    metrics: Metrics,
+    slab: Arc<Slab>,
+}
+
+impl Clone for Recorder {
+    fn clone(&self) -> Self {
+        self.metrics.get_recorder()
+    }
+}
+
+impl Recorder {
+    pub fn record(&mut self, method: Method, elapsed: Duration) {
+        self.slab.methods[method as usize].record_owned(elapsed.as_nanos() as u64);
+    }
+}
+
+/// Prometheus text format encoder.
+///
+/// # Example
+///
+/// ```
+/// use std::time::Duration;
+/// use turn_server::metrics::*;
+///
+/// let metrics = Metrics::default();
+/// metrics.record_auth_fetch(Duration::from_millis(3));
+///
+/// let mut encoder = Encoder::default();
+/// encoder.family("turn_allocations", "gauge", "allocated relay ports.");
+/// encoder.sample("turn_allocations", &[], 1);
+/// encoder.family("turn_auth_fetch_seconds", "histogram", "password fetch latency.");
+/// encoder.histogram("turn_auth_fetch_seconds", &[], &metrics.get_auth_fetch());
+///
+/// let text = encoder.finish();
+/// assert!(text.contains("# TYPE turn_allocations gauge\n"));
+/// assert!(text.contains("turn_allocations 1\n"));
+/// assert!(text.contains("turn_auth_fetch_seconds_bucket{le=\"0.004194304\"} 1\n"));
+/// assert!(text.contains("turn_auth_fetch_seconds_bucket{le=\"+Inf\"} 1\n"));
+/// assert!(text.contains("turn_auth_fetch_seconds_count 1\n"));
+/// ```
+#[derive(Default)]
+pub struct Encoder(String);
+
+impl Encoder {
+    /// start a metric family, the samples of the family follow.
+    pub fn family(&mut self, name: &str, kind: &str, help: &str) {
+        let _ = writeln!(self.0, "# HELP {} {}", name, help);
+        let _ = writeln!(self.0, "# TYPE {} {}", name, kind);
+    }
+
+    pub fn sample(&mut self, name: &str, labels: &[(&str, &str)], value: impl Display) {
+        self.0.push_str(name);
+        self.labels(labels, None);
+        let _ = writeln!(self.0, " {}", value);
+    }
+
+    /// write the buckets, the sum and the count of a histogram, in seconds.
+    pub fn histogram(&mut self, name: &str, labels: &[(&str, &str)], counts: &HistogramCounts) {
+        for exp in EXPORTED {
+            let le = ((1u64 << exp) as f64 / 1e9).to_string();
+            let _ = write!(self.0, "{}_bucket", name);
+            self.labels(labels, Some(&le));
+            let _ = writeln!(self.0, " {}", counts.below(exp));
+        }
+
+        let count = counts.count();
+        let _ = write!(self.0, "{}_bucket", name);
+        self.labels(labels, Some("+Inf"));
+        let _ = writeln!(self.0, " {}", count);
+
+        let _ = write!(self.0, "{}_sum", name);
+        self.labels(labels, None);
+        let _ = writeln!(self.0, " {}", counts.sum().as_secs_f64());
+
+        let _ = write!(self.0, "{}_count", name);
+        self.labels(labels, None);
+        let _ = writeln!(self.0, " {}", count);
+    }
+
+    pub fn finish(self) -> String {
+        self.0
+    }
+
+    fn labels(&mut self, labels: &[(&str, &str)], le: Option<&str>) {
+        if labels.is_empty() && le.is_none() {
+            return;
+        }
+
+        self.0.push('{');
+        let le = le.map(|le| ("le", le));
+        for (i, (key, value)) in labels.iter().copied().chain(le).enumerate() {
+            if i > 0 {
+                self.0.push(',');
+            }
+
+            let _ = write!(self.0, "{}=\"", key);
+            for c in value.chars() {
+                match c {
+                    '\\' => self.0.push_str("\\\\"),
+                    '"' => self.0.push_str("\\\""),
+                    '\n' => self.0.push_str("\\n"),
+                    c => self.0.push(c),
+                }
+            }
+
+            self.0.push('"');
+        }
+
+        self.0.push('}');
+    }
+}
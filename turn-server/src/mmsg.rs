@@ -0,0 +1,436 @@
+//! Batched udp socket io.
+//!
+//! Wraps `recvmmsg`/`sendmmsg` so that a worker can move many datagrams
+//! per system call, and uses UDP GRO/GSO when the kernel supports it, so
+//! that segments of the same flow are coalesced into a single buffer on
+//! receive and split by the kernel (or the NIC) on send.
+
+use std::{
+    io::{Error, Result},
+    mem::{size_of, zeroed},
+    net::{Ipv4Addr, Ipv6Addr, SocketAddr, SocketAddrV4, SocketAddrV6},
+    os::fd::{AsRawFd, RawFd},
+    ptr,
+};
+
+use tokio::{io::Interest, net::UdpSocket};
+
+/// The maximum size of a single datagram handled by the server.
+pub const MTU: usize = 2048;
+
+/// The receive buffer size of one message when GRO is enabled, the kernel
+/// can coalesce up to 64 segments of the same flow into one buffer.
+const GRO_BUF_SIZE: usize = 65535;
+
+/// The kernel limit on the number of segments in one GSO message.
+const GSO_MAX_SEGMENTS: usize = 64;
+
+/// The maximum payload size of one GSO message.
+const GSO_MAX_SIZE: usize = 65000;
+
+/// Control message buffer, large enough for one `UDP_GRO` or
+/// `UDP_SEGMENT` control message and aligned for `cmsghdr`.
+type Control = [u64; 8];
+
+fn setsockopt(fd: RawFd, level: libc::c_int, name: libc::c_int, value: libc::c_int) -> bool {
+    unsafe {
+        libc::setsockopt(
+            fd,
+            level,
+            name,
+            &value as *const _ as *const libc::c_void,
+            size_of::<libc::c_int>() as libc::socklen_t,
+        ) == 0
+    }
+}
+
+/// Try to enable UDP GRO on the socket.
+///
+/// Returns false if the kernel does not support it.
+pub fn enable_gro(socket: &UdpSocket) -> bool {
+    setsockopt(socket.as_raw_fd(), libc::SOL_UDP, libc::UDP_GRO, 1)
+}
+
+/// Check whether the kernel supports UDP GSO on the socket.
+///
+/// Setting the socket level segment size to zero does not change the
+/// behavior of the socket, it only fails when the option is unknown.
+pub fn support_gso(socket: &UdpSocket) -> bool {
+    setsockopt(socket.as_raw_fd(), libc::SOL_UDP, libc::UDP_SEGMENT, 0)
+}
+
+fn to_socket_addr(storage: &libc::sockaddr_storage) -> Option<SocketAddr> {
+    match storage.ss_family as libc::c_int {
+        libc::AF_INET => {
+            let addr = unsafe { &*(storage as *const _ as *const libc::sockaddr_in) };
+            Some(SocketAddr::V4(SocketAddrV4::new(
+                Ipv4Addr::from(u32::from_be(addr.sin_addr.s_addr)),
+                u16::from_be(addr.sin_port),
+            )))
+        }
+        libc::AF_INET6 => {
+            let addr = unsafe { &*(storage as *const _ as *const libc::sockaddr_in6) };
+            Some(SocketAddr::V6(SocketAddrV6::new(
+                Ipv6Addr::from(addr.sin6_addr.s6_addr),
+                u16::from_be(addr.sin6_port),
+                addr.sin6_flowinfo,
+                addr.sin6_scope_id,
+            )))
+        }
+        _ => None,
+    }
+}
+
+fn from_socket_addr(addr: &SocketAddr, storage: &mut libc::sockaddr_storage) -> libc::socklen_t {
+    *storage = unsafe { zeroed() };
+
+    match addr {
+        SocketAddr::V4(addr) => {
+            let sin = unsafe { &mut *(storage as *mut _ as *mut libc::sockaddr_in) };
+            sin.sin_family = libc::AF_INET as libc::sa_family_t;
+            sin.sin_port = addr.port().to_be();
+            sin.sin_addr.s_addr = u32::from(*addr.ip()).to_be();
+            size_of::<libc::sockaddr_in>() as libc::socklen_t
+        }
+        SocketAddr::V6(addr) => {
+            let sin6 = unsafe { &mut *(storage as *mut _ as *mut libc::sockaddr_in6) };
+            sin6.sin6_family = libc::AF_INET6 as libc::sa_family_t;
+            sin6.sin6_port = addr.port().to_be();
+            sin6.sin6_flowinfo = addr.flowinfo();
+            sin6.sin6_addr.s6_addr = addr.ip().octets();
+            sin6.sin6_scope_id = addr.scope_id();
+            size_of::<libc::sockaddr_in6>() as libc::socklen_t
+        }
+    }
+}
+
+/// Batched receiver.
+///
+/// Each message slot has its own buffer, address and control buffer, the
+/// received datagrams (and the GRO segments inside them) are flattened
+/// into a packet list that can be read by index.
+pub struct RecvBatch {
+    buf: Vec<u8>,
+    slot_size: usize,
+    gro: bool,
+    iovecs: Vec<libc::iovec>,
+    addrs: Vec<libc::sockaddr_storage>,
+    controls: Vec<Control>,
+    hdrs: Vec<libc::mmsghdr>,
+    packets: Vec<(usize, usize, SocketAddr)>,
+}
+
+unsafe impl Send for RecvBatch {}
+
+impl RecvBatch {
+    pub fn new(size: usize, gro: bool) -> Self {
+        let slot_size = if gro { GRO_BUF_SIZE } else { MTU };
+        Self {
+            buf: vec![0u8; slot_size * size],
+            iovecs: vec![unsafe { zeroed() }; size],
+            addrs: vec![unsafe { zeroed() }; size],
+            controls: vec![[0u64; 8]; size],
+            hdrs: vec![unsafe { zeroed() }; size],
+            packets: Vec::with_capacity(size),
+            slot_size,
+            gro,
+        }
+    }
+
+    /// Receive a batch of datagrams.
+    ///
+    /// Waits until the socket is readable, and returns the number of
+    /// packets received by one `recvmmsg` call.
+    pub async fn recv(&mut self, socket: &UdpSocket) -> Result<usize> {
+        let fd = socket.as_raw_fd();
+        socket
+            .async_io(Interest::READABLE, || self.recvmmsg(fd))
+            .await
+    }
+
+    /// Get the packet and the source address by index.
+    pub fn get(&self, index: usize) -> (&[u8], SocketAddr) {
+        let (offset, size, addr) = self.packets[index];
+        (&self.buf[offset..offset + size], addr)
+    }
+
+    fn recvmmsg(&mut self, fd: RawFd) -> Result<usize> {
+        let base = self.buf.as_mut_ptr();
+        for i in 0..self.hdrs.len() {
+            self.iovecs[i] = libc::iovec {
+                iov_base: unsafe { base.add(i * self.slot_size) } as *mut libc::c_void,
+                iov_len: self.slot_size,
+            };
+
+            let hdr = &mut self.hdrs[i].msg_hdr;
+            hdr.msg_name = &mut self.addrs[i] as *mut _ as *mut libc::c_void;
+            hdr.msg_namelen = size_of::<libc::sockaddr_storage>() as libc::socklen_t;
+            hdr.msg_iov = &mut self.iovecs[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = self.controls[i].as_mut_ptr() as *mut libc::c_void;
+            hdr.msg_controllen = size_of::<Control>() as _;
+            hdr.msg_flags = 0;
+        }
+
+        let count = unsafe {
+            libc::recvmmsg(
+                fd,
+                self.hdrs.as_mut_ptr(),
+                self.hdrs.len() as _,
+                libc::MSG_DONTWAIT as _,
+                ptr::null_mut(),
+            )
+        };
+
+        if count < 0 {
+            return Err(Error::last_os_error());
+        }
+
+        self.packets.clear();
+        for i in 0..count as usize {
+            let size = self.hdrs[i].msg_len as usize;
+            let addr = match to_socket_addr(&self.addrs[i]) {
+                Some(a) => a,
+                None => continue,
+            };
+
+            // When GRO is enabled, one buffer may contain multiple segments
+            // of the same size (except the last one), the segment size is
+            // carried in the control message.
+            let segment = if self.gro {
+                self.gro_segment(i).unwrap_or(size)
+            } else {
+                size
+            };
+
+            let base = i * self.slot_size;
+            let mut offset = 0;
+            while offset < size {
+                let len = segment.min(size - offset);
+                self.packets.push((base + offset, len, addr));
+                offset += len;
+            }
+        }
+
+        Ok(self.packets.len())
+    }
+
+    fn gro_segment(&self, index: usize) -> Option<usize> {
+        let hdr = &self.hdrs[index].msg_hdr;
+        unsafe {
+            let mut cmsg = libc::CMSG_FIRSTHDR(hdr);
+            while !cmsg.is_null() {
+                if (*cmsg).cmsg_level == libc::SOL_UDP && (*cmsg).cmsg_type == libc::UDP_GRO {
+                    let size = ptr::read_unaligned(libc::CMSG_DATA(cmsg) as *const libc::c_int);
+                    return (size > 0).then_some(size as usize);
+                }
+
+                cmsg = libc::CMSG_NXTHDR(hdr, cmsg);
+            }
+        }
+
+        None
+    }
+}
+
+/// Batched sender.
+///
+/// Packets are copied into one contiguous buffer, consecutive packets to
+/// the same address are merged into one GSO message when possible, and
+/// the whole queue is flushed with `sendmmsg`.
+pub struct SendBatch {
+    buf: Vec<u8>,
+    size: usize,
+    gso: bool,
+    packets: Vec<(usize, usize, SocketAddr)>,
+    /// the index of the first packet of each message, and the number of
+    /// the packets merged into it.
+    messages: Vec<(usize, usize)>,
+    iovecs: Vec<libc::iovec>,
+    addrs: Vec<libc::sockaddr_storage>,
+    controls: Vec<Control>,
+    hdrs: Vec<libc::mmsghdr>,
+}
+
+unsafe impl Send for SendBatch {}
+
+impl SendBatch {
+    pub fn new(size: usize, gso: bool) -> Self {
+        Self {
+            buf: Vec::with_capacity(MTU * size),
+            packets: Vec::with_capacity(size),
+            messages: Vec::with_capacity(size),
+            iovecs: vec![unsafe { zeroed() }; size],
+            addrs: vec![unsafe { zeroed() }; size],
+            controls: vec![[0u64; 8]; size],
+            hdrs: vec![unsafe { zeroed() }; size],
+            size,
+            gso,
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.packets.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.packets.is_empty()
+    }
+
+    /// the number of bytes in the send queue.
+    pub fn bytes(&self) -> usize {
+        self.buf.len()
+    }
+
+    pub fn is_full(&self) -> bool {
+        self.packets.len() >= self.size
+    }
+
+    /// Push a packet to the send queue.
+    ///
+    /// Returns false and leaves the packet out when it is larger than the
+    /// MTU or the queue is full, the caller has to send it another way, or
+    /// flush first when `is_full` returns true.
+    pub fn push(&mut self, data: &[u8], addr: SocketAddr) -> bool {
+        if data.len() > MTU || self.is_full() {
+            return false;
+        }
+
+        self.packets.push((self.buf.len(), data.len(), addr));
+        self.buf.extend_from_slice(data);
+        true
+    }
+
+    /// Send all packets in the queue.
+    ///
+    /// Returns the number of `sendmmsg` calls, `sent` is called with the
+    /// index in the queue of every packet that was handed to the kernel. A
+    /// packet that fails to send is skipped so that one unreachable peer
+    /// does not block the rest of the queue.
+    pub async fn flush(&mut self, socket: &UdpSocket, mut sent: impl FnMut(usize)) -> usize {
+        let fd = socket.as_raw_fd();
+        let count = self.prepare();
+        let mut syscalls = 0;
+        let mut offset = 0;
+
+        while offset < count {
+            syscalls += 1;
+            match socket
+                .async_io(Interest::WRITABLE, || self.sendmmsg(fd, offset, count))
+                .await
+            {
+                Ok(messages) => {
+                    for &(first, packets) in &self.messages[offset..offset + messages] {
+                        (first..first + packets).for_each(&mut sent);
+                    }
+
+                    offset += messages;
+                }
+                Err(e) => {
+                    // The NIC may not support checksum offload for GSO, the
+                    // kernel reports it as EIO, stop merging packets for
+                    // the later batches.
+                    if self.gso && e.raw_os_error() == Some(libc::EIO) {
+                        log::warn!("udp gso is not supported by the device, fall back to sendmmsg");
+                        self.gso = false;
+                    }
+
+                    log::debug!("udp sendmmsg failed: err={}", e);
+                    offset += 1;
+                }
+            }
+        }
+
+        self.packets.clear();
+        self.messages.clear();
+        self.buf.clear();
+        syscalls
+    }
+
+    /// build the message headers, and return the number of messages.
+    fn prepare(&mut self) -> usize {
+        let base = self.buf.as_mut_ptr();
+        let mut count = 0;
+        let mut index = 0;
+
+        self.messages.clear();
+        while index < self.packets.len() {
+            let first = index;
+            let (offset, segment, addr) = self.packets[index];
+            let mut size = segment;
+            let mut segments = 1;
+            index += 1;
+
+            // Only consecutive packets to the same address can be merged,
+            // all segments must have the same size except the last one,
+            // which may be shorter.
+            if self.gso {
+                while index < self.packets.len() && segments < GSO_MAX_SEGMENTS {
+                    let (_, len, to) = self.packets[index];
+                    if to != addr || len > segment || size + len > GSO_MAX_SIZE {
+                        break;
+                    }
+
+                    size += len;
+                    segments += 1;
+                    index += 1;
+
+                    if len < segment {
+                        break;
+                    }
+                }
+            }
+
+            self.iovecs[count] = libc::iovec {
+                iov_base: unsafe { base.add(offset) } as *mut libc::c_void,
+                iov_len: size,
+            };
+
+            let namelen = from_socket_addr(&addr, &mut self.addrs[count]);
+            let hdr = &mut self.hdrs[count].msg_hdr;
+            hdr.msg_name = &mut self.addrs[count] as *mut _ as *mut libc::c_void;
+            hdr.msg_namelen = namelen;
+            hdr.msg_iov = &mut self.iovecs[count];
+            hdr.msg_iovlen = 1;
+            hdr.msg_flags = 0;
+            hdr.msg_control = ptr::null_mut();
+            hdr.msg_controllen = 0;
+
+            if segments > 1 {
+                hdr.msg_control = self.controls[count].as_mut_ptr() as *mut libc::c_void;
+                hdr.msg_controllen = size_of::<Control>() as _;
+
+                unsafe {
+                    let cmsg = libc::CMSG_FIRSTHDR(hdr);
+                    (*cmsg).cmsg_level = libc::SOL_UDP;
+                    (*cmsg).cmsg_type = libc::UDP_SEGMENT;
+                    (*cmsg).cmsg_len = libc::CMSG_LEN(size_of::<u16>() as _) as _;
+                    ptr::write_unaligned(libc::CMSG_DATA(cmsg) as *mut u16, segment as u16);
+                    hdr.msg_controllen = libc::CMSG_SPACE(size_of::<u16>() as _) as _;
+                }
+            }
+
+            self.messages.push((first, segments));
+            count += 1;
+        }
+
+        count
+    }
+
+    fn sendmmsg(&mut self, fd: RawFd, offset: usize, count: usize) -> Result<usize> {
+        let sent = unsafe {
+            libc::sendmmsg(
+                fd,
+                self.hdrs[offset..].as_mut_ptr(),
+                (count - offset) as _,
+                libc::MSG_DONTWAIT as _,
+            )
+        };
+
+        if sent < 0 {
+            Err(Error::last_os_error())
+        } else {
+            Ok(sent as usize)
+        }
+    }
+}
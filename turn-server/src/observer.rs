@@ -1,21 +1,47 @@
 use std::{net::SocketAddr, sync::Arc};
 
-use crate::{api::HooksService, config::Config, statistics::Statistics};
+use crate::{
+    api::HooksService,
+    cluster::Cluster,
+    config::Config,
+    credentials::Credentials,
+    events::Event,
+    metrics::Metrics,
+    relay::Relays,
+    statistics::{Statistics, Stats},
+    xdp::Fastpath,
+};
 
 use anyhow::Result;
 use async_trait::async_trait;
-use serde_json::json;
+use turn::router::{forwards::Forward, limits::Limits};
 
 pub struct Observer {
+    config: Arc<Config>,
     hooks: HooksService,
     statistics: Statistics,
+    relays: Relays,
+    cluster: Cluster,
+    fastpath: Fastpath,
 }
 
 impl Observer {
-    pub async fn new(cfg: Arc<Config>, statistics: Statistics) -> Result<Self> {
+    pub async fn new(
+        cfg: Arc<Config>,
+        statistics: Statistics,
+        credentials: Credentials,
+        metrics: Metrics,
+        relays: Relays,
+        cluster: Cluster,
+        fastpath: Fastpath,
+    ) -> Result<Self> {
         Ok(Self {
-            hooks: HooksService::new(cfg)?,
+            hooks: HooksService::new(cfg.clone(), credentials, metrics)?,
+            config: cfg,
             statistics,
+            relays,
+            cluster,
+            fastpath,
         })
     }
 }
@@ -47,13 +73,12 @@ impl turn::Observer for Observer {
     #[allow(clippy::let_underscore_future)]
     fn allocated(&self, addr: &SocketAddr, name: &str, port: u16) {
         log::info!("allocate: addr={:?}, name={:?}, port={}", addr, name, port);
-        self.statistics.set(*addr);
-        self.hooks.send_event(json!({
-            "kind": "allocated",
-            "name": name,
-            "addr": addr,
-            "port": port,
-        }));
+        self.statistics.set(*addr, name);
+        self.hooks.send_event(Event::Allocated {
+            name: name.to_string(),
+            addr: *addr,
+            port,
+        });
     }
 
     /// binding request
@@ -81,10 +106,7 @@ impl turn::Observer for Observer {
     #[allow(clippy::let_underscore_future)]
     fn binding(&self, addr: &SocketAddr) {
         log::info!("binding: addr={:?}", addr);
-        self.hooks.send_event(json!({
-            "kind": "binding",
-            "addr": addr,
-        }))
+        self.hooks.send_event(Event::Binding { addr: *addr })
     }
 
     /// channel binding request
@@ -126,12 +148,11 @@ impl turn::Observer for Observer {
             channel
         );
 
-        self.hooks.send_event(json!({
-            "kind": "channel_bind",
-            "name": name,
-            "addr": addr,
-            "channel": channel,
-        }));
+        self.hooks.send_event(Event::ChannelBind {
+            name: name.to_string(),
+            addr: *addr,
+            channel,
+        });
     }
 
     /// create permission request
@@ -182,12 +203,11 @@ impl turn::Observer for Observer {
             relay
         );
 
-        self.hooks.send_event(json!({
-            "kind": "create_permission",
-            "name": name,
-            "addr": addr,
-            "relay": relay,
-        }));
+        self.hooks.send_event(Event::CreatePermission {
+            name: name.to_string(),
+            addr: *addr,
+            relay: *relay,
+        });
     }
 
     /// refresh request
@@ -238,12 +258,11 @@ impl turn::Observer for Observer {
             expiration
         );
 
-        self.hooks.send_event(json!({
-            "kind": "refresh",
-            "name": name,
-            "addr": addr,
-            "expiration": expiration,
-        }))
+        self.hooks.send_event(Event::Refresh {
+            name: name.to_string(),
+            addr: *addr,
+            expiration,
+        })
     }
 
     /// session closed
@@ -255,10 +274,81 @@ impl turn::Observer for Observer {
     fn abort(&self, addr: &SocketAddr, name: &str) {
         log::info!("node abort: addr={:?}, name={:?}", addr, name);
         self.statistics.delete(addr);
-        self.hooks.send_event(json!({
-            "kind": "abort",
-            "name": name,
-            "addr": addr,
-        }))
+        self.hooks.send_event(Event::Abort {
+            name: name.to_string(),
+            addr: *addr,
+        })
+    }
+
+    /// the limits that the hooks server gave the user with its password
+    /// take the place of the configured ones.
+    fn get_limits(&self, _: &SocketAddr, name: &str) -> Limits {
+        self.hooks
+            .get_limits(name)
+            .unwrap_or_else(|| self.config.turn.limits.as_limits())
+    }
+
+    fn limited(&self, addr: &SocketAddr, size: usize) {
+        self.statistics
+            .send_shared(addr, &[Stats::LimitedBytes(size), Stats::LimitedPkts(1)]);
+    }
+
+    fn restored(&self, addr: &SocketAddr, name: &str) {
+        log::info!("restore: addr={:?}, name={:?}", addr, name);
+        self.statistics.set(*addr, name);
+    }
+
+    fn external_relay(&self) -> bool {
+        self.relays.is_enabled() || self.cluster.is_enabled()
+    }
+
+    /// without the relay sockets only the allocations of the other nodes
+    /// are external peers, which need no socket.
+    fn open_relay(&self, relay: &SocketAddr) -> bool {
+        !self.relays.is_enabled() || self.relays.open(relay)
+    }
+
+    fn close_relay(&self, relay: &SocketAddr) {
+        self.relays.close(relay)
+    }
+
+    fn permit_peer(&self, peer: &SocketAddr) -> bool {
+        self.relays.is_enabled() || self.cluster.is_member(&peer.ip())
+    }
+
+    /// the allocations are placed on the nodes of the cluster by the
+    /// username, the client is sent to an interface of the node with the
+    /// same transport as the interface that it asked on.
+    fn alternate_server(
+        &self,
+        addr: &SocketAddr,
+        external: &SocketAddr,
+        name: &str,
+    ) -> Option<SocketAddr> {
+        let transport = self
+            .config
+            .turn
+            .interfaces
+            .iter()
+            .find(|item| item.external == *external)?
+            .transport;
+
+        let alternate = self.cluster.get_alternate(name, transport, external)?;
+        log::info!(
+            "allocate redirect: addr={:?}, name={:?}, alternate={:?}",
+            addr,
+            name,
+            alternate
+        );
+
+        Some(alternate)
+    }
+
+    fn forward_bound(&self, addr: &SocketAddr, channel: u16, forward: &Forward) {
+        self.fastpath.bind(addr, channel, forward)
+    }
+
+    fn forward_removed(&self, addr: &SocketAddr, channel: u16) {
+        self.fastpath.unbind(addr, channel)
     }
 }
@@ -0,0 +1,355 @@
+use crate::{
+    config::{Interface, Relay},
+    router::Router,
+};
+
+use std::{
+    io::ErrorKind,
+    net::{IpAddr, SocketAddr, UdpSocket},
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc, Mutex, RwLock,
+    },
+    thread,
+    time::Duration,
+};
+
+use ahash::AHashMap;
+use bytes::BytesMut;
+use mio::{net, Events, Interest, Poll, Registry, Token};
+
+/// The maximum number of datagrams that are read from one socket before
+/// the other ready sockets get their turn.
+const RELAY_BATCH: usize = 64;
+
+/// The number of readiness events that a poller waits for at once.
+const EVENTS: usize = 1024;
+
+/// The largest udp payload.
+const RECV_BUF_SIZE: usize = 65536;
+
+struct Socket {
+    socket: net::UdpSocket,
+    relay: SocketAddr,
+}
+
+/// a readiness poller, one per thread. the sockets are registered with
+/// their own token, the poller looks the socket of an event up by it.
+struct Poller {
+    registry: Registry,
+    poll: Mutex<Option<Poll>>,
+    tokens: RwLock<AHashMap<Token, Arc<Socket>>>,
+}
+
+/// The traffic of the relay sockets.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct RelayCounts {
+    pub sockets: usize,
+    pub recv_pkts: usize,
+    pub recv_bytes: usize,
+    pub send_pkts: usize,
+    pub send_bytes: usize,
+    pub dropped_pkts: usize,
+}
+
+#[derive(Default)]
+struct Counts {
+    recv_pkts: AtomicUsize,
+    recv_bytes: AtomicUsize,
+    send_pkts: AtomicUsize,
+    send_bytes: AtomicUsize,
+    dropped_pkts: AtomicUsize,
+}
+
+struct Inner {
+    binds: Vec<(IpAddr, IpAddr)>,
+    pollers: Vec<Poller>,
+    sockets: RwLock<AHashMap<SocketAddr, (usize, Token, Arc<Socket>)>>,
+    next_poller: AtomicUsize,
+    next_token: AtomicUsize,
+    counts: Counts,
+}
+
+/// relay sockets of the allocations.
+///
+/// every relayed transport address of an allocation is a udp socket that
+/// the peers outside of the server send to. the sockets are non-blocking
+/// and spread across a few poller threads, each thread waits for the
+/// readiness of all of its sockets with one system call (epoll on linux),
+/// so there is no task or thread per socket and the number of sockets is
+/// only limited by the file descriptors of the process.
+///
+/// the data that is received is encoded for the client of the allocation
+/// and sent through the router to the interface of the client, the data
+/// towards the peers is written to the socket directly by the interface
+/// workers.
+#[derive(Clone)]
+pub struct Relays(Arc<Inner>);
+
+impl Relays {
+    /// create the relay sockets, no poller is created when the relay is
+    /// disabled.
+    ///
+    /// the relay socket of an external ip is bound to the listen ip of the
+    /// interface that has this external ip, which is the ip that the
+    /// external ip is translated to when the server is behind a nat.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::{config::*, relay::*};
+    ///
+    /// let relays = Relays::new(&Relay::default(), &[]).unwrap();
+    /// assert!(!relays.is_enabled());
+    /// ```
+    pub fn new(options: &Relay, interfaces: &[Interface]) -> std::io::Result<Self> {
+        let mut pollers = Vec::with_capacity(options.threads);
+        if options.enabled {
+            for _ in 0..options.threads.max(1) {
+                let poll = Poll::new()?;
+                pollers.push(Poller {
+                    registry: poll.registry().try_clone()?,
+                    poll: Mutex::new(Some(poll)),
+                    tokens: RwLock::new(AHashMap::with_capacity(1024)),
+                });
+            }
+        }
+
+        Ok(Self(Arc::new(Inner {
+            binds: interfaces
+                .iter()
+                .map(|item| (item.external.ip(), item.bind.ip()))
+                .collect(),
+            sockets: RwLock::new(AHashMap::with_capacity(1024)),
+            next_poller: AtomicUsize::new(0),
+            next_token: AtomicUsize::new(0),
+            counts: Counts::default(),
+            pollers,
+        })))
+    }
+
+    /// whether the allocations relay to the peers outside of the server.
+    pub fn is_enabled(&self) -> bool {
+        !self.0.pollers.is_empty()
+    }
+
+    /// start the poller threads.
+    ///
+    /// the data of the peers is checked against the permissions of the
+    /// turn router and forwarded through the router of the interfaces.
+    pub fn start(&self, service: Arc<turn::Router>, router: Arc<Router>) -> std::io::Result<()> {
+        for (index, poller) in self.0.pollers.iter().enumerate() {
+            if let Some(poll) = poller.poll.lock().unwrap().take() {
+                let inner = self.0.clone();
+                let service = service.clone();
+                let router = router.clone();
+                thread::Builder::new()
+                    .name(format!("turn-relay-{}", index))
+                    .spawn(move || poll_loop(poll, index, inner, service, router))?;
+            }
+        }
+
+        Ok(())
+    }
+
+    /// open the relay socket of the relayed transport address.
+    ///
+    /// returns false when the relay is disabled or the address can not be
+    /// bound, for example because the port is used by another process.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::{SocketAddr, UdpSocket};
+    /// use turn_server::{config::*, relay::*};
+    ///
+    /// let options = Relay {
+    ///     enabled: true,
+    ///     threads: 1,
+    /// };
+    ///
+    /// let relays = Relays::new(&options, &[]).unwrap();
+    /// let relay = UdpSocket::bind("127.0.0.1:0")
+    ///     .unwrap()
+    ///     .local_addr()
+    ///     .unwrap();
+    ///
+    /// assert!(relays.open(&relay));
+    /// assert!(!relays.open(&relay));
+    /// assert_eq!(relays.get_counts().sockets, 1);
+    ///
+    /// relays.close(&relay);
+    /// assert_eq!(relays.get_counts().sockets, 0);
+    /// ```
+    pub fn open(&self, relay: &SocketAddr) -> bool {
+        if !self.is_enabled() || self.0.sockets.read().unwrap().contains_key(relay) {
+            return false;
+        }
+
+        let ip = self
+            .0
+            .binds
+            .iter()
+            .find(|(external, _)| *external == relay.ip())
+            .map(|(_, bind)| *bind)
+            .unwrap_or(relay.ip());
+
+        let socket = match UdpSocket::bind(SocketAddr::new(ip, relay.port()))
+            .and_then(|socket| socket.set_nonblocking(true).map(|_| socket))
+        {
+            Ok(socket) => socket,
+            Err(e) => {
+                log::warn!("relay socket bind failed: relay={}, err={}", relay, e);
+                return false;
+            }
+        };
+
+        let index = self.0.next_poller.fetch_add(1, Ordering::Relaxed) % self.0.pollers.len();
+        let token = Token(self.0.next_token.fetch_add(1, Ordering::Relaxed));
+        let poller = &self.0.pollers[index];
+
+        let mut socket = net::UdpSocket::from_std(socket);
+        if let Err(e) = poller
+            .registry
+            .register(&mut socket, token, Interest::READABLE)
+        {
+            log::warn!("relay socket register failed: relay={}, err={}", relay, e);
+            return false;
+        }
+
+        let socket = Arc::new(Socket {
+            relay: *relay,
+            socket,
+        });
+
+        poller.tokens.write().unwrap().insert(token, socket.clone());
+        self.0
+            .sockets
+            .write()
+            .unwrap()
+            .insert(*relay, (index, token, socket));
+        true
+    }
+
+    /// close the relay socket of the relayed transport address.
+    ///
+    /// closing the socket also removes it from the poller, the socket is
+    /// closed as soon as the poller is done with it.
+    pub fn close(&self, relay: &SocketAddr) {
+        let removed = self.0.sockets.write().unwrap().remove(relay);
+        if let Some((index, token, _)) = removed {
+            self.0.pollers[index].tokens.write().unwrap().remove(&token);
+        }
+    }
+
+    /// send the data to the peer from the relay socket.
+    ///
+    /// the socket is non-blocking, the datagram is dropped when the send
+    /// buffer of the socket is full.
+    pub fn send(&self, relay: &SocketAddr, peer: &SocketAddr, data: &[u8]) {
+        let counts = &self.0.counts;
+        let sent = match self.0.sockets.read().unwrap().get(relay) {
+            Some((_, _, socket)) => socket.socket.send_to(data, *peer).is_ok(),
+            None => false,
+        };
+
+        if sent {
+            counts.send_pkts.fetch_add(1, Ordering::Relaxed);
+            counts.send_bytes.fetch_add(data.len(), Ordering::Relaxed);
+        } else {
+            counts.dropped_pkts.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// get the number of relay sockets and their traffic.
+    pub fn get_counts(&self) -> RelayCounts {
+        let counts = &self.0.counts;
+        RelayCounts {
+            sockets: self.0.sockets.read().unwrap().len(),
+            recv_pkts: counts.recv_pkts.load(Ordering::Relaxed),
+            recv_bytes: counts.recv_bytes.load(Ordering::Relaxed),
+            send_pkts: counts.send_pkts.load(Ordering::Relaxed),
+            send_bytes: counts.send_bytes.load(Ordering::Relaxed),
+            dropped_pkts: counts.dropped_pkts.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// the loop of a poller thread.
+///
+/// the readiness is edge triggered, so a socket is read until it would
+/// block. a socket that still has data after a batch is put back to be
+/// read again after the other ready sockets, without waiting for a new
+/// event.
+fn poll_loop(
+    mut poll: Poll,
+    index: usize,
+    inner: Arc<Inner>,
+    service: Arc<turn::Router>,
+    router: Arc<Router>,
+) {
+    let mut events = Events::with_capacity(EVENTS);
+    let mut pending = Vec::<Token>::with_capacity(EVENTS);
+    let mut ready = Vec::<Token>::with_capacity(EVENTS);
+    let mut buf = vec![0u8; RECV_BUF_SIZE];
+    let mut bytes = BytesMut::with_capacity(4096);
+
+    loop {
+        let timeout = (!pending.is_empty()).then_some(Duration::ZERO);
+        if let Err(e) = poll.poll(&mut events, timeout) {
+            if e.kind() == ErrorKind::Interrupted {
+                continue;
+            }
+
+            log::error!("relay poll failed: err={}", e);
+            break;
+        }
+
+        ready.clear();
+        ready.append(&mut pending);
+        ready.extend(events.iter().map(|event| event.token()));
+        for token in ready.iter() {
+            let socket = match inner.pollers[index].tokens.read().unwrap().get(token) {
+                Some(socket) => socket.clone(),
+                None => continue,
+            };
+
+            let mut drained = false;
+            for _ in 0..RELAY_BATCH {
+                let (size, peer) = match socket.socket.recv_from(&mut buf) {
+                    Ok(ret) => ret,
+                    Err(e) => {
+                        if e.kind() != ErrorKind::WouldBlock {
+                            log::warn!(
+                                "relay socket recv failed: relay={}, err={}",
+                                socket.relay,
+                                e
+                            );
+                        }
+
+                        drained = true;
+                        break;
+                    }
+                };
+
+                inner.counts.recv_pkts.fetch_add(1, Ordering::Relaxed);
+                inner.counts.recv_bytes.fetch_add(size, Ordering::Relaxed);
+                if let Ok(Some(res)) = turn::processor::peer::process(
+                    &service,
+                    &socket.relay,
+                    &peer,
+                    &buf[..size],
+                    &mut bytes,
+                ) {
+                    if let (Some(to), Some(target)) = (res.interface, res.relay) {
+                        router.send(&to, res.kind, &target, res.data);
+                    }
+                }
+            }
+
+            if !drained {
+                pending.push(*token);
+            }
+        }
+    }
+}
@@ -1,18 +1,309 @@
-use std::{net::SocketAddr, sync::RwLock};
+use std::{
+    cell::RefCell,
+    collections::VecDeque,
+    hash::{BuildHasher, Hash, Hasher},
+    net::SocketAddr,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc, Mutex, RwLock,
+    },
+};
 
-use ahash::AHashMap;
-use tokio::sync::mpsc::*;
+use ahash::{AHashMap, RandomState};
+use bytes::{Bytes, BytesMut};
+use tokio::sync::Notify;
 use turn::StunClass;
 
-type Receiver = UnboundedSender<(Vec<u8>, StunClass, SocketAddr)>;
+use crate::{
+    cluster::Cluster,
+    config::{DropPolicy, Queue},
+    relay::Relays,
+    statistics::{Stats, StatisticsActor},
+    trace::{Stage, Trace, Tracer},
+};
+
+/// A packet forwarded by the router, the payload, the kind of payload, the
+/// destination address and the trace of a sampled packet.
+pub type Packet = (Bytes, StunClass, SocketAddr, Option<Box<Trace>>);
+
+/// The size of one pool chunk, packets forwarded by the router are copied
+/// into the chunk and handed out as shared slices of it.
+const POOL_CHUNK_SIZE: usize = 64 * 1024;
+
+thread_local! {
+    static POOL: RefCell<BytesMut> = RefCell::new(BytesMut::with_capacity(POOL_CHUNK_SIZE));
+}
+
+/// Copy the packet into the pool of the current thread.
+///
+/// The packets share the chunk of the pool, so there is one allocation per
+/// chunk instead of one per packet. When all the packets of a chunk have
+/// been sent and dropped, the chunk is reclaimed by `reserve` instead of
+/// allocating a new one.
+fn to_bytes(data: &[u8]) -> Bytes {
+    POOL.with(|pool| {
+        let mut pool = pool.borrow_mut();
+        if pool.capacity() < data.len() {
+            pool.reserve(POOL_CHUNK_SIZE.max(data.len()));
+        }
+
+        pool.extend_from_slice(data);
+        pool.split().freeze()
+    })
+}
+
+#[derive(Default)]
+struct State {
+    packets: VecDeque<Packet>,
+    bytes: usize,
+    closed: bool,
+}
+
+impl State {
+    fn is_full(&self, options: &Queue, size: usize) -> bool {
+        self.packets.len() >= options.max_packets
+            || (!self.packets.is_empty() && self.bytes + size > options.max_bytes)
+    }
+
+    fn pop_front(&mut self) -> Option<Packet> {
+        let packet = self.packets.pop_front()?;
+        self.bytes -= packet.0.len();
+        Some(packet)
+    }
+
+    /// remove the oldest media packet, the stun messages are kept.
+    fn pop_media(&mut self) -> Option<Packet> {
+        let index = self
+            .packets
+            .iter()
+            .position(|(_, kind, ..)| *kind == StunClass::Channel)?;
+        let packet = self.packets.remove(index)?;
+        self.bytes -= packet.0.len();
+        Some(packet)
+    }
+}
+
+/// A bounded single consumer packet queue.
+///
+/// The queue is limited by the number of packets and the number of bytes,
+/// when either budget is exceeded packets are dropped according to the drop
+/// policy instead of letting the queue grow without limit.
+#[derive(Default)]
+struct Endpoint {
+    state: Mutex<State>,
+    notify: Notify,
+    /// the endpoint of a stream transport, whose stun messages are never
+    /// dropped.
+    stream: bool,
+}
+
+impl Endpoint {
+    /// push a packet into the queue, the dropped packets are passed to
+    /// `dropped`.
+    ///
+    /// returns false if the receiver has been dropped.
+    fn push(&self, options: &Queue, packet: Packet, mut dropped: impl FnMut(&Packet)) -> bool {
+        {
+            let mut state = self.state.lock().unwrap();
+            if state.closed {
+                return false;
+            }
+
+            // The clients do not retransmit the stun messages over a stream
+            // (RFC 8489 section 6.2.2), a dropped response would stall the
+            // transaction, so they go over the bound instead whatever the
+            // policy is.
+            let keep = self.stream && packet.1 == StunClass::Msg;
+            let size = packet.0.len();
+            while state.is_full(options, size) {
+                let evicted = match options.policy {
+                    DropPolicy::DropOldest if self.stream => state.pop_media(),
+                    DropPolicy::DropOldest => state.pop_front(),
+                    DropPolicy::DropNewest => None,
+                    DropPolicy::KeepStun if packet.1 == StunClass::Msg => state.pop_media(),
+                    DropPolicy::KeepStun => None,
+                };
+
+                match evicted {
+                    Some(evicted) => dropped(&evicted),
+                    None if keep => break,
+                    None => {
+                        dropped(&packet);
+                        return true;
+                    }
+                }
+            }
+
+            state.bytes += size;
+            state.packets.push_back(packet);
+        }
+
+        self.notify.notify_one();
+        true
+    }
+
+    fn close(&self) {
+        self.state.lock().unwrap().closed = true;
+        self.notify.notify_one();
+    }
+}
+
+/// The endpoint reader of the route.
+pub struct Receiver(Arc<Endpoint>);
+
+impl Receiver {
+    /// Receive the next packet.
+    ///
+    /// Returns `None` when the endpoint has been removed from the router and
+    /// all the queued packets have been received.
+    pub async fn recv(&mut self) -> Option<Packet> {
+        loop {
+            {
+                let mut state = self.0.state.lock().unwrap();
+                if let Some(packet) = state.pop_front() {
+                    return Some(packet);
+                }
+
+                if state.closed {
+                    return None;
+                }
+            }
+
+            self.0.notify.notified().await;
+        }
+    }
+
+    /// Receive the next packet if there is one, without waiting.
+    pub fn try_recv(&mut self) -> Option<Packet> {
+        self.0.state.lock().unwrap().pop_front()
+    }
+
+    /// Whether there is no packet in the queue.
+    pub fn is_empty(&self) -> bool {
+        self.0.state.lock().unwrap().packets.is_empty()
+    }
+}
+
+impl Drop for Receiver {
+    fn drop(&mut self) {
+        self.0.close();
+    }
+}
+
+/// The packets waiting in the endpoint queues of the router and the packets
+/// dropped from them.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct QueueCounts {
+    pub packets: usize,
+    pub bytes: usize,
+    pub dropped_pkts: usize,
+    pub dropped_bytes: usize,
+}
 
 /// Handles packet forwarding between transport protocols.
+///
+/// an endpoint can have several receivers (one per socket shard), in which
+/// case packets are spread across them by the hash of the destination
+/// address, so the packets of one peer always leave from the same shard and
+/// keep their order.
 #[derive(Default)]
 pub struct Router {
-    senders: RwLock<AHashMap<SocketAddr, Receiver>>,
+    senders: RwLock<AHashMap<SocketAddr, Vec<Arc<Endpoint>>>>,
+    hasher: RandomState,
+    options: Queue,
+    actor: Option<StatisticsActor>,
+    relays: Option<Relays>,
+    cluster: Option<Cluster>,
+    tracer: Tracer,
+    dropped_pkts: AtomicUsize,
+    dropped_bytes: AtomicUsize,
 }
 
 impl Router {
+    /// Create a router with bounded endpoint queues.
+    ///
+    /// the dropped packets are counted in the statistics of the session that
+    /// they are addressed to.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::StunClass;
+    /// use turn_server::{config::*, router::*, statistics::*};
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///     let statistics = Statistics::default();
+    ///     let options = Queue {
+    ///         max_packets: 1,
+    ///         max_bytes: 1024,
+    ///         policy: DropPolicy::DropNewest,
+    ///     };
+    ///
+    ///     statistics.set(addr, "test");
+    ///     let router = Router::new(options, statistics.get_actor());
+    ///     let mut receiver = router.get_receiver(addr);
+    ///
+    ///     router.send(&addr, StunClass::Channel, &addr, &[1, 2, 3]);
+    ///     router.send(&addr, StunClass::Channel, &addr, &[4, 5, 6]);
+    ///     assert_eq!(receiver.recv().await.unwrap().0, vec![1, 2, 3]);
+    ///     assert!(receiver.try_recv().is_none());
+    ///     assert_eq!(statistics.get(&addr).unwrap().dropped_pkts, 1);
+    /// }
+    /// ```
+    pub fn new(options: Queue, actor: StatisticsActor) -> Self {
+        Self {
+            actor: Some(actor),
+            options,
+            ..Default::default()
+        }
+    }
+
+    /// send the data towards the external peers from the relay sockets.
+    ///
+    /// the data of the `Peer` class is not queued, the interface of it is
+    /// the relayed transport address that it is sent from.
+    pub fn with_relays(mut self, relays: Relays) -> Self {
+        self.relays = Some(relays);
+        self
+    }
+
+    /// get the relay sockets.
+    pub fn get_relays(&self) -> Option<&Relays> {
+        self.relays.as_ref()
+    }
+
+    /// send the data towards the allocations of the other nodes of the
+    /// cluster through the inter-node protocol.
+    ///
+    /// the data of the `Peer` class goes to the cluster when the ip of the
+    /// peer is a relay ip of another node, and to the relay sockets
+    /// otherwise.
+    pub fn with_cluster(mut self, cluster: Cluster) -> Self {
+        self.cluster = Some(cluster);
+        self
+    }
+
+    /// get the cluster.
+    pub fn get_cluster(&self) -> Option<&Cluster> {
+        self.cluster.as_ref()
+    }
+
+    /// trace the sampled packets with the tracer, the router finishes the
+    /// traces of the packets that it hands to the relay sockets and the
+    /// cluster, the senders of the queues finish the rest.
+    pub fn with_tracer(mut self, tracer: Tracer) -> Self {
+        self.tracer = tracer;
+        self
+    }
+
+    /// get the tracer.
+    pub fn get_tracer(&self) -> &Tracer {
+        &self.tracer
+    }
+
     /// Get the endpoint reader for the route.
     ///
     /// Each transport protocol is layered according to its own endpoint, and
@@ -38,13 +329,109 @@ impl Router {
     ///     assert_eq!(ret.2, addr);
     /// }
     /// ```
-    pub fn get_receiver(
-        &self,
-        interface: SocketAddr,
-    ) -> UnboundedReceiver<(Vec<u8>, StunClass, SocketAddr)> {
-        let (sender, receiver) = unbounded_channel();
-        self.senders.write().unwrap().insert(interface, sender);
-        receiver
+    pub fn get_receiver(&self, interface: SocketAddr) -> Receiver {
+        self.get_receivers(interface, 1).pop().unwrap()
+    }
+
+    /// Get multiple endpoint readers for the route.
+    ///
+    /// The data forwarded to this endpoint is distributed to the readers by
+    /// the destination address, one reader per socket shard.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::StunClass;
+    /// use turn_server::router::*;
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///     let router = Router::default();
+    ///     let mut receivers = router.get_receivers(addr, 4);
+    ///     assert_eq!(receivers.len(), 4);
+    ///
+    ///     router.send(&addr, StunClass::Channel, &addr, &[1, 2, 3]);
+    ///     router.send(&addr, StunClass::Channel, &addr, &[4, 5, 6]);
+    ///
+    ///     let receiver = receivers
+    ///         .iter_mut()
+    ///         .find(|receiver| !receiver.is_empty())
+    ///         .unwrap();
+    ///     assert_eq!(receiver.recv().await.unwrap().0, vec![1, 2, 3]);
+    ///     assert_eq!(receiver.recv().await.unwrap().0, vec![4, 5, 6]);
+    /// }
+    /// ```
+    pub fn get_receivers(&self, interface: SocketAddr, count: usize) -> Vec<Receiver> {
+        self.insert_endpoints(interface, count, false)
+    }
+
+    /// Get the endpoint reader for the route of a stream transport.
+    ///
+    /// the stun messages of the endpoint are never dropped when its queue is
+    /// full, only the media is.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::StunClass;
+    /// use turn_server::{config::*, router::*, statistics::*};
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///     let statistics = Statistics::default();
+    ///     let options = Queue {
+    ///         max_packets: 2,
+    ///         max_bytes: 1024,
+    ///         policy: DropPolicy::DropNewest,
+    ///     };
+    ///
+    ///     let router = Router::new(options, statistics.get_actor());
+    ///     let mut receiver = router.get_stream_receiver(addr);
+    ///
+    ///     // the queue is full of channel data, the response still gets
+    ///     // through while more channel data is dropped.
+    ///     for _ in 0..3 {
+    ///         router.send(&addr, StunClass::Channel, &addr, &[1, 2, 3]);
+    ///     }
+    ///
+    ///     router.send(&addr, StunClass::Msg, &addr, &[4, 5, 6]);
+    ///     router.send(&addr, StunClass::Channel, &addr, &[1, 2, 3]);
+    ///
+    ///     let mut received = Vec::new();
+    ///     while let Some(packet) = receiver.try_recv() {
+    ///         received.push(packet.1);
+    ///     }
+    ///
+    ///     assert_eq!(
+    ///         received,
+    ///         vec![StunClass::Channel, StunClass::Channel, StunClass::Msg]
+    ///     );
+    ///     assert_eq!(router.get_queue_counts().dropped_pkts, 2);
+    /// }
+    /// ```
+    pub fn get_stream_receiver(&self, interface: SocketAddr) -> Receiver {
+        self.insert_endpoints(interface, 1, true).pop().unwrap()
+    }
+
+    fn insert_endpoints(&self, interface: SocketAddr, count: usize, stream: bool) -> Vec<Receiver> {
+        let endpoints = (0..count.max(1))
+            .map(|_| {
+                Arc::new(Endpoint {
+                    stream,
+                    ..Endpoint::default()
+                })
+            })
+            .collect::<Vec<_>>();
+        let receivers = endpoints.iter().cloned().map(Receiver).collect();
+        if let Some(previous) = self.senders.write().unwrap().insert(interface, endpoints) {
+            previous.iter().for_each(|endpoint| endpoint.close());
+        }
+
+        receivers
     }
 
     /// Send data to router.
@@ -52,7 +439,9 @@ impl Router {
     /// By specifying the endpoint identifier and destination address, the route
     /// is forwarded to the corresponding endpoint. However, it should be noted
     /// that calling this function will not notify whether the endpoint exists.
-    /// If it does not exist, the data will be discarded by default.
+    /// If it does not exist, the data will be discarded by default. If the
+    /// queue of the endpoint is full, packets are dropped according to the
+    /// drop policy.
     ///
     /// # Example
     ///
@@ -75,21 +464,149 @@ impl Router {
     /// }
     /// ```
     pub fn send(&self, interface: &SocketAddr, class: StunClass, addr: &SocketAddr, data: &[u8]) {
-        let mut is_destroy = false;
+        self.send_traced(interface, class, addr, data, None)
+    }
+
+    /// send the data to the router with the trace of a sampled packet, the
+    /// trace goes through the queue with the packet.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::{net::SocketAddr, time::Instant};
+    /// use turn::StunClass;
+    /// use turn_server::{router::*, trace::*};
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///     let router = Router::default();
+    ///     let mut receiver = router.get_receiver(addr);
+    ///
+    ///     let trace = Trace::new(addr, &[0x40, 0x00, 0x00, 0x00], Instant::now());
+    ///     router.send_traced(&addr, StunClass::Channel, &addr, &[1, 2, 3], Some(trace));
+    ///
+    ///     let ret = receiver.recv().await.unwrap();
+    ///     assert_eq!(ret.0, vec![1, 2, 3]);
+    ///     assert!(ret.3.is_some());
+    /// }
+    /// ```
+    pub fn send_traced(
+        &self,
+        interface: &SocketAddr,
+        class: StunClass,
+        addr: &SocketAddr,
+        data: &[u8],
+        trace: Option<Box<Trace>>,
+    ) {
+        if class == StunClass::Peer {
+            if let Some(cluster) = &self.cluster {
+                if cluster.is_member(&addr.ip()) {
+                    cluster.send(interface, addr, data);
+                    self.finish(trace);
+                    return;
+                }
+            }
+
+            if let Some(relays) = &self.relays {
+                relays.send(interface, addr, data);
+            }
+
+            self.finish(trace);
+            return;
+        }
+
+        let mut closed = None;
 
         {
-            if let Some(sender) = self.senders.read().unwrap().get(interface) {
-                if sender.send((data.to_vec(), class, *addr)).is_err() {
-                    is_destroy = true;
+            if let Some(senders) = self.senders.read().unwrap().get(interface) {
+                let sender = if senders.len() > 1 {
+                    let mut hasher = self.hasher.build_hasher();
+                    addr.hash(&mut hasher);
+                    &senders[hasher.finish() as usize % senders.len()]
+                } else {
+                    &senders[0]
+                };
+
+                let packet = (to_bytes(data), class, *addr, trace);
+                if !sender.push(&self.options, packet, |(bytes, _, addr, _)| {
+                    self.dropped_pkts.fetch_add(1, Ordering::Relaxed);
+                    self.dropped_bytes.fetch_add(bytes.len(), Ordering::Relaxed);
+                    if let Some(actor) = &self.actor {
+                        actor.send_shared(
+                            addr,
+                            &[Stats::DroppedBytes(bytes.len()), Stats::DroppedPkts(1)],
+                        );
+                    }
+                }) {
+                    closed = Some(sender.clone());
                 }
             }
         }
 
-        if is_destroy {
-            self.remove(interface);
+        // Only the shard whose receiver is gone is removed, the other
+        // shards of the interface keep forwarding.
+        if let Some(endpoint) = closed {
+            self.remove_endpoint(interface, &endpoint);
         }
     }
 
+    fn finish(&self, trace: Option<Box<Trace>>) {
+        if let Some(mut trace) = trace {
+            trace.lap(Stage::Send);
+            self.tracer.finish(trace);
+        }
+    }
+
+    /// get the depth of the endpoint queues and the number of dropped
+    /// packets.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::StunClass;
+    /// use turn_server::{config::*, router::*, statistics::*};
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///     let statistics = Statistics::default();
+    ///     let options = Queue {
+    ///         max_packets: 1,
+    ///         max_bytes: 1024,
+    ///         policy: DropPolicy::DropNewest,
+    ///     };
+    ///
+    ///     let router = Router::new(options, statistics.get_actor());
+    ///     let _receiver = router.get_receiver(addr);
+    ///
+    ///     router.send(&addr, StunClass::Channel, &addr, &[1, 2, 3]);
+    ///     router.send(&addr, StunClass::Channel, &addr, &[4, 5]);
+    ///
+    ///     let counts = router.get_queue_counts();
+    ///     assert_eq!(counts.packets, 1);
+    ///     assert_eq!(counts.bytes, 3);
+    ///     assert_eq!(counts.dropped_pkts, 1);
+    ///     assert_eq!(counts.dropped_bytes, 2);
+    /// }
+    /// ```
+    pub fn get_queue_counts(&self) -> QueueCounts {
+        let mut counts = QueueCounts {
+            dropped_pkts: self.dropped_pkts.load(Ordering::Relaxed),
+            dropped_bytes: self.dropped_bytes.load(Ordering::Relaxed),
+            ..Default::default()
+        };
+
+        for endpoint in self.senders.read().unwrap().values().flatten() {
+            let state = endpoint.state.lock().unwrap();
+            counts.packets += state.packets.len();
+            counts.bytes += state.bytes;
+        }
+
+        counts
+    }
+
     /// delete endpoint.
     ///
     /// # Example
@@ -116,6 +633,51 @@ impl Router {
     /// }
     /// ```
     pub fn remove(&self, interface: &SocketAddr) {
-        drop(self.senders.write().unwrap().remove(interface))
+        if let Some(endpoints) = self.senders.write().unwrap().remove(interface) {
+            endpoints.iter().for_each(|endpoint| endpoint.close());
+        }
+    }
+
+    /// delete the endpoint of one receiver, the packets of the interface
+    /// are spread across its other receivers, and the interface is deleted
+    /// with its last receiver.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::StunClass;
+    /// use turn_server::router::*;
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///     let router = Router::default();
+    ///     let mut receivers = router.get_receivers(addr, 2);
+    ///
+    ///     router.remove_receiver(&addr, &receivers[0]);
+    ///     assert!(receivers[0].recv().await.is_none());
+    ///
+    ///     router.send(&addr, StunClass::Channel, &addr, &[1, 2, 3]);
+    ///     assert_eq!(receivers[1].recv().await.unwrap().0, vec![1, 2, 3]);
+    ///
+    ///     router.remove_receiver(&addr, &receivers[1]);
+    ///     assert!(receivers[1].recv().await.is_none());
+    /// }
+    /// ```
+    pub fn remove_receiver(&self, interface: &SocketAddr, receiver: &Receiver) {
+        self.remove_endpoint(interface, &receiver.0);
+    }
+
+    fn remove_endpoint(&self, interface: &SocketAddr, endpoint: &Arc<Endpoint>) {
+        endpoint.close();
+
+        let mut senders = self.senders.write().unwrap();
+        if let Some(endpoints) = senders.get_mut(interface) {
+            endpoints.retain(|it| !Arc::ptr_eq(it, endpoint));
+            if endpoints.is_empty() {
+                senders.remove(interface);
+            }
+        }
     }
 }
@@ -1,53 +1,145 @@
 use crate::{
+    auth::Authenticator,
+    cluster::Cluster,
     config::{Config, Interface, Transport},
-    router::Router,
-    statistics::{Statistics, Stats},
+    metrics::{Method, Metrics, Recorder},
+    relay::Relays,
+    router::{Packet, Receiver, Router},
+    statistics::{InterfaceActor, Statistics, StatisticsActor, Stats},
+    tls,
+    trace::{Stage, Tracer},
 };
 
-use std::{io::ErrorKind::ConnectionReset, net::SocketAddr, sync::Arc};
+use std::{
+    io::{ErrorKind, ErrorKind::ConnectionReset, IoSlice},
+    net::SocketAddr,
+    sync::Arc,
+    time::{Duration, Instant},
+};
 
 use bytes::BytesMut;
 use stun::Decoder;
 use tokio::{
-    io::AsyncReadExt,
-    io::AsyncWriteExt,
+    io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt},
     net::{TcpListener, UdpSocket},
-    sync::Mutex,
+    time::timeout,
 };
 
-use turn::{Service, StunClass};
+use tokio_rustls::TlsAcceptor;
+
+use turn::{Processor, Service, StunClass};
+
+#[cfg(target_os = "linux")]
+use crate::mmsg;
 
 /// start turn server.
 ///
 /// create a specified number of threads,
 /// each thread processes udp data separately.
+///
+/// returns the router that the interfaces forward packets through, the
+/// pollers of the relay sockets and the threads of the cluster are started
+/// with it.
 pub async fn run(
     config: Arc<Config>,
     statistics: Statistics,
+    metrics: Metrics,
+    relays: Relays,
+    cluster: Cluster,
     service: &Service,
-) -> anyhow::Result<()> {
-    let router = Arc::new(Router::default());
+) -> anyhow::Result<Arc<Router>> {
+    let router = Arc::new(
+        Router::new(config.turn.queue.clone(), statistics.get_actor())
+            .with_relays(relays.clone())
+            .with_cluster(cluster.clone())
+            .with_tracer(Tracer::new(&config.turn.trace, metrics.clone())),
+    );
+
+    relays.start(service.get_router().clone(), router.clone())?;
+    cluster.start(service.get_router().clone(), router.clone())?;
+
+    let auth = Authenticator::new(
+        &config.turn.auth,
+        service.clone(),
+        router.clone(),
+        metrics.clone(),
+    );
     for Interface {
         transport,
         external,
         bind,
+        batch,
+        reuse_port,
+        cert,
+        key,
     } in config.turn.interfaces.clone()
     {
-        if transport == Transport::UDP {
+        if transport == Transport::UDP && reuse_port {
+            #[cfg(target_os = "linux")]
+            udp_sharded_server(
+                crate::shard::bind(bind, num_cpus::get())?,
+                external,
+                batch,
+                service.clone(),
+                router.clone(),
+                auth.clone(),
+                statistics.clone(),
+                metrics.clone(),
+            )?;
+
+            #[cfg(not(target_os = "linux"))]
+            {
+                log::warn!(
+                    "udp reuse port is only supported on linux, ignored: interface={:?}",
+                    bind
+                );
+
+                tokio::spawn(udp_server(
+                    UdpSocket::bind(bind).await?,
+                    external,
+                    batch,
+                    service.clone(),
+                    router.clone(),
+                    auth.clone(),
+                    statistics.clone(),
+                    metrics.clone(),
+                ));
+            }
+        } else if transport == Transport::UDP {
             tokio::spawn(udp_server(
                 UdpSocket::bind(bind).await?,
                 external,
+                batch,
                 service.clone(),
                 router.clone(),
+                auth.clone(),
                 statistics.clone(),
+                metrics.clone(),
             ));
         } else {
+            let tls = if transport == Transport::TLS {
+                match (&cert, &key) {
+                    (Some(cert), Some(key)) => Some(tls::acceptor(cert, key)?),
+                    _ => {
+                        return Err(anyhow::anyhow!(
+                            "tls interface requires a cert and a key: interface={}",
+                            bind
+                        ))
+                    }
+                }
+            } else {
+                None
+            };
+
             tokio::spawn(tcp_server(
                 TcpListener::bind(bind).await?,
+                tls,
                 external,
                 service.clone(),
                 router.clone(),
+                auth.clone(),
                 statistics.clone(),
+                metrics.clone(),
             ));
         }
 
@@ -59,21 +151,35 @@ pub async fn run(
         );
     }
 
-    Ok(())
+    Ok(router)
 }
 
 static ZERO_BUF: [u8; 4] = [0u8; 4];
 
+/// The maximum number of frames that a tcp connection writes with one
+/// system call.
+const TCP_BATCH: usize = 64;
+
+/// The time that a tls client has to complete the handshake.
+const TLS_HANDSHAKE_TIMEOUT: Duration = Duration::from_secs(10);
+
 /// tcp socket process thread.
 ///
 /// This function is used to handle all connections coming from the tcp
 /// listener, and handle the receiving, sending and forwarding of messages.
+/// when the interface has a tls acceptor, every connection does the tls
+/// handshake first, on its own task so that a slow client does not hold up
+/// the listener.
+#[allow(clippy::too_many_arguments)]
 async fn tcp_server(
     listen: TcpListener,
+    tls: Option<TlsAcceptor>,
     external: SocketAddr,
     service: Service,
     router: Arc<Router>,
+    auth: Authenticator,
     statistics: Statistics,
+    metrics: Metrics,
 ) {
     let local_addr = listen
         .local_addr()
@@ -82,11 +188,6 @@ async fn tcp_server(
     // Accept all connections on the current listener, but exit the entire
     // process when an error occurs.
     while let Ok((socket, addr)) = listen.accept().await {
-        let router = router.clone();
-        let actor = statistics.get_actor();
-        let mut receiver = router.get_receiver(addr);
-        let mut processor = service.get_processor(addr, external);
-
         log::info!(
             "tcp socket accept: addr={:?}, interface={:?}",
             addr,
@@ -100,39 +201,91 @@ async fn tcp_server(
             log::error!("tcp socket set nodelay failed!: addr={}, err={}", addr, e);
         }
 
-        let (mut reader, writer) = socket.into_split();
-        let writer = Arc::new(Mutex::new(writer));
-        let writer_ = writer.clone();
-        let actor_ = actor.clone();
-
-        // Use a separate task to handle messages forwarded to this socket.
-        tokio::spawn(async move {
-            while let Some((bytes, kind, _)) = receiver.recv().await {
-                let mut writer = writer_.lock().await;
-                if writer.write_all(bytes.as_slice()).await.is_err() {
-                    break;
-                } else {
-                    actor_.send(&addr, &[Stats::SendBytes(bytes.len()), Stats::SendPkts(1)]);
-                }
+        let session = TcpSession {
+            processor: service.get_processor(addr, external),
+            actor: statistics.get_actor(),
+            router: router.clone(),
+            auth: auth.clone(),
+            metrics: metrics.clone(),
+            local_addr,
+            external,
+            addr,
+        };
 
-                // The channel data needs to be aligned in multiples of 4 in
-                // tcp. If the channel data is forwarded to tcp, the alignment
-                // bit needs to be filled, because if the channel data comes
-                // from udp, it is not guaranteed to be aligned and needs to be
-                // checked.
-                if kind == StunClass::Channel {
-                    let pad = bytes.len() % 4;
-                    if pad > 0 && writer.write_all(&ZERO_BUF[..(4 - pad)]).await.is_err() {
-                        break;
+        match &tls {
+            None => {
+                let (reader, writer) = socket.into_split();
+                session.spawn(reader, writer);
+            }
+            Some(acceptor) => {
+                let acceptor = acceptor.clone();
+                tokio::spawn(async move {
+                    match timeout(TLS_HANDSHAKE_TIMEOUT, acceptor.accept(socket)).await {
+                        Ok(Ok(stream)) => {
+                            let (reader, writer) = tokio::io::split(stream);
+                            session.spawn(reader, writer);
+                        }
+                        Ok(Err(e)) => {
+                            log::warn!("tls handshake failed: addr={:?}, err={}", addr, e);
+                        }
+                        Err(_) => {
+                            log::warn!("tls handshake timeout: addr={:?}", addr);
+                        }
                     }
-                }
+                });
             }
-        });
+        }
+    }
+
+    log::error!("tcp server close: interface={:?}", local_addr);
+}
+
+/// The state of a tcp connection, plain or over tls.
+struct TcpSession {
+    processor: Processor,
+    actor: StatisticsActor,
+    router: Arc<Router>,
+    auth: Authenticator,
+    metrics: Metrics,
+    local_addr: SocketAddr,
+    external: SocketAddr,
+    addr: SocketAddr,
+}
+
+impl TcpSession {
+    /// spawn the reader and the writer task of the connection.
+    fn spawn<R, W>(self, mut reader: R, writer: W)
+    where
+        R: AsyncRead + Unpin + Send + 'static,
+        W: AsyncWrite + Unpin + Send + 'static,
+    {
+        let Self {
+            mut processor,
+            mut actor,
+            router,
+            auth,
+            metrics,
+            local_addr,
+            external,
+            addr,
+        } = self;
+
+        // The connection has a single writer task, the responses of the
+        // reader are queued with the forwarded packets, so the socket needs
+        // no lock and the queued frames are written together.
+        let receiver = router.get_stream_receiver(addr);
+        let tracer = router.get_tracer().clone();
+        tokio::spawn(tcp_writer(writer, receiver, actor.clone(), tracer, addr));
 
         tokio::spawn(async move {
+            let mut sampler = router.get_tracer().get_sampler();
             let mut buf = BytesMut::new();
 
-            'a: while let Ok(size) = reader.read_buf(&mut buf).await {
+            while let Ok(size) = reader.read_buf(&mut buf).await {
+                // The messages of this read wait for the ones before them
+                // from here.
+                let received = sampler.is_enabled().then(Instant::now);
+
                 // When the received message is 0, it means that the socket
                 // has been closed.
                 if size == 0 {
@@ -166,20 +319,28 @@ async fn tcp_server(
                     };
 
                     let chunk = buf.split_to(size);
-                    if let Ok(Some(res)) = processor.process(&chunk, addr).await {
-                        let target = res.relay.unwrap_or(addr);
-                        if let Some(to) = res.interface {
-                            router.send(&to, res.kind, &target, res.data);
-                        } else {
-                            if writer.lock().await.write_all(res.data).await.is_err() {
-                                break 'a;
-                            }
+                    if processor.requires_key(&chunk, addr) {
+                        auth.submit(&chunk, addr, addr, external);
+                        continue;
+                    }
 
-                            actor.send(
-                                &addr,
-                                &[Stats::SendBytes(res.data.len()), Stats::SendPkts(1)],
-                            );
+                    let mut trace = sampler.sample().then(|| {
+                        sampler.start(&chunk, addr, received.unwrap_or_else(Instant::now))
+                    });
+
+                    // The connections share the histograms, a slab for every
+                    // connection would cost more than it saves.
+                    let start = Instant::now();
+                    let ret = processor.process(&chunk, addr).await;
+                    metrics.record(Method::of(&chunk), start.elapsed());
+                    if let Ok(Some(res)) = ret {
+                        if let Some(trace) = &mut trace {
+                            trace.lap(Stage::Process);
                         }
+
+                        let target = res.relay.unwrap_or(addr);
+                        let to = res.interface.unwrap_or(addr);
+                        router.send_traced(&to, res.kind, &target, res.data, trace);
                     }
                 }
             }
@@ -192,8 +353,89 @@ async fn tcp_server(
             );
         });
     }
+}
 
-    log::error!("tcp server close: interface={:?}", local_addr);
+/// tcp connection writer.
+///
+/// waits for the next frame of the connection, takes the frames that are
+/// already queued behind it, and writes them all with one vectored write.
+/// returns when the router endpoint is removed or the socket fails.
+async fn tcp_writer<W: AsyncWrite + Unpin>(
+    mut writer: W,
+    mut receiver: Receiver,
+    mut actor: StatisticsActor,
+    tracer: Tracer,
+    addr: SocketAddr,
+) {
+    let mut frames = Vec::with_capacity(TCP_BATCH);
+
+    while let Some(packet) = receiver.recv().await {
+        frames.push(dequeued(packet));
+        while frames.len() < TCP_BATCH {
+            match receiver.try_recv() {
+                Some(packet) => frames.push(dequeued(packet)),
+                None => break,
+            }
+        }
+
+        if write_frames(&mut writer, &frames).await.is_err() {
+            break;
+        }
+
+        for (bytes, _, _, trace) in frames.drain(..) {
+            actor.send(&addr, &[Stats::SendBytes(bytes.len()), Stats::SendPkts(1)]);
+            if let Some(mut trace) = trace {
+                trace.lap(Stage::Send);
+                tracer.finish(trace);
+            }
+        }
+    }
+}
+
+/// end the queue stage of a traced packet that has been taken from the
+/// queue.
+#[inline(always)]
+fn dequeued(mut packet: Packet) -> Packet {
+    if let Some(trace) = &mut packet.3 {
+        trace.lap(Stage::Queue);
+    }
+
+    packet
+}
+
+/// write the frames to the tcp socket, as few system calls as the socket
+/// accepts, and flush it.
+///
+/// The channel data needs to be aligned in multiples of 4 in tcp. If the
+/// channel data is forwarded to tcp, the alignment bit needs to be filled,
+/// because if the channel data comes from udp, it is not guaranteed to be
+/// aligned and needs to be checked. the padding is written with its frame.
+async fn write_frames<W: AsyncWrite + Unpin>(
+    writer: &mut W,
+    frames: &[Packet],
+) -> std::io::Result<()> {
+    let mut slices = Vec::with_capacity(frames.len() * 2);
+    for (bytes, kind, ..) in frames {
+        slices.push(IoSlice::new(bytes));
+
+        let pad = bytes.len() % 4;
+        if *kind == StunClass::Channel && pad > 0 {
+            slices.push(IoSlice::new(&ZERO_BUF[..(4 - pad)]));
+        }
+    }
+
+    let mut slices = &mut slices[..];
+    while !slices.is_empty() {
+        match writer.write_vectored(slices).await? {
+            0 => return Err(ErrorKind::WriteZero.into()),
+            size => IoSlice::advance_slices(&mut slices, size),
+        }
+    }
+
+    // A tls stream can accept the frames and keep the encrypted records in
+    // its session, they are only sent when it is flushed, and the writer
+    // waits for the next packets after this.
+    writer.flush().await
 }
 
 /// udp socket process thread.
@@ -204,74 +446,507 @@ async fn tcp_server(
 async fn udp_server(
     socket: UdpSocket,
     external: SocketAddr,
+    batch: usize,
     service: Service,
     router: Arc<Router>,
+    auth: Authenticator,
     statistics: Statistics,
+    metrics: Metrics,
 ) {
     let socket = Arc::new(socket);
     let local_addr = socket
         .local_addr()
         .expect("get udp socket local addr failed!");
 
+    let (batch, gro, gso) = udp_batch_options(&socket, batch);
     for _ in 0..num_cpus::get() {
-        let socket = socket.clone();
+        tokio::spawn(udp_worker(
+            socket.clone(),
+            external,
+            service.get_processor(external, external),
+            router.clone(),
+            auth.clone(),
+            statistics.get_actor(),
+            statistics.get_interface_actor(local_addr),
+            metrics.get_recorder(),
+            batch,
+            gro,
+            gso,
+        ));
+    }
+
+    udp_forwarder(
+        socket,
+        &mut router.get_receiver(external),
+        statistics.get_actor(),
+        statistics.get_interface_actor(local_addr),
+        router.get_tracer().clone(),
+        batch,
+        gso,
+    )
+    .await;
+
+    router.remove(&external);
+    log::error!("udp server close: interface={:?}", local_addr);
+}
+
+/// sharded udp socket process threads.
+///
+/// each socket is bound to the same address with `SO_REUSEPORT` and owned
+/// by its own thread, which is pinned to one core and runs a single
+/// threaded runtime. the thread receives the flows that the kernel hashes
+/// to its socket, and sends the packets that the router forwards to its
+/// shard, so the shards never share a receive queue or a socket.
+#[cfg(target_os = "linux")]
+fn udp_sharded_server(
+    sockets: Vec<std::net::UdpSocket>,
+    external: SocketAddr,
+    batch: usize,
+    service: Service,
+    router: Arc<Router>,
+    auth: Authenticator,
+    statistics: Statistics,
+    metrics: Metrics,
+) -> anyhow::Result<()> {
+    let receivers = router.get_receivers(external, sockets.len());
+    for (index, (socket, mut receiver)) in sockets.into_iter().zip(receivers).enumerate() {
         let router = router.clone();
-        let actor = statistics.get_actor();
-        let mut processor = service.get_processor(external, external);
+        let auth = auth.clone();
+        let statistics = statistics.clone();
+        let recorder = metrics.get_recorder();
+        let processor = service.get_processor(external, external);
+
+        std::thread::Builder::new()
+            .name(format!("turn-udp-{}", index))
+            .spawn(move || {
+                if !crate::shard::pin_current_thread(index) {
+                    log::warn!("udp shard pin to core failed: shard={}", index);
+                }
 
-        tokio::spawn(async move {
-            let mut buf = vec![0u8; 2048];
-
-            loop {
-                // Note: An error will also be reported when the remote host is
-                // shut down, which is not processed yet, but a
-                // warning will be issued.
-                let (size, addr) = match socket.recv_from(&mut buf).await {
-                    Err(e) if e.kind() != ConnectionReset => break,
-                    Ok(s) => s,
-                    _ => continue,
+                let runtime = match tokio::runtime::Builder::new_current_thread()
+                    .enable_all()
+                    .build()
+                {
+                    Ok(runtime) => runtime,
+                    Err(e) => {
+                        log::error!("udp shard runtime failed: shard={}, err={}", index, e);
+                        return;
+                    }
                 };
 
-                actor.send(&addr, &[Stats::ReceivedBytes(size), Stats::ReceivedPkts(1)]);
+                runtime.block_on(async move {
+                    let socket = match UdpSocket::from_std(socket) {
+                        Ok(socket) => Arc::new(socket),
+                        Err(e) => {
+                            log::error!("udp shard socket failed: shard={}, err={}", index, e);
+                            return;
+                        }
+                    };
 
-                // The stun message requires at least 4 bytes. (currently the
-                // smallest stun message is channel data,
-                // excluding content)
-                if size >= 4 {
-                    if let Ok(Some(res)) = processor.process(&buf[..size], addr).await {
-                        let target = res.relay.unwrap_or(addr);
-                        if let Some(to) = res.interface {
-                            router.send(&to, res.kind, &target, res.data);
-                        } else {
-                            if let Err(e) = socket.send_to(res.data, &target).await {
-                                if e.kind() != ConnectionReset {
-                                    break;
-                                }
-                            }
+                    let local_addr = socket
+                        .local_addr()
+                        .expect("get udp socket local addr failed!");
+
+                    let (batch, gro, gso) = udp_batch_options(&socket, batch);
+                    tokio::spawn(udp_worker(
+                        socket.clone(),
+                        external,
+                        processor,
+                        router.clone(),
+                        auth,
+                        statistics.get_actor(),
+                        statistics.get_interface_actor(local_addr),
+                        recorder,
+                        batch,
+                        gro,
+                        gso,
+                    ));
+
+                    udp_forwarder(
+                        socket,
+                        &mut receiver,
+                        statistics.get_actor(),
+                        statistics.get_interface_actor(local_addr),
+                        router.get_tracer().clone(),
+                        batch,
+                        gso,
+                    )
+                    .await;
+
+                    // The other shards of the interface keep their
+                    // endpoints.
+                    router.remove_receiver(&external, &receiver);
+                    log::error!(
+                        "udp shard close: interface={:?}, shard={}",
+                        local_addr,
+                        index
+                    );
+                });
+            })?;
+    }
 
-                            actor.send(
-                                &addr,
-                                &[Stats::SendBytes(res.data.len()), Stats::SendPkts(1)],
-                            );
+    Ok(())
+}
+
+/// check the batch size of the interface against the platform, and enable
+/// GRO/GSO on the socket when batching is used.
+///
+/// returns the batch size that is actually used and whether GRO/GSO are
+/// enabled.
+fn udp_batch_options(socket: &UdpSocket, batch: usize) -> (usize, bool, bool) {
+    if batch <= 1 {
+        return (1, false, false);
+    }
+
+    let local_addr = socket
+        .local_addr()
+        .expect("get udp socket local addr failed!");
+
+    #[cfg(not(target_os = "linux"))]
+    {
+        log::warn!(
+            "udp batch io is only supported on linux, ignored: interface={:?}",
+            local_addr
+        );
+
+        (1, false, false)
+    }
+
+    #[cfg(target_os = "linux")]
+    {
+        let gro = mmsg::enable_gro(socket);
+        let gso = mmsg::support_gso(socket);
+        log::info!(
+            "udp batch io enabled: interface={:?}, batch={}, gro={}, gso={}",
+            local_addr,
+            batch,
+            gro,
+            gso
+        );
+
+        (batch, gro, gso)
+    }
+}
+
+/// send the packets forwarded by the router from other interfaces.
+///
+/// returns when the router endpoint is removed or the socket fails.
+#[allow(clippy::too_many_arguments)]
+async fn udp_forwarder(
+    socket: Arc<UdpSocket>,
+    receiver: &mut Receiver,
+    mut actor: StatisticsActor,
+    mut syscalls: InterfaceActor,
+    tracer: Tracer,
+    batch: usize,
+    gso: bool,
+) {
+    #[cfg(target_os = "linux")]
+    if batch > 1 {
+        let mut writer = mmsg::SendBatch::new(batch, gso);
+        let mut queued = Vec::with_capacity(batch);
+        let mut traces = Vec::new();
+        while let Some(packet) = receiver.recv().await {
+            // Drain the packets that are already queued, without waiting,
+            // and send them together.
+            let mut packet = Some(packet);
+            while let Some((bytes, _, addr, trace)) = packet.map(dequeued) {
+                if writer.push(&bytes, addr) {
+                    queued.push((addr, bytes.len()));
+                    traces.extend(trace);
+                } else {
+                    // The packets forwarded from the tcp clients may not
+                    // fit in a slot of the batch, they are sent on their
+                    // own.
+                    syscalls.send(1, 1, bytes.len());
+                    match socket.send_to(&bytes, addr).await {
+                        Ok(_) => {
+                            actor.send(&addr, &[Stats::SendBytes(bytes.len()), Stats::SendPkts(1)]);
+                            if let Some(mut trace) = trace {
+                                trace.lap(Stage::Send);
+                                tracer.finish(trace);
+                            }
                         }
+                        Err(e) => log::debug!("udp send failed: addr={}, err={}", addr, e),
                     }
                 }
+
+                packet = if writer.is_full() {
+                    None
+                } else {
+                    receiver.try_recv()
+                };
             }
-        });
+
+            if !writer.is_empty() {
+                flush_batch(&socket, &mut writer, &mut queued, &mut actor, &mut syscalls).await;
+                tracer.finish_sent(&mut traces);
+            }
+        }
+
+        return;
     }
 
-    let actor = statistics.get_actor();
-    let mut receiver = router.get_receiver(external);
-    while let Some((bytes, _, addr)) = receiver.recv().await {
+    #[cfg(not(target_os = "linux"))]
+    let _ = (batch, gso);
+
+    while let Some(packet) = receiver.recv().await {
+        let (bytes, _, addr, trace) = dequeued(packet);
+        syscalls.send(1, 1, bytes.len());
         if let Err(e) = socket.send_to(&bytes, addr).await {
             if e.kind() != ConnectionReset {
                 break;
             }
         } else {
             actor.send(&addr, &[Stats::SendBytes(bytes.len()), Stats::SendPkts(1)]);
+            if let Some(mut trace) = trace {
+                trace.lap(Stage::Send);
+                tracer.finish(trace);
+            }
         }
     }
+}
 
-    router.remove(&external);
-    log::error!("udp server close: interface={:?}", local_addr);
+/// udp socket worker.
+///
+/// picks the batched worker when batching is enabled.
+#[allow(clippy::too_many_arguments)]
+async fn udp_worker(
+    socket: Arc<UdpSocket>,
+    external: SocketAddr,
+    processor: Processor,
+    router: Arc<Router>,
+    auth: Authenticator,
+    actor: StatisticsActor,
+    syscalls: InterfaceActor,
+    recorder: Recorder,
+    batch: usize,
+    gro: bool,
+    gso: bool,
+) {
+    #[cfg(target_os = "linux")]
+    if batch > 1 {
+        return udp_batch_worker(
+            socket, external, processor, router, auth, actor, syscalls, recorder, batch, gro, gso,
+        )
+        .await;
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    let _ = (batch, gro, gso);
+
+    udp_single_worker(
+        socket, external, processor, router, auth, actor, syscalls, recorder,
+    )
+    .await
+}
+
+/// udp worker, one datagram per system call.
+#[allow(clippy::too_many_arguments)]
+async fn udp_single_worker(
+    socket: Arc<UdpSocket>,
+    external: SocketAddr,
+    mut processor: Processor,
+    router: Arc<Router>,
+    auth: Authenticator,
+    mut actor: StatisticsActor,
+    mut syscalls: InterfaceActor,
+    mut recorder: Recorder,
+) {
+    let mut sampler = router.get_tracer().get_sampler();
+    let mut buf = vec![0u8; 2048];
+
+    loop {
+        // Note: An error will also be reported when the remote host is
+        // shut down, which is not processed yet, but a
+        // warning will be issued.
+        let (size, addr) = match socket.recv_from(&mut buf).await {
+            Err(e) if e.kind() != ConnectionReset => break,
+            Ok(s) => s,
+            _ => continue,
+        };
+
+        let received = sampler.is_enabled().then(Instant::now);
+        syscalls.recv(1, 1, size);
+        actor.send(&addr, &[Stats::ReceivedBytes(size), Stats::ReceivedPkts(1)]);
+
+        // The stun message requires at least 4 bytes. (currently the
+        // smallest stun message is channel data,
+        // excluding content)
+        if size >= 4 {
+            // Requests that wait for the key of their node are processed by
+            // the auth stage, so the other clients of this worker are not
+            // held up behind the hooks server.
+            if processor.requires_key(&buf[..size], addr) {
+                auth.submit(&buf[..size], addr, external, external);
+                continue;
+            }
+
+            let mut trace = sampler
+                .sample()
+                .then(|| sampler.start(&buf[..size], addr, received.unwrap_or_else(Instant::now)));
+
+            let start = Instant::now();
+            let ret = processor.process(&buf[..size], addr).await;
+            recorder.record(Method::of(&buf[..size]), start.elapsed());
+            if let Ok(Some(res)) = ret {
+                if let Some(trace) = &mut trace {
+                    trace.lap(Stage::Process);
+                }
+
+                let target = res.relay.unwrap_or(addr);
+                if let Some(to) = res.interface {
+                    router.send_traced(&to, res.kind, &target, res.data, trace);
+                } else {
+                    syscalls.send(1, 1, res.data.len());
+                    if let Err(e) = socket.send_to(res.data, &target).await {
+                        if e.kind() != ConnectionReset {
+                            break;
+                        }
+                    }
+
+                    actor.send(
+                        &addr,
+                        &[Stats::SendBytes(res.data.len()), Stats::SendPkts(1)],
+                    );
+
+                    if let Some(mut trace) = trace {
+                        trace.lap(Stage::Send);
+                        router.get_tracer().finish(trace);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// udp worker with batched io.
+///
+/// reads up to `batch` datagrams with one `recvmmsg` call, hands them to
+/// the processor one by one, and flushes all the responses with one
+/// `sendmmsg` call after the whole batch has been processed.
+#[cfg(target_os = "linux")]
+#[allow(clippy::too_many_arguments)]
+async fn udp_batch_worker(
+    socket: Arc<UdpSocket>,
+    external: SocketAddr,
+    mut processor: Processor,
+    router: Arc<Router>,
+    auth: Authenticator,
+    mut actor: StatisticsActor,
+    mut syscalls: InterfaceActor,
+    mut recorder: Recorder,
+    batch: usize,
+    gro: bool,
+    gso: bool,
+) {
+    let mut reader = mmsg::RecvBatch::new(batch, gro);
+    let mut writer = mmsg::SendBatch::new(batch, gso);
+    let mut queued = Vec::with_capacity(batch);
+    let mut sampler = router.get_tracer().get_sampler();
+    let mut traces = Vec::new();
+
+    loop {
+        let count = match reader.recv(&socket).await {
+            Err(e) if e.kind() != ConnectionReset => break,
+            Ok(s) => s,
+            _ => continue,
+        };
+
+        // The packets of the batch wait for the ones before them from here.
+        let received = sampler.is_enabled().then(Instant::now);
+
+        let mut bytes = 0;
+        for i in 0..count {
+            let (buf, addr) = reader.get(i);
+            bytes += buf.len();
+            actor.send(&addr, &[Stats::ReceivedBytes(buf.len()), Stats::ReceivedPkts(1)]);
+
+            if buf.len() < 4 {
+                continue;
+            }
+
+            if processor.requires_key(buf, addr) {
+                auth.submit(buf, addr, external, external);
+                continue;
+            }
+
+            let mut trace = sampler
+                .sample()
+                .then(|| sampler.start(buf, addr, received.unwrap_or_else(Instant::now)));
+
+            let start = Instant::now();
+            let ret = processor.process(buf, addr).await;
+            recorder.record(Method::of(buf), start.elapsed());
+            if let Ok(Some(res)) = ret {
+                if let Some(trace) = &mut trace {
+                    trace.lap(Stage::Process);
+                }
+
+                let target = res.relay.unwrap_or(addr);
+                if let Some(to) = res.interface {
+                    router.send_traced(&to, res.kind, &target, res.data, trace);
+                    continue;
+                }
+
+                // GRO can produce more packets than the batch size, so the
+                // queue may fill up before the whole batch is processed.
+                if writer.is_full() {
+                    flush_batch(&socket, &mut writer, &mut queued, &mut actor, &mut syscalls).await;
+                    router.get_tracer().finish_sent(&mut traces);
+                }
+
+                if writer.push(res.data, target) {
+                    queued.push((addr, res.data.len()));
+                    traces.extend(trace);
+                    continue;
+                }
+
+                syscalls.send(1, 1, res.data.len());
+                if let Err(e) = socket.send_to(res.data, &target).await {
+                    if e.kind() != ConnectionReset {
+                        break;
+                    }
+                } else {
+                    actor.send(
+                        &addr,
+                        &[Stats::SendBytes(res.data.len()), Stats::SendPkts(1)],
+                    );
+
+                    if let Some(mut trace) = trace {
+                        trace.lap(Stage::Send);
+                        router.get_tracer().finish(trace);
+                    }
+                }
+            }
+        }
+
+        syscalls.recv(1, count, bytes);
+        if !writer.is_empty() {
+            flush_batch(&socket, &mut writer, &mut queued, &mut actor, &mut syscalls).await;
+            router.get_tracer().finish_sent(&mut traces);
+        }
+    }
+}
+
+/// send the packets of the batch, and count the packets that were handed
+/// to the kernel to the sessions that they were queued for.
+#[cfg(target_os = "linux")]
+async fn flush_batch(
+    socket: &UdpSocket,
+    writer: &mut mmsg::SendBatch,
+    queued: &mut Vec<(SocketAddr, usize)>,
+    actor: &mut StatisticsActor,
+    syscalls: &mut InterfaceActor,
+) {
+    let (pkts, bytes) = (writer.len(), writer.bytes());
+    let calls = writer
+        .flush(socket, |index| {
+            let (addr, size) = queued[index];
+            actor.send(&addr, &[Stats::SendBytes(size), Stats::SendPkts(1)]);
+        })
+        .await;
+
+    syscalls.send(calls, pkts, bytes);
+    queued.clear();
 }
@@ -0,0 +1,56 @@
+//! Sharded udp sockets.
+//!
+//! Binds several udp sockets to the same address with `SO_REUSEPORT`, the
+//! kernel spreads the incoming flows across them by the hash of the
+//! 5-tuple, so every socket has its own receive queue and can be owned by
+//! a single worker thread pinned to one core.
+
+use std::{
+    io::Result,
+    mem::{size_of, zeroed},
+    net::{SocketAddr, UdpSocket},
+};
+
+use socket2::{Domain, Protocol, Socket, Type};
+
+/// Bind `count` non-blocking udp sockets with `SO_REUSEPORT` to the same
+/// address.
+///
+/// All sockets are created before any of them starts receiving, so a
+/// failure does not leave a half sharded interface behind.
+pub fn bind(addr: SocketAddr, count: usize) -> Result<Vec<UdpSocket>> {
+    let mut sockets = Vec::with_capacity(count);
+    for _ in 0..count {
+        let socket = Socket::new(Domain::for_address(addr), Type::DGRAM, Some(Protocol::UDP))?;
+        socket.set_reuse_port(true)?;
+        socket.set_nonblocking(true)?;
+        socket.bind(&addr.into())?;
+        sockets.push(socket.into());
+    }
+
+    Ok(sockets)
+}
+
+/// Pin the current thread to the `index`th cpu that the process is allowed
+/// to run on (wrapping around).
+///
+/// Returns false if the affinity of the thread could not be changed.
+pub fn pin_current_thread(index: usize) -> bool {
+    unsafe {
+        let mut allowed: libc::cpu_set_t = zeroed();
+        if libc::sched_getaffinity(0, size_of::<libc::cpu_set_t>(), &mut allowed) != 0 {
+            return false;
+        }
+
+        let cpus = (0..libc::CPU_SETSIZE as usize)
+            .filter(|cpu| libc::CPU_ISSET(*cpu, &allowed))
+            .collect::<Vec<usize>>();
+        if cpus.is_empty() {
+            return false;
+        }
+
+        let mut set: libc::cpu_set_t = zeroed();
+        libc::CPU_SET(cpus[index % cpus.len()], &mut set);
+        libc::sched_setaffinity(0, size_of::<libc::cpu_set_t>(), &set) == 0
+    }
+}
@@ -1,21 +1,56 @@
 use std::{
     net::SocketAddr,
     sync::{
-        atomic::{AtomicUsize, Ordering},
-        Arc, RwLock,
+        atomic::{AtomicBool, AtomicUsize, Ordering},
+        Arc, Mutex, RwLock,
     },
-    time::Duration,
+    time::{Duration, SystemTime, UNIX_EPOCH},
 };
 
 use ahash::AHashMap;
 use tokio::time::sleep;
 
-#[derive(Debug, Clone, Copy)]
+#[derive(Debug, Default, Clone, Copy)]
 pub struct NodeCounts {
     pub received_bytes: usize,
     pub send_bytes: usize,
     pub received_pkts: usize,
     pub send_pkts: usize,
+    pub dropped_bytes: usize,
+    pub dropped_pkts: usize,
+    pub limited_bytes: usize,
+    pub limited_pkts: usize,
+}
+
+impl NodeCounts {
+    fn merge(&mut self, other: &Self) {
+        self.received_bytes += other.received_bytes;
+        self.send_bytes += other.send_bytes;
+        self.received_pkts += other.received_pkts;
+        self.send_pkts += other.send_pkts;
+        self.dropped_bytes += other.dropped_bytes;
+        self.dropped_pkts += other.dropped_pkts;
+        self.limited_bytes += other.limited_bytes;
+        self.limited_pkts += other.limited_pkts;
+    }
+
+    /// the bytes that the node received and sent.
+    pub fn traffic(&self) -> usize {
+        self.received_bytes + self.send_bytes
+    }
+
+    fn since(&self, base: &Self) -> Self {
+        Self {
+            received_bytes: self.received_bytes.wrapping_sub(base.received_bytes),
+            send_bytes: self.send_bytes.wrapping_sub(base.send_bytes),
+            received_pkts: self.received_pkts.wrapping_sub(base.received_pkts),
+            send_pkts: self.send_pkts.wrapping_sub(base.send_pkts),
+            dropped_bytes: self.dropped_bytes.wrapping_sub(base.dropped_bytes),
+            dropped_pkts: self.dropped_pkts.wrapping_sub(base.dropped_pkts),
+            limited_bytes: self.limited_bytes.wrapping_sub(base.limited_bytes),
+            limited_pkts: self.limited_pkts.wrapping_sub(base.limited_pkts),
+        }
+    }
 }
 
 /// The type of information passed in the statisticsing channel
@@ -25,6 +60,11 @@ pub enum Stats {
     SendBytes(usize),
     ReceivedPkts(usize),
     SendPkts(usize),
+    DroppedBytes(usize),
+    DroppedPkts(usize),
+    /// the data that the node sent beyond its limits.
+    LimitedBytes(usize),
+    LimitedPkts(usize),
 }
 
 #[derive(Default)]
@@ -35,22 +75,35 @@ impl Count {
         self.0.fetch_add(value, Ordering::Relaxed);
     }
 
-    fn get(&self) -> usize {
-        self.0.load(Ordering::Relaxed)
+    /// add to a counter that has a single writer, a plain load and store
+    /// instead of a locked read-modify-write.
+    fn add_owned(&self, value: usize) {
+        let count = self.0.load(Ordering::Relaxed);
+        self.0.store(count.wrapping_add(value), Ordering::Relaxed);
     }
 
-    fn set_zero(&self) {
-        self.0.fetch_add(0, Ordering::Relaxed);
+    fn get(&self) -> usize {
+        self.0.load(Ordering::Relaxed)
     }
 }
 
 /// Worker independent statisticsing statistics
+///
+/// the counters are cumulative, a slab is aligned to a cache line so that
+/// the slabs of different workers never share one.
 #[derive(Default)]
+#[repr(align(64))]
 struct Counts {
     received_bytes: Count,
     send_bytes: Count,
     received_pkts: Count,
     send_pkts: Count,
+    dropped_bytes: Count,
+    dropped_pkts: Count,
+    limited_bytes: Count,
+    limited_pkts: Count,
+    /// set when the node is removed, the worker drops the slab then.
+    removed: AtomicBool,
 }
 
 impl Counts {
@@ -60,33 +113,278 @@ impl Counts {
             Stats::ReceivedPkts(v) => self.received_pkts.add(*v),
             Stats::SendBytes(v) => self.send_bytes.add(*v),
             Stats::SendPkts(v) => self.send_pkts.add(*v),
+            Stats::DroppedBytes(v) => self.dropped_bytes.add(*v),
+            Stats::DroppedPkts(v) => self.dropped_pkts.add(*v),
+            Stats::LimitedBytes(v) => self.limited_bytes.add(*v),
+            Stats::LimitedPkts(v) => self.limited_pkts.add(*v),
+        }
+    }
+
+    fn add_owned(&self, payload: &Stats) {
+        match payload {
+            Stats::ReceivedBytes(v) => self.received_bytes.add_owned(*v),
+            Stats::ReceivedPkts(v) => self.received_pkts.add_owned(*v),
+            Stats::SendBytes(v) => self.send_bytes.add_owned(*v),
+            Stats::SendPkts(v) => self.send_pkts.add_owned(*v),
+            Stats::DroppedBytes(v) => self.dropped_bytes.add_owned(*v),
+            Stats::DroppedPkts(v) => self.dropped_pkts.add_owned(*v),
+            Stats::LimitedBytes(v) => self.limited_bytes.add_owned(*v),
+            Stats::LimitedPkts(v) => self.limited_pkts.add_owned(*v),
+        }
+    }
+
+    fn load(&self) -> NodeCounts {
+        NodeCounts {
+            received_bytes: self.received_bytes.get(),
+            received_pkts: self.received_pkts.get(),
+            send_bytes: self.send_bytes.get(),
+            send_pkts: self.send_pkts.get(),
+            dropped_bytes: self.dropped_bytes.get(),
+            dropped_pkts: self.dropped_pkts.get(),
+            limited_bytes: self.limited_bytes.get(),
+            limited_pkts: self.limited_pkts.get(),
+        }
+    }
+
+    fn is_removed(&self) -> bool {
+        self.removed.load(Ordering::Relaxed)
+    }
+}
+
+#[derive(Default)]
+struct Slabs {
+    list: Vec<Arc<Counts>>,
+    removed: bool,
+}
+
+/// The statistics of a node.
+///
+/// every worker that counts packets of the node owns a slab of counters
+/// and is the only writer of it, the slabs are merged when the statistics
+/// are read.
+struct Node {
+    username: Arc<str>,
+    /// counters for the callers that do not own a slab.
+    shared: Counts,
+    slabs: Mutex<Slabs>,
+    /// the totals at the last reset, the counts are reported since then.
+    base: Mutex<NodeCounts>,
+}
+
+impl Node {
+    fn total(&self) -> NodeCounts {
+        let mut total = self.shared.load();
+        for counts in &self.slabs.lock().unwrap().list {
+            total.merge(&counts.load());
+        }
+
+        total
+    }
+
+    fn get(&self) -> NodeCounts {
+        self.total().since(&self.base.lock().unwrap())
+    }
+
+    /// start a new interval, returns the counts of the interval that ended.
+    fn reset(&self) -> NodeCounts {
+        let total = self.total();
+        let mut base = self.base.lock().unwrap();
+        let counts = total.since(&base);
+        *base = total;
+        counts
+    }
+
+    fn remove(&self) {
+        let mut slabs = self.slabs.lock().unwrap();
+        slabs.removed = true;
+        for counts in &slabs.list {
+            counts.removed.store(true, Ordering::Relaxed);
+        }
+    }
+}
+
+type Nodes = Arc<RwLock<AHashMap<SocketAddr, Arc<Node>>>>;
+
+/// The number of the sessions with the most traffic that the snapshot
+/// keeps in order.
+pub const TOP_SESSIONS: usize = 1000;
+
+/// A session of the snapshot, with its counts of the last second.
+#[derive(Debug, Clone)]
+pub struct Session {
+    pub addr: SocketAddr,
+    pub username: Arc<str>,
+    pub counts: NodeCounts,
+}
+
+/// read-optimized snapshot of the sessions.
+///
+/// it is built by the aggregation every second from the counts that it
+/// resets, outside the lock of the session table, and is shared with the
+/// readers as it is, so listing the sessions never holds a lock that the
+/// workers take.
+#[derive(Debug, Default)]
+pub struct Snapshot {
+    /// the unix time that the snapshot was built at, in seconds.
+    pub time: u64,
+    /// the sessions ordered by address.
+    sessions: Vec<Session>,
+    /// the indexes of the sessions with the most traffic, the most first.
+    top: Vec<usize>,
+}
+
+impl Snapshot {
+    fn new(mut sessions: Vec<Session>) -> Self {
+        sessions.sort_unstable_by_key(|it| it.addr);
+
+        let mut top = (0..sessions.len()).collect::<Vec<_>>();
+        let by_traffic = |a: &usize, b: &usize| {
+            sessions[*b]
+                .counts
+                .traffic()
+                .cmp(&sessions[*a].counts.traffic())
+        };
+
+        // Only the head of the index is ordered, the rest is cut off.
+        if top.len() > TOP_SESSIONS {
+            top.select_nth_unstable_by(TOP_SESSIONS - 1, by_traffic);
+            top.truncate(TOP_SESSIONS);
         }
+
+        top.sort_unstable_by(by_traffic);
+
+        let time = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .unwrap_or_default()
+            .as_secs();
+
+        Self {
+            sessions,
+            time,
+            top,
+        }
+    }
+
+    /// the number of the sessions.
+    pub fn len(&self) -> usize {
+        self.sessions.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.sessions.is_empty()
+    }
+
+    /// get a page of the sessions ordered by address, the page starts
+    /// after the `cursor` address.
+    ///
+    /// the cursor of the next page is the address of the last session of
+    /// the page, a page that is shorter than `limit` is the last one.
+    pub fn get_page(&self, cursor: Option<SocketAddr>, limit: usize) -> &[Session] {
+        let start = match cursor {
+            Some(cursor) => self.sessions.partition_point(|it| it.addr <= cursor),
+            None => 0,
+        };
+
+        let end = start.saturating_add(limit).min(self.sessions.len());
+        &self.sessions[start..end]
+    }
+
+    /// get the sessions with the most traffic in the last second, the most
+    /// first, up to `TOP_SESSIONS` of them.
+    pub fn get_top(&self, limit: usize) -> impl Iterator<Item = &Session> {
+        self.top.iter().take(limit).map(|i| &self.sessions[*i])
+    }
+}
+
+/// The number of packets moved by the recv/send system calls of an
+/// interface.
+#[derive(Debug, Clone, Copy)]
+pub struct InterfaceCounts {
+    pub recv_syscalls: usize,
+    pub recv_pkts: usize,
+    pub recv_bytes: usize,
+    pub send_syscalls: usize,
+    pub send_pkts: usize,
+    pub send_bytes: usize,
+}
+
+impl InterfaceCounts {
+    /// average number of packets received per system call.
+    pub fn recv_pkts_per_syscall(&self) -> f64 {
+        self.recv_pkts as f64 / self.recv_syscalls.max(1) as f64
     }
 
-    fn clear(&self) {
-        self.received_bytes.set_zero();
-        self.received_pkts.set_zero();
-        self.send_bytes.set_zero();
-        self.send_pkts.set_zero();
+    /// average number of packets sent per system call.
+    pub fn send_pkts_per_syscall(&self) -> f64 {
+        self.send_pkts as f64 / self.send_syscalls.max(1) as f64
     }
 }
 
+/// Interface syscall statistics
+///
+/// Unlike the session statistics, it is cumulative and never cleared. every
+/// worker of the interface owns a slab of its own, like the session
+/// statistics.
+#[derive(Default)]
+#[repr(align(64))]
+struct Syscalls {
+    recv_syscalls: Count,
+    recv_pkts: Count,
+    recv_bytes: Count,
+    send_syscalls: Count,
+    send_pkts: Count,
+    send_bytes: Count,
+}
+
+type Interface = Arc<Mutex<Vec<Arc<Syscalls>>>>;
+
 /// worker cluster statistics
 #[derive(Clone)]
-pub struct Statistics(Arc<RwLock<AHashMap<SocketAddr, Counts>>>);
+pub struct Statistics {
+    nodes: Nodes,
+    snapshot: Arc<RwLock<Arc<Snapshot>>>,
+    interfaces: Arc<RwLock<AHashMap<SocketAddr, Interface>>>,
+}
 
 impl Default for Statistics {
     fn default() -> Self {
-        let map: Arc<RwLock<AHashMap<SocketAddr, Counts>>> = Default::default();
-        let map_ = Arc::downgrade(&map);
+        let nodes: Nodes = Default::default();
+        let snapshot: Arc<RwLock<Arc<Snapshot>>> = Default::default();
+        let nodes_ = Arc::downgrade(&nodes);
+        let snapshot_ = snapshot.clone();
         tokio::spawn(async move {
-            while let Some(map) = map_.upgrade() {
-                let _ = map.read().unwrap().iter().for_each(|(_, it)| it.clear());
+            loop {
                 sleep(Duration::from_secs(1)).await;
+
+                // The table is only borrowed for the reset, not across the
+                // sleep, so the task ends once the statistics are dropped.
+                let Some(map) = nodes_.upgrade() else {
+                    break;
+                };
+
+                let sessions = map
+                    .read()
+                    .unwrap()
+                    .iter()
+                    .map(|(addr, node)| Session {
+                        username: node.username.clone(),
+                        counts: node.reset(),
+                        addr: *addr,
+                    })
+                    .collect();
+
+                drop(map);
+
+                // The sorting is done outside of the lock of the table.
+                *snapshot_.write().unwrap() = Arc::new(Snapshot::new(sessions));
             }
         });
 
-        Self(map)
+        Self {
+            interfaces: Default::default(),
+            snapshot,
+            nodes,
+        }
     }
 }
 
@@ -106,13 +404,90 @@ impl Statistics {
     /// async fn main() {
     ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///     let statistics = Statistics::default();
-    ///     let sender = statistics.get_actor();
+    ///     let mut sender = statistics.get_actor();
     ///
+    ///     statistics.set(addr, "test");
     ///     sender.send(&addr, &[Stats::ReceivedBytes(100)]);
+    ///     sender.clone().send(&addr, &[Stats::ReceivedBytes(100)]);
+    ///     sender.send_shared(&addr, &[Stats::DroppedPkts(1)]);
+    ///
+    ///     let counts = statistics.get(&addr).unwrap();
+    ///     assert_eq!(counts.received_bytes, 200);
+    ///     assert_eq!(counts.dropped_pkts, 1);
     /// }
     /// ```
     pub fn get_actor(&self) -> StatisticsActor {
-        StatisticsActor(self.0.clone())
+        StatisticsActor::new(self.nodes.clone())
+    }
+
+    /// get interface syscall sender
+    ///
+    /// Each udp worker records the number of system calls it made and the
+    /// number of packets moved by them, so that the effect of batched io
+    /// can be observed.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn_server::statistics::*;
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:3478".parse::<SocketAddr>().unwrap();
+    ///     let statistics = Statistics::default();
+    ///     let mut actor = statistics.get_interface_actor(addr);
+    ///
+    ///     actor.recv(1, 32, 32 * 1200);
+    ///     actor.send(2, 32, 32 * 1200);
+    ///     actor.clone().recv(1, 32, 32 * 1200);
+    ///
+    ///     let counts = statistics.get_interface(&addr).unwrap();
+    ///     assert_eq!(counts.recv_pkts_per_syscall(), 32.0);
+    ///     assert_eq!(counts.send_pkts_per_syscall(), 16.0);
+    ///     assert_eq!(counts.recv_bytes, 64 * 1200);
+    /// }
+    /// ```
+    pub fn get_interface_actor(&self, interface: SocketAddr) -> InterfaceActor {
+        InterfaceActor::new(
+            self.interfaces
+                .write()
+                .unwrap()
+                .entry(interface)
+                .or_default()
+                .clone(),
+        )
+    }
+
+    /// Obtain the syscall statistics of an interface
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn_server::statistics::*;
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:3478".parse::<SocketAddr>().unwrap();
+    ///     let statistics = Statistics::default();
+    ///     assert!(statistics.get_interface(&addr).is_none());
+    ///
+    ///     statistics.get_interface_actor(addr).recv(1, 1, 1200);
+    ///     assert_eq!(statistics.get_interface(&addr).unwrap().recv_pkts, 1);
+    /// }
+    /// ```
+    pub fn get_interface(&self, interface: &SocketAddr) -> Option<InterfaceCounts> {
+        let interface = self.interfaces.read().unwrap().get(interface)?.clone();
+        let slabs = interface.lock().unwrap();
+        Some(InterfaceCounts {
+            recv_syscalls: slabs.iter().map(|it| it.recv_syscalls.get()).sum(),
+            recv_pkts: slabs.iter().map(|it| it.recv_pkts.get()).sum(),
+            recv_bytes: slabs.iter().map(|it| it.recv_bytes.get()).sum(),
+            send_syscalls: slabs.iter().map(|it| it.send_syscalls.get()).sum(),
+            send_pkts: slabs.iter().map(|it| it.send_pkts.get()).sum(),
+            send_bytes: slabs.iter().map(|it| it.send_bytes.get()).sum(),
+        })
     }
 
     /// Add an address to the watch list
@@ -128,12 +503,20 @@ impl Statistics {
     ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///     let statistics = Statistics::default();
     ///
-    ///     statistics.set(addr.clone());
+    ///     statistics.set(addr, "test");
     ///     assert_eq!(statistics.get(&addr).is_some(), true);
     /// }
     /// ```
-    pub fn set(&self, addr: SocketAddr) {
-        self.0.write().unwrap().insert(addr, Counts::default());
+    pub fn set(&self, addr: SocketAddr, username: &str) {
+        let node = Arc::new(Node {
+            username: username.into(),
+            shared: Counts::default(),
+            slabs: Mutex::default(),
+            base: Mutex::default(),
+        });
+        if let Some(node) = self.nodes.write().unwrap().insert(addr, node) {
+            node.remove();
+        }
     }
 
     /// Remove an address from the watch list
@@ -149,7 +532,7 @@ impl Statistics {
     ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///     let statistics = Statistics::default();
     ///
-    ///     statistics.set(addr.clone());
+    ///     statistics.set(addr, "test");
     ///     assert_eq!(statistics.get(&addr).is_some(), true);
     ///
     ///     statistics.delete(&addr);
@@ -157,12 +540,43 @@ impl Statistics {
     /// }
     /// ```
     pub fn delete(&self, addr: &SocketAddr) {
-        self.0.write().unwrap().remove(addr);
+        if let Some(node) = self.nodes.write().unwrap().remove(addr) {
+            node.remove();
+        }
+    }
+
+    /// count through the shared counters of the node, for the callers that
+    /// do not hold a sender.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn_server::statistics::*;
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///     let statistics = Statistics::default();
+    ///
+    ///     statistics.set(addr, "test");
+    ///     statistics.send_shared(&addr, &[Stats::LimitedPkts(1), Stats::LimitedBytes(100)]);
+    ///
+    ///     let counts = statistics.get(&addr).unwrap();
+    ///     assert_eq!(counts.limited_pkts, 1);
+    ///     assert_eq!(counts.limited_bytes, 100);
+    /// }
+    /// ```
+    pub fn send_shared(&self, addr: &SocketAddr, payload: &[Stats]) {
+        if let Some(node) = self.nodes.read().unwrap().get(addr) {
+            payload.iter().for_each(|item| node.shared.add(item));
+        }
     }
 
     /// Obtain a list of statistics from statisticsing
     ///
-    /// The obtained list is in the same order as it was added.
+    /// The counts of all the workers are merged, they are counted since the
+    /// last reset, which happens every second.
     ///
     /// # Example
     ///
@@ -175,17 +589,58 @@ impl Statistics {
     ///     let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///     let statistics = Statistics::default();
     ///
-    ///     statistics.set(addr.clone());
+    ///     statistics.set(addr, "test");
     ///     assert_eq!(statistics.get(&addr).is_some(), true);
     /// }
     /// ```
     pub fn get(&self, addr: &SocketAddr) -> Option<NodeCounts> {
-        self.0.read().unwrap().get(addr).map(|counts| NodeCounts {
-            received_bytes: counts.received_bytes.get(),
-            received_pkts: counts.received_pkts.get(),
-            send_bytes: counts.send_bytes.get(),
-            send_pkts: counts.send_pkts.get(),
-        })
+        self.nodes.read().unwrap().get(addr).map(|node| node.get())
+    }
+
+    /// get the latest snapshot of the sessions.
+    ///
+    /// the snapshot is rebuilt every second by the aggregation, a reader
+    /// only takes the lock for as long as it clones the pointer to it.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::{net::SocketAddr, time::Duration};
+    /// use turn_server::statistics::*;
+    ///
+    /// #[tokio::main]
+    /// async fn main() {
+    ///     let statistics = Statistics::default();
+    ///     let mut actor = statistics.get_actor();
+    ///     for port in 8080..8083 {
+    ///         let addr = SocketAddr::from(([127, 0, 0, 1], port));
+    ///         statistics.set(addr, "test");
+    ///         actor.send(&addr, &[Stats::SendBytes(port as usize)]);
+    ///     }
+    ///
+    ///     assert!(statistics.get_snapshot().is_empty());
+    ///
+    ///     tokio::time::sleep(Duration::from_millis(1500)).await;
+    ///     let snapshot = statistics.get_snapshot();
+    ///     assert_eq!(snapshot.len(), 3);
+    ///
+    ///     let page = snapshot.get_page(None, 2);
+    ///     assert_eq!(page.len(), 2);
+    ///     assert_eq!(page[0].addr.port(), 8080);
+    ///     assert_eq!(&*page[0].username, "test");
+    ///
+    ///     let next = snapshot.get_page(Some(page[1].addr), 2);
+    ///     assert_eq!(next.len(), 1);
+    ///     assert_eq!(next[0].addr.port(), 8082);
+    ///
+    ///     let top = snapshot.get_top(2).collect::<Vec<_>>();
+    ///     assert_eq!(top[0].addr.port(), 8082);
+    ///     assert_eq!(top[0].counts.send_bytes, 8082);
+    ///     assert_eq!(top[1].addr.port(), 8081);
+    /// }
+    /// ```
+    pub fn get_snapshot(&self) -> Arc<Snapshot> {
+        self.snapshot.read().unwrap().clone()
     }
 }
 
@@ -194,15 +649,110 @@ impl Statistics {
 /// It is held by each worker, and status information can be sent to the
 /// statisticsing instance through this instance to update the internal
 /// statistical information of the statistics.
-#[derive(Clone)]
-pub struct StatisticsActor(Arc<RwLock<AHashMap<SocketAddr, Counts>>>);
+///
+/// every sender owns its own slab of counters for each node that it has
+/// counted, so counting a packet takes no lock and no shared atomic. a
+/// clone is a new sender with slabs of its own.
+pub struct StatisticsActor {
+    nodes: Nodes,
+    slabs: AHashMap<SocketAddr, Arc<Counts>>,
+    sweep_at: usize,
+}
+
+impl Clone for StatisticsActor {
+    fn clone(&self) -> Self {
+        Self::new(self.nodes.clone())
+    }
+}
 
 impl StatisticsActor {
-    pub fn send(&self, addr: &SocketAddr, payload: &[Stats]) {
-        if let Some(counts) = self.0.read().unwrap().get(addr) {
-            for item in payload {
-                counts.add(item);
+    fn new(nodes: Nodes) -> Self {
+        Self {
+            slabs: AHashMap::with_capacity(64),
+            sweep_at: 64,
+            nodes,
+        }
+    }
+
+    pub fn send(&mut self, addr: &SocketAddr, payload: &[Stats]) {
+        if let Some(counts) = self.slabs.get(addr) {
+            if !counts.is_removed() {
+                payload.iter().for_each(|item| counts.add_owned(item));
+                return;
+            }
+        }
+
+        if let Some(counts) = self.register(addr) {
+            payload.iter().for_each(|item| counts.add_owned(item));
+        }
+    }
+
+    /// count through the shared counters of the node, for the callers that
+    /// can not hold a sender of their own.
+    pub fn send_shared(&self, addr: &SocketAddr, payload: &[Stats]) {
+        if let Some(node) = self.nodes.read().unwrap().get(addr) {
+            payload.iter().for_each(|item| node.shared.add(item));
+        }
+    }
+
+    /// create the slab of this sender for the node.
+    fn register(&mut self, addr: &SocketAddr) -> Option<Arc<Counts>> {
+        let node = self.nodes.read().unwrap().get(addr)?.clone();
+        let counts = Arc::new(Counts::default());
+        {
+            let mut slabs = node.slabs.lock().unwrap();
+            if slabs.removed {
+                return None;
             }
+
+            slabs.list.push(counts.clone());
+        }
+
+        // Drop the slabs of the removed nodes once the table has doubled
+        // since the last sweep.
+        if self.slabs.len() >= self.sweep_at {
+            self.slabs.retain(|_, counts| !counts.is_removed());
+            self.sweep_at = (self.slabs.len() * 2).max(64);
         }
+
+        self.slabs.insert(*addr, counts.clone());
+        Some(counts)
+    }
+}
+
+/// interface syscall sender
+///
+/// It is held by each udp worker of the interface and owns its own slab of
+/// counters, a clone is a new sender with a slab of its own.
+pub struct InterfaceActor {
+    interface: Interface,
+    counts: Arc<Syscalls>,
+}
+
+impl Clone for InterfaceActor {
+    fn clone(&self) -> Self {
+        Self::new(self.interface.clone())
+    }
+}
+
+impl InterfaceActor {
+    fn new(interface: Interface) -> Self {
+        let counts = Arc::new(Syscalls::default());
+        interface.lock().unwrap().push(counts.clone());
+        Self { interface, counts }
+    }
+
+    /// record the receive system calls and the packets and bytes they read.
+    pub fn recv(&mut self, syscalls: usize, pkts: usize, bytes: usize) {
+        self.counts.recv_syscalls.add_owned(syscalls);
+        self.counts.recv_pkts.add_owned(pkts);
+        self.counts.recv_bytes.add_owned(bytes);
+    }
+
+    /// record the send system calls and the packets and bytes they wrote.
+    pub fn send(&mut self, syscalls: usize, pkts: usize, bytes: usize) {
+        self.counts.send_syscalls.add_owned(syscalls);
+        self.counts.send_pkts.add_owned(pkts);
+        self.counts.send_bytes.add_owned(bytes);
     }
 }
@@ -0,0 +1,35 @@
+use std::{path::Path, sync::Arc};
+
+use tokio_rustls::{
+    rustls::{
+        crypto::ring::default_provider,
+        pki_types::{pem::PemObject, CertificateDer, PrivateKeyDer},
+        ServerConfig,
+    },
+    TlsAcceptor,
+};
+
+/// create the tls acceptor of an interface.
+///
+/// the certificate chain and the private key are read from pem files, the
+/// protocol versions and the cipher suites are the safe defaults of rustls.
+///
+/// # Example
+///
+/// ```
+/// use std::path::Path;
+/// use turn_server::tls::*;
+///
+/// let cert = Path::new("not_found.pem");
+/// assert!(acceptor(cert, cert).is_err());
+/// ```
+pub fn acceptor(cert: &Path, key: &Path) -> anyhow::Result<TlsAcceptor> {
+    let certs = CertificateDer::pem_file_iter(cert)?.collect::<Result<Vec<_>, _>>()?;
+    let key = PrivateKeyDer::from_pem_file(key)?;
+    let config = ServerConfig::builder_with_provider(Arc::new(default_provider()))
+        .with_safe_default_protocol_versions()?
+        .with_no_client_auth()
+        .with_single_cert(certs, key)?;
+
+    Ok(TlsAcceptor::from(Arc::new(config)))
+}
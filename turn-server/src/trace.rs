@@ -0,0 +1,341 @@
+use crate::{
+    config,
+    metrics::{Method, Metrics},
+};
+
+use std::{
+    cmp::{Ordering, Reverse},
+    collections::BinaryHeap,
+    net::SocketAddr,
+    sync::{Arc, Mutex},
+    time::{Duration, Instant, SystemTime, UNIX_EPOCH},
+};
+
+use stun::Decoder;
+
+/// A stage of the path of a packet through the server.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Stage {
+    /// from the receive system call to the start of the processing, the
+    /// packet waits for the packets before it in its batch.
+    Recv,
+    /// decoding the message.
+    Decode,
+    /// the processor, the authentication, the router lookups and the
+    /// response.
+    Process,
+    /// waiting in the forwarding queue of the interface it leaves from.
+    Queue,
+    /// until the send system call has returned.
+    Send,
+}
+
+impl Stage {
+    pub const ALL: [Stage; 5] = [
+        Stage::Recv,
+        Stage::Decode,
+        Stage::Process,
+        Stage::Queue,
+        Stage::Send,
+    ];
+
+    /// the label value of the stage.
+    pub fn name(&self) -> &'static str {
+        match self {
+            Self::Recv => "recv",
+            Self::Decode => "decode",
+            Self::Process => "process",
+            Self::Queue => "queue",
+            Self::Send => "send",
+        }
+    }
+}
+
+/// the timing of a sampled packet.
+///
+/// a stage ends where the next one starts, so the stages add up to the
+/// total, the stages that a packet does not go through stay at zero.
+#[derive(Debug, Clone)]
+pub struct Trace {
+    pub addr: SocketAddr,
+    pub method: Method,
+    pub size: usize,
+    /// the unix time that the packet was received at, in microseconds.
+    pub time: u64,
+    pub stages: [Duration; Stage::ALL.len()],
+    pub total: Duration,
+    start: Instant,
+    lap: Instant,
+}
+
+impl Trace {
+    /// start the trace of a packet that was received at `start`.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::time::Instant;
+    /// use turn_server::{metrics::Method, trace::*};
+    ///
+    /// let addr = "127.0.0.1:8080".parse().unwrap();
+    /// let mut trace = Trace::new(addr, &[0x40, 0x00, 0x00, 0x00], Instant::now());
+    /// trace.lap(Stage::Process);
+    /// trace.lap(Stage::Send);
+    ///
+    /// assert_eq!(trace.method, Method::ChannelData);
+    /// assert_eq!(trace.get(Stage::Queue).as_nanos(), 0);
+    /// assert_eq!(trace.get(Stage::Process) + trace.get(Stage::Send), trace.total);
+    /// ```
+    pub fn new(addr: SocketAddr, buf: &[u8], start: Instant) -> Box<Self> {
+        let time = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .unwrap_or_default()
+            .as_micros() as u64;
+
+        Box::new(Self {
+            stages: [Duration::ZERO; Stage::ALL.len()],
+            total: Duration::ZERO,
+            method: Method::of(buf),
+            size: buf.len(),
+            lap: start,
+            start,
+            addr,
+            time,
+        })
+    }
+
+    /// end the stage now, the next stage starts where it ends.
+    pub fn lap(&mut self, stage: Stage) {
+        let now = Instant::now();
+        self.stages[stage as usize] += now.duration_since(self.lap);
+        self.total = now.duration_since(self.start);
+        self.lap = now;
+    }
+
+    pub fn get(&self, stage: Stage) -> Duration {
+        self.stages[stage as usize]
+    }
+}
+
+/// a kept trace, ordered by its total duration.
+struct Slow(Trace);
+
+impl PartialEq for Slow {
+    fn eq(&self, other: &Self) -> bool {
+        self.0.total == other.0.total
+    }
+}
+
+impl Eq for Slow {}
+
+impl PartialOrd for Slow {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for Slow {
+    fn cmp(&self, other: &Self) -> Ordering {
+        self.0.total.cmp(&other.0.total)
+    }
+}
+
+struct Inner {
+    every: u64,
+    slow: Duration,
+    capacity: usize,
+    /// the slowest traces, the fastest of them on top so that a slower one
+    /// takes its place.
+    slowest: Mutex<BinaryHeap<Reverse<Slow>>>,
+    metrics: Metrics,
+}
+
+/// hot path tracer.
+///
+/// one in every `sample` packets that a worker receives is traced through
+/// its stages until it is sent. the stages of the traced packets are
+/// recorded into the stage histograms of the metrics, and the traces that
+/// took longer than the slow threshold are kept, up to the capacity of the
+/// slowest ones. the packets are not traced when the tracer is disabled, the
+/// workers only check a counter of their own.
+///
+/// the requests that wait for the key of their node in the auth stage and
+/// the packets that the relay sockets and the cluster receive are not
+/// traced.
+#[derive(Clone, Default)]
+pub struct Tracer(Option<Arc<Inner>>);
+
+impl Tracer {
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::{config, metrics::Metrics, trace::*};
+    ///
+    /// let tracer = Tracer::new(&config::Trace::default(), Metrics::default());
+    /// assert!(!tracer.is_enabled());
+    /// assert!(!tracer.get_sampler().sample());
+    /// ```
+    pub fn new(options: &config::Trace, metrics: Metrics) -> Self {
+        if options.sample == 0 {
+            return Self(None);
+        }
+
+        Self(Some(Arc::new(Inner {
+            slow: Duration::from_micros(options.slow),
+            slowest: Mutex::new(BinaryHeap::with_capacity(options.capacity)),
+            every: options.sample,
+            capacity: options.capacity,
+            metrics,
+        })))
+    }
+
+    pub fn is_enabled(&self) -> bool {
+        self.0.is_some()
+    }
+
+    /// get a sampler for a worker.
+    pub fn get_sampler(&self) -> Sampler {
+        let every = self.0.as_ref().map(|inner| inner.every).unwrap_or(0);
+        Sampler {
+            decoder: Decoder::new(),
+            countdown: every,
+            every,
+        }
+    }
+
+    /// finish the trace of a packet that has been sent.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use std::time::{Duration, Instant};
+    /// use turn_server::{config, metrics::Metrics, trace::*};
+    ///
+    /// let metrics = Metrics::default();
+    /// let options = config::Trace {
+    ///     sample: 1,
+    ///     slow: 0,
+    ///     capacity: 1,
+    /// };
+    ///
+    /// let tracer = Tracer::new(&options, metrics.clone());
+    /// let addr = "127.0.0.1:8080".parse().unwrap();
+    /// for ms in [10, 30, 20] {
+    ///     let start = Instant::now() - Duration::from_millis(ms);
+    ///     let mut trace = Trace::new(addr, &[0x40, 0x00, 0x00, 0x00], start);
+    ///     trace.lap(Stage::Send);
+    ///     tracer.finish(trace);
+    /// }
+    ///
+    /// // the slowest trace is kept, not the latest one.
+    /// let slowest = tracer.get_slowest();
+    /// assert_eq!(metrics.get_stage(Stage::Send).count(), 3);
+    /// assert_eq!(slowest.len(), 1);
+    /// assert!(slowest[0].total >= Duration::from_millis(30));
+    /// ```
+    pub fn finish(&self, trace: Box<Trace>) {
+        let Some(inner) = &self.0 else {
+            return;
+        };
+
+        inner.metrics.record_trace(&trace);
+        if trace.total >= inner.slow && inner.capacity > 0 {
+            let mut slowest = inner.slowest.lock().unwrap();
+            if slowest.len() >= inner.capacity {
+                match slowest.peek() {
+                    Some(Reverse(fastest)) if fastest.0.total < trace.total => {
+                        slowest.pop();
+                    }
+                    _ => return,
+                }
+            }
+
+            slowest.push(Reverse(Slow(*trace)));
+        }
+    }
+
+    /// end the send stage of the traces and finish them.
+    pub fn finish_sent(&self, traces: &mut Vec<Box<Trace>>) {
+        for mut trace in traces.drain(..) {
+            trace.lap(Stage::Send);
+            self.finish(trace);
+        }
+    }
+
+    /// get the slowest traces that took longer than the slow threshold, the
+    /// slowest first.
+    pub fn get_slowest(&self) -> Vec<Trace> {
+        let Some(inner) = &self.0 else {
+            return Vec::new();
+        };
+
+        let mut traces = inner
+            .slowest
+            .lock()
+            .unwrap()
+            .iter()
+            .map(|Reverse(slow)| slow.0.clone())
+            .collect::<Vec<_>>();
+
+        traces.sort_by(|a, b| b.total.cmp(&a.total));
+        traces
+    }
+}
+
+/// the sampler of a worker.
+pub struct Sampler {
+    every: u64,
+    countdown: u64,
+    decoder: Decoder,
+}
+
+impl Sampler {
+    /// whether the next packet is traced.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::{config, metrics::Metrics, trace::*};
+    ///
+    /// let options = config::Trace {
+    ///     sample: 4,
+    ///     ..Default::default()
+    /// };
+    ///
+    /// let mut sampler = Tracer::new(&options, Metrics::default()).get_sampler();
+    /// let sampled = (0..100).filter(|_| sampler.sample()).count();
+    /// assert_eq!(sampled, 25);
+    /// ```
+    #[inline(always)]
+    pub fn sample(&mut self) -> bool {
+        if self.every == 0 {
+            return false;
+        }
+
+        self.countdown -= 1;
+        if self.countdown > 0 {
+            return false;
+        }
+
+        self.countdown = self.every;
+        true
+    }
+
+    pub fn is_enabled(&self) -> bool {
+        self.every > 0
+    }
+
+    /// start the trace of a sampled packet that was received at `start`,
+    /// the packet is decoded once more on its own to time the decoder.
+    pub fn start(&mut self, buf: &[u8], addr: SocketAddr, start: Instant) -> Box<Trace> {
+        let mut trace = Trace::new(addr, buf, start);
+        trace.lap(Stage::Recv);
+
+        if buf.len() >= 4 {
+            let _ = self.decoder.decode(buf);
+        }
+
+        trace.lap(Stage::Decode);
+        trace
+    }
+}
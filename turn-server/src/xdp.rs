@@ -0,0 +1,459 @@
+use crate::{
+    config::{Interface, Transport, Xdp},
+    statistics::{Statistics, StatisticsActor, Stats},
+};
+
+use std::{
+    io,
+    net::{IpAddr, SocketAddr},
+    path::Path,
+    sync::{Arc, Mutex, Weak},
+    thread,
+    time::Duration,
+};
+
+use ahash::AHashMap;
+use turn::{router::forwards::Forward, StunClass};
+
+/// The map of the listen addresses of the udp interfaces.
+const PORTS_MAP: &str = "turn_ports";
+
+/// The map of the forwarding entries of the channels.
+const FLOWS_MAP: &str = "turn_flows";
+
+/// a listen address of a udp interface, `struct endpoint` of the program.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct Endpoint {
+    addr: u32,
+    port: u16,
+    pad: u16,
+}
+
+/// the client and the channel, `struct flow_key` of the program.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct FlowKey {
+    addr: u32,
+    port: u16,
+    channel: u16,
+}
+
+/// the forwarding entry of a channel, `struct flow` of the program.
+#[repr(C)]
+#[derive(Clone, Copy, Default, PartialEq, Eq)]
+struct Flow {
+    target_addr: u32,
+    interface_addr: u32,
+    target_port: u16,
+    interface_port: u16,
+    pad: u32,
+    pkts: u64,
+    bytes: u64,
+}
+
+impl Endpoint {
+    /// the endpoint of an ipv4 address, the addresses are kept in network
+    /// byte order like in the packet headers.
+    fn new(addr: &SocketAddr) -> Option<Self> {
+        match addr.ip() {
+            IpAddr::V4(ip) if !ip.is_unspecified() => Some(Self {
+                addr: u32::from_ne_bytes(ip.octets()),
+                port: addr.port().to_be(),
+                pad: 0,
+            }),
+            _ => None,
+        }
+    }
+}
+
+/// an offloaded channel and the counters that were read back so far.
+struct Entry {
+    key: FlowKey,
+    flow: Flow,
+    target: SocketAddr,
+    pkts: u64,
+    bytes: u64,
+}
+
+struct Inner {
+    flows: Map,
+    interfaces: AHashMap<SocketAddr, Endpoint>,
+    entries: Mutex<AHashMap<(SocketAddr, u16), Entry>>,
+    actor: StatisticsActor,
+}
+
+/// xdp fast path of the channel data.
+///
+/// the xdp program in `turn-server/xdp` relays the ChannelData between the
+/// udp clients of the server in the kernel, without waking up the
+/// interface workers. this is the user space side of it: the forwarding
+/// entries of the channels are copied into the pinned maps of the program
+/// when the router resolves or removes them, and the counters that the
+/// program keeps per channel are read back into the session statistics.
+///
+/// only the channels of which both ends are ipv4 clients of a udp interface
+/// bound to a specific address are offloaded, the rest of the traffic still
+/// goes through the sockets.
+#[derive(Clone)]
+pub struct Fastpath(Option<Arc<Inner>>);
+
+impl Fastpath {
+    /// open the pinned maps of the xdp program, nothing is opened when the
+    /// fast path is disabled.
+    ///
+    /// # Example
+    ///
+    /// ```
+    /// use turn_server::{config::*, statistics::*, xdp::*};
+    ///
+    /// let fastpath = Fastpath::new(&Xdp::default(), &[], Statistics::default()).unwrap();
+    /// assert!(!fastpath.is_enabled());
+    /// assert_eq!(fastpath.len(), 0);
+    /// ```
+    pub fn new(
+        options: &Xdp,
+        interfaces: &[Interface],
+        statistics: Statistics,
+    ) -> io::Result<Self> {
+        if !options.enabled {
+            return Ok(Self(None));
+        }
+
+        let ports = Map::open(&options.pin_path.join(PORTS_MAP))?;
+        let flows = Map::open(&options.pin_path.join(FLOWS_MAP))?;
+
+        let mut endpoints = AHashMap::with_capacity(interfaces.len());
+        for interface in interfaces {
+            if interface.transport != Transport::UDP {
+                continue;
+            }
+
+            match Endpoint::new(&interface.bind) {
+                Some(endpoint) => {
+                    ports.update(&endpoint, &1u8)?;
+                    endpoints.insert(interface.bind, endpoint);
+                }
+                None => log::warn!(
+                    "xdp fast path skips the interface: bind={}, ipv4 with a specific address is \
+                     required",
+                    interface.bind
+                ),
+            }
+        }
+
+        let inner = Arc::new(Inner {
+            entries: Mutex::new(AHashMap::with_capacity(1024)),
+            actor: statistics.get_actor(),
+            interfaces: endpoints,
+            flows,
+        });
+
+        let interval = Duration::from_secs(options.interval.max(1));
+        let inner_ = Arc::downgrade(&inner);
+        thread::Builder::new()
+            .name("turn-xdp".to_string())
+            .spawn(move || poll_loop(inner_, interval))?;
+
+        Ok(Self(Some(inner)))
+    }
+
+    /// whether the channel data is relayed by the xdp program.
+    pub fn is_enabled(&self) -> bool {
+        self.0.is_some()
+    }
+
+    /// get the number of the offloaded channels.
+    pub fn len(&self) -> usize {
+        self.0
+            .as_ref()
+            .map(|inner| inner.entries.lock().unwrap().len())
+            .unwrap_or(0)
+    }
+
+    /// whether no channel is offloaded.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// copy the forwarding entry of the channel into the map of the program.
+    ///
+    /// a refreshed channel resolves to the same entry, which is left as it
+    /// is so the counters of the program keep going. a channel that is
+    /// rebound to a target that can not be offloaded is taken out of the
+    /// map.
+    pub fn bind(&self, addr: &SocketAddr, channel: u16, forward: &Forward) {
+        let inner = match &self.0 {
+            Some(inner) => inner,
+            None => return,
+        };
+
+        let flow = match (
+            forward.kind,
+            Endpoint::new(&forward.target),
+            inner.interfaces.get(&forward.interface),
+        ) {
+            (StunClass::Channel, Some(target), Some(interface)) => Flow {
+                target_addr: target.addr,
+                target_port: target.port,
+                interface_addr: interface.addr,
+                interface_port: interface.port,
+                ..Default::default()
+            },
+            _ => return self.unbind(addr, channel),
+        };
+
+        let key = match Endpoint::new(addr) {
+            Some(client) => FlowKey {
+                addr: client.addr,
+                port: client.port,
+                channel,
+            },
+            None => return,
+        };
+
+        let mut entries = inner.entries.lock().unwrap();
+        if let Some(entry) = entries.get_mut(&(*addr, channel)) {
+            if entry.flow == flow {
+                return;
+            }
+
+            collect(&inner.flows, addr, entry, &inner.actor);
+        }
+
+        if let Err(e) = inner.flows.update(&key, &flow) {
+            log::warn!(
+                "xdp flow update failed: addr={}, channel={}, err={}",
+                addr,
+                channel,
+                e
+            );
+
+            if entries.remove(&(*addr, channel)).is_some() {
+                let _ = inner.flows.delete(&key);
+            }
+
+            return;
+        }
+
+        entries.insert(
+            (*addr, channel),
+            Entry {
+                target: forward.target,
+                pkts: 0,
+                bytes: 0,
+                flow,
+                key,
+            },
+        );
+    }
+
+    /// take the channel out of the map of the program, the counters that
+    /// were not read back yet are counted first.
+    pub fn unbind(&self, addr: &SocketAddr, channel: u16) {
+        let inner = match &self.0 {
+            Some(inner) => inner,
+            None => return,
+        };
+
+        let entry = inner.entries.lock().unwrap().remove(&(*addr, channel));
+        if let Some(mut entry) = entry {
+            collect(&inner.flows, addr, &mut entry, &inner.actor);
+            if let Err(e) = inner.flows.delete(&entry.key) {
+                log::warn!(
+                    "xdp flow delete failed: addr={}, channel={}, err={}",
+                    addr,
+                    channel,
+                    e
+                );
+            }
+        }
+    }
+}
+
+/// read the counters of the offloaded channel and add what the program
+/// relayed since the last read to the statistics of the sender and the
+/// target, the same way the interface workers count a relayed packet.
+fn collect(flows: &Map, addr: &SocketAddr, entry: &mut Entry, actor: &StatisticsActor) {
+    let flow = match flows.lookup::<_, Flow>(&entry.key) {
+        Ok(flow) if flow.pkts > entry.pkts => flow,
+        _ => return,
+    };
+
+    let pkts = (flow.pkts - entry.pkts) as usize;
+    let bytes = flow.bytes.wrapping_sub(entry.bytes) as usize;
+    entry.pkts = flow.pkts;
+    entry.bytes = flow.bytes;
+    actor.send_shared(
+        addr,
+        &[Stats::ReceivedBytes(bytes), Stats::ReceivedPkts(pkts)],
+    );
+    actor.send_shared(
+        &entry.target,
+        &[Stats::SendBytes(bytes), Stats::SendPkts(pkts)],
+    );
+}
+
+/// the loop of the thread that reads the counters back, it ends when the
+/// fast path is dropped.
+fn poll_loop(inner: Weak<Inner>, interval: Duration) {
+    loop {
+        thread::sleep(interval);
+        let inner = match inner.upgrade() {
+            Some(inner) => inner,
+            None => break,
+        };
+
+        let mut entries = inner.entries.lock().unwrap();
+        for ((addr, _), entry) in entries.iter_mut() {
+            collect(&inner.flows, addr, entry, &inner.actor);
+        }
+    }
+}
+
+/// a pinned bpf map.
+struct Map(i32);
+
+impl Map {
+    fn open(path: &Path) -> io::Result<Self> {
+        let fd = sys::obj_get(path).map_err(|e| {
+            io::Error::new(e.kind(), format!("open bpf map {}: {}", path.display(), e))
+        })?;
+
+        Ok(Self(fd))
+    }
+
+    fn lookup<K, V: Default>(&self, key: &K) -> io::Result<V> {
+        let mut value = V::default();
+        sys::map_elem(
+            sys::BPF_MAP_LOOKUP_ELEM,
+            self.0,
+            key as *const K as u64,
+            &mut value as *mut V as u64,
+        )?;
+
+        Ok(value)
+    }
+
+    fn update<K, V>(&self, key: &K, value: &V) -> io::Result<()> {
+        sys::map_elem(
+            sys::BPF_MAP_UPDATE_ELEM,
+            self.0,
+            key as *const K as u64,
+            value as *const V as u64,
+        )
+    }
+
+    fn delete<K>(&self, key: &K) -> io::Result<()> {
+        sys::map_elem(sys::BPF_MAP_DELETE_ELEM, self.0, key as *const K as u64, 0)
+    }
+}
+
+impl Drop for Map {
+    fn drop(&mut self) {
+        sys::close(self.0);
+    }
+}
+
+/// the `bpf(2)` commands that are used on the pinned maps, there is no bpf
+/// library in the dependencies for a handful of system calls.
+#[cfg(target_os = "linux")]
+mod sys {
+    use std::{ffi::CString, io, os::unix::ffi::OsStrExt, path::Path};
+
+    pub const BPF_MAP_LOOKUP_ELEM: i32 = 1;
+    pub const BPF_MAP_UPDATE_ELEM: i32 = 2;
+    pub const BPF_MAP_DELETE_ELEM: i32 = 3;
+    const BPF_OBJ_GET: i32 = 7;
+
+    /// the leading fields of `union bpf_attr` for the map element commands,
+    /// the kernel takes the size of the attributes from the caller.
+    #[repr(C)]
+    struct MapElemAttr {
+        map_fd: u32,
+        pad: u32,
+        key: u64,
+        value: u64,
+        flags: u64,
+    }
+
+    /// the leading fields of `union bpf_attr` for `BPF_OBJ_GET`.
+    #[repr(C)]
+    struct ObjAttr {
+        pathname: u64,
+        bpf_fd: u32,
+        file_flags: u32,
+    }
+
+    fn bpf<T>(cmd: i32, attr: &T) -> io::Result<i32> {
+        let ret = unsafe {
+            libc::syscall(
+                libc::SYS_bpf,
+                cmd,
+                attr as *const T,
+                std::mem::size_of::<T>() as u32,
+            )
+        };
+
+        if ret < 0 {
+            return Err(io::Error::last_os_error());
+        }
+
+        Ok(ret as i32)
+    }
+
+    pub fn obj_get(path: &Path) -> io::Result<i32> {
+        let path = CString::new(path.as_os_str().as_bytes())?;
+        bpf(
+            BPF_OBJ_GET,
+            &ObjAttr {
+                pathname: path.as_ptr() as u64,
+                bpf_fd: 0,
+                file_flags: 0,
+            },
+        )
+    }
+
+    pub fn map_elem(cmd: i32, fd: i32, key: u64, value: u64) -> io::Result<()> {
+        bpf(
+            cmd,
+            &MapElemAttr {
+                map_fd: fd as u32,
+                pad: 0,
+                flags: 0,
+                value,
+                key,
+            },
+        )?;
+
+        Ok(())
+    }
+
+    pub fn close(fd: i32) {
+        unsafe {
+            libc::close(fd);
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+mod sys {
+    use std::{io, path::Path};
+
+    pub const BPF_MAP_LOOKUP_ELEM: i32 = 1;
+    pub const BPF_MAP_UPDATE_ELEM: i32 = 2;
+    pub const BPF_MAP_DELETE_ELEM: i32 = 3;
+
+    pub fn obj_get(_: &Path) -> io::Result<i32> {
+        Err(io::Error::new(
+            io::ErrorKind::Unsupported,
+            "the xdp fast path is only supported on linux",
+        ))
+    }
+
+    pub fn map_elem(_: i32, _: i32, _: u64, _: u64) -> io::Result<()> {
+        Err(io::ErrorKind::Unsupported.into())
+    }
+
+    pub fn close(_: i32) {}
+}
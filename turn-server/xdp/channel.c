@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// xdp fast path of the channel data between the udp clients of the server.
+//
+// the ChannelData of an established channel is rewritten in place, the
+// addresses of the ip and udp headers are set to the interface and the
+// address of the target client, and the packet is sent out again without
+// reaching the socket. everything else, stun messages, the first packets of
+// a channel, fragments, ipv6, is passed to the udp sockets of the server.
+//
+// the maps are pinned by the loader and kept in sync by turn-server, see
+// `turn.xdp` in docs/configure.md:
+//
+//   clang -O2 -g -target bpf -c channel.c -o channel.o
+//   bpftool prog load channel.o /sys/fs/bpf/turn/prog pinmaps /sys/fs/bpf/turn
+//   bpftool net attach xdp pinned /sys/fs/bpf/turn/prog dev eth0
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+#ifndef AF_INET
+#define AF_INET 2
+#endif
+
+// a listen address of a udp interface, in network byte order.
+struct endpoint {
+    __u32 addr;
+    __u16 port;
+    __u16 pad;
+};
+
+// the client address in network byte order, the channel number in host
+// byte order.
+struct flow_key {
+    __u32 addr;
+    __u16 port;
+    __u16 channel;
+};
+
+// the forwarding entry of the channel, the counters are read back by
+// turn-server and added to the statistics of the sessions.
+struct flow {
+    __u32 target_addr;
+    __u32 interface_addr;
+    __u16 target_port;
+    __u16 interface_port;
+    __u32 pad;
+    __u64 pkts;
+    __u64 bytes;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 64);
+    __type(key, struct endpoint);
+    __type(value, __u8);
+} turn_ports SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 262144);
+    __type(key, struct flow_key);
+    __type(value, struct flow);
+} turn_flows SEC(".maps");
+
+static __always_inline __u16 ip_checksum(struct iphdr *ip)
+{
+    __u16 *words = (__u16 *)ip;
+    __u32 sum = 0;
+
+#pragma unroll
+    for (int i = 0; i < sizeof(*ip) / 2; i++)
+        sum += words[i];
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+SEC("xdp")
+int turn_channel(struct xdp_md *ctx)
+{
+    void *data = (void *)(long)ctx->data;
+    void *end = (void *)(long)ctx->data_end;
+
+    struct ethhdr *eth = data;
+    if ((void *)(eth + 1) > end || eth->h_proto != bpf_htons(ETH_P_IP))
+        return XDP_PASS;
+
+    struct iphdr *ip = (void *)(eth + 1);
+    if ((void *)(ip + 1) > end || ip->ihl != 5 || ip->protocol != IPPROTO_UDP)
+        return XDP_PASS;
+
+    // the fragments are reassembled by the kernel.
+    if (ip->frag_off & bpf_htons(0x3fff))
+        return XDP_PASS;
+
+    struct udphdr *udp = (void *)(ip + 1);
+    __u8 *payload = (void *)(udp + 1);
+    if ((void *)(payload + 4) > end)
+        return XDP_PASS;
+
+    // the first two bits of ChannelData are 0b01.
+    if ((payload[0] & 0xc0) != 0x40)
+        return XDP_PASS;
+
+    struct endpoint local = {
+        .addr = ip->daddr,
+        .port = udp->dest,
+    };
+
+    if (!bpf_map_lookup_elem(&turn_ports, &local))
+        return XDP_PASS;
+
+    struct flow_key key = {
+        .addr = ip->saddr,
+        .port = udp->source,
+        .channel = ((__u16)payload[0] << 8) | payload[1],
+    };
+
+    struct flow *flow = bpf_map_lookup_elem(&turn_flows, &key);
+    if (!flow)
+        return XDP_PASS;
+
+    // a message that is longer than the datagram is dropped by the server,
+    // leave it to the socket path.
+    __u16 size = bpf_ntohs(udp->len);
+    __u16 len = ((__u16)payload[2] << 8) | payload[3];
+    if (size < sizeof(*udp) + 4 + len)
+        return XDP_PASS;
+
+    size -= sizeof(*udp);
+
+    struct bpf_fib_lookup fib = {
+        .family = AF_INET,
+        .l4_protocol = IPPROTO_UDP,
+        .tot_len = bpf_ntohs(ip->tot_len),
+        .ipv4_src = flow->interface_addr,
+        .ipv4_dst = flow->target_addr,
+        .ifindex = ctx->ingress_ifindex,
+    };
+
+    if (bpf_fib_lookup(ctx, &fib, sizeof(fib), 0) != BPF_FIB_LKUP_RET_SUCCESS)
+        return XDP_PASS;
+
+    __builtin_memcpy(eth->h_dest, fib.dmac, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, fib.smac, ETH_ALEN);
+
+    ip->saddr = flow->interface_addr;
+    ip->daddr = flow->target_addr;
+    ip->ttl = 64;
+    ip->check = 0;
+    ip->check = ip_checksum(ip);
+
+    // the udp checksum is optional over ipv4.
+    udp->source = flow->interface_port;
+    udp->dest = flow->target_port;
+    udp->check = 0;
+
+    __sync_fetch_and_add(&flow->pkts, 1);
+    __sync_fetch_and_add(&flow->bytes, size);
+
+    if (fib.ifindex == ctx->ingress_ifindex)
+        return XDP_TX;
+
+    return bpf_redirect(fib.ifindex, 0);
+}
+
+char LICENSE[] SEC("license") = "GPL";
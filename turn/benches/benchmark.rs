@@ -1,7 +1,15 @@
-use std::{net::SocketAddr, sync::Arc};
+use std::{
+    net::SocketAddr,
+    sync::Arc,
+    thread,
+    time::{Duration, Instant},
+};
 
 use criterion::*;
-use turn::{Observer, Router};
+use turn::{
+    router::ports::{port_range, PortPools},
+    Observer, Router,
+};
 
 struct RouterObserver;
 
@@ -22,11 +30,11 @@ fn criterion_benchmark(c: &mut Criterion) {
     let _ = router.get_key_block(&local_addr, &local_interface, &local_interface, "test");
     let _ = router.get_key_block(&peer_addr, &peer_interface, &peer_interface, "test");
 
-    let local_port = router.alloc_port(&local_addr).unwrap();
-    let peer_port = router.alloc_port(&peer_addr).unwrap();
+    let local_relay = router.alloc_port(&local_addr, &[local_interface.ip()]).unwrap();
+    let peer_relay = router.alloc_port(&peer_addr, &[peer_interface.ip()]).unwrap();
 
-    router.bind_port(&local_addr, peer_port);
-    router.bind_port(&peer_addr, local_port);
+    router.bind_port(&local_addr, &peer_relay);
+    router.bind_port(&peer_addr, &local_relay);
 
     router.refresh(&local_addr, 600);
     router.refresh(&peer_addr, 600);
@@ -34,7 +42,7 @@ fn criterion_benchmark(c: &mut Criterion) {
     let mut turn_router = c.benchmark_group("turn_router");
     turn_router.bench_function("local_indication_peer", |b| {
         b.iter(|| {
-            let addr = router.get_port_bound(peer_port).unwrap();
+            let addr = router.get_port_bound(&peer_relay).unwrap();
             let _ = router.get_bound_port(&local_addr, &addr).unwrap();
             let _ = router.get_interface(&addr).unwrap();
         })
@@ -42,14 +50,14 @@ fn criterion_benchmark(c: &mut Criterion) {
 
     turn_router.bench_function("peer_indication_local", |b| {
         b.iter(|| {
-            let addr = router.get_port_bound(local_port).unwrap();
+            let addr = router.get_port_bound(&local_relay).unwrap();
             let _ = router.get_bound_port(&peer_addr, &addr).unwrap();
             let _ = router.get_interface(&addr).unwrap();
         })
     });
 
-    router.bind_channel(&local_addr, peer_port, 0x4000).unwrap();
-    router.bind_channel(&peer_addr, local_port, 0x4000).unwrap();
+    router.bind_channel(&local_addr, &peer_relay, 0x4000).unwrap();
+    router.bind_channel(&peer_addr, &local_relay, 0x4000).unwrap();
 
     turn_router.bench_function("local_channel_data_peer", |b| {
         b.iter(|| {
@@ -65,9 +73,104 @@ fn criterion_benchmark(c: &mut Criterion) {
         })
     });
 
+    turn_router.bench_function("local_channel_data_peer_forward", |b| {
+        b.iter(|| router.get_forward(&local_addr, 0x4000).unwrap())
+    });
+
+    turn_router.bench_function("peer_channel_data_local_forward", |b| {
+        b.iter(|| router.get_forward(&peer_addr, 0x4000).unwrap())
+    });
+
+    turn_router.finish();
+
+    // The same lookups from several threads at once, the time of one
+    // iteration is the wall time of the slowest thread, so with no lock
+    // contention it stays flat as the thread count grows.
+    let mut turn_router_mt = c.benchmark_group("turn_router_mt");
+    let parallelism = thread::available_parallelism().map(|n| n.get()).unwrap_or(1);
+    for threads in [1, 2, 4, 8, 16, 32] {
+        if threads > parallelism {
+            break;
+        }
+
+        turn_router_mt.throughput(Throughput::Elements(threads as u64));
+        turn_router_mt.bench_with_input(
+            BenchmarkId::new("channel_data", threads),
+            &threads,
+            |b, threads| {
+                b.iter_custom(|iters| {
+                    parallel(*threads, iters, |i| {
+                        let addr = if i % 2 == 0 { &local_addr } else { &peer_addr };
+                        let _ = router.get_forward(addr, 0x4000).unwrap();
+                    })
+                })
+            },
+        );
+
+        turn_router_mt.bench_with_input(
+            BenchmarkId::new("indication", threads),
+            &threads,
+            |b, threads| {
+                b.iter_custom(|iters| {
+                    parallel(*threads, iters, |i| {
+                        let (addr, relay) = if i % 2 == 0 {
+                            (&local_addr, &peer_relay)
+                        } else {
+                            (&peer_addr, &local_relay)
+                        };
+
+                        let peer = router.get_port_bound(relay).unwrap();
+                        let _ = router.get_bound_port(addr, &peer).unwrap();
+                        let _ = router.get_interface(&peer).unwrap();
+                    })
+                })
+            },
+        );
+    }
+
+    turn_router_mt.finish();
+
     router.refresh(&local_addr, 0);
     router.refresh(&peer_addr, 0);
-    turn_router.finish();
+
+    // Allocate and free a port with the range filled to a given occupancy,
+    // the freed port keeps the occupancy steady.
+    let mut turn_ports = c.benchmark_group("turn_ports");
+    for (name, range) in [("dynamic", port_range()), ("wide", 1024..65535)] {
+        for occupancy in [10, 90, 99] {
+            let mut pools = PortPools::with_range(range.clone());
+            for _ in 0..pools.capacity() * occupancy / 100 {
+                pools.alloc(None).unwrap();
+            }
+
+            turn_ports.bench_function(BenchmarkId::new(name, occupancy), |b| {
+                b.iter(|| {
+                    let port = pools.alloc(None).unwrap();
+                    pools.restore(black_box(port));
+                })
+            });
+        }
+    }
+
+    turn_ports.finish();
+}
+
+/// run `iters` calls of `f` on each of `threads` threads, returns the wall
+/// time of the whole run.
+fn parallel<F: Fn(usize) + Sync>(threads: usize, iters: u64, f: F) -> Duration {
+    let start = Instant::now();
+    thread::scope(|scope| {
+        for i in 0..threads {
+            let f = &f;
+            scope.spawn(move || {
+                for _ in 0..iters {
+                    f(i);
+                }
+            });
+        }
+    });
+
+    start.elapsed()
 }
 
 criterion_group!(benches, criterion_benchmark);
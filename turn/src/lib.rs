@@ -3,8 +3,11 @@ pub mod router;
 
 pub use processor::Processor;
 pub use router::nodes::Node;
+pub use router::nonces::Nonces;
 pub use router::Router;
 
+use router::{forwards::Forward, limits::Limits};
+
 use std::{net::SocketAddr, sync::Arc};
 
 use async_trait::async_trait;
@@ -13,6 +16,9 @@ use async_trait::async_trait;
 pub enum StunClass {
     Msg,
     Channel,
+    /// application data sent to an external peer from a relay socket, the
+    /// interface of the response is the relayed transport address.
+    Peer,
 }
 
 #[rustfmt::skip]
@@ -204,6 +210,102 @@ pub trait Observer: Send + Sync {
     /// exit of the session.
     #[allow(unused)]
     fn abort(&self, addr: &SocketAddr, name: &str) {}
+
+    /// the limits of a new node
+    ///
+    /// asked once when the node is created, the data that the node sends
+    /// beyond the limits is dropped and reported with `limited`.
+    #[allow(unused)]
+    fn get_limits(&self, addr: &SocketAddr, name: &str) -> Limits {
+        Limits::default()
+    }
+
+    /// data dropped by a limit
+    ///
+    /// Triggered for every packet of `size` bytes that the node sends
+    /// beyond its limits.
+    #[allow(unused)]
+    fn limited(&self, addr: &SocketAddr, size: usize) {}
+
+    /// session restore
+    ///
+    /// Triggered when the session is restored from the snapshot of another
+    /// process, with its allocations, permissions and channels. no
+    /// `allocated` or `channel_bind` is triggered for the restored state.
+    #[allow(unused)]
+    fn restored(&self, addr: &SocketAddr, name: &str) {}
+
+    /// whether the allocations relay to the peers outside of the server.
+    ///
+    /// by default only the allocations of this server can be peers of each
+    /// other, and the permissions towards any other address are rejected
+    /// with a 403 (Forbidden) error. when this returns true, every relayed
+    /// transport address is opened with `open_relay` and the data of the
+    /// external peers goes through these sockets.
+    fn external_relay(&self) -> bool {
+        false
+    }
+
+    /// relay socket open
+    ///
+    /// Triggered when a relayed transport address is allocated and the
+    /// external relay is enabled. returns false when the address can not
+    /// be bound, another port is allocated then.
+    #[allow(unused)]
+    fn open_relay(&self, relay: &SocketAddr) -> bool {
+        true
+    }
+
+    /// relay socket close
+    ///
+    /// Triggered when the allocation of a relayed transport address that
+    /// was opened with `open_relay` is removed.
+    #[allow(unused)]
+    fn close_relay(&self, relay: &SocketAddr) {}
+
+    /// whether the allocations may relay to the external peer.
+    ///
+    /// only asked when the external relay is enabled, the permissions and
+    /// channels towards a peer that is not permitted are rejected with a
+    /// 403 (Forbidden) error.
+    #[allow(unused)]
+    fn permit_peer(&self, peer: &SocketAddr) -> bool {
+        true
+    }
+
+    /// alternate server of an allocation
+    ///
+    /// Triggered by an authenticated Allocate request of a client that has
+    /// no allocation yet. `external` is the external address of the
+    /// interface that the request was received on. when this returns an
+    /// address, the server rejects the request with a 300 (Try Alternate)
+    /// error and the address in the ALTERNATE-SERVER attribute, the client
+    /// then allocates on that server.
+    #[allow(unused)]
+    fn alternate_server(
+        &self,
+        addr: &SocketAddr,
+        external: &SocketAddr,
+        name: &str,
+    ) -> Option<SocketAddr> {
+        None
+    }
+
+    /// channel forwarding entry installed
+    ///
+    /// Triggered when the forwarding entry of a channel is resolved, or
+    /// replaced by a rebind. the ChannelData that the address sends on the
+    /// channel goes to the target of the entry from now on, so a copy of
+    /// the forwarding table, for example one in the kernel, can follow it.
+    #[allow(unused)]
+    fn forward_bound(&self, addr: &SocketAddr, channel: u16, forward: &Forward) {}
+
+    /// channel forwarding entry removed
+    ///
+    /// Triggered when the channel expires, or the address or the target of
+    /// the channel is removed.
+    #[allow(unused)]
+    fn forward_removed(&self, addr: &SocketAddr, channel: u16) {}
 }
 
 /// TUTN service.
@@ -234,11 +336,54 @@ impl Service {
     /// Service::new("test".to_string(), vec![], ObserverTest);
     /// ```
     pub fn new<T>(realm: String, externals: Vec<SocketAddr>, observer: T) -> Self
+    where
+        T: Observer + 'static,
+    {
+        Self::with_options(realm, externals, observer, router::Options::default())
+    }
+
+    /// Create turn service with the given router options.
+    ///
+    /// every external ip is a relay ip with a port pool of the whole port
+    /// range of the options.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::Options;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {}
+    ///
+    /// let service = Service::with_options(
+    ///     "test".to_string(),
+    ///     vec!["127.0.0.1:3478".parse().unwrap()],
+    ///     ObserverTest,
+    ///     Options {
+    ///         nonces: Nonces::with_secret(b"secret"),
+    ///         port_range: 1024..65535,
+    ///     },
+    /// );
+    ///
+    /// assert_eq!(service.get_router().capacity(), 65535 - 1024);
+    /// ```
+    pub fn with_options<T>(
+        realm: String,
+        externals: Vec<SocketAddr>,
+        observer: T,
+        options: router::Options,
+    ) -> Self
     where
         T: Observer + 'static,
     {
         let observer = Arc::new(observer);
-        let router = Router::new(realm.clone(), observer.clone());
+        let router = Router::with_options(realm.clone(), observer.clone(), options);
+        for external in &externals {
+            router.add_relay(external.ip());
+        }
+
         Self {
             externals: Arc::new(externals),
             observer,
@@ -1,7 +1,7 @@
 use super::{verify_message, Context, Response};
 use crate::{StunClass, SOFTWARE};
 
-use std::{net::SocketAddr, sync::Arc};
+use std::net::SocketAddr;
 
 use bytes::BytesMut;
 use stun::attribute::ErrKind::*;
@@ -26,6 +26,23 @@ fn reject<'a>(
     Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
 }
 
+/// send the client to the server that its allocation is placed on.
+#[inline(always)]
+fn redirect<'a>(
+    reader: &MessageReader,
+    key: &util::HmacSha1,
+    alternate: SocketAddr,
+    bytes: &'a mut BytesMut,
+) -> Result<Option<Response<'a>>, StunError> {
+    let method = Method::Allocate(Kind::Error);
+    let mut pack = MessageWriter::extend(method, reader, bytes);
+    pack.append::<ErrorCode>(Error::from(TryAlternate));
+    pack.append::<AlternateServer>(alternate);
+    pack.append::<Software>(SOFTWARE);
+    pack.flush_with(key);
+    Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
+}
+
 /// return allocate ok response
 ///
 /// NOTE: The use of randomized port assignments to avoid certain
@@ -40,18 +57,17 @@ fn reject<'a>(
 fn resolve<'a>(
     ctx: &Context,
     reader: &MessageReader,
-    key: &[u8; 16],
-    port: u16,
+    key: &util::HmacSha1,
+    relay: SocketAddr,
     bytes: &'a mut BytesMut,
 ) -> Result<Option<Response<'a>>, StunError> {
     let method = Method::Allocate(Kind::Response);
-    let alloc_addr = Arc::new(SocketAddr::new(ctx.env.external.ip(), port));
     let mut pack = MessageWriter::extend(method, reader, bytes);
-    pack.append::<XorRelayedAddress>(*alloc_addr.as_ref());
+    pack.append::<XorRelayedAddress>(relay);
     pack.append::<XorMappedAddress>(ctx.addr);
     pack.append::<Lifetime>(600);
     pack.append::<Software>(SOFTWARE);
-    pack.flush(Some(key))?;
+    pack.flush_with(key);
     Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
 }
 
@@ -81,15 +97,30 @@ pub async fn process<'a>(
     }
 
     let (username, key) = match verify_message(&ctx, &reader).await {
-        None => return reject(ctx, reader, bytes, Unauthorized),
-        Some(ret) => ret,
+        Err(err) => return reject(ctx, reader, bytes, err),
+        Ok(ret) => ret,
     };
 
-    let port = match ctx.env.router.alloc_port(&ctx.addr) {
+    // The allocations may be placed on another server, the key that was
+    // fetched for the redirected client is not kept.
+    let allocated = ctx
+        .env
+        .router
+        .get_node(&ctx.addr)
+        .map(|node| !node.ports.is_empty());
+    if allocated == Some(false) {
+        let observer = &ctx.env.observer;
+        if let Some(alternate) = observer.alternate_server(&ctx.addr, &ctx.env.external, username) {
+            ctx.env.router.remove_silent(&ctx.addr);
+            return redirect(&reader, &key, alternate, bytes);
+        }
+    }
+
+    let relay = match ctx.env.router.alloc_port(&ctx.addr, &ctx.env.relays) {
         None => return reject(ctx, reader, bytes, Unauthorized),
-        Some(p) => p,
+        Some(r) => r,
     };
 
-    ctx.env.observer.allocated(&ctx.addr, username, port);
-    resolve(&ctx, &reader, &key, port, bytes)
+    ctx.env.observer.allocated(&ctx.addr, username, relay.port());
+    resolve(&ctx, &reader, &key, relay, bytes)
 }
@@ -1,4 +1,4 @@
-use super::{verify_message, Context, Response};
+use super::{ip_is_local, verify_message, Context, Response};
 use crate::StunClass;
 
 use bytes::BytesMut;
@@ -18,6 +18,7 @@ fn reject<'a>(
     let mut pack = MessageWriter::extend(method, &reader, bytes);
     pack.append::<ErrorCode>(Error::from(err));
     pack.append::<Realm>(&ctx.env.realm);
+    pack.append::<Nonce>(&ctx.env.router.get_nonce(&ctx.addr));
     pack.flush(None)?;
     Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
 }
@@ -26,11 +27,11 @@ fn reject<'a>(
 #[inline(always)]
 fn resolve<'a>(
     reader: &MessageReader,
-    key: &[u8; 16],
+    key: &util::HmacSha1,
     bytes: &'a mut BytesMut,
 ) -> Result<Option<Response<'a>>, StunError> {
     let method = Method::ChannelBind(Kind::Response);
-    MessageWriter::extend(method, reader, bytes).flush(Some(key))?;
+    MessageWriter::extend(method, reader, bytes).flush_with(key);
     Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
 }
 
@@ -79,7 +80,8 @@ pub async fn process<'a>(
         Some(c) => c,
     };
 
-    if ctx.env.external.ip() != peer.ip() {
+    let is_local = ip_is_local(&ctx, &peer);
+    if !is_local && !ctx.env.router.is_external_relay() {
         return reject(ctx, reader, bytes, Forbidden);
     }
 
@@ -88,16 +90,17 @@ pub async fn process<'a>(
     }
 
     let (username, key) = match verify_message(&ctx, &reader).await {
-        None => return reject(ctx, reader, bytes, Unauthorized),
-        Some(ret) => ret,
+        Err(err) => return reject(ctx, reader, bytes, err),
+        Ok(ret) => ret,
     };
 
-    if ctx
-        .env
-        .router
-        .bind_channel(&ctx.addr, peer.port(), number)
-        .is_none()
-    {
+    let bound = if is_local {
+        ctx.env.router.bind_channel(&ctx.addr, &peer, number)
+    } else {
+        ctx.env.router.bind_peer_channel(&ctx.addr, &peer, number)
+    };
+
+    if bound.is_none() {
         return reject(ctx, reader, bytes, InsufficientCapacity);
     }
 
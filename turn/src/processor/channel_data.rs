@@ -1,5 +1,8 @@
-use super::{Context, Response};
+use super::{Env, Response};
 use crate::StunClass;
+
+use std::net::SocketAddr;
+
 use stun::ChannelData;
 
 /// process channel data
@@ -30,9 +33,34 @@ use stun::ChannelData;
 /// the Length field in the ChannelData message is 0, then there will be
 /// no data in the UDP datagram, but the UDP datagram is still formed and
 /// sent [(Section 4.1 of [RFC6263])](https://tools.ietf.org/html/rfc6263#section-4.1).
-pub fn process(ctx: Context, data: ChannelData<'_>) -> Option<Response<'_>> {
-    let addr = ctx.env.router.get_channel_bound(&ctx.addr, data.number)?;
-    let interface = ctx.env.router.get_interface(&addr)?;
-    let to = (ctx.env.interface != interface.addr).then(|| interface.addr);
-    Some(Response::new(data.buf, StunClass::Channel, Some(addr), to))
+///
+/// this is the data path, it takes the environment by reference instead of a
+/// `Context`, so relaying a message does not touch any reference count.
+#[inline(always)]
+pub fn process<'a>(env: &Env, addr: SocketAddr, data: ChannelData<'a>) -> Option<Response<'a>> {
+    let forward = env.router.get_forward(&addr, data.number)?;
+    if !env.router.check_limit(&addr, data.buf.len()) {
+        env.observer.limited(&addr, data.buf.len());
+        return None;
+    }
+
+    // An external peer receives the application data only, from the relay
+    // socket of the allocation.
+    if forward.kind == StunClass::Peer {
+        let size = u16::from_be_bytes([data.buf[2], data.buf[3]]) as usize;
+        return Some(Response::new(
+            &data.buf[4..4 + size],
+            StunClass::Peer,
+            Some(forward.target),
+            Some(forward.interface),
+        ));
+    }
+
+    let to = (env.interface != forward.interface).then_some(forward.interface);
+    Some(Response::new(
+        data.buf,
+        StunClass::Channel,
+        Some(forward.target),
+        to,
+    ))
 }
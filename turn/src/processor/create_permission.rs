@@ -18,6 +18,7 @@ fn reject<'a>(
     let mut pack = MessageWriter::extend(method, &reader, bytes);
     pack.append::<ErrorCode>(Error::from(err));
     pack.append::<Realm>(&ctx.env.realm);
+    pack.append::<Nonce>(&ctx.env.router.get_nonce(&ctx.addr));
     pack.flush(None)?;
     Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
 }
@@ -26,13 +27,13 @@ fn reject<'a>(
 #[inline(always)]
 fn resolve<'a>(
     reader: &MessageReader,
-    key: &[u8; 16],
+    key: &util::HmacSha1,
     bytes: &'a mut BytesMut,
 ) -> Result<Option<Response<'a>>, StunError> {
     let method = Method::CreatePermission(Kind::Response);
     let mut pack = MessageWriter::extend(method, reader, bytes);
     pack.append::<Software>(SOFTWARE);
-    pack.flush(Some(key))?;
+    pack.flush_with(key);
     Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
 }
 
@@ -81,8 +82,8 @@ pub async fn process<'a>(
     bytes: &'a mut BytesMut,
 ) -> Result<Option<Response<'a>>, StunError> {
     let (username, key) = match verify_message(&ctx, &reader).await {
-        None => return reject(ctx, reader, bytes, Unauthorized),
-        Some(ret) => ret,
+        Err(err) => return reject(ctx, reader, bytes, err),
+        Ok(ret) => ret,
     };
 
     let peer = match reader.get::<XorPeerAddress>() {
@@ -90,11 +91,15 @@ pub async fn process<'a>(
         Some(a) => a,
     };
 
-    if !ip_is_local(&ctx, &peer) {
-        return reject(ctx, reader, bytes, Forbidden);
-    }
+    // The peers outside of the server are reached through the relay
+    // socket of the allocation, when the external relay is enabled.
+    let bound = if ip_is_local(&ctx, &peer) {
+        ctx.env.router.bind_port(&ctx.addr, &peer)
+    } else {
+        ctx.env.router.bind_peer(&ctx.addr, &peer)
+    };
 
-    if ctx.env.router.bind_port(&ctx.addr, peer.port()).is_none() {
+    if bound.is_none() {
         return reject(ctx, reader, bytes, Forbidden);
     }
 
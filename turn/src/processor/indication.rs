@@ -1,5 +1,3 @@
-use std::net::SocketAddr;
-
 use super::{ip_is_local, Context, Response};
 use crate::StunClass;
 
@@ -61,23 +59,42 @@ pub async fn process<'a>(
         Some(x) => x,
     };
 
-    if !ip_is_local(&ctx, &peer) {
-        return Ok(None);
-    }
-
     let data = match reader.get::<Data>() {
         None => return Ok(None),
         Some(x) => x,
     };
 
-    let addr = match ctx.env.router.get_port_bound(peer.port()) {
+    if !ctx.env.router.check_limit(&ctx.addr, data.len()) {
+        ctx.env.observer.limited(&ctx.addr, data.len());
+        return Ok(None);
+    }
+
+    // The data of an external peer leaves from the relay socket of the
+    // allocation as it is, without the stun message around it.
+    if !ip_is_local(&ctx, &peer) {
+        let relay = match ctx.env.router.get_peer_relay(&ctx.addr, &peer) {
+            None => return Ok(None),
+            Some(r) => r,
+        };
+
+        bytes.clear();
+        bytes.extend_from_slice(data);
+        return Ok(Some(Response::new(
+            bytes,
+            StunClass::Peer,
+            Some(peer),
+            Some(relay),
+        )));
+    }
+
+    let addr = match ctx.env.router.get_port_bound(&peer) {
         None => return Ok(None),
         Some(a) => a,
     };
 
-    let port = match ctx.env.router.get_bound_port(&ctx.addr, &addr) {
+    let relay = match ctx.env.router.get_bound_port(&ctx.addr, &addr) {
         None => return Ok(None),
-        Some(p) => p,
+        Some(r) => r,
     };
 
     let interface = match ctx.env.router.get_interface(&addr) {
@@ -87,7 +104,7 @@ pub async fn process<'a>(
 
     let method = Method::DataIndication;
     let mut pack = MessageWriter::extend(method, &reader, bytes);
-    pack.append::<XorPeerAddress>(SocketAddr::new(interface.external.ip(), port));
+    pack.append::<XorPeerAddress>(relay);
     pack.append::<Data>(data);
     pack.flush(None)?;
 
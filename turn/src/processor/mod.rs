@@ -4,11 +4,16 @@ pub mod channel_bind;
 pub mod channel_data;
 pub mod create_permission;
 pub mod indication;
+pub mod peer;
 pub mod refresh;
 
 use crate::{router::Router, Observer, StunClass};
 
-use std::{net::SocketAddr, sync::Arc};
+use std::{
+    convert::TryFrom,
+    net::{IpAddr, SocketAddr},
+    sync::Arc,
+};
 
 use bytes::BytesMut;
 use stun::attribute::*;
@@ -20,6 +25,9 @@ pub struct Env {
     pub router: Arc<Router>,
     pub external: Arc<SocketAddr>,
     pub externals: Arc<Vec<SocketAddr>>,
+    /// the relay ips that the allocations of this interface are spread
+    /// across, the external ips of the same address family.
+    pub relays: Vec<IpAddr>,
     pub observer: Arc<dyn Observer>,
 }
 
@@ -40,11 +48,19 @@ impl Processor {
         router: Arc<Router>,
         observer: Arc<dyn Observer>,
     ) -> Self {
+        let mut relays = vec![external.ip()];
+        for item in externals.iter() {
+            if item.is_ipv4() == external.is_ipv4() && !relays.contains(&item.ip()) {
+                relays.push(item.ip());
+            }
+        }
+
         Self {
             decoder: Decoder::new(),
             buf: BytesMut::with_capacity(4096),
             env: Arc::new(Env {
                 external: Arc::new(external),
+                relays,
                 realm: Arc::new(realm),
                 externals,
                 interface,
@@ -169,17 +185,71 @@ impl Processor {
         b: &'a [u8],
         addr: SocketAddr,
     ) -> Result<Option<Response<'c>>, StunError> {
+        // Most of the traffic is ChannelData, it goes straight to the
+        // forwarding lookup without the general decoder and the context.
+        if Decoder::is_channel_data(b) {
+            return Ok(channel_data::process(&self.env, addr, ChannelData::try_from(b)?));
+        }
+
         let ctx = Context {
             env: self.env.clone(),
             addr,
         };
 
         Ok(match self.decoder.decode(b)? {
-            Payload::ChannelData(x) => channel_data::process(ctx, x),
+            Payload::ChannelData(x) => channel_data::process(&ctx.env, addr, x),
             Payload::Message(x) => Self::message_process(ctx, x, &mut self.buf).await?,
         })
     }
 
+    /// whether processing the message has to fetch the key of the node
+    /// from the observer.
+    ///
+    /// the key is fetched on the first authenticated request of a node,
+    /// which can take as long as a round trip to the hooks server, and
+    /// `process` waits for it. the caller can hand these messages over to a
+    /// separate task instead, so that the other messages it receives are not
+    /// held up behind the fetch. ChannelData and the messages of the nodes
+    /// whose key is known never require it.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {}
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let service = Service::new("test".to_string(), vec![], ObserverTest);
+    /// let mut processor = service.get_processor(addr, addr);
+    ///
+    /// // channel data.
+    /// assert!(!processor.requires_key(&[0x40, 0x00, 0x00, 0x00], addr));
+    /// ```
+    pub fn requires_key(&mut self, b: &[u8], addr: SocketAddr) -> bool {
+        // Only stun messages carry credentials, the first two bits of a
+        // ChannelData message are never zero.
+        if b.len() < 4 || Decoder::is_channel_data(b) || self.env.router.has_key(&addr) {
+            return false;
+        }
+
+        match self.decoder.decode(b) {
+            Ok(Payload::Message(m)) => {
+                matches!(
+                    m.method,
+                    Method::Allocate(Kind::Request)
+                        | Method::CreatePermission(Kind::Request)
+                        | Method::ChannelBind(Kind::Request)
+                        | Method::Refresh(Kind::Request)
+                ) && m.get::<UserName>().is_some()
+            }
+            _ => false,
+        }
+    }
+
     /// process stun message
     ///
     /// TURN is an extension to STUN.  All TURN messages, with the exception
@@ -397,16 +467,27 @@ pub struct Context {
 pub(crate) async fn verify_message<'a>(
     ctx: &Context,
     reader: &MessageReader<'a, '_>,
-) -> Option<(&'a str, Arc<[u8; 16]>)> {
-    let username = reader.get::<UserName>()?;
-    let key = ctx
+) -> Result<(&'a str, Arc<util::HmacSha1>), ErrKind> {
+    // The nonces are not stored, a nonce that the server did not issue to
+    // this address, or that has expired, is rejected with a fresh one.
+    if let Some(nonce) = reader.get::<Nonce>() {
+        if !ctx.env.router.verify_nonce(&ctx.addr, nonce) {
+            return Err(ErrKind::StaleNonce);
+        }
+    }
+
+    let username = reader.get::<UserName>().ok_or(ErrKind::Unauthorized)?;
+    let integrity = ctx
         .env
         .router
-        .get_key(&ctx.addr, &ctx.env.interface, &ctx.env.external, username)
-        .await?;
+        .get_integrity(&ctx.addr, &ctx.env.interface, &ctx.env.external, username)
+        .await
+        .ok_or(ErrKind::Unauthorized)?;
 
-    reader.integrity(&key).ok()?;
-    Some((username, key))
+    reader
+        .integrity_with(&integrity)
+        .map_err(|_| ErrKind::Unauthorized)?;
+    Ok((username, integrity))
 }
 
 /// Check if the ip address belongs to the current turn server.
@@ -0,0 +1,130 @@
+use super::Response;
+use crate::{router::Router, StunClass};
+
+use std::net::SocketAddr;
+
+use bytes::{BufMut, BytesMut};
+use rand::{thread_rng, RngCore};
+use stun::attribute::{Data, XorPeerAddress};
+use stun::{MessageWriter, Method, StunError};
+
+/// process the data that an external peer sent to a relay socket
+///
+/// When the server receives a UDP datagram at a currently allocated
+/// relayed transport address, the server looks up the allocation
+/// associated with the relayed transport address.  The server then
+/// checks to see whether the set of permissions for the allocation allow
+/// the relaying of the UDP datagram as described in
+/// [Section 9](https://tools.ietf.org/html/rfc8656#section-9).
+///
+/// If relaying is permitted, then the server checks if there is a
+/// channel bound to the peer that sent the UDP datagram.  If a channel
+/// is bound, then the server forms a ChannelData message with the
+/// channel number and the data of the datagram.
+///
+/// If relaying is permitted but no channel is bound to the peer, then
+/// the server forms and sends a Data indication.  The Data indication
+/// MUST contain both an XOR-PEER-ADDRESS and a DATA attribute.  The DATA
+/// attribute is set to the value of the 'data octets' field from the
+/// datagram, and the XOR-PEER-ADDRESS attribute is set to the source
+/// transport address of the received UDP datagram.  The Data indication
+/// is then sent on the 5-tuple associated with the allocation.
+///
+/// the response is addressed to the node of the allocation, through the
+/// interface that the node is connected to.
+///
+/// # Examples
+///
+/// ```
+/// use bytes::BytesMut;
+/// use std::net::SocketAddr;
+/// use std::sync::Arc;
+/// use turn::router::*;
+/// use turn::*;
+///
+/// struct ObserverTest;
+///
+/// impl Observer for ObserverTest {
+///     fn get_password_blocking(
+///         &self,
+///         _: &SocketAddr,
+///         _: &str,
+///     ) -> Option<String> {
+///         Some("test".to_string())
+///     }
+///
+///     fn external_relay(&self) -> bool {
+///         true
+///     }
+/// }
+///
+/// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+/// let interface = "127.0.0.1:3478".parse::<SocketAddr>().unwrap();
+/// let peer = "1.1.1.1:8080".parse::<SocketAddr>().unwrap();
+///
+/// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+/// router.get_key_block(&addr, &interface, &interface, "test").unwrap();
+/// let relay = router.alloc_port(&addr, &[addr.ip()]).unwrap();
+///
+/// let mut bytes = BytesMut::new();
+/// let ret = processor::peer::process(&router, &relay, &peer, &[1, 2], &mut bytes);
+/// assert!(ret.unwrap().is_none());
+///
+/// router.bind_peer_channel(&addr, &peer, 0x4000).unwrap();
+/// let ret = processor::peer::process(&router, &relay, &peer, &[1, 2], &mut bytes)
+///     .unwrap()
+///     .unwrap();
+///
+/// assert_eq!(ret.data, &[0x40, 0x00, 0x00, 0x02, 1, 2]);
+/// assert_eq!(ret.kind, StunClass::Channel);
+/// assert_eq!(ret.relay, Some(addr));
+/// assert_eq!(ret.interface, Some(interface));
+/// ```
+pub fn process<'a>(
+    router: &Router,
+    relay: &SocketAddr,
+    peer: &SocketAddr,
+    data: &[u8],
+    bytes: &'a mut BytesMut,
+) -> Result<Option<Response<'a>>, StunError> {
+    let addr = match router.get_port_bound(relay) {
+        None => return Ok(None),
+        Some(a) => a,
+    };
+
+    if router.get_peer_relay(&addr, peer).is_none() {
+        return Ok(None);
+    }
+
+    let interface = match router.get_interface(&addr) {
+        None => return Ok(None),
+        Some(p) => p,
+    };
+
+    let kind = match router.get_peer_channel(&addr, peer) {
+        Some(number) => {
+            bytes.clear();
+            bytes.put_u16(number);
+            bytes.put_u16(data.len() as u16);
+            bytes.extend_from_slice(data);
+            StunClass::Channel
+        }
+        None => {
+            let mut token = [0u8; 12];
+            thread_rng().fill_bytes(&mut token);
+
+            let mut pack = MessageWriter::new(Method::DataIndication, &token, bytes);
+            pack.append::<XorPeerAddress>(*peer);
+            pack.append::<Data>(data);
+            pack.flush(None)?;
+            StunClass::Msg
+        }
+    };
+
+    Ok(Some(Response::new(
+        bytes,
+        kind,
+        Some(addr),
+        Some(interface.addr),
+    )))
+}
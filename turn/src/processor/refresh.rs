@@ -2,13 +2,13 @@ use super::{verify_message, Context, Response};
 use crate::StunClass;
 
 use bytes::BytesMut;
-use stun::attribute::ErrKind::*;
 use stun::attribute::*;
 use stun::*;
 
 /// return refresh error response
 #[inline(always)]
 fn reject<'a>(
+    ctx: &Context,
     reader: MessageReader,
     bytes: &'a mut BytesMut,
     err: ErrKind,
@@ -16,6 +16,8 @@ fn reject<'a>(
     let method = Method::Refresh(Kind::Error);
     let mut pack = MessageWriter::extend(method, &reader, bytes);
     pack.append::<ErrorCode>(Error::from(err));
+    pack.append::<Realm>(&ctx.env.realm);
+    pack.append::<Nonce>(&ctx.env.router.get_nonce(&ctx.addr));
     pack.flush(None)?;
     Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
 }
@@ -25,13 +27,13 @@ fn reject<'a>(
 pub fn resolve<'a>(
     reader: &MessageReader,
     lifetime: u32,
-    key: &[u8; 16],
+    key: &util::HmacSha1,
     bytes: &'a mut BytesMut,
 ) -> Result<Option<Response<'a>>, StunError> {
     let method = Method::Refresh(Kind::Response);
     let mut pack = MessageWriter::extend(method, reader, bytes);
     pack.append::<Lifetime>(lifetime);
-    pack.flush(Some(key))?;
+    pack.flush_with(key);
     Ok(Some(Response::new(bytes, StunClass::Msg, None, None)))
 }
 
@@ -80,8 +82,8 @@ pub async fn process<'a>(
     bytes: &'a mut BytesMut,
 ) -> Result<Option<Response<'a>>, StunError> {
     let (username, key) = match verify_message(&ctx, &reader).await {
-        None => return reject(reader, bytes, Unauthorized),
-        Some(ret) => ret,
+        Err(err) => return reject(&ctx, reader, bytes, err),
+        Ok(ret) => ret,
     };
 
     let time = reader.get::<Lifetime>().unwrap_or(600);
@@ -0,0 +1,387 @@
+use std::{
+    hash::{BuildHasher, Hash, Hasher},
+    sync::RwLock,
+};
+
+use ahash::{AHashMap, RandomState};
+
+/// The number of shards of an arena, must be a power of two.
+const SHARDS: usize = 64;
+
+/// generational handle of a record of the arena.
+///
+/// the handle addresses the slot of the record directly. the slot is reused
+/// once the record is removed, and the generation of the slot is bumped, so
+/// a handle that outlived its record never reaches the record that took the
+/// slot over.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub struct Handle {
+    shard: u32,
+    index: u32,
+    generation: u32,
+}
+
+struct Slot<K, V> {
+    generation: u32,
+    entry: Option<(K, V)>,
+}
+
+struct Slab<K, V> {
+    index: AHashMap<K, u32>,
+    slots: Vec<Slot<K, V>>,
+    free: Vec<u32>,
+}
+
+impl<K: Hash + Eq, V> Slab<K, V> {
+    fn get(&self, key: &K) -> Option<&V> {
+        let index = *self.index.get(key)?;
+        self.slots[index as usize].entry.as_ref().map(|(_, v)| v)
+    }
+
+    fn get_mut(&mut self, key: &K) -> Option<&mut V> {
+        let index = *self.index.get(key)?;
+        self.slots[index as usize].entry.as_mut().map(|(_, v)| v)
+    }
+}
+
+/// Pads the lock of a shard to its own cache line, like the shards of the
+/// sharded map.
+#[repr(align(128))]
+struct Shard<K, V>(RwLock<Slab<K, V>>);
+
+/// sharded slab arena.
+///
+/// every record lives in one slot of a slab, the key only indexes the slot.
+/// removing a record frees its slot in place for the next record, and the
+/// holders of a handle reach the record without hashing the key again.
+pub struct Arena<K, V> {
+    shards: Box<[Shard<K, V>]>,
+    hasher: RandomState,
+}
+
+impl<K: Hash + Eq + Copy, V> Arena<K, V> {
+    /// create an arena that can hold `capacity` records without
+    /// reallocating.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// assert_eq!(arena.len(), 0);
+    /// ```
+    pub fn with_capacity(capacity: usize) -> Self {
+        Self {
+            shards: (0..SHARDS)
+                .map(|_| {
+                    Shard(RwLock::new(Slab {
+                        index: AHashMap::with_capacity(capacity / SHARDS),
+                        slots: Vec::with_capacity(capacity / SHARDS),
+                        free: Vec::new(),
+                    }))
+                })
+                .collect(),
+            hasher: RandomState::new(),
+        }
+    }
+
+    fn locate(&self, key: &K) -> usize {
+        let mut hasher = self.hasher.build_hasher();
+        key.hash(&mut hasher);
+        hasher.finish() as usize & (SHARDS - 1)
+    }
+
+    /// insert the record of the key, returns the handle of the record.
+    ///
+    /// the record of a key that is already there is replaced in its slot,
+    /// and the handles of the old record stop resolving.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 2);
+    /// assert_eq!(arena.get_handle(&1), Some(handle));
+    ///
+    /// let replaced = arena.insert(1, 3);
+    /// assert_ne!(handle, replaced);
+    /// assert_eq!(arena.with_handle(handle, |_, v| *v), None);
+    /// assert_eq!(arena.with_handle(replaced, |_, v| *v), Some(3));
+    /// ```
+    pub fn insert(&self, key: K, value: V) -> Handle {
+        let shard = self.locate(&key);
+        let mut slab = self.shards[shard].0.write().unwrap();
+        let index = if let Some(index) = slab.index.get(&key).copied() {
+            let slot = &mut slab.slots[index as usize];
+            slot.generation = slot.generation.wrapping_add(1);
+            index
+        } else if let Some(index) = slab.free.pop() {
+            index
+        } else {
+            slab.slots.push(Slot {
+                generation: 0,
+                entry: None,
+            });
+
+            (slab.slots.len() - 1) as u32
+        };
+
+        slab.index.insert(key, index);
+        let slot = &mut slab.slots[index as usize];
+        slot.entry = Some((key, value));
+
+        Handle {
+            shard: shard as u32,
+            generation: slot.generation,
+            index,
+        }
+    }
+
+    /// remove the record of the key, returns the removed value.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 2);
+    ///
+    /// assert_eq!(arena.remove(&1), Some(2));
+    /// assert_eq!(arena.remove(&1), None);
+    /// assert_eq!(arena.with_handle(handle, |_, v| *v), None);
+    ///
+    /// // the slot is reused, the old handle still does not resolve.
+    /// let handle1 = arena.insert(1, 3);
+    /// assert_ne!(handle, handle1);
+    /// assert_eq!(arena.with_handle(handle, |_, v| *v), None);
+    /// ```
+    pub fn remove(&self, key: &K) -> Option<V> {
+        let mut slab = self.shards[self.locate(key)].0.write().unwrap();
+        let index = slab.index.remove(key)?;
+        let slot = &mut slab.slots[index as usize];
+        slot.generation = slot.generation.wrapping_add(1);
+
+        let (_, value) = slot.entry.take()?;
+        slab.free.push(index);
+        Some(value)
+    }
+
+    /// get the handle of the record of the key.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 2);
+    ///
+    /// assert_eq!(arena.get_handle(&1), Some(handle));
+    /// assert_eq!(arena.get_handle(&2), None);
+    /// ```
+    pub fn get_handle(&self, key: &K) -> Option<Handle> {
+        let shard = self.locate(key);
+        let slab = self.shards[shard].0.read().unwrap();
+        let index = *slab.index.get(key)?;
+        Some(Handle {
+            generation: slab.slots[index as usize].generation,
+            shard: shard as u32,
+            index,
+        })
+    }
+
+    /// read the record of the key.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// arena.insert(1, 2);
+    ///
+    /// assert_eq!(arena.with(&1, |v| *v), Some(2));
+    /// assert_eq!(arena.with(&2, |v| *v), None);
+    /// ```
+    pub fn with<R>(&self, key: &K, f: impl FnOnce(&V) -> R) -> Option<R> {
+        self.shards[self.locate(key)]
+            .0
+            .read()
+            .unwrap()
+            .get(key)
+            .map(f)
+    }
+
+    /// modify the record of the key.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// arena.insert(1, 2);
+    ///
+    /// assert_eq!(arena.with_mut(&1, |v| *v += 1), Some(()));
+    /// assert_eq!(arena.with(&1, |v| *v), Some(3));
+    /// ```
+    pub fn with_mut<R>(&self, key: &K, f: impl FnOnce(&mut V) -> R) -> Option<R> {
+        self.shards[self.locate(key)]
+            .0
+            .write()
+            .unwrap()
+            .get_mut(key)
+            .map(f)
+    }
+
+    /// read the key and the record of the handle, none when the record of
+    /// the handle has been removed or replaced.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 2);
+    ///
+    /// assert_eq!(arena.with_handle(handle, |k, v| (*k, *v)), Some((1, 2)));
+    /// ```
+    pub fn with_handle<R>(&self, handle: Handle, f: impl FnOnce(&K, &V) -> R) -> Option<R> {
+        let slab = self.shards.get(handle.shard as usize)?.0.read().unwrap();
+        let slot = slab.slots.get(handle.index as usize)?;
+        if slot.generation != handle.generation {
+            return None;
+        }
+
+        slot.entry.as_ref().map(|(k, v)| f(k, v))
+    }
+
+    /// modify the record of the handle, returns the key of the record with
+    /// the result, none when the record of the handle has been removed or
+    /// replaced.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 2);
+    ///
+    /// assert_eq!(arena.with_handle_mut(handle, |_, v| *v += 1), Some(()));
+    /// assert_eq!(arena.with(&1, |v| *v), Some(3));
+    ///
+    /// arena.remove(&1);
+    /// assert_eq!(arena.with_handle_mut(handle, |_, v| *v += 1), None);
+    /// ```
+    pub fn with_handle_mut<R>(&self, handle: Handle, f: impl FnOnce(&K, &mut V) -> R) -> Option<R> {
+        let mut slab = self.shards.get(handle.shard as usize)?.0.write().unwrap();
+        let slot = slab.slots.get_mut(handle.index as usize)?;
+        if slot.generation != handle.generation {
+            return None;
+        }
+
+        slot.entry.as_mut().map(|(k, v)| f(k, v))
+    }
+
+    /// sum the result of the function over all the records.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// arena.insert(1, 2);
+    /// arena.insert(3, 4);
+    ///
+    /// assert_eq!(arena.sum(|v| *v as usize), 6);
+    /// ```
+    pub fn sum(&self, f: impl Fn(&V) -> usize) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| {
+                shard
+                    .0
+                    .read()
+                    .unwrap()
+                    .slots
+                    .iter()
+                    .filter_map(|slot| slot.entry.as_ref())
+                    .map(|(_, v)| f(v))
+                    .sum::<usize>()
+            })
+            .sum()
+    }
+
+    /// get the keys of the records that match the filter.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// arena.insert(1, 2);
+    /// arena.insert(3, 4);
+    ///
+    /// assert_eq!(arena.keys_where(|v| *v > 2), vec![3]);
+    /// ```
+    pub fn keys_where(&self, f: impl Fn(&V) -> bool) -> Vec<K> {
+        let mut keys = Vec::new();
+        for shard in self.shards.iter() {
+            let slab = shard.0.read().unwrap();
+            keys.extend(
+                slab.slots
+                    .iter()
+                    .filter_map(|slot| slot.entry.as_ref())
+                    .filter(|(_, v)| f(v))
+                    .map(|(k, _)| *k),
+            );
+        }
+
+        keys
+    }
+
+    /// get the number of records of all shards.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// arena.insert(1, 2);
+    /// assert_eq!(arena.len(), 1);
+    ///
+    /// arena.remove(&1);
+    /// assert_eq!(arena.len(), 0);
+    /// ```
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.0.read().unwrap().index.len())
+            .sum()
+    }
+
+    /// whether all shards are empty.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::arena::*;
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// assert!(arena.is_empty());
+    /// ```
+    pub fn is_empty(&self) -> bool {
+        self.shards
+            .iter()
+            .all(|shard| shard.0.read().unwrap().index.is_empty())
+    }
+}
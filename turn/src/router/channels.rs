@@ -1,9 +1,10 @@
-use super::ports::capacity;
-
-use ahash::AHashMap;
+use super::{arena::Handle, ports::capacity, shards::ShardedMap};
 
 use std::iter::{IntoIterator, Iterator};
-use std::{net::SocketAddr, sync::RwLock, time::Instant};
+use std::time::Instant;
+
+/// The lifetime of a channel binding in seconds.
+pub const LIFETIME: u64 = 600;
 
 /// channels iterator.
 pub struct Iter {
@@ -21,18 +22,18 @@ impl Iter {
 }
 
 impl Iterator for Iter {
-    type Item = SocketAddr;
+    type Item = Handle;
 
     /// Iterator for channels.
     ///
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let mut iter = Iter::new(Channel::new(&addr));
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let mut iter = Iter::new(Channel::new(addr));
     ///
     /// assert_eq!(iter.next(), Some(addr));
     /// ```
@@ -90,33 +91,36 @@ impl Iterator for Iter {
 /// server being unable to fulfill the request).  A client that wishes to
 /// be safe should either queue the data or use Send indications until
 /// the channel binding is confirmed.
+///
+/// the channel holds the handles of the records of the nodes that bound it,
+/// the peers that the nodes bound it to live in the records.
 pub struct Channel {
     timer: Instant,
-    bound: [Option<SocketAddr>; 2],
+    bound: [Option<Handle>; 2],
 }
 
 impl Channel {
-    pub fn new(a: &SocketAddr) -> Self {
+    pub fn new(a: Handle) -> Self {
         Self {
-            bound: [Some(*a), None],
+            bound: [Some(a), None],
             timer: Instant::now(),
         }
     }
 
-    /// whether to include the current socketaddr.
+    /// whether to include the current node.
     ///
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let channel = Channel::new(&addr);
-    /// assert!(channel.includes(&addr));
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let channel = Channel::new(addr);
+    /// assert!(channel.includes(addr));
     /// ```
-    pub fn includes(&self, a: &SocketAddr) -> bool {
-        self.bound.contains(&Some(*a))
+    pub fn includes(&self, a: Handle) -> bool {
+        self.bound.contains(&Some(a))
     }
 
     /// wether the peer addr has been established.
@@ -124,11 +128,10 @@ impl Channel {
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let channel = Channel::new(&addr);
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let channel = Channel::new(arena.insert(1, 1));
     /// assert!(channel.is_half());
     /// ```
     pub fn is_half(&self) -> bool {
@@ -140,18 +143,16 @@ impl Channel {
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
-    /// let mut channel = Channel::new(&addr);
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let mut channel = Channel::new(arena.insert(1, 1));
     ///
-    /// channel.up(&peer);
+    /// channel.up(arena.insert(2, 2));
     /// assert!(!channel.is_half());
     /// ```
-    pub fn up(&mut self, a: &SocketAddr) {
-        self.bound[1] = Some(*a)
+    pub fn up(&mut self, a: Handle) {
+        self.bound[1] = Some(a)
     }
 
     /// refresh channel lifetime.
@@ -159,11 +160,10 @@ impl Channel {
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let mut channel = Channel::new(&addr);
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let mut channel = Channel::new(arena.insert(1, 1));
     ///
     /// channel.refresh();
     /// assert!(!channel.is_death());
@@ -177,34 +177,47 @@ impl Channel {
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let mut channel = Channel::new(&addr);
-    /// // channel.is_death()
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let channel = Channel::new(arena.insert(1, 1));
+    /// assert!(!channel.is_death());
     /// ```
     pub fn is_death(&self) -> bool {
-        self.timer.elapsed().as_secs() >= 600
+        self.timer.elapsed().as_secs() >= LIFETIME
+    }
+
+    /// the number of seconds until the channel lifetime ends.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::{arena::*, channels::*};
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let channel = Channel::new(arena.insert(1, 1));
+    /// assert_eq!(channel.remaining(), LIFETIME);
+    /// ```
+    pub fn remaining(&self) -> u64 {
+        LIFETIME.saturating_sub(self.timer.elapsed().as_secs())
     }
 }
 
 impl IntoIterator for Channel {
     type IntoIter = Iter;
-    type Item = SocketAddr;
+    type Item = Handle;
 
     /// Into iterator for channels.
     ///
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let channel = Channel::new(&addr);
-    /// let iter = channel.into_iter();
-    /// // iter.next()
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let mut iter = Channel::new(addr).into_iter();
+    /// assert_eq!(iter.next(), Some(addr));
     /// ```
     fn into_iter(self) -> Self::IntoIter {
         Iter {
@@ -215,9 +228,11 @@ impl IntoIterator for Channel {
 }
 
 /// channels table.
+///
+/// keyed by the channel number, a channel holds the handles of the nodes
+/// that bound it.
 pub struct Channels {
-    map: RwLock<AHashMap<u16, Channel>>,
-    bounds: RwLock<AHashMap<(SocketAddr, u16), SocketAddr>>,
+    map: ShardedMap<u16, Channel>,
 }
 
 impl Default for Channels {
@@ -229,51 +244,31 @@ impl Default for Channels {
 impl Channels {
     pub fn new() -> Self {
         Self {
-            map: RwLock::new(AHashMap::with_capacity(capacity())),
-            bounds: RwLock::new(AHashMap::with_capacity(capacity())),
+            map: ShardedMap::with_capacity(capacity()),
         }
     }
 
-    /// get bound address.
-    ///
-    /// # Examples
-    ///
-    /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
-    ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
-    /// let channels = Channels::new();
-    ///
-    /// channels.insert(&addr, 43159, &peer).unwrap();
-    /// channels.insert(&peer, 43160, &addr).unwrap();
-    ///
-    /// assert_eq!(channels.get_bound(&addr, 43159).unwrap(), peer);
-    /// ```
-    pub fn get_bound(&self, a: &SocketAddr, c: u16) -> Option<SocketAddr> {
-        self.bounds.read().unwrap().get(&(*a, c)).cloned()
-    }
-
-    /// insert address for peer address to channel table.
+    /// insert the node to the channel, a channel is bound by the two sides
+    /// at most.
     ///
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let peer = arena.insert(2, 2);
+    /// let other = arena.insert(3, 3);
     /// let channels = Channels::new();
     ///
-    /// channels.insert(&addr, 43159, &peer).unwrap();
-    /// channels.insert(&peer, 43160, &addr).unwrap();
-    ///
-    /// assert_eq!(channels.get_bound(&addr, 43159).unwrap(), peer);
+    /// assert!(channels.insert(addr, 43159).is_some());
+    /// assert!(channels.insert(peer, 43159).is_some());
+    /// assert!(channels.insert(addr, 43159).is_some());
+    /// assert!(channels.insert(other, 43159).is_none());
     /// ```
-    pub fn insert(&self, a: &SocketAddr, c: u16, p: &SocketAddr) -> Option<()> {
-        let mut map = self.map.write().unwrap();
+    pub fn insert(&self, a: Handle, c: u16) -> Option<()> {
+        let mut map = self.map.shard(&c).write().unwrap();
         let mut is_empty = false;
 
         let channel = map.entry(c).or_insert_with(|| {
@@ -294,11 +289,6 @@ impl Channels {
             channel.refresh();
         }
 
-        self.bounds
-            .write()
-            .unwrap()
-            .entry((*a, c))
-            .or_insert_with(|| *p);
         Some(())
     }
 
@@ -307,26 +297,90 @@ impl Channels {
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::channels::*;
+    /// use turn::router::{arena::*, channels::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let peer = arena.insert(2, 2);
     /// let channels = Channels::new();
     ///
-    /// channels.insert(&addr, 43159, &peer).unwrap();
-    /// channels.insert(&peer, 43160, &addr).unwrap();
+    /// channels.insert(addr, 43159).unwrap();
+    /// channels.insert(peer, 43160).unwrap();
     ///
     /// assert!(channels.remove(43159).is_some());
     /// assert!(channels.remove(43160).is_some());
+    /// assert!(channels.remove(43160).is_none());
     /// ```
-    pub fn remove(&self, c: u16) -> Option<()> {
-        let mut bounds = self.bounds.write().unwrap();
-        for a in self.map.write().unwrap().remove(&c)? {
-            bounds.remove(&(a, c));
-        }
+    pub fn remove(&self, c: u16) -> Option<Channel> {
+        self.map.remove(&c)
+    }
 
-        Some(())
+    /// get the number of seconds until the channel lifetime ends.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::{arena::*, channels::*};
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let channels = Channels::new();
+    ///
+    /// channels.insert(arena.insert(1, 1), 43159).unwrap();
+    /// assert_eq!(channels.get_remaining(43159), Some(LIFETIME));
+    /// assert_eq!(channels.get_remaining(43160), None);
+    /// ```
+    pub fn get_remaining(&self, c: u16) -> Option<u64> {
+        self.map
+            .shard(&c)
+            .read()
+            .unwrap()
+            .get(&c)
+            .map(|v| v.remaining())
+    }
+
+    /// get the number of channel bindings, a channel bound by both of its
+    /// sides counts twice.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::{arena::*, channels::*};
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let channels = Channels::new();
+    /// assert_eq!(channels.len(), 0);
+    ///
+    /// channels.insert(arena.insert(1, 1), 43159).unwrap();
+    /// assert_eq!(channels.len(), 1);
+    ///
+    /// channels.insert(arena.insert(2, 2), 43159).unwrap();
+    /// assert_eq!(channels.len(), 2);
+    /// ```
+    pub fn len(&self) -> usize {
+        self.map
+            .shards()
+            .map(|shard| {
+                shard
+                    .read()
+                    .unwrap()
+                    .values()
+                    .map(|channel| channel.bound.iter().flatten().count())
+                    .sum::<usize>()
+            })
+            .sum()
+    }
+
+    /// whether there is no channel binding.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::channels::*;
+    ///
+    /// assert!(Channels::new().is_empty());
+    /// ```
+    pub fn is_empty(&self) -> bool {
+        self.map.is_empty()
     }
 
     /// get death channels.
@@ -339,11 +393,16 @@ impl Channels {
     /// ```
     pub fn get_deaths(&self) -> Vec<u16> {
         self.map
-            .read()
-            .unwrap()
-            .iter()
-            .filter(|(_, v)| v.is_death())
-            .map(|(k, _)| *k)
+            .shards()
+            .flat_map(|shard| {
+                shard
+                    .read()
+                    .unwrap()
+                    .iter()
+                    .filter(|(_, v)| v.is_death())
+                    .map(|(k, _)| *k)
+                    .collect::<Vec<u16>>()
+            })
             .collect::<Vec<u16>>()
     }
 }
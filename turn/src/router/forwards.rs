@@ -0,0 +1,129 @@
+use super::{arena::Handle, ports::capacity, shards::ShardedMap};
+use crate::StunClass;
+
+use std::net::SocketAddr;
+
+use ahash::AHashSet;
+
+/// precomputed channel data forwarding entry.
+///
+/// the target address and the egress interface of a channel, resolved once
+/// when the channel is bound, so relaying a ChannelData message is a single
+/// lookup.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Forward {
+    /// the address that the channel is bound to.
+    pub target: SocketAddr,
+    /// the interface that the target is connected to, or the relay address
+    /// that the data is sent from when the target is an external peer.
+    pub interface: SocketAddr,
+    /// `Channel` when the target is a node of this server, `Peer` when it
+    /// is an external peer that receives the application data only.
+    pub kind: StunClass,
+}
+
+/// channel data forwarding index.
+///
+/// the forwarding entries live in the records of the nodes that send on the
+/// channels, this indexes the entries by the handle of the node that they
+/// forward to, so that the entries pointing at a removed node can be
+/// invalidated.
+pub struct Forwards {
+    targets: ShardedMap<Handle, AHashSet<(Handle, u16)>>,
+}
+
+impl Default for Forwards {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Forwards {
+    pub fn new() -> Self {
+        Self {
+            targets: ShardedMap::with_capacity(capacity()),
+        }
+    }
+
+    /// index the forwarding entry of the channel of the node towards the
+    /// target.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::{arena::*, forwards::*};
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let peer = arena.insert(2, 2);
+    ///
+    /// let forwards = Forwards::new();
+    /// forwards.insert(peer, addr, 0x4000);
+    /// assert_eq!(forwards.remove_target(peer), vec![(addr, 0x4000)]);
+    /// ```
+    pub fn insert(&self, target: Handle, a: Handle, c: u16) {
+        self.targets
+            .shard(&target)
+            .write()
+            .unwrap()
+            .entry(target)
+            .or_insert_with(|| AHashSet::with_capacity(5))
+            .insert((a, c));
+    }
+
+    /// remove the forwarding entry of the channel of the node from the
+    /// index of the target.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::{arena::*, forwards::*};
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let peer = arena.insert(2, 2);
+    ///
+    /// let forwards = Forwards::new();
+    /// forwards.insert(peer, addr, 0x4000);
+    /// forwards.remove(peer, addr, 0x4000);
+    /// assert_eq!(forwards.remove_target(peer), vec![]);
+    /// ```
+    pub fn remove(&self, target: Handle, a: Handle, c: u16) {
+        let mut targets = self.targets.shard(&target).write().unwrap();
+        if let Some(keys) = targets.get_mut(&target) {
+            keys.remove(&(a, c));
+            if keys.is_empty() {
+                targets.remove(&target);
+            }
+        }
+    }
+
+    /// remove the index of the target, returns the nodes and the channels
+    /// of the entries that forward to it.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::{arena::*, forwards::*};
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let peer = arena.insert(2, 2);
+    ///
+    /// let forwards = Forwards::new();
+    /// forwards.insert(peer, addr, 0x4000);
+    /// forwards.insert(peer, addr, 0x4001);
+    ///
+    /// let mut removed = forwards.remove_target(peer);
+    /// removed.sort_by_key(|(_, c)| *c);
+    ///
+    /// assert_eq!(removed, vec![(addr, 0x4000), (addr, 0x4001)]);
+    /// assert_eq!(forwards.remove_target(peer), vec![]);
+    /// ```
+    pub fn remove_target(&self, target: Handle) -> Vec<(Handle, u16)> {
+        self.targets
+            .remove(&target)
+            .map(|keys| keys.into_iter().collect())
+            .unwrap_or_default()
+    }
+}
@@ -0,0 +1,186 @@
+use std::sync::atomic::{AtomicU64, Ordering};
+
+const SECOND: u64 = 1_000_000_000;
+
+/// The number of nanoseconds of traffic at the full rate that a bucket
+/// lets through at once after it has been idle.
+pub const BURST: u64 = SECOND;
+
+/// A rate limit, zero is unlimited.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct Limit {
+    /// packets per second.
+    pub pps: u64,
+    /// bits per second.
+    pub bps: u64,
+}
+
+impl Limit {
+    /// whether the limit lets everything through.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::limits::*;
+    ///
+    /// assert!(Limit::default().is_unlimited());
+    /// assert!(!Limit { pps: 100, bps: 0 }.is_unlimited());
+    /// ```
+    pub fn is_unlimited(&self) -> bool {
+        self.pps == 0 && self.bps == 0
+    }
+}
+
+/// The limits of a node, of the allocation itself and of all the
+/// allocations of its username together.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct Limits {
+    pub allocation: Limit,
+    pub user: Limit,
+}
+
+/// lock-free token bucket.
+///
+/// a gcra bucket, it keeps the theoretical arrival time of the next unit
+/// of traffic, a packet takes its cost from it with one compare exchange,
+/// and it is let through as long as the arrival time does not run more than
+/// `BURST` ahead of the clock.
+#[derive(Default)]
+struct Bucket(AtomicU64);
+
+impl Bucket {
+    fn take(&self, now: u64, cost: u64) -> bool {
+        let mut tat = self.0.load(Ordering::Relaxed);
+        loop {
+            let next = tat.max(now).saturating_add(cost);
+            if next > now.saturating_add(BURST) {
+                return false;
+            }
+
+            match self
+                .0
+                .compare_exchange_weak(tat, next, Ordering::Relaxed, Ordering::Relaxed)
+            {
+                Ok(_) => return true,
+                Err(current) => tat = current,
+            }
+        }
+    }
+
+    /// give back the cost of a packet that was taken but not let through.
+    fn refund(&self, cost: u64) {
+        let _ = self
+            .0
+            .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |tat| {
+                Some(tat.saturating_sub(cost))
+            });
+    }
+}
+
+/// packet and bandwidth limiter.
+pub struct Limiter {
+    limit: Limit,
+    pps: Bucket,
+    bps: Bucket,
+}
+
+impl Limiter {
+    pub fn new(limit: Limit) -> Self {
+        Self {
+            pps: Bucket::default(),
+            bps: Bucket::default(),
+            limit,
+        }
+    }
+
+    /// get the limit of the limiter.
+    pub fn limit(&self) -> Limit {
+        self.limit
+    }
+
+    /// take a packet of `size` bytes at `now` nanoseconds from the limiter,
+    /// returns false when the packet exceeds the limit, a rejected packet
+    /// takes nothing from the limiter.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::limits::*;
+    ///
+    /// let limiter = Limiter::new(Limit { pps: 2, bps: 0 });
+    ///
+    /// // a burst of one second of packets, then one packet every half a
+    /// // second.
+    /// assert!(limiter.check(0, 100));
+    /// assert!(limiter.check(0, 100));
+    /// assert!(!limiter.check(0, 100));
+    /// assert!(limiter.check(500_000_000, 100));
+    /// assert!(!limiter.check(500_000_000, 100));
+    ///
+    /// let limiter = Limiter::new(Limit { pps: 0, bps: 8000 });
+    /// assert!(limiter.check(0, 1000));
+    /// assert!(!limiter.check(0, 1));
+    /// assert!(limiter.check(1_000_000_000, 1000));
+    ///
+    /// // the packet over the bandwidth does not use up a packet.
+    /// let limiter = Limiter::new(Limit { pps: 2, bps: 8000 });
+    /// assert!(limiter.check(0, 1000));
+    /// assert!(!limiter.check(0, 1));
+    /// assert!(limiter.check(0, 0));
+    /// assert!(!limiter.check(0, 0));
+    /// ```
+    pub fn check(&self, now: u64, size: usize) -> bool {
+        let pps = self.pps_cost();
+        if pps > 0 && !self.pps.take(now, pps) {
+            return false;
+        }
+
+        if self.limit.bps > 0 && !self.bps.take(now, self.bps_cost(size)) {
+            if pps > 0 {
+                self.pps.refund(pps);
+            }
+
+            return false;
+        }
+
+        true
+    }
+
+    /// give back a packet of `size` bytes that the limiter let through, but
+    /// that another limiter rejected.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::limits::*;
+    ///
+    /// let limiter = Limiter::new(Limit { pps: 1, bps: 8000 });
+    /// assert!(limiter.check(0, 1000));
+    /// assert!(!limiter.check(0, 1000));
+    ///
+    /// limiter.refund(1000);
+    /// assert!(limiter.check(0, 1000));
+    /// ```
+    pub fn refund(&self, size: usize) {
+        let pps = self.pps_cost();
+        if pps > 0 {
+            self.pps.refund(pps);
+        }
+
+        if self.limit.bps > 0 {
+            self.bps.refund(self.bps_cost(size));
+        }
+    }
+
+    fn pps_cost(&self) -> u64 {
+        if self.limit.pps > 0 {
+            SECOND / self.limit.pps
+        } else {
+            0
+        }
+    }
+
+    fn bps_cost(&self, size: usize) -> u64 {
+        (size as u128 * 8 * SECOND as u128 / self.limit.bps as u128) as u64
+    }
+}
@@ -1,20 +1,79 @@
+pub mod arena;
 pub mod channels;
+pub mod forwards;
 pub mod interfaces;
+pub mod limits;
 pub mod nodes;
 pub mod nonces;
+pub mod peers;
 pub mod ports;
+pub mod shards;
+pub mod snapshot;
+pub mod timer;
 
 #[rustfmt::skip]
-use crate::Observer;
+use crate::{Observer, StunClass};
 use self::{
+    arena::Handle,
     channels::Channels,
-    interfaces::{Interface, Interfaces},
+    forwards::{Forward, Forwards},
+    interfaces::Interface,
     nodes::Nodes,
     nonces::Nonces,
-    ports::Ports,
+    ports::{port_range, Ports, PERMISSION_LIFETIME},
+    snapshot::{Session, Snapshot},
+    timer::{Timeout, Timer, TICK},
 };
 
-use std::{net::SocketAddr, sync::Arc, thread, time::Duration};
+use std::{
+    net::{IpAddr, SocketAddr},
+    ops::Range,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc,
+    },
+    thread,
+    time::Instant,
+};
+
+use stun::util::HmacSha1;
+
+/// The number of ports tried when the relay sockets of the allocations are
+/// opened and a port can not be bound.
+const RELAY_ATTEMPTS: usize = 4;
+
+/// The options of a router.
+///
+/// # Examples
+///
+/// ```
+/// use turn::router::nonces::*;
+/// use turn::router::*;
+///
+/// let options = Options {
+///     nonces: Nonces::with_secret(b"secret"),
+///     ..Options::default()
+/// };
+///
+/// assert_eq!(options.port_range, 49152..65535);
+/// ```
+pub struct Options {
+    /// the nonce table that the nonces are issued from, for example one with
+    /// a secret shared with other servers, whose nonces are then accepted by
+    /// each other.
+    pub nonces: Nonces,
+    /// the range that the relay ports are allocated from.
+    pub port_range: Range<u16>,
+}
+
+impl Default for Options {
+    fn default() -> Self {
+        Self {
+            nonces: Nonces::new(),
+            port_range: port_range(),
+        }
+    }
+}
 
 /// Router State Tree.
 ///
@@ -33,7 +92,12 @@ pub struct Router {
     nonces: Nonces,
     nodes: Nodes,
     channels: Channels,
-    interfaces: Interfaces,
+    forwards: Forwards,
+    timer: Timer,
+    external: bool,
+    /// set once a node has a limit, the data path skips the limiters until
+    /// then.
+    limited: AtomicBool,
 }
 
 impl Router {
@@ -52,27 +116,55 @@ impl Router {
     /// Router::new("test".to_string(), Arc::new(ObserverTest));
     /// ```
     pub fn new(realm: String, observer: Arc<dyn Observer>) -> Arc<Self> {
+        Self::with_options(realm, observer, Options::default())
+    }
+
+    /// create a router with the given options.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::sync::Arc;
+    /// use turn::router::nonces::*;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {}
+    ///
+    /// let router = Router::with_options(
+    ///     "test".to_string(),
+    ///     Arc::new(ObserverTest),
+    ///     Options {
+    ///         nonces: Nonces::with_secret(b"secret"),
+    ///         port_range: 1024..65535,
+    ///     },
+    /// );
+    ///
+    /// router.add_relay("127.0.0.1".parse().unwrap());
+    /// assert_eq!(router.capacity(), 65535 - 1024);
+    /// ```
+    pub fn with_options(realm: String, observer: Arc<dyn Observer>, options: Options) -> Arc<Self> {
         let this = Arc::new(Self {
-            interfaces: Interfaces::default(),
             channels: Channels::default(),
-            nonces: Nonces::default(),
-            ports: Ports::default(),
+            forwards: Forwards::default(),
+            timer: Timer::default(),
+            external: observer.external_relay(),
+            limited: AtomicBool::new(false),
+            nonces: options.nonces,
+            ports: Ports::with_range(options.port_range),
             nodes: Nodes::default(),
             observer,
             realm,
         });
 
         let this_ = Arc::downgrade(&this);
-        thread::spawn(move || {
-            while let Some(this) = this_.upgrade() {
-                thread::sleep(Duration::from_secs(60));
-                this.nodes.get_deaths().iter().for_each(|a| {
-                    this.remove(a);
-                });
-
-                this.channels.get_deaths().iter().for_each(|c| {
-                    this.channels.remove(*c);
-                });
+        thread::spawn(move || loop {
+            thread::sleep(TICK);
+            match this_.upgrade() {
+                Some(this) => this.timer.advance().into_iter().for_each(|t| this.expire(t)),
+                None => break,
             }
         });
 
@@ -92,12 +184,37 @@ impl Router {
     /// impl Observer for ObserverTest {}
     ///
     /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// assert_eq!(router.capacity(), 0);
+    ///
+    /// router.add_relay("127.0.0.1".parse().unwrap());
     /// assert_eq!(router.capacity(), 16383);
     /// ```
     pub fn capacity(&self) -> usize {
         self.ports.capacity()
     }
 
+    /// add a relay ip, the relay addresses on this ip get a port pool of
+    /// their own.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    /// impl Observer for ObserverTest {}
+    ///
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// router.add_relay("127.0.0.1".parse().unwrap());
+    /// router.add_relay("127.0.0.2".parse().unwrap());
+    /// assert_eq!(router.capacity(), 2 * 16383);
+    /// ```
+    pub fn add_relay(&self, ip: IpAddr) {
+        self.ports.add_relay(ip);
+    }
+
     /// get router allocate size.
     ///
     /// # Examples
@@ -117,6 +234,45 @@ impl Router {
         self.ports.len()
     }
 
+    /// get the number of channel bindings.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    /// impl Observer for ObserverTest {}
+    ///
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// assert_eq!(router.channels_len(), 0);
+    /// ```
+    pub fn channels_len(&self) -> usize {
+        self.channels.len()
+    }
+
+    /// get the number of permissions.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    /// impl Observer for ObserverTest {}
+    ///
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// assert_eq!(router.permissions_len(), 0);
+    /// ```
+    pub fn permissions_len(&self) -> usize {
+        self.nodes
+            .sum_states(|state| state.permissions.len() + state.peers.permissions())
+    }
+
     /// get router allocate size is empty.
     ///
     /// # Examples
@@ -173,7 +329,7 @@ impl Router {
     /// assert_eq!(interface.addr, addr);
     /// ```
     pub fn get_interface(&self, addr: &SocketAddr) -> Option<Arc<Interface>> {
-        self.interfaces.get_ref(addr)
+        self.nodes.get_interface(addr)
     }
 
     /// get user list.
@@ -209,11 +365,12 @@ impl Router {
     ///
     /// assert_eq!(key.as_slice(), &secret);
     ///
-    /// let users = router.get_users(0, 10);
+    /// let users = router.get_users(None, 10);
     /// assert_eq!(users.as_slice(), &[("test".to_string(), vec![addr])]);
+    /// assert!(router.get_users(Some("test"), 10).is_empty());
     /// ```
-    pub fn get_users(&self, skip: usize, limit: usize) -> Vec<(String, Vec<SocketAddr>)> {
-        self.nodes.get_users(skip, limit)
+    pub fn get_users(&self, cursor: Option<&str>, limit: usize) -> Vec<(String, Vec<SocketAddr>)> {
+        self.nodes.get_users(cursor, limit)
     }
 
     /// get node.
@@ -260,6 +417,40 @@ impl Router {
         self.nodes.get_node(addr)
     }
 
+    /// whether the key of the node is already known, so authenticating its
+    /// requests does not have to ask the observer.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {
+    ///     fn get_password_blocking(
+    ///         &self,
+    ///         _: &SocketAddr,
+    ///         _: &str,
+    ///     ) -> Option<String> {
+    ///         Some("test".to_string())
+    ///     }
+    /// }
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// assert!(!router.has_key(&addr));
+    ///
+    /// router.get_key_block(&addr, &addr, &addr, "test").unwrap();
+    /// assert!(router.has_key(&addr));
+    /// ```
+    pub fn has_key(&self, addr: &SocketAddr) -> bool {
+        self.nodes.get_secret(addr).is_some()
+    }
+
     /// get node bound list.
     ///
     /// # Examples
@@ -334,12 +525,38 @@ impl Router {
     /// assert_eq!(key.as_slice(), &secret);
     ///
     /// let nonce = router.get_nonce(&addr);
-    /// assert_eq!(nonce.len(), 16);
+    /// assert_eq!(nonce.len(), 24);
+    /// assert!(router.verify_nonce(&addr, &nonce));
     /// ```
-    pub fn get_nonce(&self, addr: &SocketAddr) -> Arc<String> {
+    pub fn get_nonce(&self, addr: &SocketAddr) -> String {
         self.nonces.get(addr)
     }
 
+    /// check the nonce that the node sent.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    /// impl Observer for ObserverTest {}
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    ///
+    /// let nonce = router.get_nonce(&addr);
+    /// assert!(router.verify_nonce(&addr, &nonce));
+    /// assert!(!router.verify_nonce(&peer, &nonce));
+    /// ```
+    pub fn verify_nonce(&self, addr: &SocketAddr, nonce: &str) -> bool {
+        self.nonces.verify(addr, nonce)
+    }
+
     /// get the password of the node SocketAddr.
     ///
     /// require remote control service to distribute keys.
@@ -388,8 +605,11 @@ impl Router {
         }
 
         let pwd = self.observer.get_password_blocking(addr, username)?;
-        let key = self.nodes.insert(addr, &self.realm, username, &pwd)?;
-        self.interfaces.insert(*addr, *interface, *external);
+        let key = self
+            .nodes
+            .insert(addr, interface, external, &self.realm, username, &pwd)?;
+        self.schedule_node(addr);
+        self.set_limits(addr, username);
         Some(key)
     }
 
@@ -409,11 +629,35 @@ impl Router {
         }
 
         let pwd = self.observer.get_password(addr, username).await?;
-        let key = self.nodes.insert(addr, &self.realm, username, &pwd)?;
-        self.interfaces.insert(*addr, *interface, *external);
+        let key = self
+            .nodes
+            .insert(addr, interface, external, &self.realm, username, &pwd)?;
+        self.schedule_node(addr);
+        self.set_limits(addr, username);
         Some(key)
     }
 
+    /// get the keyed hmac state of the node SocketAddr, which signs and
+    /// checks the messages of the node without running the key schedule.
+    ///
+    /// like `get_key`, the password is requested from the observer when
+    /// the node does not exist yet.
+    pub async fn get_integrity(
+        &self,
+        addr: &SocketAddr,
+        interface: &SocketAddr,
+        external: &SocketAddr,
+        username: &str,
+    ) -> Option<Arc<HmacSha1>> {
+        let integrity = self.nodes.get_integrity(addr);
+        if integrity.is_some() {
+            return integrity;
+        }
+
+        self.get_key(addr, interface, external, username).await?;
+        self.nodes.get_integrity(addr)
+    }
+
     /// obtain the peer address bound to the current
     /// node according to the channel number.
     ///
@@ -448,16 +692,18 @@ impl Router {
     ///
     /// assert_eq!(key.as_slice(), &secret);
     ///
-    /// let port = router.alloc_port(&addr).unwrap();
-    /// assert!(router.bind_port(&addr, port).is_some());
-    /// assert_eq!(router.get_port_bound(port), Some(addr));
+    /// let relay = router.alloc_port(&addr, &[addr.ip()]).unwrap();
+    /// assert!(router.bind_port(&addr, &relay).is_some());
+    /// assert_eq!(router.get_port_bound(&relay), Some(addr));
     /// ```
     pub fn get_channel_bound(&self, addr: &SocketAddr, channel: u16) -> Option<SocketAddr> {
-        self.channels.get_bound(addr, channel)
+        self.nodes
+            .with_state(addr, |state| state.channels.get(&channel).copied())
+            .flatten()
     }
 
     /// obtain the peer address bound to the current
-    /// node according to the port number.
+    /// node according to the relay address.
     ///
     /// # Examples
     ///
@@ -490,15 +736,15 @@ impl Router {
     ///
     /// assert_eq!(key.as_slice(), &secret);
     ///
-    /// let port = router.alloc_port(&addr).unwrap();
-    /// assert!(router.bind_port(&addr, port).is_some());
-    /// assert_eq!(router.get_port_bound(port), Some(addr));
+    /// let relay = router.alloc_port(&addr, &[addr.ip()]).unwrap();
+    /// assert!(router.bind_port(&addr, &relay).is_some());
+    /// assert_eq!(router.get_port_bound(&relay), Some(addr));
     /// ```
-    pub fn get_port_bound(&self, port: u16) -> Option<SocketAddr> {
-        self.ports.get(port)
+    pub fn get_port_bound(&self, relay: &SocketAddr) -> Option<SocketAddr> {
+        self.nodes.get_handle_addr(self.ports.get(relay)?)
     }
 
-    /// get node the port.
+    /// get the relay address of the node that the peer is bound to.
     ///
     /// # Examples
     ///
@@ -529,19 +775,31 @@ impl Router {
     ///
     /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
     /// let key = router.get_key_block(&addr, &addr, &addr, "test").unwrap();
+    /// router.get_key_block(&peer, &peer, &peer, "test").unwrap();
     ///
     /// assert_eq!(key.as_slice(), &secret);
     ///
-    /// let port = router.alloc_port(&addr).unwrap();
-    /// assert!(router.bind_port(&addr, port).is_some());
-    /// assert!(router.bind_port(&peer, port).is_some());
-    /// assert_eq!(router.get_bound_port(&addr, &peer), Some(port));
+    /// let relay = router.alloc_port(&addr, &[addr.ip()]).unwrap();
+    /// assert!(router.bind_port(&addr, &relay).is_some());
+    /// assert!(router.bind_port(&peer, &relay).is_some());
+    /// assert_eq!(router.get_bound_port(&addr, &peer), Some(relay));
+    ///
+    /// // the permission is freed with the node that installed it.
+    /// router.remove(&peer);
+    /// assert_eq!(router.get_bound_port(&addr, &peer), None);
     /// ```
-    pub fn get_bound_port(&self, addr: &SocketAddr, peer: &SocketAddr) -> Option<u16> {
-        self.ports.get_bound(addr, peer)
+    pub fn get_bound_port(&self, addr: &SocketAddr, peer: &SocketAddr) -> Option<SocketAddr> {
+        self.nodes
+            .with_state(peer, |state| {
+                state.permissions.get(addr).map(|(relay, _)| *relay)
+            })
+            .flatten()
     }
 
-    /// alloc a port from State.
+    /// alloc a relay address from State.
+    ///
+    /// the port is taken from the least loaded port pool of the given relay
+    /// ips, each relay ip has a pool of the whole port range.
     ///
     /// In all cases, the server SHOULD only allocate ports from the range
     /// 49152 - 65535 (the Dynamic and/or Private Port range [PORT-NUMBERS]),
@@ -612,12 +870,24 @@ impl Router {
     /// let key = router.get_key_block(&addr, &addr, &addr, "test").unwrap();
     ///
     /// assert_eq!(key.as_slice(), &secret);
-    /// assert!(router.alloc_port(&addr).is_some());
+    /// assert!(router.alloc_port(&addr, &[addr.ip()]).is_some());
     /// ```
-    pub fn alloc_port(&self, addr: &SocketAddr) -> Option<u16> {
-        let port = self.ports.alloc(addr)?;
-        self.nodes.push_port(addr, port);
-        Some(port)
+    pub fn alloc_port(&self, addr: &SocketAddr, relays: &[IpAddr]) -> Option<SocketAddr> {
+        // The port may be in use by another process, in which case the
+        // relay socket can not be opened and another port is tried.
+        let handle = self.nodes.get_handle(addr)?;
+        for _ in 0..RELAY_ATTEMPTS {
+            let relay = self.ports.alloc(handle, relays)?;
+            if self.external && !self.observer.open_relay(&relay) {
+                self.ports.release(&relay);
+                continue;
+            }
+
+            self.nodes.push_port(addr, relay);
+            return Some(relay);
+        }
+
+        None
     }
 
     /// bind port for State.
@@ -658,11 +928,24 @@ impl Router {
     ///
     /// assert_eq!(key.as_slice(), &secret);
     ///
-    /// let port = router.alloc_port(&addr).unwrap();
-    /// assert!(router.bind_port(&addr, port).is_some());
+    /// let relay = router.alloc_port(&addr, &[addr.ip()]).unwrap();
+    /// assert!(router.bind_port(&addr, &relay).is_some());
     /// ```
-    pub fn bind_port(&self, addr: &SocketAddr, port: u16) -> Option<()> {
-        self.ports.bound(addr, port)
+    pub fn bind_port(&self, addr: &SocketAddr, relay: &SocketAddr) -> Option<()> {
+        let peer = self.nodes.get_handle_addr(self.ports.get(relay)?)?;
+        let handle = self.nodes.get_handle(addr)?;
+        self.nodes.with_handle_state_mut(handle, |_, state| {
+            let now = Instant::now();
+            state
+                .permissions
+                .entry(peer)
+                .and_modify(|(_, timer)| *timer = now)
+                .or_insert((*relay, now));
+        })?;
+
+        self.timer
+            .schedule(PERMISSION_LIFETIME, Timeout::Permission(handle, peer));
+        Some(())
     }
 
     /// bind channel number for State.
@@ -708,16 +991,298 @@ impl Router {
     ///
     /// assert_eq!(key.as_slice(), &secret);
     ///
-    /// let port = router.alloc_port(&addr).unwrap();
-    /// assert!(router.bind_channel(&addr, port, 0x4000).is_some());
+    /// let relay = router.alloc_port(&addr, &[addr.ip()]).unwrap();
+    /// assert!(router.bind_channel(&addr, &relay, 0x4000).is_some());
     /// ```
-    pub fn bind_channel(&self, addr: &SocketAddr, port: u16, channel: u16) -> Option<()> {
-        let source = self.ports.get(port)?;
-        self.channels.insert(addr, channel, &source)?;
-        self.nodes.push_channel(addr, channel)?;
+    pub fn bind_channel(&self, addr: &SocketAddr, relay: &SocketAddr, channel: u16) -> Option<()> {
+        if self.get_peer_channel_bound(addr, channel) {
+            return None;
+        }
+
+        let handle = self.nodes.get_handle(addr)?;
+        let source = self.nodes.get_handle_addr(self.ports.get(relay)?)?;
+        self.channels.insert(handle, channel)?;
+        let target = self.nodes.bind_channel(handle, channel, source)?;
+        self.timer
+            .schedule(channels::LIFETIME, Timeout::Channel(channel));
+
+        // Resolve the forwarding entry once here, the channel data path only
+        // does a single lookup of it.
+        if let Some(interface) = self.nodes.get_interface(&target) {
+            self.insert_forward(
+                handle,
+                channel,
+                Forward {
+                    interface: interface.addr,
+                    kind: StunClass::Channel,
+                    target,
+                },
+            );
+        }
+
         Some(())
     }
 
+    /// get the precomputed forwarding entry of the channel.
+    ///
+    /// the entry is resolved when the channel is bound, resolved again when
+    /// the node is refreshed, and invalidated when the channel or the target
+    /// node is removed.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {
+    ///     fn get_password_blocking(
+    ///         &self,
+    ///         _: &SocketAddr,
+    ///         _: &str,
+    ///     ) -> Option<String> {
+    ///         Some("test".to_string())
+    ///     }
+    /// }
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    /// let interface = "127.0.0.1:3478".parse::<SocketAddr>().unwrap();
+    ///
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// router.get_key_block(&addr, &interface, &interface, "test").unwrap();
+    /// router.get_key_block(&peer, &interface, &interface, "test").unwrap();
+    ///
+    /// let relay = router.alloc_port(&peer, &[peer.ip()]).unwrap();
+    /// assert!(router.bind_channel(&addr, &relay, 0x4000).is_some());
+    ///
+    /// let forward = router.get_forward(&addr, 0x4000).unwrap();
+    /// assert_eq!(forward.target, peer);
+    /// assert_eq!(forward.interface, interface);
+    ///
+    /// router.remove(&peer);
+    /// assert!(router.get_forward(&addr, 0x4000).is_none());
+    /// ```
+    pub fn get_forward(&self, addr: &SocketAddr, channel: u16) -> Option<Forward> {
+        self.nodes.get_forward(addr, channel)
+    }
+
+    /// take a packet of `size` bytes that the node sends from the limiters of
+    /// the node, returns false when the packet exceeds a limit of the node
+    /// and has to be dropped.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use std::sync::Arc;
+    /// use turn::router::limits::*;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {
+    ///     fn get_password_blocking(
+    ///         &self,
+    ///         _: &SocketAddr,
+    ///         _: &str,
+    ///     ) -> Option<String> {
+    ///         Some("test".to_string())
+    ///     }
+    ///
+    ///     fn get_limits(&self, _: &SocketAddr, _: &str) -> Limits {
+    ///         Limits {
+    ///             allocation: Limit { pps: 1, bps: 0 },
+    ///             user: Limit::default(),
+    ///         }
+    ///     }
+    /// }
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    ///
+    /// assert!(router.check_limit(&addr, 100));
+    ///
+    /// router.get_key_block(&addr, &addr, &addr, "test").unwrap();
+    /// assert!(router.check_limit(&addr, 100));
+    /// assert!(!router.check_limit(&addr, 100));
+    /// ```
+    #[inline(always)]
+    pub fn check_limit(&self, addr: &SocketAddr, size: usize) -> bool {
+        !self.limited.load(Ordering::Relaxed) || self.nodes.check_limit(addr, size)
+    }
+
+    /// whether the allocations relay to the peers outside of the server.
+    pub fn is_external_relay(&self) -> bool {
+        self.external
+    }
+
+    /// install or refresh the permission of the node towards the ip of an
+    /// external peer.
+    ///
+    /// the data towards the peer is sent from the relayed transport address
+    /// of the node that has the address family of the peer. returns none
+    /// when the external relay is disabled or the node has no such relayed
+    /// transport address.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {
+    ///     fn get_password_blocking(
+    ///         &self,
+    ///         _: &SocketAddr,
+    ///         _: &str,
+    ///     ) -> Option<String> {
+    ///         Some("test".to_string())
+    ///     }
+    ///
+    ///     fn external_relay(&self) -> bool {
+    ///         true
+    ///     }
+    /// }
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let peer = "1.1.1.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// router.get_key_block(&addr, &addr, &addr, "test").unwrap();
+    /// assert!(router.bind_peer(&addr, &peer).is_none());
+    ///
+    /// let relay = router.alloc_port(&addr, &[addr.ip()]).unwrap();
+    /// assert!(router.bind_peer(&addr, &peer).is_some());
+    /// assert_eq!(router.get_peer_relay(&addr, &peer), Some(relay));
+    /// assert_eq!(router.permissions_len(), 1);
+    /// ```
+    pub fn bind_peer(&self, addr: &SocketAddr, peer: &SocketAddr) -> Option<()> {
+        let relay = self.get_relay(addr, peer)?;
+        let handle = self.nodes.get_handle(addr)?;
+        self.nodes.with_handle_state_mut(handle, |_, state| {
+            state.peers.insert_permission(peer.ip(), relay)
+        })?;
+
+        self.timer.schedule(
+            PERMISSION_LIFETIME,
+            Timeout::PeerPermission(handle, peer.ip()),
+        );
+
+        Some(())
+    }
+
+    /// bind or refresh the channel of the node to an external peer, which
+    /// also installs or refreshes the permission towards the peer ip.
+    ///
+    /// the channel data of the node is then relayed to the peer with a
+    /// single lookup, like the channels between the nodes of this server.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {
+    ///     fn get_password_blocking(
+    ///         &self,
+    ///         _: &SocketAddr,
+    ///         _: &str,
+    ///     ) -> Option<String> {
+    ///         Some("test".to_string())
+    ///     }
+    ///
+    ///     fn external_relay(&self) -> bool {
+    ///         true
+    ///     }
+    /// }
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let peer = "1.1.1.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// router.get_key_block(&addr, &addr, &addr, "test").unwrap();
+    ///
+    /// let relay = router.alloc_port(&addr, &[addr.ip()]).unwrap();
+    /// assert!(router.bind_peer_channel(&addr, &peer, 0x4000).is_some());
+    /// assert_eq!(router.get_peer_channel(&addr, &peer), Some(0x4000));
+    ///
+    /// let forward = router.get_forward(&addr, 0x4000).unwrap();
+    /// assert_eq!(forward.target, peer);
+    /// assert_eq!(forward.interface, relay);
+    /// assert_eq!(forward.kind, StunClass::Peer);
+    ///
+    /// router.remove(&addr);
+    /// assert!(router.get_forward(&addr, 0x4000).is_none());
+    /// assert!(router.get_peer_channel(&addr, &peer).is_none());
+    /// ```
+    pub fn bind_peer_channel(
+        &self,
+        addr: &SocketAddr,
+        peer: &SocketAddr,
+        channel: u16,
+    ) -> Option<()> {
+        if self.get_channel_bound(addr, channel).is_some() {
+            return None;
+        }
+
+        let relay = self.get_relay(addr, peer)?;
+        let handle = self.nodes.get_handle(addr)?;
+        self.nodes
+            .with_handle_state_mut(handle, |_, state| {
+                state.peers.bind_channel(peer, channel, relay)
+            })
+            .flatten()?;
+
+        self.timer
+            .schedule(channels::LIFETIME, Timeout::PeerChannel(handle, channel));
+        self.timer.schedule(
+            PERMISSION_LIFETIME,
+            Timeout::PeerPermission(handle, peer.ip()),
+        );
+
+        self.insert_forward(
+            handle,
+            channel,
+            Forward {
+                interface: relay,
+                kind: StunClass::Peer,
+                target: *peer,
+            },
+        );
+
+        Some(())
+    }
+
+    /// get the relayed transport address that the data towards the external
+    /// peer is sent from, when the node has a permission towards the peer.
+    pub fn get_peer_relay(&self, addr: &SocketAddr, peer: &SocketAddr) -> Option<SocketAddr> {
+        self.nodes
+            .with_state(addr, |state| state.peers.get_permission(&peer.ip()))
+            .flatten()
+    }
+
+    /// get the channel number that the external peer is bound to.
+    pub fn get_peer_channel(&self, addr: &SocketAddr, peer: &SocketAddr) -> Option<u16> {
+        self.nodes
+            .with_state(addr, |state| state.peers.get_number(peer))
+            .flatten()
+    }
+
     /// refresh node lifetime.
     ///
     /// The server computes a value called the "desired lifetime" as follows:
@@ -789,6 +1354,8 @@ impl Router {
     pub fn refresh(&self, addr: &SocketAddr, delay: u32) {
         if delay > 0 {
             self.nodes.set_lifetime(addr, delay);
+            self.schedule_node(addr);
+            self.revalidate_forwards(addr);
         } else {
             self.remove(addr);
         }
@@ -830,16 +1397,96 @@ impl Router {
     /// assert!(router.get_node(&addr).is_none());
     /// ```
     pub fn remove(&self, addr: &SocketAddr) -> Option<()> {
-        let node = self.nodes.remove(addr)?;
-        self.ports.remove(addr, &node.ports);
+        let username = self.remove_node(addr)?;
+        self.observer.abort(addr, &username);
+        Some(())
+    }
+
+    /// remove a node without letting the observer know that it was aborted,
+    /// for a node whose allocation was never placed on this server, such as
+    /// a client that is redirected to an alternate server.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use std::sync::atomic::{AtomicUsize, Ordering};
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// static ABORTED: AtomicUsize = AtomicUsize::new(0);
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {
+    ///     fn get_password_blocking(
+    ///         &self,
+    ///         _: &SocketAddr,
+    ///         _: &str,
+    ///     ) -> Option<String> {
+    ///         Some("test".to_string())
+    ///     }
+    ///
+    ///     fn abort(&self, _: &SocketAddr, _: &str) {
+    ///         ABORTED.fetch_add(1, Ordering::Relaxed);
+    ///     }
+    /// }
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    ///
+    /// router.get_key_block(&addr, &addr, &addr, "test").unwrap();
+    /// assert!(router.remove_silent(&addr).is_some());
+    /// assert!(router.get_node(&addr).is_none());
+    /// assert_eq!(ABORTED.load(Ordering::Relaxed), 0);
+    ///
+    /// router.get_key_block(&addr, &addr, &addr, "test").unwrap();
+    /// assert!(router.remove(&addr).is_some());
+    /// assert_eq!(ABORTED.load(Ordering::Relaxed), 1);
+    /// ```
+    pub fn remove_silent(&self, addr: &SocketAddr) -> Option<()> {
+        self.remove_node(addr).map(|_| ())
+    }
+
+    /// remove a node and everything that points at it, returns the username
+    /// of the node.
+    fn remove_node(&self, addr: &SocketAddr) -> Option<String> {
+        let handle = self.nodes.get_handle(addr)?;
+
+        // The permissions, channel bounds and forwarding entries of the node
+        // are freed with its record, only the indexes that point at the
+        // record are left to clean up.
+        let (node, state) = self.nodes.remove(addr)?;
+
+        // The sockets are closed before the ports go back to the pools, so
+        // that a port is never handed out while its old socket is open.
+        if self.external {
+            node.ports
+                .iter()
+                .for_each(|relay| self.observer.close_relay(relay));
+        }
+
+        node.ports
+            .iter()
+            .for_each(|relay| self.ports.release(relay));
         for c in node.channels {
-            self.channels.remove(c);
+            self.remove_channel(c);
         }
 
-        self.nonces.remove(addr);
-        self.interfaces.remove(addr);
-        self.observer.abort(addr, &node.username);
-        Some(())
+        for (c, (_, target)) in state.forwards {
+            if let Some(target) = target {
+                self.forwards.remove(target, handle, c);
+            }
+
+            self.observer.forward_removed(addr, c);
+        }
+
+        for (source, c) in self.forwards.remove_target(handle) {
+            self.remove_forward(source, c);
+        }
+
+        Some(node.username)
     }
 
     /// remove a node from username.
@@ -883,4 +1530,447 @@ impl Router {
             self.remove(&addr);
         }
     }
+
+    /// take a snapshot of all the nodes, which another router restores with
+    /// `restore`.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use std::sync::Arc;
+    /// use turn::router::*;
+    /// use turn::*;
+    ///
+    /// struct ObserverTest;
+    ///
+    /// impl Observer for ObserverTest {
+    ///     fn get_password_blocking(
+    ///         &self,
+    ///         _: &SocketAddr,
+    ///         _: &str,
+    ///     ) -> Option<String> {
+    ///         Some("test".to_string())
+    ///     }
+    /// }
+    ///
+    /// let a = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let b = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    ///
+    /// let router = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// router.get_key_block(&a, &a, &a, "test").unwrap();
+    /// router.get_key_block(&b, &b, &b, "test").unwrap();
+    ///
+    /// let relay_a = router.alloc_port(&a, &[a.ip()]).unwrap();
+    /// let relay_b = router.alloc_port(&b, &[b.ip()]).unwrap();
+    /// router.bind_channel(&a, &relay_b, 0x4000).unwrap();
+    /// router.bind_channel(&b, &relay_a, 0x4000).unwrap();
+    ///
+    /// let snapshot = router.snapshot();
+    /// assert_eq!(snapshot.sessions.len(), 2);
+    ///
+    /// let restored = Router::new("test".to_string(), Arc::new(ObserverTest));
+    /// assert_eq!(restored.restore(&snapshot), 2);
+    /// assert_eq!(restored.get_port_bound(&relay_a), Some(a));
+    /// assert_eq!(restored.get_forward(&a, 0x4000).unwrap().target, b);
+    /// assert_eq!(restored.get_forward(&b, 0x4000).unwrap().target, a);
+    /// assert_eq!(
+    ///     restored.get_node(&a).unwrap().secret,
+    ///     router.get_node(&a).unwrap().secret
+    /// );
+    ///
+    /// // the nodes that already exist are left alone.
+    /// assert_eq!(restored.restore(&snapshot), 0);
+    /// ```
+    pub fn snapshot(&self) -> Snapshot {
+        let mut sessions = Vec::with_capacity(self.ports.len());
+        for (username, addrs) in self.nodes.get_users(None, usize::MAX) {
+            for addr in addrs {
+                let (node, interface) =
+                    match (self.nodes.get_node(&addr), self.nodes.get_interface(&addr)) {
+                        (Some(node), Some(interface)) => (node, interface),
+                        _ => continue,
+                    };
+
+                let Some((bounds, permissions, peer_permissions, peer_channels)) =
+                    self.nodes.with_state(&addr, |state| {
+                        let bounds = node
+                            .channels
+                            .iter()
+                            .filter_map(|channel| Some((*channel, *state.channels.get(channel)?)))
+                            .collect::<Vec<_>>();
+
+                        let peer_channels = state
+                            .peers
+                            .get_channels()
+                            .into_iter()
+                            .filter_map(|(channel, peer)| {
+                                let relay = state.peers.get_permission(&peer.ip())?;
+                                Some((channel, peer, relay))
+                            })
+                            .collect::<Vec<_>>();
+
+                        (
+                            bounds,
+                            state
+                                .permissions
+                                .values()
+                                .map(|(relay, _)| *relay)
+                                .collect::<Vec<_>>(),
+                            state.peers.get_permissions(),
+                            peer_channels,
+                        )
+                    })
+                else {
+                    continue;
+                };
+
+                // A channel is restored by the relay address of the peer,
+                // any of the relay addresses of the peer resolves to it.
+                let channels = bounds
+                    .into_iter()
+                    .filter_map(|(channel, peer)| {
+                        let relay = *self.nodes.get_node(&peer)?.ports.first()?;
+                        Some((channel, relay))
+                    })
+                    .collect();
+
+                sessions.push(Session {
+                    lifetime: node.remaining().min(u32::MAX as u64) as u32,
+                    permissions,
+                    peer_permissions,
+                    interface: interface.addr,
+                    external: interface.external,
+                    username: username.clone(),
+                    secret: *node.secret,
+                    ports: node.ports,
+                    peer_channels,
+                    channels,
+                    addr,
+                });
+            }
+        }
+
+        Snapshot { sessions }
+    }
+
+    /// restore the nodes of a snapshot, returns the number of the nodes
+    /// that were restored.
+    ///
+    /// the nodes keep their keys, so the clients are not asked for their
+    /// credentials again and the observer is not asked for the passwords.
+    /// the nodes that already exist or have no lifetime left are skipped,
+    /// and so are the relay addresses that can not be taken, for example
+    /// because the port range has changed.
+    pub fn restore(&self, snapshot: &Snapshot) -> usize {
+        let mut restored = Vec::with_capacity(snapshot.sessions.len());
+        for session in &snapshot.sessions {
+            let addr = &session.addr;
+            if session.lifetime == 0 || self.nodes.get_node(addr).is_some() {
+                continue;
+            }
+
+            self.nodes.insert_with_secret(
+                addr,
+                &session.interface,
+                &session.external,
+                &session.username,
+                session.secret,
+            );
+
+            self.nodes.set_lifetime(addr, session.lifetime);
+            let Some(handle) = self.nodes.get_handle(addr) else {
+                continue;
+            };
+
+            for relay in &session.ports {
+                if self.ports.take(handle, relay).is_none() {
+                    continue;
+                }
+
+                if self.external && !self.observer.open_relay(relay) {
+                    self.ports.release(relay);
+                    continue;
+                }
+
+                self.nodes.push_port(addr, *relay);
+            }
+
+            self.schedule_node(addr);
+            self.set_limits(addr, &session.username);
+            restored.push(session);
+        }
+
+        // The permissions and channels resolve the relay addresses of the
+        // peers, which are all in place now.
+        for session in &restored {
+            let addr = &session.addr;
+            let Some(handle) = self.nodes.get_handle(addr) else {
+                continue;
+            };
+
+            for relay in &session.permissions {
+                self.bind_port(addr, relay);
+            }
+
+            for (channel, relay) in &session.channels {
+                self.bind_channel(addr, relay, *channel);
+            }
+
+            // The external peers were permitted when the permissions were
+            // installed, they are not asked about again.
+            for (ip, relay) in &session.peer_permissions {
+                if self.ports.get(relay) == Some(handle) {
+                    self.nodes.with_handle_state_mut(handle, |_, state| {
+                        state.peers.insert_permission(*ip, *relay)
+                    });
+
+                    self.timer
+                        .schedule(PERMISSION_LIFETIME, Timeout::PeerPermission(handle, *ip));
+                }
+            }
+
+            for (channel, peer, relay) in &session.peer_channels {
+                if self.ports.get(relay) != Some(handle)
+                    || self.get_channel_bound(addr, *channel).is_some()
+                    || self
+                        .nodes
+                        .with_handle_state_mut(handle, |_, state| {
+                            state.peers.bind_channel(peer, *channel, *relay)
+                        })
+                        .flatten()
+                        .is_none()
+                {
+                    continue;
+                }
+
+                self.timer
+                    .schedule(channels::LIFETIME, Timeout::PeerChannel(handle, *channel));
+                self.timer.schedule(
+                    PERMISSION_LIFETIME,
+                    Timeout::PeerPermission(handle, peer.ip()),
+                );
+
+                self.insert_forward(
+                    handle,
+                    *channel,
+                    Forward {
+                        interface: *relay,
+                        kind: StunClass::Peer,
+                        target: *peer,
+                    },
+                );
+            }
+
+            self.observer.restored(addr, &session.username);
+        }
+
+        restored.len()
+    }
+
+    /// get the relayed transport address of the node that the data towards
+    /// the external peer is sent from, none when the peer is not permitted.
+    fn get_relay(&self, addr: &SocketAddr, peer: &SocketAddr) -> Option<SocketAddr> {
+        if !self.external || !self.observer.permit_peer(peer) {
+            return None;
+        }
+
+        self.nodes
+            .get_node(addr)?
+            .ports
+            .into_iter()
+            .find(|relay| relay.is_ipv4() == peer.is_ipv4())
+    }
+
+    /// set the limits that the observer gives the node.
+    fn set_limits(&self, addr: &SocketAddr, username: &str) {
+        let limits = self.observer.get_limits(addr, username);
+        if limits.allocation.is_unlimited() && limits.user.is_unlimited() {
+            return;
+        }
+
+        if self.nodes.set_limits(addr, &limits).is_some() {
+            self.limited.store(true, Ordering::Relaxed);
+        }
+    }
+
+    /// schedule the expiry of the node at the end of its lifetime.
+    fn schedule_node(&self, addr: &SocketAddr) {
+        if let Some(handle) = self.nodes.get_handle(addr) {
+            if let Some((_, remaining)) = self.nodes.get_handle_remaining(handle) {
+                self.timer.schedule(remaining, Timeout::Node(handle));
+            }
+        }
+    }
+
+    /// handle a fired timer.
+    ///
+    /// the object may have been refreshed since the timer was scheduled, in
+    /// which case the timer is scheduled again for the rest of its lifetime.
+    fn expire(&self, timeout: Timeout) {
+        let remaining = match timeout {
+            Timeout::Node(handle) => self
+                .nodes
+                .get_handle_remaining(handle)
+                .map(|(_, remaining)| remaining),
+            Timeout::Channel(c) => self.channels.get_remaining(c),
+            Timeout::Permission(handle, peer) => self
+                .nodes
+                .with_handle_state(handle, |_, state| {
+                    state.permissions.get(&peer).map(|(_, timer)| {
+                        PERMISSION_LIFETIME.saturating_sub(timer.elapsed().as_secs())
+                    })
+                })
+                .flatten(),
+            Timeout::PeerPermission(handle, ip) => self
+                .nodes
+                .with_handle_state(handle, |_, state| state.peers.get_permission_remaining(&ip))
+                .flatten(),
+            Timeout::PeerChannel(handle, c) => self
+                .nodes
+                .with_handle_state(handle, |_, state| state.peers.get_channel_remaining(c))
+                .flatten(),
+        };
+
+        match (remaining, timeout) {
+            (None, _) => (),
+            (Some(0), Timeout::Node(handle)) => {
+                if let Some((addr, _)) = self.nodes.get_handle_remaining(handle) {
+                    self.remove(&addr);
+                }
+            }
+            (Some(0), Timeout::Channel(c)) => self.remove_channel(c),
+            (Some(0), Timeout::Permission(handle, peer)) => {
+                self.nodes.with_handle_state_mut(handle, |_, state| {
+                    state.permissions.remove(&peer);
+                });
+            }
+            (Some(0), Timeout::PeerPermission(handle, ip)) => {
+                self.nodes
+                    .with_handle_state_mut(handle, |_, state| state.peers.remove_permission(&ip));
+            }
+            (Some(0), Timeout::PeerChannel(handle, c)) => {
+                if self
+                    .nodes
+                    .with_handle_state_mut(handle, |_, state| state.peers.remove_channel(c))
+                    .flatten()
+                    .is_some()
+                {
+                    self.remove_forward(handle, c);
+                }
+            }
+            (Some(remaining), _) => self.timer.schedule(remaining, timeout),
+        }
+    }
+
+    /// whether the channel of the node is bound to an external peer.
+    fn get_peer_channel_bound(&self, addr: &SocketAddr, channel: u16) -> bool {
+        self.nodes
+            .with_state(addr, |state| state.peers.get_channel(channel).is_some())
+            .unwrap_or(false)
+    }
+
+    /// remove a channel, the bounds of the nodes on it and the forwarding
+    /// entries of it.
+    fn remove_channel(&self, c: u16) {
+        if let Some(channel) = self.channels.remove(c) {
+            for handle in channel {
+                self.nodes.with_handle_state_mut(handle, |_, state| {
+                    state.channels.remove(&c);
+                });
+
+                self.remove_forward(handle, c);
+            }
+        }
+    }
+
+    /// install the forwarding entry of the channel and let the observer
+    /// know about it.
+    ///
+    /// the limited nodes are left out of the copies of the table, their
+    /// channel data has to go through the limiters.
+    fn insert_forward(&self, handle: Handle, channel: u16, forward: Forward) {
+        let target = match forward.kind {
+            StunClass::Channel => self.nodes.get_handle(&forward.target),
+            _ => None,
+        };
+
+        let Some((addr, previous)) = self.nodes.with_handle_state_mut(handle, |addr, state| {
+            let previous = state.forwards.insert(channel, (forward, target));
+            (*addr, previous.and_then(|(_, previous)| previous))
+        }) else {
+            return;
+        };
+
+        if let Some(previous) = previous {
+            self.forwards.remove(previous, handle, channel);
+        }
+
+        if let Some(target) = target {
+            self.forwards.insert(target, handle, channel);
+        }
+
+        if !self.nodes.is_limited(&addr) {
+            self.observer.forward_bound(&addr, channel, &forward);
+        }
+    }
+
+    /// resolve the forwarding entries of the channels of the node again,
+    /// the entries whose target moved to another interface or was replaced
+    /// are installed again, and the ones whose target is gone are removed.
+    fn revalidate_forwards(&self, addr: &SocketAddr) {
+        let Some(handle) = self.nodes.get_handle(addr) else {
+            return;
+        };
+
+        let channels = self
+            .nodes
+            .with_handle_state(handle, |_, state| {
+                state
+                    .channels
+                    .iter()
+                    .map(|(channel, target)| {
+                        (*channel, *target, state.forwards.get(channel).copied())
+                    })
+                    .collect::<Vec<_>>()
+            })
+            .unwrap_or_default();
+
+        for (channel, target, cached) in channels {
+            let Some(interface) = self.nodes.get_interface(&target) else {
+                self.remove_forward(handle, channel);
+                continue;
+            };
+
+            let forward = Forward {
+                interface: interface.addr,
+                kind: StunClass::Channel,
+                target,
+            };
+
+            if cached != Some((forward, self.nodes.get_handle(&target))) {
+                self.insert_forward(handle, channel, forward);
+            }
+        }
+    }
+
+    /// remove the forwarding entry of the channel and let the observer know
+    /// about it.
+    fn remove_forward(&self, handle: Handle, channel: u16) {
+        let removed = self
+            .nodes
+            .with_handle_state_mut(handle, |addr, state| {
+                let (_, target) = state.forwards.remove(&channel)?;
+                Some((*addr, target))
+            })
+            .flatten();
+
+        if let Some((addr, target)) = removed {
+            if let Some(target) = target {
+                self.forwards.remove(target, handle, channel);
+            }
+
+            self.observer.forward_removed(&addr, channel);
+        }
+    }
 }
@@ -1,24 +1,38 @@
 use std::{
     collections::BTreeMap,
     net::SocketAddr,
+    ops::Bound,
     sync::{Arc, RwLock},
     time::Instant,
 };
 
-use super::ports::capacity;
+use super::{
+    arena::{Arena, Handle},
+    forwards::Forward,
+    interfaces::Interface,
+    limits::{Limiter, Limits},
+    peers::Peers,
+    ports::capacity,
+};
 
 use ahash::{AHashMap, AHashSet};
-use stun::util::long_key;
+use stun::util::{long_key, HmacSha1};
 
 /// turn node session.
 #[derive(Clone)]
 pub struct Node {
     pub channels: Vec<u16>,
-    pub ports: Vec<u16>,
+    /// the relay addresses allocated to the node.
+    pub ports: Vec<SocketAddr>,
     pub lifetime: Instant,
     pub expiration: u64,
     pub secret: Arc<[u8; 16]>,
+    /// the hmac state keyed with the secret, built once for all the
+    /// messages of the node.
+    pub integrity: Arc<HmacSha1>,
     pub username: String,
+    /// the password of the node, empty for a node that was restored from a
+    /// snapshot, which only keeps the key.
     pub password: String,
 }
 
@@ -27,14 +41,38 @@ impl Node {
     ///
     /// node session from group number and long key.
     pub fn new(realm: &str, username: &str, password: &str) -> Self {
-        let secret = Arc::new(long_key(username, password, realm));
+        let mut node = Self::with_secret(username, long_key(username, password, realm));
+        node.password = password.to_string();
+        node
+    }
+
+    /// create node session from the long-term key of the user.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::nodes::*;
+    ///
+    /// let node = Node::new("test", "test", "test");
+    /// let restored = Node::with_secret("test", *node.secret);
+    ///
+    /// assert_eq!(restored.secret, node.secret);
+    /// assert!(restored.password.is_empty());
+    /// ```
+    pub fn with_secret(username: &str, secret: [u8; 16]) -> Self {
+        let secret = Arc::new(secret);
+        let integrity = Arc::new(
+            HmacSha1::new(secret.as_slice()).expect("hmac accepts keys of any length"),
+        );
+
         Self {
             channels: Vec::with_capacity(5),
             ports: Vec::with_capacity(10),
             username: username.to_string(),
-            password: password.to_string(),
+            password: String::new(),
             lifetime: Instant::now(),
             expiration: 600,
+            integrity,
             secret,
         }
     }
@@ -80,6 +118,26 @@ impl Node {
         self.lifetime.elapsed().as_secs() >= self.expiration
     }
 
+    /// the number of seconds until the node is dead.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::nodes::*;
+    ///
+    /// let mut node = Node::new("test", "test", "test");
+    ///
+    /// node.set_lifetime(600);
+    /// assert_eq!(node.remaining(), 600);
+    ///
+    /// node.set_lifetime(0);
+    /// assert_eq!(node.remaining(), 0);
+    /// ```
+    pub fn remaining(&self) -> u64 {
+        self.expiration
+            .saturating_sub(self.lifetime.elapsed().as_secs())
+    }
+
     /// get node the secret.
     ///
     /// # Examples
@@ -101,21 +159,23 @@ impl Node {
         self.secret.clone()
     }
 
-    /// posh port in node.
+    /// posh relay address in node.
     ///
     /// # Examples
     ///
     /// ```
+    /// use std::net::SocketAddr;
     /// use turn::router::nodes::*;
     ///
     /// let mut node = Node::new("test", "test", "test");
+    /// let relay = "127.0.0.1:43196".parse::<SocketAddr>().unwrap();
     ///
-    /// node.push_port(43196);
-    /// assert_eq!(&node.ports, &[43196]);
+    /// node.push_port(relay);
+    /// assert_eq!(&node.ports, &[relay]);
     /// ```
-    pub fn push_port(&mut self, port: u16) {
-        if !self.ports.contains(&port) {
-            self.ports.push(port);
+    pub fn push_port(&mut self, relay: SocketAddr) {
+        if !self.ports.contains(&relay) {
+            self.ports.push(relay);
         }
     }
 
@@ -138,10 +198,49 @@ impl Node {
     }
 }
 
+/// the state of a node towards its peers.
+///
+/// the state lives in the record of the node and is freed with it, the
+/// tables of the router only index the handles of the records.
+#[derive(Default)]
+pub struct State {
+    /// the permissions that the node installed towards the local peers, by
+    /// the address of the peer, with the relay address of the peer that the
+    /// permission was installed on and when it was refreshed.
+    pub permissions: AHashMap<SocketAddr, (SocketAddr, Instant)>,
+    /// the peers that the channels of the node are bound to.
+    pub channels: AHashMap<u16, SocketAddr>,
+    /// the forwarding entries of the channels of the node, with the handle
+    /// of the node that a local entry forwards to.
+    pub forwards: AHashMap<u16, (Forward, Option<Handle>)>,
+    /// the permissions and channels towards the external peers.
+    pub peers: Peers,
+}
+
+/// the record of a node, the session and the interface that it is served
+/// on are kept together so that one lookup finds both.
+struct Record {
+    node: Node,
+    interface: Arc<Interface>,
+    /// the limiter of the allocation and the limiter that the allocations
+    /// of the username share, none when they are unlimited.
+    limiter: Option<Limiter>,
+    user_limiter: Option<Arc<Limiter>>,
+    state: State,
+}
+
 /// node table.
+///
+/// the nodes live in a slab arena, a node is one record that is freed in
+/// place when the node is removed, and the timers of the nodes hold the
+/// generational handles of the records instead of the addresses.
 pub struct Nodes {
-    map: RwLock<AHashMap<SocketAddr, Node>>,
+    map: Arena<SocketAddr, Record>,
     addrs: RwLock<BTreeMap<String, AHashSet<SocketAddr>>>,
+    /// the limiters of the usernames, changed under the lock of `addrs`.
+    users: RwLock<AHashMap<String, Arc<Limiter>>>,
+    /// the clock of the limiters.
+    epoch: Instant,
 }
 
 impl Default for Nodes {
@@ -154,26 +253,44 @@ impl Nodes {
     pub fn new() -> Self {
         Self {
             addrs: RwLock::new(BTreeMap::new()),
-            map: RwLock::new(AHashMap::with_capacity(capacity())),
+            users: RwLock::new(AHashMap::new()),
+            map: Arena::with_capacity(capacity()),
+            epoch: Instant::now(),
         }
     }
 
     /// get users name and address.
     ///
+    /// the users are ordered by name, a page starts after the `cursor`
+    /// name, so the names before it are not walked.
+    ///
     /// # Examples
     ///
     /// ```
+    /// use std::net::SocketAddr;
     /// use turn::router::nodes::*;
     ///
     /// let nodes = Nodes::new();
-    /// assert_eq!(nodes.get_users(0, 10), vec![]);
+    /// assert_eq!(nodes.get_users(None, 10), vec![]);
+    ///
+    /// let a = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let b = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    /// nodes.insert(&a, &a, &a, "test", "a", "test");
+    /// nodes.insert(&b, &b, &b, "test", "b", "test");
+    ///
+    /// assert_eq!(nodes.get_users(None, 1), vec![("a".to_string(), vec![a])]);
+    /// assert_eq!(nodes.get_users(Some("a"), 10), vec![("b".to_string(), vec![b])]);
     /// ```
-    pub fn get_users(&self, skip: usize, limit: usize) -> Vec<(String, Vec<SocketAddr>)> {
+    pub fn get_users(&self, cursor: Option<&str>, limit: usize) -> Vec<(String, Vec<SocketAddr>)> {
+        let start = match cursor {
+            Some(cursor) => Bound::Excluded(cursor),
+            None => Bound::Unbounded,
+        };
+
         self.addrs
             .read()
             .unwrap()
-            .iter()
-            .skip(skip)
+            .range::<str, _>((start, Bound::Unbounded))
             .take(limit)
             .map(|(k, v)| (k.clone(), v.iter().copied().collect()))
             .collect()
@@ -190,7 +307,7 @@ impl Nodes {
     /// let nodes = Nodes::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
     ///
     /// let node = nodes.get_node(&addr).unwrap();
     /// assert_eq!(node.username.as_str(), "test");
@@ -206,7 +323,7 @@ impl Nodes {
     /// assert_eq!(node.ports.len(), 0);
     /// ```
     pub fn get_node(&self, a: &SocketAddr) -> Option<Node> {
-        self.map.read().unwrap().get(a).cloned()
+        self.map.with(a, |r| r.node.clone())
     }
 
     /// get password from address.
@@ -220,7 +337,7 @@ impl Nodes {
     /// let nodes = Nodes::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
     ///
     /// let secret = nodes.get_secret(&addr).unwrap();
     /// assert_eq!(
@@ -232,7 +349,55 @@ impl Nodes {
     /// );
     /// ```
     pub fn get_secret(&self, a: &SocketAddr) -> Option<Arc<[u8; 16]>> {
-        self.map.read().unwrap().get(a).map(|n| n.get_secret())
+        self.map.with(a, |r| r.node.get_secret())
+    }
+
+    /// get the keyed hmac state from address.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use stun::util::*;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    ///
+    /// let integrity = nodes.get_integrity(&addr).unwrap();
+    /// let expected = HmacSha1::new(&long_key("test", "test", "test")).unwrap();
+    /// assert_eq!(integrity.digest(&[b"test"]), expected.digest(&[b"test"]));
+    /// ```
+    pub fn get_integrity(&self, a: &SocketAddr) -> Option<Arc<HmacSha1>> {
+        self.map.with(a, |r| r.node.integrity.clone())
+    }
+
+    /// get the interface that the node is served on.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let interface = "127.0.0.1:3478".parse::<SocketAddr>().unwrap();
+    /// let external = "1.1.1.1:3478".parse::<SocketAddr>().unwrap();
+    ///
+    /// nodes.insert(&addr, &interface, &external, "test", "test", "test");
+    ///
+    /// let ret = nodes.get_interface(&addr).unwrap();
+    /// assert_eq!(ret.addr, interface);
+    /// assert_eq!(ret.external, external);
+    ///
+    /// nodes.remove(&addr);
+    /// assert!(nodes.get_interface(&addr).is_none());
+    /// ```
+    pub fn get_interface(&self, a: &SocketAddr) -> Option<Arc<Interface>> {
+        self.map.with(a, |r| r.interface.clone())
     }
 
     /// insert node in node table.
@@ -246,7 +411,7 @@ impl Nodes {
     /// let nodes = Nodes::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
     ///
     /// let node = nodes.get_node(&addr).unwrap();
     /// assert_eq!(node.username.as_str(), "test");
@@ -264,17 +429,58 @@ impl Nodes {
     pub fn insert(
         &self,
         addr: &SocketAddr,
+        interface: &SocketAddr,
+        external: &SocketAddr,
         realm: &str,
         username: &str,
         password: &str,
     ) -> Option<Arc<[u8; 16]>> {
         let node = Node::new(realm, username, password);
+        self.insert_node(addr, interface, external, node)
+    }
+
+    /// insert node in node table with the long-term key of the user, for
+    /// the nodes that are restored from a snapshot.
+    pub fn insert_with_secret(
+        &self,
+        addr: &SocketAddr,
+        interface: &SocketAddr,
+        external: &SocketAddr,
+        username: &str,
+        secret: [u8; 16],
+    ) -> Option<Arc<[u8; 16]>> {
+        let node = Node::with_secret(username, secret);
+        self.insert_node(addr, interface, external, node)
+    }
+
+    fn insert_node(
+        &self,
+        addr: &SocketAddr,
+        interface: &SocketAddr,
+        external: &SocketAddr,
+        node: Node,
+    ) -> Option<Arc<[u8; 16]>> {
+        let username = node.username.clone();
         let pwd = node.get_secret();
+        let interface = Arc::new(Interface {
+            addr: *interface,
+            external: *external,
+        });
+
         let mut addrs = self.addrs.write().unwrap();
-        self.map.write().unwrap().insert(*addr, node);
+        self.map.insert(
+            *addr,
+            Record {
+                state: State::default(),
+                limiter: None,
+                user_limiter: None,
+                interface,
+                node,
+            },
+        );
 
         addrs
-            .entry(username.to_string())
+            .entry(username)
             .or_insert_with(|| AHashSet::with_capacity(5))
             .insert(*addr);
         Some(pwd)
@@ -291,9 +497,10 @@ impl Nodes {
     /// let nodes = Nodes::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
     ///
-    /// assert!(nodes.push_port(&addr, 60000).is_some());
+    /// let relay = "127.0.0.1:60000".parse::<SocketAddr>().unwrap();
+    /// assert!(nodes.push_port(&addr, relay).is_some());
     ///
     /// let node = nodes.get_node(&addr).unwrap();
     /// assert_eq!(node.username.as_str(), "test");
@@ -306,11 +513,10 @@ impl Nodes {
     ///     ]
     /// );
     /// assert_eq!(node.channels, vec![]);
-    /// assert_eq!(node.ports, vec![60000]);
+    /// assert_eq!(node.ports, vec![relay]);
     /// ```
-    pub fn push_port(&self, a: &SocketAddr, port: u16) -> Option<()> {
-        self.map.write().unwrap().get_mut(a)?.push_port(port);
-        Some(())
+    pub fn push_port(&self, a: &SocketAddr, relay: SocketAddr) -> Option<()> {
+        self.map.with_mut(a, |r| r.node.push_port(relay))
     }
 
     /// push channel to node.
@@ -324,7 +530,7 @@ impl Nodes {
     /// let nodes = Nodes::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
     ///
     /// assert!(nodes.push_channel(&addr, 0x4000).is_some());
     ///
@@ -342,8 +548,7 @@ impl Nodes {
     /// assert_eq!(node.ports, vec![]);
     /// ```
     pub fn push_channel(&self, a: &SocketAddr, channel: u16) -> Option<()> {
-        self.map.write().unwrap().get_mut(a)?.push_channel(channel);
-        Some(())
+        self.map.with_mut(a, |r| r.node.push_channel(channel))
     }
 
     /// set lifetime to node.
@@ -357,7 +562,7 @@ impl Nodes {
     /// let nodes = Nodes::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
     ///
     /// assert!(nodes.set_lifetime(&addr, 600).is_some());
     ///
@@ -392,8 +597,7 @@ impl Nodes {
     /// assert!(node.is_death());
     /// ```
     pub fn set_lifetime(&self, a: &SocketAddr, delay: u32) -> Option<()> {
-        self.map.write().unwrap().get_mut(a)?.set_lifetime(delay);
-        Some(())
+        self.map.with_mut(a, |r| r.node.set_lifetime(delay))
     }
 
     /// remove node from address.
@@ -407,7 +611,7 @@ impl Nodes {
     /// let nodes = Nodes::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
     ///
     /// let node = nodes.get_node(&addr).unwrap();
     /// assert_eq!(node.username.as_str(), "test");
@@ -425,17 +629,326 @@ impl Nodes {
     /// assert!(nodes.remove(&addr).is_some());
     /// assert!(nodes.get_node(&addr).is_none());
     /// ```
-    pub fn remove(&self, a: &SocketAddr) -> Option<Node> {
+    pub fn remove(&self, a: &SocketAddr) -> Option<(Node, State)> {
         let mut user_addrs = self.addrs.write().unwrap();
-        let node = self.map.write().unwrap().remove(a)?;
+        let Record { node, state, .. } = self.map.remove(a)?;
         let addrs = user_addrs.get_mut(&node.username)?;
         if addrs.len() == 1 {
             user_addrs.remove(&node.username)?;
+            self.users.write().unwrap().remove(&node.username);
         } else {
             addrs.remove(a);
         }
 
-        Some(node)
+        Some((node, state))
+    }
+
+    /// read the state of the node.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    ///
+    /// assert!(nodes.with_state(&addr, |_| ()).is_none());
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    /// nodes.with_state_mut(&addr, |state| state.channels.insert(0x4000, peer));
+    /// assert_eq!(
+    ///     nodes.with_state(&addr, |state| state.channels.get(&0x4000).copied()),
+    ///     Some(Some(peer))
+    /// );
+    /// ```
+    pub fn with_state<R>(&self, a: &SocketAddr, f: impl FnOnce(&State) -> R) -> Option<R> {
+        self.map.with(a, |r| f(&r.state))
+    }
+
+    /// modify the state of the node.
+    pub fn with_state_mut<R>(&self, a: &SocketAddr, f: impl FnOnce(&mut State) -> R) -> Option<R> {
+        self.map.with_mut(a, |r| f(&mut r.state))
+    }
+
+    /// read the address and the state of the node of the handle, none when
+    /// the node of the handle is gone.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    ///
+    /// let handle = nodes.get_handle(&addr).unwrap();
+    /// assert_eq!(nodes.with_handle_state(handle, |a, _| *a), Some(addr));
+    ///
+    /// nodes.remove(&addr);
+    /// assert_eq!(nodes.with_handle_state(handle, |a, _| *a), None);
+    /// ```
+    pub fn with_handle_state<R>(
+        &self,
+        handle: Handle,
+        f: impl FnOnce(&SocketAddr, &State) -> R,
+    ) -> Option<R> {
+        self.map.with_handle(handle, |a, r| f(a, &r.state))
+    }
+
+    /// modify the state of the node of the handle, none when the node of
+    /// the handle is gone.
+    pub fn with_handle_state_mut<R>(
+        &self,
+        handle: Handle,
+        f: impl FnOnce(&SocketAddr, &mut State) -> R,
+    ) -> Option<R> {
+        self.map.with_handle_mut(handle, |a, r| f(a, &mut r.state))
+    }
+
+    /// sum the result of the function over the states of all the nodes.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    /// nodes.with_state_mut(&addr, |state| state.channels.insert(0x4000, peer));
+    /// assert_eq!(nodes.sum_states(|state| state.channels.len()), 1);
+    /// ```
+    pub fn sum_states(&self, f: impl Fn(&State) -> usize) -> usize {
+        self.map.sum(|r| f(&r.state))
+    }
+
+    /// bind the channel of the node to the peer, the channel keeps the peer
+    /// that it was bound to first. returns the peer that the channel is
+    /// bound to.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    /// let other = "127.0.0.1:8082".parse::<SocketAddr>().unwrap();
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    ///
+    /// let handle = nodes.get_handle(&addr).unwrap();
+    /// assert_eq!(nodes.bind_channel(handle, 0x4000, peer), Some(peer));
+    /// assert_eq!(nodes.bind_channel(handle, 0x4000, other), Some(peer));
+    /// assert_eq!(nodes.get_node(&addr).unwrap().channels, vec![0x4000]);
+    /// ```
+    pub fn bind_channel(
+        &self,
+        handle: Handle,
+        channel: u16,
+        peer: SocketAddr,
+    ) -> Option<SocketAddr> {
+        self.map.with_handle_mut(handle, |_, r| {
+            r.node.push_channel(channel);
+            *r.state.channels.entry(channel).or_insert(peer)
+        })
+    }
+
+    /// get the forwarding entry of the channel of the node.
+    #[inline(always)]
+    pub fn get_forward(&self, a: &SocketAddr, channel: u16) -> Option<Forward> {
+        self.map
+            .with(a, |r| {
+                r.state.forwards.get(&channel).map(|(forward, _)| *forward)
+            })
+            .flatten()
+    }
+
+    /// set the limits of the node, the limiter of the username is shared
+    /// by all the nodes of the username.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::{limits::*, nodes::*};
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let addr1 = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    /// let limits = Limits {
+    ///     allocation: Limit { pps: 2, bps: 0 },
+    ///     user: Limit { pps: 3, bps: 0 },
+    /// };
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    /// nodes.insert(&addr1, &addr1, &addr1, "test", "test", "test");
+    /// assert!(!nodes.is_limited(&addr));
+    ///
+    /// assert!(nodes.set_limits(&addr, &limits).is_some());
+    /// assert!(nodes.set_limits(&addr1, &limits).is_some());
+    /// assert!(nodes.is_limited(&addr));
+    ///
+    /// // the allocation passes two packets, the user three.
+    /// assert!(nodes.check_limit(&addr, 100));
+    /// assert!(nodes.check_limit(&addr, 100));
+    /// assert!(!nodes.check_limit(&addr, 100));
+    /// assert!(nodes.check_limit(&addr1, 100));
+    /// assert!(!nodes.check_limit(&addr1, 100));
+    /// ```
+    pub fn set_limits(&self, a: &SocketAddr, limits: &Limits) -> Option<()> {
+        let username = self.map.with(a, |r| r.node.username.clone())?;
+        let user_limiter = if limits.user.is_unlimited() {
+            None
+        } else {
+            let _addrs = self.addrs.write().unwrap();
+            let mut users = self.users.write().unwrap();
+            let limiter = users
+                .entry(username)
+                .or_insert_with(|| Arc::new(Limiter::new(limits.user)));
+
+            // The limit of the username changed, the nodes created from now
+            // on share the new one.
+            if limiter.limit() != limits.user {
+                *limiter = Arc::new(Limiter::new(limits.user));
+            }
+
+            Some(limiter.clone())
+        };
+
+        let limiter = (!limits.allocation.is_unlimited()).then(|| Limiter::new(limits.allocation));
+        self.map.with_mut(a, |r| {
+            r.user_limiter = user_limiter;
+            r.limiter = limiter;
+        })
+    }
+
+    /// whether the node has a limit.
+    pub fn is_limited(&self, a: &SocketAddr) -> bool {
+        self.map
+            .with(a, |r| r.limiter.is_some() || r.user_limiter.is_some())
+            .unwrap_or(false)
+    }
+
+    /// take a packet of `size` bytes from the limiters of the node, returns
+    /// false when the packet exceeds a limit of the node.
+    pub fn check_limit(&self, a: &SocketAddr, size: usize) -> bool {
+        let now = self.epoch.elapsed().as_nanos() as u64;
+        self.map
+            .with(a, |r| {
+                if !r.limiter.as_ref().map_or(true, |l| l.check(now, size)) {
+                    return false;
+                }
+
+                // The allocation gets back what the packet took from it when
+                // the username is over its limit.
+                if !r.user_limiter.as_ref().map_or(true, |l| l.check(now, size)) {
+                    if let Some(limiter) = &r.limiter {
+                        limiter.refund(size);
+                    }
+
+                    return false;
+                }
+
+                true
+            })
+            .unwrap_or(true)
+    }
+
+    /// get the number of seconds until the node is dead.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    /// assert_eq!(nodes.get_remaining(&addr), Some(600));
+    /// ```
+    pub fn get_remaining(&self, a: &SocketAddr) -> Option<u64> {
+        self.map.with(a, |r| r.node.remaining())
+    }
+
+    /// get the handle of the record of the node.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// assert!(nodes.get_handle(&addr).is_none());
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    /// assert!(nodes.get_handle(&addr).is_some());
+    /// ```
+    pub fn get_handle(&self, a: &SocketAddr) -> Option<Handle> {
+        self.map.get_handle(a)
+    }
+
+    /// get the address of the node of the handle.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    ///
+    /// let handle = nodes.get_handle(&addr).unwrap();
+    /// assert_eq!(nodes.get_handle_addr(handle), Some(addr));
+    /// ```
+    pub fn get_handle_addr(&self, handle: Handle) -> Option<SocketAddr> {
+        self.map.with_handle(handle, |a, _| *a)
+    }
+
+    /// get the address of the node of the handle and the number of seconds
+    /// until the node is dead, none when the node of the handle is gone,
+    /// even if another node took its address over.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::nodes::*;
+    ///
+    /// let nodes = Nodes::new();
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    ///
+    /// let handle = nodes.get_handle(&addr).unwrap();
+    /// assert_eq!(nodes.get_handle_remaining(handle), Some((addr, 600)));
+    ///
+    /// nodes.remove(&addr);
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    /// assert_eq!(nodes.get_handle_remaining(handle), None);
+    /// ```
+    pub fn get_handle_remaining(&self, handle: Handle) -> Option<(SocketAddr, u64)> {
+        self.map
+            .with_handle(handle, |a, r| (*a, r.node.remaining()))
     }
 
     /// get node name bound address.
@@ -450,8 +963,8 @@ impl Nodes {
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     /// let addr1 = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
-    /// nodes.insert(&addr1, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
+    /// nodes.insert(&addr1, &addr1, &addr1, "test", "test", "test");
     ///
     /// let ret = nodes.get_addrs("test");
     ///
@@ -481,7 +994,7 @@ impl Nodes {
     /// let nodes = Nodes::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
     ///
-    /// nodes.insert(&addr, "test", "test", "test");
+    /// nodes.insert(&addr, &addr, &addr, "test", "test", "test");
     ///
     /// assert!(nodes.set_lifetime(&addr, 600).is_some());
     /// assert_eq!(nodes.get_deaths(), vec![]);
@@ -490,12 +1003,6 @@ impl Nodes {
     /// assert_eq!(nodes.get_deaths(), vec![addr]);
     /// ```
     pub fn get_deaths(&self) -> Vec<SocketAddr> {
-        self.map
-            .read()
-            .unwrap()
-            .iter()
-            .filter(|(_, v)| v.is_death())
-            .map(|(k, _)| *k)
-            .collect::<Vec<SocketAddr>>()
+        self.map.keys_where(|r| r.node.is_death())
     }
 }
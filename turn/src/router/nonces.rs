@@ -1,104 +1,93 @@
-use super::ports::capacity;
-
 use std::{
-    net::SocketAddr,
-    sync::{Arc, RwLock},
-    time::Instant,
+    fmt::Write,
+    net::{IpAddr, SocketAddr},
+    time::{SystemTime, UNIX_EPOCH},
 };
 
-use ahash::AHashMap;
-use rand::{distributions::Alphanumeric, thread_rng, Rng};
+use rand::{thread_rng, RngCore};
+use stun::util::HmacSha1;
+
+/// The lifetime of a nonce in seconds.
+pub const LIFETIME: u64 = 3600;
+
+/// Nonces are issued per bucket of half the lifetime and accepted in the
+/// bucket they were issued in and the next one, so a nonce is valid for
+/// between half of and the whole lifetime.
+const BUCKET: u64 = LIFETIME / 2;
+
+/// The length of a nonce, the bucket and 8 bytes of the hmac in hex.
+const NONCE_SIZE: usize = 24;
 
-/// Session nonce.
+/// stateless session nonces.
 ///
 /// The NONCE attribute may be present in requests and responses.  It
 /// contains a sequence of qdtext or quoted-pair, which are defined in
-/// [RFC3261](https://datatracker.ietf.org/doc/html/rfc3261).  
+/// [RFC3261](https://datatracker.ietf.org/doc/html/rfc3261).
 /// Note that this means that the NONCE attribute will not
 /// contain the actual surrounding quote characters.  The NONCE attribute
 /// MUST be fewer than 128 characters (which can be as long as 509 bytes
 /// when encoding them and a long as 763 bytes when decoding them).  See
 /// Section 5.4 of [RFC7616](https://datatracker.ietf.org/doc/html/rfc7616#section-5.4)
 /// for guidance on selection of nonce values in a server.
-pub struct Nonce {
-    raw: Arc<String>,
-    timer: Instant,
+///
+/// the nonce of a node is the time bucket followed by the hmac of the node
+/// address and the bucket with the server secret, nothing is stored per
+/// node. a nonce is checked by recomputing the hmac, so the servers that
+/// share the secret accept each other's nonces, also across restarts.
+pub struct Nonces {
+    /// the hmac state keyed with the secret, so issuing and checking a
+    /// nonce does not run the key schedule again.
+    mac: HmacSha1,
 }
 
-impl Default for Nonce {
+impl Default for Nonces {
     fn default() -> Self {
         Self::new()
     }
 }
 
-impl Nonce {
-    pub fn new() -> Self {
-        Self {
-            raw: Arc::new(Self::create_nonce()),
-            timer: Instant::now(),
-        }
-    }
-
-    /// whether the nonce is dead.
+impl Nonces {
+    /// create the nonces with a random secret.
     ///
     /// # Examples
     ///
     /// ```
+    /// use std::net::SocketAddr;
     /// use turn::router::nonces::*;
     ///
-    /// let nonce = Nonce::new();
-    /// assert!(!nonce.is_death());
+    /// let addr = "127.0.0.1:1080".parse::<SocketAddr>().unwrap();
+    /// let nonce = Nonces::new().get(&addr);
+    ///
+    /// assert!(!Nonces::new().verify(&addr, &nonce));
     /// ```
-    pub fn is_death(&self) -> bool {
-        self.timer.elapsed().as_secs() >= 3600
+    pub fn new() -> Self {
+        let mut secret = vec![0u8; 32];
+        thread_rng().fill_bytes(&mut secret);
+        Self::with_secret(&secret)
     }
 
-    /// unwind nonce random string.
+    /// create the nonces with a secret shared between servers.
     ///
     /// # Examples
     ///
     /// ```
+    /// use std::net::SocketAddr;
     /// use turn::router::nonces::*;
     ///
-    /// let nonce = Nonce::new();
-    /// assert_eq!(nonce.unwind().len(), 16);
+    /// let addr = "127.0.0.1:1080".parse::<SocketAddr>().unwrap();
+    /// let nonce = Nonces::with_secret(b"secret").get(&addr);
+    ///
+    /// assert!(Nonces::with_secret(b"secret").verify(&addr, &nonce));
     /// ```
-    pub fn unwind(&self) -> Arc<String> {
-        self.raw.clone()
-    }
-
-    /// generate nonce string.
-    fn create_nonce() -> String {
-        let mut rng = thread_rng();
-        std::iter::repeat(())
-            .map(|_| rng.sample(Alphanumeric) as char)
-            .take(16)
-            .collect::<String>()
-            .to_lowercase()
-    }
-}
-
-/// nonce table.
-pub struct Nonces {
-    map: RwLock<AHashMap<SocketAddr, Nonce>>,
-}
-
-impl Default for Nonces {
-    fn default() -> Self {
-        Self::new()
-    }
-}
-
-impl Nonces {
-    pub fn new() -> Self {
+    pub fn with_secret(secret: &[u8]) -> Self {
         Self {
-            map: RwLock::new(AHashMap::with_capacity(capacity())),
+            mac: HmacSha1::new(secret).expect("hmac accepts keys of any length"),
         }
     }
 
     /// get session nonce string.
     ///
-    /// each node is assigned a random string valid for 1 hour.
+    /// the nonce of a node stays the same for the whole time bucket.
     ///
     /// # Examples
     ///
@@ -107,21 +96,20 @@ impl Nonces {
     /// use turn::router::nonces::*;
     ///
     /// let addr = "127.0.0.1:1080".parse::<SocketAddr>().unwrap();
-    /// let nonce_table = Nonces::new();
+    /// let nonces = Nonces::new();
     ///
-    /// assert_eq!(nonce_table.get(&addr).len(), 16);
+    /// let nonce = nonces.get(&addr);
+    /// assert_eq!(nonce.len(), 24);
+    /// assert!(nonces.verify(&addr, &nonce));
     /// ```
-    pub fn get(&self, a: &SocketAddr) -> Arc<String> {
-        if let Some(n) = self.map.read().unwrap().get(a) {
-            if !n.is_death() {
-                return n.unwind();
-            }
-        }
-
-        self.map.write().unwrap().entry(*a).or_default().unwind()
+    pub fn get(&self, a: &SocketAddr) -> String {
+        self.create(a, Self::bucket())
     }
 
-    /// remove session nonce string.
+    /// check the nonce of a node.
+    ///
+    /// the nonce is valid when it was issued to the node in the current or
+    /// the previous time bucket.
     ///
     /// # Examples
     ///
@@ -130,15 +118,72 @@ impl Nonces {
     /// use turn::router::nonces::*;
     ///
     /// let addr = "127.0.0.1:1080".parse::<SocketAddr>().unwrap();
-    /// let nonce_table = Nonces::new();
-    ///
-    /// let nonce = nonce_table.get(&addr);
-    /// nonce_table.remove(&addr);
+    /// let peer = "127.0.0.1:1081".parse::<SocketAddr>().unwrap();
+    /// let nonces = Nonces::new();
     ///
-    /// let new_nonce = nonce_table.get(&addr);
-    /// assert!(nonce.as_str() != new_nonce.as_str());
+    /// let nonce = nonces.get(&addr);
+    /// assert!(nonces.verify(&addr, &nonce));
+    /// assert!(!nonces.verify(&peer, &nonce));
+    /// assert!(!nonces.verify(&addr, "0000000000000000"));
     /// ```
-    pub fn remove(&self, a: &SocketAddr) {
-        self.map.write().unwrap().remove(a);
+    pub fn verify(&self, a: &SocketAddr, nonce: &str) -> bool {
+        if nonce.len() != NONCE_SIZE || !nonce.is_char_boundary(8) {
+            return false;
+        }
+
+        let bucket = match u32::from_str_radix(&nonce[..8], 16) {
+            Ok(bucket) => bucket as u64,
+            Err(_) => return false,
+        };
+
+        let now = Self::bucket();
+        if bucket != now && bucket + 1 != now {
+            return false;
+        }
+
+        // Compare the whole nonce without an early exit.
+        let expected = self.create(a, bucket);
+        expected.len() == nonce.len()
+            && expected
+                .bytes()
+                .zip(nonce.bytes())
+                .fold(0, |diff, (x, y)| diff | (x ^ y))
+                == 0
+    }
+
+    /// the current time bucket.
+    fn bucket() -> u64 {
+        SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map(|time| time.as_secs())
+            .unwrap_or(0)
+            / BUCKET
+    }
+
+    /// create the nonce of the node in the time bucket.
+    fn create(&self, a: &SocketAddr, bucket: u64) -> String {
+        let mut addr = [0u8; 18];
+        let size = match a.ip() {
+            IpAddr::V4(ip) => {
+                addr[..4].copy_from_slice(&ip.octets());
+                4
+            }
+            IpAddr::V6(ip) => {
+                addr[..16].copy_from_slice(&ip.octets());
+                16
+            }
+        };
+
+        addr[size..size + 2].copy_from_slice(&a.port().to_be_bytes());
+
+        let bucket = bucket as u32;
+        let mut nonce = String::with_capacity(NONCE_SIZE);
+        let _ = write!(nonce, "{:08x}", bucket);
+        let mac = self.mac.digest(&[&addr[..size + 2], &bucket.to_be_bytes()]);
+        for byte in &mac[..8] {
+            let _ = write!(nonce, "{:02x}", byte);
+        }
+
+        nonce
     }
 }
@@ -0,0 +1,247 @@
+use super::{channels::LIFETIME, ports::PERMISSION_LIFETIME};
+
+use std::{
+    net::{IpAddr, SocketAddr},
+    time::Instant,
+};
+
+use ahash::AHashMap;
+
+/// external peers of an allocation.
+///
+/// the peers that are not allocations of this server are reached through
+/// the relay sockets of the server. unlike the permissions between the
+/// local nodes, which are keyed by the address of the peer, these are
+/// keyed by the ip of the peer as the rfc describes. the table lives in the
+/// record of the node and is freed with it.
+#[derive(Default)]
+pub struct Peers {
+    /// the permissions by peer ip, and the relay address that the data
+    /// towards the peer is sent from.
+    permissions: AHashMap<IpAddr, (SocketAddr, Instant)>,
+    /// the channel bindings by channel number.
+    channels: AHashMap<u16, (SocketAddr, Instant)>,
+    /// the channel numbers by peer address.
+    numbers: AHashMap<SocketAddr, u16>,
+}
+
+impl Peers {
+    /// install or refresh the permission towards the peer ip, the data
+    /// towards the peer is sent from the relay address.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::{IpAddr, SocketAddr};
+    /// use turn::router::peers::*;
+    ///
+    /// let relay = "127.0.0.1:49152".parse::<SocketAddr>().unwrap();
+    /// let peer = "1.1.1.1".parse::<IpAddr>().unwrap();
+    ///
+    /// let mut peers = Peers::default();
+    /// peers.insert_permission(peer, relay);
+    /// assert_eq!(peers.get_permission(&peer), Some(relay));
+    /// assert_eq!(peers.permissions(), 1);
+    /// ```
+    pub fn insert_permission(&mut self, ip: IpAddr, relay: SocketAddr) {
+        self.permissions.insert(ip, (relay, Instant::now()));
+    }
+
+    /// get the relay address of the permission towards the peer ip.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::IpAddr;
+    /// use turn::router::peers::*;
+    ///
+    /// let peer = "1.1.1.1".parse::<IpAddr>().unwrap();
+    ///
+    /// let peers = Peers::default();
+    /// assert_eq!(peers.get_permission(&peer), None);
+    /// ```
+    pub fn get_permission(&self, ip: &IpAddr) -> Option<SocketAddr> {
+        self.permissions.get(ip).map(|(relay, _)| *relay)
+    }
+
+    /// get the permissions, the peer ips and the relay addresses that the
+    /// data towards them is sent from.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::{IpAddr, SocketAddr};
+    /// use turn::router::peers::*;
+    ///
+    /// let relay = "127.0.0.1:49152".parse::<SocketAddr>().unwrap();
+    /// let peer = "1.1.1.1".parse::<IpAddr>().unwrap();
+    ///
+    /// let mut peers = Peers::default();
+    /// assert_eq!(peers.get_permissions(), vec![]);
+    ///
+    /// peers.insert_permission(peer, relay);
+    /// assert_eq!(peers.get_permissions(), vec![(peer, relay)]);
+    /// ```
+    pub fn get_permissions(&self) -> Vec<(IpAddr, SocketAddr)> {
+        self.permissions
+            .iter()
+            .map(|(ip, (relay, _))| (*ip, *relay))
+            .collect()
+    }
+
+    /// get the channels, the channel numbers and the peers that they are
+    /// bound to.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::peers::*;
+    ///
+    /// let relay = "127.0.0.1:49152".parse::<SocketAddr>().unwrap();
+    /// let peer = "1.1.1.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// let mut peers = Peers::default();
+    /// peers.bind_channel(&peer, 0x4000, relay).unwrap();
+    /// assert_eq!(peers.get_channels(), vec![(0x4000, peer)]);
+    /// ```
+    pub fn get_channels(&self) -> Vec<(u16, SocketAddr)> {
+        self.channels
+            .iter()
+            .map(|(channel, (peer, _))| (*channel, *peer))
+            .collect()
+    }
+
+    /// get the number of the permissions towards the external peers.
+    pub fn permissions(&self) -> usize {
+        self.permissions.len()
+    }
+
+    /// get the number of seconds until the permission ends.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::{IpAddr, SocketAddr};
+    /// use turn::router::peers::*;
+    /// use turn::router::ports::PERMISSION_LIFETIME;
+    ///
+    /// let relay = "127.0.0.1:49152".parse::<SocketAddr>().unwrap();
+    /// let peer = "1.1.1.1".parse::<IpAddr>().unwrap();
+    ///
+    /// let mut peers = Peers::default();
+    /// peers.insert_permission(peer, relay);
+    /// assert_eq!(
+    ///     peers.get_permission_remaining(&peer),
+    ///     Some(PERMISSION_LIFETIME)
+    /// );
+    ///
+    /// peers.remove_permission(&peer);
+    /// assert_eq!(peers.get_permission_remaining(&peer), None);
+    /// ```
+    pub fn get_permission_remaining(&self, ip: &IpAddr) -> Option<u64> {
+        self.permissions
+            .get(ip)
+            .map(|(_, timer)| PERMISSION_LIFETIME.saturating_sub(timer.elapsed().as_secs()))
+    }
+
+    /// remove the permission towards the peer ip.
+    pub fn remove_permission(&mut self, ip: &IpAddr) {
+        self.permissions.remove(ip);
+    }
+
+    /// bind or refresh the channel to the peer, which also installs or
+    /// refreshes the permission towards the peer ip.
+    ///
+    /// returns none when the channel is bound to another peer, or the peer
+    /// to another channel.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::peers::*;
+    ///
+    /// let relay = "127.0.0.1:49152".parse::<SocketAddr>().unwrap();
+    /// let peer = "1.1.1.1:8080".parse::<SocketAddr>().unwrap();
+    /// let other = "1.1.1.1:8081".parse::<SocketAddr>().unwrap();
+    ///
+    /// let mut peers = Peers::default();
+    /// assert!(peers.bind_channel(&peer, 0x4000, relay).is_some());
+    /// assert!(peers.bind_channel(&peer, 0x4000, relay).is_some());
+    /// assert!(peers.bind_channel(&other, 0x4000, relay).is_none());
+    /// assert!(peers.bind_channel(&peer, 0x4001, relay).is_none());
+    ///
+    /// assert_eq!(peers.get_channel(0x4000), Some(peer));
+    /// assert_eq!(peers.get_number(&peer), Some(0x4000));
+    /// assert_eq!(peers.get_permission(&peer.ip()), Some(relay));
+    /// ```
+    pub fn bind_channel(
+        &mut self,
+        peer: &SocketAddr,
+        channel: u16,
+        relay: SocketAddr,
+    ) -> Option<()> {
+        if let Some((bound, _)) = self.channels.get(&channel) {
+            if bound != peer {
+                return None;
+            }
+        }
+
+        if let Some(number) = self.numbers.get(peer) {
+            if *number != channel {
+                return None;
+            }
+        }
+
+        let now = Instant::now();
+        self.channels.insert(channel, (*peer, now));
+        self.numbers.insert(*peer, channel);
+        self.permissions.insert(peer.ip(), (relay, now));
+        Some(())
+    }
+
+    /// get the peer that the channel is bound to.
+    pub fn get_channel(&self, channel: u16) -> Option<SocketAddr> {
+        self.channels.get(&channel).map(|(peer, _)| *peer)
+    }
+
+    /// get the channel number that the peer is bound to.
+    pub fn get_number(&self, peer: &SocketAddr) -> Option<u16> {
+        self.numbers.get(peer).copied()
+    }
+
+    /// get the number of seconds until the channel binding ends.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::SocketAddr;
+    /// use turn::router::channels::LIFETIME;
+    /// use turn::router::peers::*;
+    ///
+    /// let relay = "127.0.0.1:49152".parse::<SocketAddr>().unwrap();
+    /// let peer = "1.1.1.1:8080".parse::<SocketAddr>().unwrap();
+    ///
+    /// let mut peers = Peers::default();
+    /// peers.bind_channel(&peer, 0x4000, relay).unwrap();
+    /// assert_eq!(peers.get_channel_remaining(0x4000), Some(LIFETIME));
+    ///
+    /// assert_eq!(peers.remove_channel(0x4000), Some(peer));
+    /// assert_eq!(peers.get_channel_remaining(0x4000), None);
+    /// assert_eq!(peers.get_number(&peer), None);
+    /// ```
+    pub fn get_channel_remaining(&self, channel: u16) -> Option<u64> {
+        self.channels
+            .get(&channel)
+            .map(|(_, timer)| LIFETIME.saturating_sub(timer.elapsed().as_secs()))
+    }
+
+    /// remove the channel binding, returns the peer that the channel was
+    /// bound to.
+    pub fn remove_channel(&mut self, channel: u16) -> Option<SocketAddr> {
+        let (peer, _) = self.channels.remove(&channel)?;
+        self.numbers.remove(&peer);
+        Some(peer)
+    }
+}
@@ -1,12 +1,16 @@
-use ahash::AHashMap;
+use super::{arena::Handle, shards::ShardedMap};
+
 use rand::{thread_rng, Rng};
 
 use std::{
-    net::SocketAddr,
+    net::{IpAddr, SocketAddr},
     ops::Range,
     sync::{Mutex, RwLock},
 };
 
+/// The lifetime of a permission in seconds.
+pub const PERMISSION_LIFETIME: u64 = 300;
+
 /// Bit Flag
 #[derive(PartialEq)]
 pub enum Bit {
@@ -41,10 +45,17 @@ pub enum Bit {
 /// While the server IP address, the well-known port, and the client IP
 /// address may be known by an attacker, the ephemeral port of the client
 /// is usually unknown and must be guessed.
+///
+/// a bucket holds the state of 64 ports, one bit each, and a summary word
+/// holds one bit per bucket that is set when the bucket is full. a port is
+/// allocated from a random bucket at a random offset, when that bucket is
+/// full the next bucket with a free port is found through the summary, so
+/// that even a nearly full range is searched 4096 ports at a time.
 pub struct PortPools {
     pub buckets: Vec<u64>,
+    summary: Vec<u64>,
+    range: Range<u16>,
     allocated: usize,
-    bit_len: u32,
     peak: usize,
 }
 
@@ -56,11 +67,51 @@ impl Default for PortPools {
 
 impl PortPools {
     pub fn new() -> Self {
+        Self::with_range(port_range())
+    }
+
+    /// create the pools of a port range.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::ports::PortPools;
+    ///
+    /// let mut pools = PortPools::with_range(10000..10100);
+    /// assert_eq!(pools.capacity(), 100);
+    ///
+    /// for _ in 0..100 {
+    ///     let port = pools.alloc(None).unwrap();
+    ///     assert!((10000..10100).contains(&port));
+    /// }
+    ///
+    /// assert_eq!(pools.alloc(None), None);
+    /// ```
+    pub fn with_range(range: Range<u16>) -> Self {
+        assert!(range.start < range.end);
+
+        let capacity = (range.end - range.start) as usize;
+        let size = (capacity + 63) / 64;
+        let mut buckets = vec![0; size];
+        let mut summary = vec![0; (size + 63) / 64];
+
+        // The bits past the end of the range are marked as allocated, so
+        // that the last bucket and the last summary word fill up like the
+        // others.
+        if capacity % 64 != 0 {
+            buckets[size - 1] = u64::MAX >> (capacity % 64);
+        }
+
+        if size % 64 != 0 {
+            summary[size / 64] = u64::MAX >> (size % 64);
+        }
+
         Self {
-            buckets: vec![0; bucket_size()],
-            peak: bucket_size() - 1,
-            bit_len: bit_len(),
+            peak: size - 1,
             allocated: 0,
+            buckets,
+            summary,
+            range,
         }
     }
 
@@ -76,7 +127,21 @@ impl PortPools {
     /// assert_eq!(pools.capacity(), 65535 - 49152);
     /// ```
     pub fn capacity(&self) -> usize {
-        capacity()
+        (self.range.end - self.range.start) as usize
+    }
+
+    /// get pools port range.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::ports::PortPools;
+    ///
+    /// let pools = PortPools::new();
+    /// assert_eq!(pools.range(), 49152..65535);
+    /// ```
+    pub fn range(&self) -> Range<u16> {
+        self.range.clone()
     }
 
     /// get pools allocated size.
@@ -109,6 +174,10 @@ impl PortPools {
 
     /// random assign a port.
     ///
+    /// with a bucket index the lowest free port from that bucket on is
+    /// assigned, without one the search starts at a random bucket and a
+    /// random offset in it.
+    ///
     /// # Examples
     ///
     /// ```
@@ -121,43 +190,73 @@ impl PortPools {
     ///
     /// assert!(pool.alloc(None).is_some());
     /// ```
-    #[rustfmt::skip]
     pub fn alloc(&mut self, si: Option<usize>) -> Option<u16> {
-        let mut start = si.unwrap_or_else(|| self.random() as usize);
-        let previous = if start == 0 { self.peak } else { start - 1 };
-        let mut index = None;
-
-    // warn: loop
-    loop {
-        if let Some(i) = self.find_high(start) {
-            index = Some(i as usize);
-            break;
-        }
+        let (start, offset) = match si {
+            Some(i) => (i, 0),
+            None => (self.random() as usize, thread_rng().gen_range(0..64)),
+        };
 
-        if start == self.peak {
-            start = 0;
+        let bucket = self.find_bucket(start)?;
+        let bit = if bucket == start {
+            // The first free bit at or after the offset, wrapping around the
+            // bucket.
+            let rotated = self.buckets[bucket].rotate_left(offset);
+            (rotated.leading_ones() + offset) as usize % 64
         } else {
-            start += 1;
-        }
-
-        if start == previous {
-            break;
-        }
-    }
-
-        let bi = match index {
-            None => return None,
-            Some(i) => i,
+            self.find_high(bucket)? as usize
         };
 
-        self.write(start, bi, Bit::High);
+        self.write(bucket, bit, Bit::High);
         self.allocated += 1;
 
-        let num = (start * 64 + bi) as u16;
-        let port = port_range().start + num;
+        let num = (bucket * 64 + bit) as u16;
+        let port = self.range.start + num;
         Some(port)
     }
 
+    /// find the first bucket with a free port, starting at the given bucket
+    /// and wrapping around the range.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::ports::PortPools;
+    ///
+    /// let mut pool = PortPools::new();
+    /// assert_eq!(pool.find_bucket(3), Some(3));
+    ///
+    /// for _ in 0..64 {
+    ///     pool.alloc(Some(3)).unwrap();
+    /// }
+    ///
+    /// assert_eq!(pool.find_bucket(3), Some(4));
+    /// ```
+    pub fn find_bucket(&self, start: usize) -> Option<usize> {
+        if self.buckets[start] != u64::MAX {
+            return Some(start);
+        }
+
+        // The buckets up to the start in its summary word are skipped on the
+        // first pass and checked last, after the other words.
+        let first = start / 64;
+        let skipped = u64::MAX << (63 - start % 64);
+        let words = self.summary.len();
+        for step in 0..=words {
+            let index = (first + step) % words;
+            let word = if step == 0 {
+                self.summary[index] | skipped
+            } else {
+                self.summary[index]
+            };
+
+            if word != u64::MAX {
+                return Some(index * 64 + word.leading_ones() as usize);
+            }
+        }
+
+        None
+    }
+
     /// find the high bit in the bucket.
     ///
     /// # Examples
@@ -176,17 +275,11 @@ impl PortPools {
     /// ```
     pub fn find_high(&self, i: usize) -> Option<u32> {
         let bucket = self.buckets[i];
-        let offset = if bucket < u64::MAX {
-            bucket.leading_ones()
-        } else {
-            return None;
-        };
-
-        if i == self.peak && offset > self.bit_len {
+        if bucket == u64::MAX {
             return None;
         }
 
-        Some(offset)
+        Some(bucket.leading_ones())
     }
 
     /// write bit flag in the bucket.
@@ -220,6 +313,15 @@ impl PortPools {
             Bit::High => bucket | mask,
             Bit::Low => bucket & mask,
         };
+
+        // Keep the summary bit of the bucket in step with whether it is
+        // full.
+        let summary_mask = 1 << (63 - offset % 64);
+        if self.buckets[offset] == u64::MAX {
+            self.summary[offset / 64] |= summary_mask;
+        } else {
+            self.summary[offset / 64] &= !summary_mask;
+        }
     }
 
     /// read bucket bit value.
@@ -277,8 +379,8 @@ impl PortPools {
     /// assert_eq!(pool.alloc(Some(0)), Some(49153));
     /// ```
     pub fn restore(&mut self, port: u16) {
-        assert!(port_range().contains(&port));
-        let offset = (port - port_range().start) as usize;
+        assert!(self.range.contains(&port));
+        let offset = (port - self.range.start) as usize;
         let bucket = offset / 64;
         let bit = offset - (bucket * 64);
 
@@ -290,6 +392,43 @@ impl PortPools {
         self.allocated -= 1;
     }
 
+    /// take the given port, for example one that was allocated before a
+    /// restart. returns false when the port is outside of the range or
+    /// already allocated.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::ports::PortPools;
+    ///
+    /// let mut pool = PortPools::new();
+    ///
+    /// assert!(pool.take(49153));
+    /// assert!(!pool.take(49153));
+    /// assert!(!pool.take(1024));
+    ///
+    /// assert_eq!(pool.alloc(Some(0)), Some(49152));
+    /// assert_eq!(pool.alloc(Some(0)), Some(49154));
+    /// assert_eq!(pool.len(), 3);
+    /// ```
+    pub fn take(&mut self, port: u16) -> bool {
+        if !self.range.contains(&port) {
+            return false;
+        }
+
+        let offset = (port - self.range.start) as usize;
+        let bucket = offset / 64;
+        let bit = offset - (bucket * 64);
+
+        if self.read(bucket, bit) == Bit::High {
+            return false;
+        }
+
+        self.write(bucket, bit, Bit::High);
+        self.allocated += 1;
+        true
+    }
+
     /// get random buckets index.
     ///
     /// # Examples
@@ -301,19 +440,27 @@ impl PortPools {
     ///
     /// let max = bucket_size() as u16;
     /// let index = pool.random();
-    /// assert!((0..max - 1).contains(&index));
+    /// assert!((0..max).contains(&index));
     /// ```
     pub fn random(&self) -> u16 {
         let mut rng = thread_rng();
-        rng.gen_range(0..self.peak as u16)
+        rng.gen_range(0..=self.peak as u16)
     }
 }
 
 /// port table.
+///
+/// the relay addresses are allocated from one port pool per relay ip, so
+/// that every external ip of the server adds a whole port range to its
+/// capacity. an allocation takes a port from the least loaded pool among
+/// the relay ips it may use.
+///
+/// the relay addresses index the handles of the records of the nodes, the
+/// permissions towards a node live in the record of the node itself.
 pub struct Ports {
-    pools: Mutex<PortPools>,
-    map: RwLock<AHashMap<u16, SocketAddr>>,
-    bounds: RwLock<AHashMap<SocketAddr, AHashMap<SocketAddr, u16>>>,
+    range: Range<u16>,
+    pools: RwLock<Vec<(IpAddr, Mutex<PortPools>)>>,
+    map: ShardedMap<SocketAddr, Handle>,
 }
 
 impl Default for Ports {
@@ -324,25 +471,70 @@ impl Default for Ports {
 
 impl Ports {
     pub fn new() -> Self {
+        Self::with_range(port_range())
+    }
+
+    /// create the port table of a port range, every relay ip gets a pool
+    /// of the whole range.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::IpAddr;
+    /// use turn::router::ports::*;
+    ///
+    /// let ports = Ports::with_range(1024..65535);
+    /// ports.add_relay("127.0.0.1".parse::<IpAddr>().unwrap());
+    /// assert_eq!(ports.capacity(), 65535 - 1024);
+    /// ```
+    pub fn with_range(range: Range<u16>) -> Self {
+        let capacity = (range.end - range.start) as usize;
         Self {
-            bounds: RwLock::new(AHashMap::with_capacity(capacity())),
-            map: RwLock::new(AHashMap::with_capacity(capacity())),
-            pools: Mutex::new(PortPools::new()),
+            map: ShardedMap::with_capacity(capacity),
+            pools: RwLock::new(Vec::with_capacity(4)),
+            range,
+        }
+    }
+
+    /// add the port pool of a relay ip, does nothing when the pool
+    /// already exists.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use std::net::IpAddr;
+    /// use turn::router::ports::*;
+    ///
+    /// let ports = Ports::new();
+    /// assert_eq!(ports.capacity(), 0);
+    ///
+    /// ports.add_relay("127.0.0.1".parse::<IpAddr>().unwrap());
+    /// ports.add_relay("127.0.0.1".parse::<IpAddr>().unwrap());
+    /// ports.add_relay("127.0.0.2".parse::<IpAddr>().unwrap());
+    /// assert_eq!(ports.capacity(), 2 * (65535 - 49152));
+    /// ```
+    pub fn add_relay(&self, ip: IpAddr) {
+        let mut pools = self.pools.write().unwrap();
+        if !pools.iter().any(|(relay, _)| *relay == ip) {
+            pools.push((ip, Mutex::new(PortPools::with_range(self.range.clone()))));
         }
     }
 
-    /// get ports capacity.
+    /// get ports capacity, the capacity of all relay ips.
     ///
     /// # Examples
     ///
     /// ```
+    /// use std::net::IpAddr;
     /// use turn::router::ports::*;
     ///
     /// let ports = Ports::new();
+    /// ports.add_relay("127.0.0.1".parse::<IpAddr>().unwrap());
     /// assert_eq!(ports.capacity(), 65535 - 49152);
     /// ```
     pub fn capacity(&self) -> usize {
-        self.pools.lock().unwrap().capacity()
+        let pools = self.pools.read().unwrap();
+        pools.len() * (self.range.end - self.range.start) as usize
     }
 
     /// get ports allocated size.
@@ -356,7 +548,8 @@ impl Ports {
     /// assert_eq!(ports.len(), 0);
     /// ```
     pub fn len(&self) -> usize {
-        self.pools.lock().unwrap().len()
+        let pools = self.pools.read().unwrap();
+        pools.iter().map(|(_, pool)| pool.lock().unwrap().len()).sum()
     }
 
     /// get ports allocated size is empty.
@@ -370,123 +563,148 @@ impl Ports {
     /// assert_eq!(ports.is_empty(), true);
     /// ```
     pub fn is_empty(&self) -> bool {
-        self.pools.lock().unwrap().len() == 0
+        self.len() == 0
     }
 
-    /// get address from port.
+    /// get the handle of the node from relay address.
     ///
     /// # Examples
     ///
     /// ```
     /// use std::net::SocketAddr;
-    /// use turn::router::ports::*;
+    /// use turn::router::{arena::*, ports::*};
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 1);
     ///
     /// let ports = Ports::new();
     /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let port = ports.alloc(&addr).unwrap();
+    /// let relay = ports.alloc(handle, &[addr.ip()]).unwrap();
     ///
-    /// assert!(ports.get(port).is_some());
+    /// assert_eq!(ports.get(&relay), Some(handle));
     /// ```
-    pub fn get(&self, p: u16) -> Option<SocketAddr> {
-        self.map.read().unwrap().get(&p).cloned()
+    pub fn get(&self, relay: &SocketAddr) -> Option<Handle> {
+        self.map.get(relay)
     }
 
-    /// get address bound port.
+    /// allocate relay address in ports.
+    ///
+    /// the port is taken from the least loaded pool of the given relay ips,
+    /// the pools of the relay ips are created when they do not exist yet.
     ///
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::ports::*;
+    /// use std::net::IpAddr;
+    /// use turn::router::{arena::*, ports::*};
     ///
-    /// let local = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    /// let peer = "127.0.0.1:8081".parse::<SocketAddr>().unwrap();
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 1);
+    /// let relays = [
+    ///     "127.0.0.1".parse::<IpAddr>().unwrap(),
+    ///     "127.0.0.2".parse::<IpAddr>().unwrap(),
+    /// ];
     ///
     /// let pools = Ports::new();
-    ///
-    /// let port = pools.alloc(&local).unwrap();
-    /// assert!(pools.bound(&local, port).is_some());
-    /// assert!(pools.bound(&peer, port).is_some());
-    ///
-    /// assert_eq!(pools.get_bound(&local, &peer), Some(port));
-    /// ```
-    pub fn get_bound(&self, a: &SocketAddr, p: &SocketAddr) -> Option<u16> {
-        self.bounds.read().unwrap().get(p)?.get(a).cloned()
+    /// let first = pools.alloc(handle, &relays).unwrap();
+    /// let second = pools.alloc(handle, &relays).unwrap();
+    ///
+    /// assert_ne!(first.ip(), second.ip());
+    /// assert_eq!(pools.alloc(handle, &[]), None);
+    /// ```
+    pub fn alloc(&self, handle: Handle, relays: &[IpAddr]) -> Option<SocketAddr> {
+        let missing = {
+            let pools = self.pools.read().unwrap();
+            relays
+                .iter()
+                .any(|ip| !pools.iter().any(|(relay, _)| relay == ip))
+        };
+
+        if missing {
+            relays.iter().for_each(|ip| self.add_relay(*ip));
+        }
+
+        let pools = self.pools.read().unwrap();
+        let mut loads = pools
+            .iter()
+            .filter(|(ip, _)| relays.contains(ip))
+            .map(|(ip, pool)| (pool.lock().unwrap().len(), *ip, pool))
+            .collect::<Vec<_>>();
+
+        // A pool may fill up between reading its load and allocating from
+        // it, the next least loaded one is tried then.
+        loads.sort_unstable_by_key(|(len, _, _)| *len);
+        for (_, ip, pool) in loads {
+            if let Some(port) = pool.lock().unwrap().alloc(None) {
+                let relay = SocketAddr::new(ip, port);
+                self.map.insert(relay, handle);
+                return Some(relay);
+            }
+        }
+
+        None
     }
 
-    /// allocate port in ports.
+    /// take the given relay address for the node, the pool of its relay ip
+    /// is created when it does not exist yet.
     ///
     /// # Examples
     ///
     /// ```
     /// use std::net::SocketAddr;
-    /// use turn::router::ports::*;
+    /// use turn::router::{arena::*, ports::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 1);
+    /// let relay = "127.0.0.1:49160".parse::<SocketAddr>().unwrap();
     ///
     /// let pools = Ports::new();
-    /// assert_eq!(pools.alloc(&addr).is_some(), true);
+    /// assert!(pools.take(handle, &relay).is_some());
+    /// assert!(pools.take(handle, &relay).is_none());
+    /// assert_eq!(pools.get(&relay), Some(handle));
+    /// assert_eq!(pools.len(), 1);
     /// ```
-    pub fn alloc(&self, a: &SocketAddr) -> Option<u16> {
-        let port = self.pools.lock().unwrap().alloc(None)?;
-        self.map.write().unwrap().insert(port, *a);
-        Some(port)
-    }
+    pub fn take(&self, handle: Handle, relay: &SocketAddr) -> Option<()> {
+        self.add_relay(relay.ip());
 
-    /// bound address and peer port.
-    ///
-    /// # Examples
-    ///
-    /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::ports::*;
-    ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
-    ///
-    /// let pools = Ports::new();
-    /// let port = pools.alloc(&addr).unwrap();
-    ///
-    /// assert!(pools.bound(&addr, port).is_some());
-    /// ```
-    pub fn bound(&self, addr: &SocketAddr, port: u16) -> Option<()> {
-        let peer = *self.map.read().unwrap().get(&port)?;
-        self.bounds
-            .write()
-            .unwrap()
-            .entry(*addr)
-            .or_insert_with(|| AHashMap::with_capacity(10))
-            .entry(peer)
-            .or_insert(port);
+        let pools = self.pools.read().unwrap();
+        let (_, pool) = pools.iter().find(|(ip, _)| *ip == relay.ip())?;
+        if !pool.lock().unwrap().take(relay.port()) {
+            return None;
+        }
+
+        self.map.insert(*relay, handle);
         Some(())
     }
 
-    /// bound address and peer port.
+    /// release the relay address, the port goes back to the pool of its
+    /// relay ip.
     ///
     /// # Examples
     ///
     /// ```
-    /// use std::net::SocketAddr;
-    /// use turn::router::ports::*;
+    /// use std::net::IpAddr;
+    /// use turn::router::{arena::*, ports::*};
     ///
-    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let handle = arena.insert(1, 1);
     ///
     /// let pools = Ports::new();
-    /// let port = pools.alloc(&addr).unwrap();
+    /// let relay = pools
+    ///     .alloc(handle, &["127.0.0.1".parse::<IpAddr>().unwrap()])
+    ///     .unwrap();
     ///
-    /// assert!(pools.bound(&addr, port).is_some());
-    /// assert!(pools.remove(&addr, &vec![port]).is_some());
+    /// pools.release(&relay);
+    /// assert_eq!(pools.get(&relay), None);
+    /// assert_eq!(pools.len(), 0);
     /// ```
-    pub fn remove(&self, a: &SocketAddr, ports: &[u16]) -> Option<()> {
-        let mut pools = self.pools.lock().unwrap();
-        let mut map = self.map.write().unwrap();
-
-        for p in ports {
-            pools.restore(*p);
-            map.remove(p);
+    pub fn release(&self, relay: &SocketAddr) {
+        let pools = self.pools.read().unwrap();
+        if let Some((_, pool)) = pools.iter().find(|(ip, _)| *ip == relay.ip()) {
+            pool.lock().unwrap().restore(relay.port());
         }
 
-        self.bounds.write().unwrap().remove(a);
-        Some(())
+        self.map.remove(relay);
     }
 }
 
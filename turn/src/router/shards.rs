@@ -0,0 +1,162 @@
+use std::{
+    hash::{BuildHasher, Hash, Hasher},
+    sync::RwLock,
+};
+
+use ahash::{AHashMap, RandomState};
+
+/// The number of shards of a table, must be a power of two.
+const SHARDS: usize = 64;
+
+/// Pads the lock of a shard to its own cache line, so that the reader
+/// counters of neighbouring shards do not share a line.
+#[repr(align(128))]
+struct Shard<K, V>(RwLock<AHashMap<K, V>>);
+
+/// sharded hash table.
+///
+/// the keys are spread across independent `RwLock` protected maps by their
+/// hash, so the lookups of different sessions take different locks and the
+/// workers do not bounce one shared reader counter between cores.
+pub struct ShardedMap<K, V> {
+    shards: Box<[Shard<K, V>]>,
+    hasher: RandomState,
+}
+
+impl<K: Hash + Eq, V> ShardedMap<K, V> {
+    /// create a table that can hold `capacity` entries without reallocating.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::shards::*;
+    ///
+    /// let map = ShardedMap::<u16, u16>::with_capacity(1024);
+    /// assert_eq!(map.len(), 0);
+    /// ```
+    pub fn with_capacity(capacity: usize) -> Self {
+        Self {
+            shards: (0..SHARDS)
+                .map(|_| Shard(RwLock::new(AHashMap::with_capacity(capacity / SHARDS))))
+                .collect(),
+            hasher: RandomState::new(),
+        }
+    }
+
+    /// get the shard that holds the key.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::shards::*;
+    ///
+    /// let map = ShardedMap::<u16, u16>::with_capacity(1024);
+    /// map.shard(&1).write().unwrap().insert(1, 2);
+    /// assert_eq!(map.get(&1), Some(2));
+    /// ```
+    pub fn shard(&self, key: &K) -> &RwLock<AHashMap<K, V>> {
+        let mut hasher = self.hasher.build_hasher();
+        key.hash(&mut hasher);
+        &self.shards[hasher.finish() as usize & (SHARDS - 1)].0
+    }
+
+    /// iterate over all shards.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::shards::*;
+    ///
+    /// let map = ShardedMap::<u16, u16>::with_capacity(1024);
+    /// map.insert(1, 2);
+    /// map.insert(3, 4);
+    ///
+    /// let count = map
+    ///     .shards()
+    ///     .map(|shard| shard.read().unwrap().len())
+    ///     .sum::<usize>();
+    /// assert_eq!(count, 2);
+    /// ```
+    pub fn shards(&self) -> impl Iterator<Item = &RwLock<AHashMap<K, V>>> {
+        self.shards.iter().map(|shard| &shard.0)
+    }
+
+    /// get a copy of the value of the key.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::shards::*;
+    ///
+    /// let map = ShardedMap::<u16, u16>::with_capacity(1024);
+    /// map.insert(1, 2);
+    /// assert_eq!(map.get(&1), Some(2));
+    /// assert_eq!(map.get(&2), None);
+    /// ```
+    pub fn get(&self, key: &K) -> Option<V>
+    where
+        V: Clone,
+    {
+        self.shard(key).read().unwrap().get(key).cloned()
+    }
+
+    /// insert the value of the key, returns the previous value.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::shards::*;
+    ///
+    /// let map = ShardedMap::<u16, u16>::with_capacity(1024);
+    /// assert_eq!(map.insert(1, 2), None);
+    /// assert_eq!(map.insert(1, 3), Some(2));
+    /// ```
+    pub fn insert(&self, key: K, value: V) -> Option<V> {
+        self.shard(&key).write().unwrap().insert(key, value)
+    }
+
+    /// remove the key, returns the removed value.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::shards::*;
+    ///
+    /// let map = ShardedMap::<u16, u16>::with_capacity(1024);
+    /// map.insert(1, 2);
+    /// assert_eq!(map.remove(&1), Some(2));
+    /// assert_eq!(map.remove(&1), None);
+    /// ```
+    pub fn remove(&self, key: &K) -> Option<V> {
+        self.shard(key).write().unwrap().remove(key)
+    }
+
+    /// get the number of entries of all shards.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::shards::*;
+    ///
+    /// let map = ShardedMap::<u16, u16>::with_capacity(1024);
+    /// map.insert(1, 2);
+    /// assert_eq!(map.len(), 1);
+    /// ```
+    pub fn len(&self) -> usize {
+        self.shards().map(|shard| shard.read().unwrap().len()).sum()
+    }
+
+    /// whether all shards are empty.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::shards::*;
+    ///
+    /// let map = ShardedMap::<u16, u16>::with_capacity(1024);
+    /// assert!(map.is_empty());
+    /// ```
+    pub fn is_empty(&self) -> bool {
+        self.shards().all(|shard| shard.read().unwrap().is_empty())
+    }
+}
@@ -0,0 +1,276 @@
+use std::net::{IpAddr, Ipv4Addr, Ipv6Addr, SocketAddr};
+
+use bytes::{BufMut, BytesMut};
+
+/// The first two bytes of a snapshot.
+const MAGIC: u16 = 0x5453;
+
+/// The version of the snapshot format, a snapshot of another version is
+/// not restored.
+const VERSION: u8 = 2;
+
+/// the state of a node that outlives the process.
+///
+/// the lifetimes of the permissions and channels are not kept, they get a
+/// whole lifetime when they are restored, like after a refresh of the
+/// client.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Session {
+    pub addr: SocketAddr,
+    /// the interface and its external address that the node is served on.
+    pub interface: SocketAddr,
+    pub external: SocketAddr,
+    pub username: String,
+    /// the long-term key of the user, the password is not kept.
+    pub secret: [u8; 16],
+    /// the number of seconds until the node is dead.
+    pub lifetime: u32,
+    /// the relay addresses allocated to the node.
+    pub ports: Vec<SocketAddr>,
+    /// the relay addresses of the local peers that the node has
+    /// permissions towards.
+    pub permissions: Vec<SocketAddr>,
+    /// the channels towards the local peers, by the relay address of the
+    /// peer.
+    pub channels: Vec<(u16, SocketAddr)>,
+    /// the permissions towards the external peers, the peer ip and the
+    /// relay address that the data towards the peer is sent from.
+    pub peer_permissions: Vec<(IpAddr, SocketAddr)>,
+    /// the channels towards the external peers, the channel number, the
+    /// peer and the relay address.
+    pub peer_channels: Vec<(u16, SocketAddr, SocketAddr)>,
+}
+
+/// router state snapshot.
+///
+/// a compact binary copy of the nodes of the router, their allocations,
+/// permissions and channels, which a new process restores to take over the
+/// sessions of the old one without the clients noticing:
+///
+/// ```text
+/// snapshot: magic (u16) | version (u8) | reserved (u8) | count (u32) | session ...
+/// session:  addr | interface | external | username | secret (16 bytes) | lifetime (u32)
+///           | ports | permissions | channels | peer permissions | peer channels
+/// address:  family (u8, 4 or 6) | ip (4 or 16 bytes) | port (u16)
+/// string:   length (u16) | utf-8
+/// list:     count (u16) | item ...
+/// ```
+///
+/// the snapshot holds the long-term keys of the sessions rather than their
+/// passwords, a key still authenticates as the user in this realm, so it has
+/// to be kept as private as the credentials themselves.
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub struct Snapshot {
+    pub sessions: Vec<Session>,
+}
+
+impl Snapshot {
+    /// encode the snapshot.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use bytes::BytesMut;
+    /// use std::net::SocketAddr;
+    /// use turn::router::snapshot::*;
+    ///
+    /// let addr = "127.0.0.1:8080".parse::<SocketAddr>().unwrap();
+    /// let relay = "127.0.0.1:49152".parse::<SocketAddr>().unwrap();
+    /// let peer = "[::1]:49153".parse::<SocketAddr>().unwrap();
+    /// let snapshot = Snapshot {
+    ///     sessions: vec![Session {
+    ///         addr,
+    ///         interface: addr,
+    ///         external: addr,
+    ///         username: "test".to_string(),
+    ///         secret: [7; 16],
+    ///         lifetime: 600,
+    ///         ports: vec![relay],
+    ///         permissions: vec![relay],
+    ///         channels: vec![(0x4000, relay)],
+    ///         peer_permissions: vec![(peer.ip(), relay)],
+    ///         peer_channels: vec![(0x4001, peer, relay)],
+    ///     }],
+    /// };
+    ///
+    /// let mut buf = BytesMut::new();
+    /// snapshot.encode(&mut buf);
+    ///
+    /// assert_eq!(Snapshot::decode(&buf), Some(snapshot));
+    /// assert_eq!(Snapshot::decode(&buf[..buf.len() - 1]), None);
+    /// assert_eq!(Snapshot::decode(&buf[1..]), None);
+    ///
+    /// // an over-long username is cut on a char boundary.
+    /// let mut long = snapshot.clone();
+    /// long.sessions[0].username = "é".repeat(40000);
+    ///
+    /// let mut buf = BytesMut::new();
+    /// long.encode(&mut buf);
+    ///
+    /// let decoded = Snapshot::decode(&buf).unwrap();
+    /// assert_eq!(decoded.sessions[0].username, "é".repeat(32767));
+    /// ```
+    pub fn encode(&self, buf: &mut BytesMut) {
+        buf.put_u16(MAGIC);
+        buf.put_u8(VERSION);
+        buf.put_u8(0);
+        buf.put_u32(self.sessions.len() as u32);
+
+        for session in &self.sessions {
+            put_addr(buf, &session.addr);
+            put_addr(buf, &session.interface);
+            put_addr(buf, &session.external);
+            put_str(buf, &session.username);
+            buf.put_slice(&session.secret);
+            buf.put_u32(session.lifetime);
+
+            put_list(buf, &session.ports, put_addr);
+            put_list(buf, &session.permissions, put_addr);
+            put_list(buf, &session.channels, |buf, (channel, relay)| {
+                buf.put_u16(*channel);
+                put_addr(buf, relay);
+            });
+
+            put_list(buf, &session.peer_permissions, |buf, (ip, relay)| {
+                put_addr(buf, &SocketAddr::new(*ip, 0));
+                put_addr(buf, relay);
+            });
+
+            put_list(
+                buf,
+                &session.peer_channels,
+                |buf, (channel, peer, relay)| {
+                    buf.put_u16(*channel);
+                    put_addr(buf, peer);
+                    put_addr(buf, relay);
+                },
+            );
+        }
+    }
+
+    /// decode the snapshot, none when it is truncated, malformed or of
+    /// another version.
+    pub fn decode(buf: &[u8]) -> Option<Self> {
+        let mut reader = Reader(buf);
+        if reader.u16()? != MAGIC || reader.u8()? != VERSION {
+            return None;
+        }
+
+        reader.u8()?;
+        let count = reader.u32()? as usize;
+
+        // The count comes from the outside, the vector grows with the
+        // sessions that are actually there.
+        let mut sessions = Vec::with_capacity(count.min(buf.len() / 32));
+        for _ in 0..count {
+            sessions.push(Session {
+                addr: reader.addr()?,
+                interface: reader.addr()?,
+                external: reader.addr()?,
+                username: reader.string()?,
+                secret: reader.take(16)?.try_into().ok()?,
+                lifetime: reader.u32()?,
+                ports: reader.list(|reader| reader.addr())?,
+                permissions: reader.list(|reader| reader.addr())?,
+                channels: reader.list(|reader| Some((reader.u16()?, reader.addr()?)))?,
+                peer_permissions: reader
+                    .list(|reader| Some((reader.addr()?.ip(), reader.addr()?)))?,
+                peer_channels: reader
+                    .list(|reader| Some((reader.u16()?, reader.addr()?, reader.addr()?)))?,
+            });
+        }
+
+        if !reader.0.is_empty() {
+            return None;
+        }
+
+        Some(Self { sessions })
+    }
+}
+
+fn put_addr(buf: &mut BytesMut, addr: &SocketAddr) {
+    match addr.ip() {
+        IpAddr::V4(ip) => {
+            buf.put_u8(4);
+            buf.put_slice(&ip.octets());
+        }
+        IpAddr::V6(ip) => {
+            buf.put_u8(6);
+            buf.put_slice(&ip.octets());
+        }
+    }
+
+    buf.put_u16(addr.port());
+}
+
+/// the string is cut to the largest length that fits, on a char boundary so
+/// that it stays valid utf-8.
+fn put_str(buf: &mut BytesMut, value: &str) {
+    let mut size = value.len().min(u16::MAX as usize);
+    while !value.is_char_boundary(size) {
+        size -= 1;
+    }
+
+    buf.put_u16(size as u16);
+    buf.put_slice(&value.as_bytes()[..size]);
+}
+
+fn put_list<T>(buf: &mut BytesMut, items: &[T], put: impl Fn(&mut BytesMut, &T)) {
+    let items = &items[..items.len().min(u16::MAX as usize)];
+    buf.put_u16(items.len() as u16);
+    for item in items {
+        put(buf, item);
+    }
+}
+
+struct Reader<'a>(&'a [u8]);
+
+impl<'a> Reader<'a> {
+    fn take(&mut self, size: usize) -> Option<&'a [u8]> {
+        if self.0.len() < size {
+            return None;
+        }
+
+        let data: &'a [u8] = self.0;
+        let (head, rest) = data.split_at(size);
+        self.0 = rest;
+        Some(head)
+    }
+
+    fn u8(&mut self) -> Option<u8> {
+        Some(self.take(1)?[0])
+    }
+
+    fn u16(&mut self) -> Option<u16> {
+        Some(u16::from_be_bytes(self.take(2)?.try_into().ok()?))
+    }
+
+    fn u32(&mut self) -> Option<u32> {
+        Some(u32::from_be_bytes(self.take(4)?.try_into().ok()?))
+    }
+
+    fn addr(&mut self) -> Option<SocketAddr> {
+        let ip = match self.u8()? {
+            4 => IpAddr::V4(Ipv4Addr::from(<[u8; 4]>::try_from(self.take(4)?).ok()?)),
+            6 => IpAddr::V6(Ipv6Addr::from(<[u8; 16]>::try_from(self.take(16)?).ok()?)),
+            _ => return None,
+        };
+
+        Some(SocketAddr::new(ip, self.u16()?))
+    }
+
+    fn string(&mut self) -> Option<String> {
+        let size = self.u16()? as usize;
+        String::from_utf8(self.take(size)?.to_vec()).ok()
+    }
+
+    fn list<T>(&mut self, mut item: impl FnMut(&mut Self) -> Option<T>) -> Option<Vec<T>> {
+        let count = self.u16()? as usize;
+        let mut items = Vec::with_capacity(count.min(self.0.len()));
+        for _ in 0..count {
+            items.push(item(self)?);
+        }
+
+        Some(items)
+    }
+}
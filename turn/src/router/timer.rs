@@ -0,0 +1,156 @@
+use std::{
+    net::{IpAddr, SocketAddr},
+    sync::Mutex,
+    time::{Duration, Instant},
+};
+
+use ahash::AHashMap;
+
+use super::arena::Handle;
+
+/// The number of slots of the wheel, one slot per second, so one revolution
+/// of the wheel covers a little over 17 minutes.
+const SLOTS: u64 = 1024;
+
+/// The resolution of the wheel.
+pub const TICK: Duration = Duration::from_secs(1);
+
+/// The objects that expire.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum Timeout {
+    /// the allocation of a node, by the handle of its record, so the timer
+    /// of a removed node never touches a new node on the same address.
+    Node(Handle),
+    /// a channel binding.
+    Channel(u16),
+    /// the permission of a node towards a peer, by the handle of the record
+    /// of the node that holds it and the address of the peer.
+    Permission(Handle, SocketAddr),
+    /// the permission of a node towards the ip of an external peer.
+    PeerPermission(Handle, IpAddr),
+    /// a channel binding of a node to an external peer.
+    PeerChannel(Handle, u16),
+}
+
+struct Wheel {
+    slots: Vec<Vec<(u64, Timeout)>>,
+    pending: AHashMap<Timeout, u64>,
+    tick: u64,
+}
+
+/// hashed timer wheel.
+///
+/// scheduling is O(1): the timeout is pushed into the slot of its deadline,
+/// deadlines further than one revolution away stay in their slot and are
+/// skipped until the wheel comes around again. every object has at most one
+/// live timer, scheduling an object that already has an earlier or equal
+/// deadline does nothing, and the owner re-checks the object when the timer
+/// fires, so refreshing an object never has to cancel its timer.
+pub struct Timer {
+    wheel: Mutex<Wheel>,
+    start: Instant,
+}
+
+impl Default for Timer {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Timer {
+    pub fn new() -> Self {
+        Self {
+            wheel: Mutex::new(Wheel {
+                slots: (0..SLOTS).map(|_| Vec::new()).collect(),
+                pending: AHashMap::with_capacity(1024),
+                tick: 0,
+            }),
+            start: Instant::now(),
+        }
+    }
+
+    /// schedule the timeout to fire after `delay` seconds.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::{arena::*, timer::*};
+    ///
+    /// let arena = Arena::<u16, u16>::with_capacity(1024);
+    /// let addr = arena.insert(1, 1);
+    /// let timer = Timer::new();
+    ///
+    /// timer.schedule(0, Timeout::PeerChannel(addr, 0x4000));
+    /// assert!(timer.advance_to(0).is_empty());
+    /// assert_eq!(timer.advance_to(1), vec![Timeout::PeerChannel(addr, 0x4000)]);
+    /// ```
+    pub fn schedule(&self, delay: u64, timeout: Timeout) {
+        let now = self.start.elapsed().as_secs();
+        let mut wheel = self.wheel.lock().unwrap();
+
+        // The timeout never fires in the current tick, it has already been
+        // processed.
+        let deadline = (now + delay).max(wheel.tick + 1);
+        if let Some(pending) = wheel.pending.get(&timeout) {
+            if *pending <= deadline {
+                return;
+            }
+        }
+
+        wheel.pending.insert(timeout, deadline);
+        wheel.slots[(deadline % SLOTS) as usize].push((deadline, timeout));
+    }
+
+    /// advance the wheel to the current time and return the timeouts that
+    /// have fired.
+    pub fn advance(&self) -> Vec<Timeout> {
+        self.advance_to(self.start.elapsed().as_secs())
+    }
+
+    /// advance the wheel to the tick (seconds since the timer was created)
+    /// and return the timeouts that have fired.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use turn::router::timer::*;
+    ///
+    /// let timer = Timer::new();
+    ///
+    /// timer.schedule(2, Timeout::Channel(0x4000));
+    /// timer.schedule(2000, Timeout::Channel(0x4001));
+    ///
+    /// assert!(timer.advance_to(1).is_empty());
+    /// assert_eq!(timer.advance_to(2), vec![Timeout::Channel(0x4000)]);
+    /// assert!(timer.advance_to(1999).is_empty());
+    /// assert_eq!(timer.advance_to(2000), vec![Timeout::Channel(0x4001)]);
+    /// ```
+    pub fn advance_to(&self, now: u64) -> Vec<Timeout> {
+        let mut wheel = self.wheel.lock().unwrap();
+        let mut fired = Vec::new();
+
+        // After a long stall there is no need to walk the same slot more than
+        // once.
+        let start = wheel.tick.max(now.saturating_sub(SLOTS));
+        for tick in (start + 1)..=now {
+            let Wheel { slots, pending, .. } = &mut *wheel;
+            slots[(tick % SLOTS) as usize].retain(|(deadline, timeout)| {
+                if *deadline > now {
+                    return true;
+                }
+
+                // A later schedule with an earlier deadline leaves a stale
+                // entry behind, only the current one fires.
+                if pending.get(timeout) == Some(deadline) {
+                    pending.remove(timeout);
+                    fired.push(*timeout);
+                }
+
+                false
+            });
+        }
+
+        wheel.tick = wheel.tick.max(now);
+        fired
+    }
+}